@@ -225,6 +225,18 @@ void CodeBuilder::visit(expression::operator_::sink::SetAutoTrim* i)
     setResult(std::make_shared<hilti::expression::Void>());
 }
 
+void CodeBuilder::visit(expression::operator_::sink::SetMaxBuffered* i)
+{
+    auto sink = cg()->hiltiExpression(i->op1());
+    auto max = cg()->hiltiExpression(callParameter(i->op3(), 0));
+
+    cg()->builder()->addInstruction(hilti::instruction::flow::CallVoid,
+                                    hilti::builder::id::create("BinPACHilti::sink_set_max_buffered"),
+                                    hilti::builder::tuple::create( { sink, max, cg()->hiltiCookie() } ));
+
+    setResult(std::make_shared<hilti::expression::Void>());
+}
+
 void CodeBuilder::visit(expression::operator_::sink::SetPolicy* i)
 {
     auto sink = cg()->hiltiExpression(i->op1());
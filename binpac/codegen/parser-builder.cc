@@ -13,6 +13,8 @@
 
 extern "C" {
 #include "../../libbinpac/rtti.h"
+#include "../../hilti/codegen/jrx-aot.h"
+#include "../../libhilti/justrx/src/jrx.h"
 }
 
 using namespace binpac;
@@ -1427,6 +1429,80 @@ shared_ptr<hilti::Expression> ParserBuilder::hiltiCookie()
     return _states.size() ? state()->cookie : hilti::builder::reference::createNull();
 }
 
+// Returns true if any of a set of patterns matches all of the given data.
+// If we can't tell, returns true as well.
+static bool _matchesAll(const std::list<string>& patterns, const string& data)
+{
+    if ( patterns.empty() )
+        return false;
+
+    jrx_regex_t re;
+    jrx_regset_init(&re, -1, REG_EXTENDED | REG_NOSUB | REG_ANCHOR);
+
+    for ( auto p : patterns ) {
+        if ( jrx_regset_add(&re, p.c_str(), p.size()) != REG_OK ) {
+            jrx_regfree(&re);
+            return true;
+        }
+    }
+
+    jrx_dfa_image image;
+
+    if ( jrx_regset_finalize(&re) != REG_OK || jrx_regset_export(&re, &image) != REG_OK ) {
+        jrx_regfree(&re);
+        return true;
+    }
+
+    static const jrx_dfa_state_id NoState = (jrx_dfa_state_id)-1;
+
+    auto state = image.initial;
+
+    for ( auto c : data ) {
+        state = image.succ[state * image.num_classes + image.classes[(unsigned char)c]];
+
+        if ( state == NoState )
+            break;
+    }
+
+    bool match = (state != NoState && image.accepts[state] != 0);
+
+    jrx_dfa_image_done(&image);
+    jrx_regfree(&re);
+
+    return match;
+}
+
+// Returns true if a look-ahead terminal is a bytes constant that we can
+// match jointly with the regexps. That's the case if no other terminal
+// matching via regexps accepts the same bytes; if one does, we leave it to
+// the one-by-one matching to report the ambiguity.
+static bool _isJointBytesLiteral(shared_ptr<production::Terminal> t, const std::list<shared_ptr<production::Terminal>>& terms)
+{
+    auto c = ast::tryCast<production::Ctor>(t);
+
+    if ( ! c )
+        return false;
+
+    auto b = ast::tryCast<ctor::Bytes>(c->ctor());
+
+    if ( ! b || b->value().empty() )
+        return false;
+
+    std::list<string> patterns;
+
+    for ( auto o : terms ) {
+        auto l = ast::tryCast<production::Literal>(o);
+
+        if ( o == t || ! l )
+            continue;
+
+        for ( auto p : l->patterns() )
+            patterns.push_back(p);
+    }
+
+    return ! _matchesAll(patterns, b->value());
+}
+
 void ParserBuilder::_hiltiGetLookAhead(shared_ptr<Production> prod, const std::list<shared_ptr<production::Terminal>>& terms, bool must_find)
 {
     assert(terms.size());
@@ -1441,7 +1517,7 @@ void ParserBuilder::_hiltiGetLookAhead(shared_ptr<Production> prod, const std::l
     bool first = true;
 
     for ( auto l : terms ) {
-        if ( ast::isA<type::RegExp>(l->type()) )
+        if ( ast::isA<type::RegExp>(l->type()) || _isJointBytesLiteral(l, terms) )
             regexps.push_back(l);
         else
             other.push_back(l);
@@ -1475,7 +1551,8 @@ void ParserBuilder::_hiltiGetLookAhead(shared_ptr<Production> prod, const std::l
     cg()->builder()->addInstruction(ncur, hilti::instruction::operator_::Assign, state()->cur);
 
     // We handle regexps literals jointly first by matching them all in
-    // parallel.
+    // parallel. Bytes constants go in there as well, so that for the common
+    // case a single pass over the input determines the token.
 
     shared_ptr<hilti::Expression> mstate = nullptr;
 
@@ -1514,7 +1591,7 @@ void ParserBuilder::_hiltiGetLookAhead(shared_ptr<Production> prod, const std::l
     if ( re_done )
         cg()->moduleBuilder()->pushBuilder(re_done);
 
-    // Now iterate through the non-regexps.
+    // Now iterate through the remaining literals one by one.
 
     for ( auto t : other ) {
 
@@ -44,6 +44,18 @@ shared_ptr<Type> Bytes::type() const
     return std::make_shared<type::Bytes>(location());
 }
 
+Ctor::pattern_list Bytes::patterns() const
+{
+    // Escape everything so that we don't need to worry about meta
+    // characters.
+    string p;
+
+    for ( auto c : _value )
+        p += ::util::fmt("\\x%02x", (unsigned char)c);
+
+    return { p };
+}
+
 List::List(shared_ptr<Type> etype, const expression_list& elems, const Location& l) : Ctor(l)
 {
     assert(etype || elems.size());
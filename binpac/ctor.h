@@ -60,6 +60,9 @@ public:
     /// Returns the type of the constructed object.
     shared_ptr<Type> type() const override;
 
+    /// Returns a single pattern matching exactly the constant's bytes.
+    pattern_list patterns() const override;
+
     ACCEPT_VISITOR(Ctor);
 
 private:
@@ -389,6 +389,30 @@ opBegin(sink::SetAutoTrim : MethodCall)
     }
 opEnd
 
+static const string _doc_set_max_buffered =
+   R"(
+   Limits the amount of out-of-order data the sink buffers while waiting
+   for a hole in the input to be filled. Once more than *max* bytes are
+   pending, the sink gives up on the hole, reports it as a gap, and
+   continues with the data following it. A limit of zero, which is the
+   default, buffers without bound.
+   )";
+
+opBegin(sink::SetMaxBuffered : MethodCall)
+    opOp1(std::make_shared<type::Sink>())
+    opOp2(std::make_shared<type::MemberAttribute>(std::make_shared<ID>("set_max_buffered")))
+    opCallArg1("max", _makeUInt64())
+
+    opDoc(_doc_set_max_buffered)
+
+    opValidate() {
+    }
+
+    opResult() {
+        return std::make_shared<type::Void>();
+    }
+opEnd
+
 static const string _doc_set_policy =
    R"(
    Sets a sink's reassembly policy for ambigious input. As long as data hasn't been trimmed,
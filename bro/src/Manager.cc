@@ -339,6 +339,7 @@ bool Manager::InitPostScripts()
 	pimpl->hilti_options->jit = true;
 	pimpl->hilti_options->debug = BifConst::Hilti::debug;
 	pimpl->hilti_options->optimize = BifConst::Hilti::optimize;
+	pimpl->hilti_options->jit_tiered = BifConst::Hilti::tiered_jit;
 	pimpl->hilti_options->profile = BifConst::Hilti::profile;
 	pimpl->hilti_options->verify = ! BifConst::Hilti::no_verify;
 	pimpl->hilti_options->cg_debug = cg_debug;
@@ -347,6 +348,7 @@ bool Manager::InitPostScripts()
 	pimpl->pac2_options->jit = true;
 	pimpl->pac2_options->debug = BifConst::Hilti::debug;
 	pimpl->pac2_options->optimize = BifConst::Hilti::optimize;
+	pimpl->pac2_options->jit_tiered = BifConst::Hilti::tiered_jit;
 	pimpl->pac2_options->profile = BifConst::Hilti::profile;
 	pimpl->pac2_options->verify = ! BifConst::Hilti::no_verify;
 	pimpl->pac2_options->cg_debug = cg_debug;
@@ -3176,14 +3178,18 @@ void Manager::DumpMemoryStatistics()
 	uint64_t num_stacks = stats.num_stacks;
 	uint64_t total_refs = stats.num_refs;
 	uint64_t current_allocs = stats.num_allocs - stats.num_deallocs;
+	uint64_t copies_avoided = (stats.size_borrowed - stats.size_borrowed_copied) / 1024 / 1024;
+	uint64_t copied = stats.size_borrowed_copied / 1024 / 1024;
 
 	fprintf(stderr,
 		"%" PRIu64 "M heap, "
 		"%" PRIu64 "M alloced, "
 		"%" PRIu64 "M in %" PRIu64 " stacks, "
 		"%" PRIu64 " allocations, "
-		"%" PRIu64 " totals refs"
+		"%" PRIu64 " totals refs, "
+		"%" PRIu64 "M copies avoided, %" PRIu64 "M copied"
 		"\n",
-		heap, alloced, size_stacks, num_stacks, current_allocs, total_refs);
+		heap, alloced, size_stacks, num_stacks, current_allocs, total_refs,
+		copies_avoided, copied);
 	}
 
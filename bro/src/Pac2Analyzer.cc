@@ -20,6 +20,8 @@ using namespace binpac;
 
 using std::shared_ptr;
 
+namespace BifConst { namespace Hilti { extern int zero_copy_chunks; } }
+
 Pac2_Analyzer::Pac2_Analyzer(analyzer::Analyzer* analyzer)
 	{
 	orig.cookie.type = Pac2Cookie::PROTOCOL;
@@ -39,10 +41,12 @@ void Pac2_Analyzer::Init()
 	{
 	orig.parser = 0;
 	orig.data = 0;
+	orig.borrowed = 0;
 	orig.resume = 0;
 
 	resp.parser = 0;
 	resp.data = 0;
+	resp.borrowed = 0;
 	resp.resume = 0;
 
 	orig.cookie.protocol_cookie.tag = HiltiPlugin.Mgr()->TagForAnalyzer(orig.cookie.protocol_cookie.analyzer->GetAnalyzerTag());
@@ -55,10 +59,12 @@ void Pac2_Analyzer::Done()
 
 	GC_DTOR(orig.parser, hlt_BinPACHilti_Parser, ctx);
 	GC_DTOR(orig.data, hlt_bytes, ctx);
+	GC_DTOR(orig.borrowed, hlt_bytes, ctx);
 	GC_DTOR(orig.resume, hlt_exception, ctx);
 
 	GC_DTOR(resp.parser, hlt_BinPACHilti_Parser, ctx);
 	GC_DTOR(resp.data, hlt_bytes, ctx);
+	GC_DTOR(resp.borrowed, hlt_bytes, ctx);
 	GC_DTOR(resp.resume, hlt_exception, ctx);
 
 	Init();
@@ -123,7 +129,15 @@ int Pac2_Analyzer::FeedChunk(int len, const u_char* data, bool is_orig, bool eod
 		// First chunk.
 		debug_msg(endp->cookie.protocol_cookie.analyzer, "initial chunk", len, data, is_orig);
 
-		endp->data = hlt_bytes_new_from_data_copy((const int8_t*)data, len, &excpt, ctx);
+		if ( BifConst::Hilti::zero_copy_chunks )
+			{
+			endp->data = hlt_bytes_new_from_data_borrowed((int8_t*)data, len, &excpt, ctx);
+			endp->borrowed = endp->data;
+			GC_CCTOR(endp->borrowed, hlt_bytes, ctx);
+			}
+		else
+			endp->data = hlt_bytes_new_from_data_copy((const int8_t*)data, len, &excpt, ctx);
+
         GC_CCTOR(endp->data, hlt_bytes, ctx);
 
 		if ( eod )
@@ -149,7 +163,13 @@ int Pac2_Analyzer::FeedChunk(int len, const u_char* data, bool is_orig, bool eod
 
 		assert(endp->data && endp->resume);
 
-		if ( len )
+		if ( len && BifConst::Hilti::zero_copy_chunks )
+			{
+			endp->borrowed = hlt_bytes_append_raw_borrowed(endp->data, (int8_t*)data, len, &excpt, ctx);
+			GC_CCTOR(endp->borrowed, hlt_bytes, ctx);
+			}
+
+		else if ( len )
 			hlt_bytes_append_raw_copy(endp->data, (int8_t*)data, len, &excpt, ctx);
 
 		if ( eod )
@@ -205,6 +225,14 @@ int Pac2_Analyzer::FeedChunk(int len, const u_char* data, bool is_orig, bool eod
 	if ( eod || done || error )
         GC_CLEAR(endp->data, hlt_bytes, ctx);  // Marker that we're done parsing.
 
+	if ( endp->borrowed )
+		{
+		// Bro will reuse the chunk's memory once we return, so the
+		// parser gets its own copy of whatever it may still access.
+		hlt_bytes_unborrow(endp->borrowed, &excpt, ctx);
+		GC_CLEAR(endp->borrowed, hlt_bytes, ctx);
+		}
+
 	return result;
 	}
 
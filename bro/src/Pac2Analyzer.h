@@ -39,6 +39,7 @@ private:
 	struct Endpoint {
 		__binpac_parser* parser;
 		__hlt_bytes* data;
+		__hlt_bytes* borrowed; // Part of data referring to the current chunk, if zero-copy.
 		__hlt_exception* resume;
 		Pac2Cookie cookie;
 		};
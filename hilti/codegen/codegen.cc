@@ -18,6 +18,7 @@
 #include "abi.h"
 #include "debug-info-builder.h"
 #include "../passes/collector.h"
+#include "../passes/refcount-elision.h"
 #include "../builder/nodes.h"
 
 #include "libhilti/enum.h"
@@ -1280,6 +1281,10 @@ llvm::Value* CodeGen::llvmAddLocal(const string& name, shared_ptr<Type> type, sh
         llvm_type = llvm_type->getPointerElementType();
         local = builder->CreateAlloca(llvm_type, 0, name);
 
+        // The runtime's hoisted initializers release memory from any
+        // previous use, so we need to start out clean.
+        builder->CreateStore(llvm::Constant::getNullValue(llvm_type), local);
+
         if ( init )
             llvmValueInto(local, init, type);
     }
@@ -1848,15 +1853,77 @@ void CodeGen::llvmAdaptStackForSafepoint(bool pre)
     if ( ! pre )
         llvmCreateStackmap();
 
+    auto state = _functions.back().get();
+    auto stmt = _stmt_builder->currentStatement();
+
+    // The values we may keep referenced after the call, handing them over to
+    // the next statement's call.
+    std::set<llvm::Value*> carry;
+
+    if ( ! pre && stmt && stmt->successor() && hiltiModule()->refCountElision() ) {
+        for ( auto v : hiltiModule()->refCountElision()->carried(stmt) ) {
+            if ( auto addr = llvmValueAddress(v->expression) )
+                carry.insert(addr);
+        }
+    }
+
     for ( auto l : liveValues() ) {
         auto val = std::get<0>(l);
         auto type = std::get<1>(l);
         auto is_ptr = std::get<2>(l);
 
-        if ( pre )
+        auto c = std::find_if(state->carried.begin(), state->carried.end(),
+                              [val](const live_value& cl) { return std::get<0>(cl) == val; });
+
+        if ( pre ) {
+            if ( c != state->carried.end() ) {
+                // Still referenced from the previous call.
+                state->carried.erase(c);
+                continue;
+            }
+
             llvmCctor(val, type, is_ptr, "adapt-for-savepoint-pre");
-        else
+        }
+
+        else {
+            if ( carry.find(val) != carry.end() && c == state->carried.end() ) {
+                state->carried.push_back(l);
+                continue;
+            }
+
             llvmDtor(val, type, is_ptr, "adapt-for-savepoint-post");
+        }
+    }
+
+    if ( pre )
+        // Anything we haven't taken over isn't protected by this call.
+        llvmFlushCarriedValues();
+
+    else if ( state->carried.size() )
+        state->carried_from = stmt;
+}
+
+void CodeGen::llvmFlushCarriedValues(shared_ptr<Statement> next, bool clear)
+{
+    auto state = _functions.back().get();
+
+    if ( state->carried.empty() )
+        return;
+
+    if ( next && state->carried_from && hiltiModule()->refCountElision() &&
+         hiltiModule()->refCountElision()->carriedTo(state->carried_from, next) )
+        return;
+
+    for ( auto l : state->carried ) {
+        auto val = std::get<0>(l);
+        auto type = std::get<1>(l);
+        auto is_ptr = std::get<2>(l);
+        llvmDtor(val, type, is_ptr, "adapt-for-savepoint-carried");
+    }
+
+    if ( clear ) {
+        state->carried.clear();
+        state->carried_from = nullptr;
     }
 }
 
@@ -2430,6 +2497,7 @@ void CodeGen::llvmTriggerExceptionHandling(bool known_exception)
     llvmDebugPrint("hilti-flow", "exception raised");
 
     llvmBuildInstructionCleanup(false);
+    llvmFlushCarriedValues(nullptr, false);
 
     // Sort catches from most specific to least specific.
     auto catches = _functions.back()->catches;
@@ -3519,6 +3587,12 @@ void CodeGen::llvmDestroy(llvm::Value* val, shared_ptr<Type> type, const string&
     args.push_back(builder()->CreateBitCast(loc, llvmTypePtr()));
     args.push_back(llvmExecutionContext());
     llvmCallC("__hlt_object_destroy", args, false, false);
+
+    if ( ast::isA<type::Struct>(type) )
+        // A hoisted struct may get destroyed more than once, e.g., when it
+        // is dead and again on leaving the function. Its destructor doesn't
+        // reset the fields, so we do that here.
+        llvmCreateStore(llvm::Constant::getNullValue(val->getType()->getPointerElementType()), val);
 }
 
 void CodeGen::llvmDtor(llvm::Value* val, shared_ptr<Type> type, bool is_ptr, const string& location_addl)
@@ -3809,7 +3883,22 @@ llvm::Value* CodeGen::llvmStructNew(shared_ptr<Type> type, bool ref)
         return llvmConstNull(llvm_stype);
 
     auto s = llvmObjectNew(stype, llvm::cast<llvm::StructType>(llvm::cast<llvm::PointerType>(llvm_stype)->getElementType()), ref);
+    llvmStructInit(stype, s);
+    return s;
+}
+
+void CodeGen::llvmStructNewHoisted(shared_ptr<Type> type, llvm::Value* dst)
+{
+    auto stype = ast::as <type::Struct>(type);
+
+    // Release what a previous use left behind. That also zeros the
+    // instance, which is how it starts out in the first place.
+    llvmDestroy(dst, stype, "struct-new-hoisted");
+    llvmStructInit(stype, dst);
+}
 
+void CodeGen::llvmStructInit(shared_ptr<type::Struct> stype, llvm::Value* s)
+{
     // Initialize fields
     auto zero = llvmGEPIdx(0);
     auto mask = 0;
@@ -3837,8 +3926,6 @@ llvm::Value* CodeGen::llvmStructNew(shared_ptr<Type> type, bool ref)
     // Set mask.
     auto addr = llvmGEP(s, zero, llvmGEPIdx(1));
     llvmCreateStore(llvmConstInt(mask, 32), addr);
-
-    return s;
 }
 
 llvm::Value* CodeGen::llvmStructGet(shared_ptr<Type> stype, llvm::Value* sval, int field, struct_get_default_callback_t default_, struct_get_filter_callback_t filter, const Location& l)
@@ -1664,8 +1664,22 @@ public:
    void llvmCreateStackmap();
 
    /// XXX Ref/unref locals for get ref counts correct.
+   ///
+   /// If the module's passes::RefCountElision determined that a value stays
+   /// protected until the next safepoint call further down a straight-line
+   /// path, the unref after the call is deferred and that call's ref
+   /// skipped.
    void llvmAdaptStackForSafepoint(bool pre);
 
+   /// Emits the unrefs that llvmAdaptStackForSafepoint() has deferred.
+   ///
+   /// next: If given and the deferred values are kept across this
+   /// statement, or handed over to it, nothing is done.
+   ///
+   /// clear: If false, the values remain deferred. That's for emitting the
+   /// unrefs on an exception path only.
+   void llvmFlushCarriedValues(shared_ptr<Statement> next = nullptr, bool clear = true);
+
    /// XXX Returns all values currently live with theior types.
    typedef std::tuple<llvm::Value*, shared_ptr<Type>, bool> live_value;
    typedef std::list<live_value> live_list;
@@ -1828,6 +1842,14 @@ public:
    /// Returns: The newly allocated instance.
    llvm::Value* llvmStructNew(shared_ptr<Type> stype, bool ref);
 
+   /// Initializes a struct instance hoisted to the stack, releasing
+   /// anything a previous use of the same memory left behind.
+   ///
+   /// stype: The type, which must be a \a type::Struct.
+   ///
+   /// dst: Pointer to the stack memory holding the instance.
+   void llvmStructNewHoisted(shared_ptr<Type> stype, llvm::Value* dst);
+
    // A callback to filter the value returned by llvmStructGet().  The
    // callback will be called with the value extracted from the struct
    // instance and the returns value of the callback will then be used
@@ -2267,6 +2289,9 @@ public:
    static string llvmGetModuleIdentifier(llvm::Module* module);
 
 private:
+   // Initializes the fields of a newly created struct instance.
+   void llvmStructInit(shared_ptr<type::Struct> stype, llvm::Value* s);
+
    // Creates/finishes the module intialization function that will receive all global
    // code, and pushes it onto the stack.
    void createInitFunction();
@@ -2441,6 +2466,8 @@ private:
        handler_list catches;
        type::function::CallingConvention cc;
        int stackmap_id = 0;
+       live_list carried; // Values whose unref after a safepoint call has been deferred.
+       shared_ptr<Statement> carried_from = nullptr; // The statement whose call deferred the unrefs.
    };
 
    typedef std::list<std::unique_ptr<FunctionState>> function_list;
@@ -21,8 +21,14 @@ static string _opToStr(shared_ptr<Expression> op)
 void StatementBuilder::visit(statement::instruction::struct_::New* i)
 {
     auto stype = ast::as<type::Struct>(typedType(i->op1()));
-    auto result = cg()->llvmStructNew(stype, false);
-    cg()->llvmStore(i, result);
+
+    if ( ! i->hoisted() ) {
+        auto result = cg()->llvmStructNew(stype, false);
+        cg()->llvmStore(i, result);
+    }
+
+    else
+        cg()->llvmStructNewHoisted(stype, cg()->llvmValue(i->target()));
 }
 
 void StatementBuilder::visit(statement::instruction::struct_::Get* i)
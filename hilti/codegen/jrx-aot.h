@@ -0,0 +1,139 @@
+///
+/// The compiler links its own copy of justrx for computing DFAs ahead of
+/// time. As tools may link the runtime library as well, which comes with a
+/// copy of its own, this header renames all of the compiler copy's external
+/// symbols. It's force-included into the justrx sources built for the
+/// compiler, and must be included before ``jrx.h`` by anybody calling into
+/// them.
+///
+/// Needs to be kept in sync with the non-static functions in justrx.
+
+#ifndef HILTI_CODEGEN_JRX_AOT_H
+#define HILTI_CODEGEN_JRX_AOT_H
+
+// jrx.c
+#define jrx_can_transition hlt_aot_jrx_can_transition
+#define jrx_current_accept hlt_aot_jrx_current_accept
+#define jrx_dfa_image_done hlt_aot_jrx_dfa_image_done
+#define jrx_match_state_done hlt_aot_jrx_match_state_done
+#define jrx_match_state_init hlt_aot_jrx_match_state_init
+#define jrx_num_groups hlt_aot_jrx_num_groups
+#define jrx_regcomp hlt_aot_jrx_regcomp
+#define jrx_regerror hlt_aot_jrx_regerror
+#define jrx_regexec hlt_aot_jrx_regexec
+#define jrx_regexec_partial hlt_aot_jrx_regexec_partial
+#define jrx_regexec_search_partial hlt_aot_jrx_regexec_search_partial
+#define jrx_regfree hlt_aot_jrx_regfree
+#define jrx_reggroups hlt_aot_jrx_reggroups
+#define jrx_regset_add hlt_aot_jrx_regset_add
+#define jrx_regset_done hlt_aot_jrx_regset_done
+#define jrx_regset_export hlt_aot_jrx_regset_export
+#define jrx_regset_finalize hlt_aot_jrx_regset_finalize
+#define jrx_regset_import hlt_aot_jrx_regset_import
+#define jrx_regset_init hlt_aot_jrx_regset_init
+#define jrx_search_state_done hlt_aot_jrx_search_state_done
+#define jrx_search_state_init hlt_aot_jrx_search_state_init
+
+// dfa-interpreter-*.c
+#define jrx_match_state_advance hlt_aot_jrx_match_state_advance
+#define jrx_match_state_advance_min hlt_aot_jrx_match_state_advance_min
+#define jrx_match_state_copy_tags hlt_aot_jrx_match_state_copy_tags
+
+// util.c, jlocale.c
+#define jrx_expand_escape hlt_aot_jrx_expand_escape
+#define jrx_internal_error hlt_aot_jrx_internal_error
+#define local_ccl_blank hlt_aot_local_ccl_blank
+#define local_ccl_digit hlt_aot_local_ccl_digit
+#define local_ccl_lower hlt_aot_local_ccl_lower
+#define local_ccl_upper hlt_aot_local_ccl_upper
+#define local_ccl_word hlt_aot_local_ccl_word
+
+// ccl.c
+#define ccl_add_assertions hlt_aot_ccl_add_assertions
+#define ccl_any hlt_aot_ccl_any
+#define ccl_do_intersect hlt_aot_ccl_do_intersect
+#define ccl_empty hlt_aot_ccl_empty
+#define ccl_epsilon hlt_aot_ccl_epsilon
+#define ccl_from_range hlt_aot_ccl_from_range
+#define ccl_from_std_ccl hlt_aot_ccl_from_std_ccl
+#define ccl_group_add hlt_aot_ccl_group_add
+#define ccl_group_create hlt_aot_ccl_group_create
+#define ccl_group_delete hlt_aot_ccl_group_delete
+#define ccl_group_disambiguate hlt_aot_ccl_group_disambiguate
+#define ccl_group_print hlt_aot_ccl_group_print
+#define ccl_is_empty hlt_aot_ccl_is_empty
+#define ccl_is_epsilon hlt_aot_ccl_is_epsilon
+#define ccl_join hlt_aot_ccl_join
+#define ccl_negate hlt_aot_ccl_negate
+#define ccl_print hlt_aot_ccl_print
+
+// dfa.c
+#define dfa_compile hlt_aot_dfa_compile
+#define dfa_delete hlt_aot_dfa_delete
+#define dfa_export hlt_aot_dfa_export
+#define dfa_from_image hlt_aot_dfa_from_image
+#define dfa_from_nfa hlt_aot_dfa_from_nfa
+#define dfa_get_row hlt_aot_dfa_get_row
+#define dfa_get_state hlt_aot_dfa_get_state
+#define dfa_peek_state hlt_aot_dfa_peek_state
+#define dfa_print hlt_aot_dfa_print
+#define dfa_state_compute hlt_aot_dfa_state_compute
+
+// nfa.c
+#define _nfa_state_follow_epsilons hlt_aot__nfa_state_follow_epsilons
+#define nfa_alternative hlt_aot_nfa_alternative
+#define nfa_compile hlt_aot_nfa_compile
+#define nfa_compile_add hlt_aot_nfa_compile_add
+#define nfa_concat hlt_aot_nfa_concat
+#define nfa_context_create hlt_aot_nfa_context_create
+#define nfa_context_delete hlt_aot_nfa_context_delete
+#define nfa_create hlt_aot_nfa_create
+#define nfa_delete hlt_aot_nfa_delete
+#define nfa_empty hlt_aot_nfa_empty
+#define nfa_from_ccl hlt_aot_nfa_from_ccl
+#define nfa_iterate hlt_aot_nfa_iterate
+#define nfa_print hlt_aot_nfa_print
+#define nfa_remove_epsilons hlt_aot_nfa_remove_epsilons
+#define nfa_set_accept hlt_aot_nfa_set_accept
+#define nfa_set_capture hlt_aot_nfa_set_capture
+#define nfa_state_print hlt_aot_nfa_state_print
+
+// re-parse.y, re-scan.l
+#define REparse hlt_aot_REparse
+#define REdebug hlt_aot_REdebug
+#define REerror hlt_aot_REerror
+#define RElex hlt_aot_RElex
+#define RElex_init hlt_aot_RElex_init
+#define RElex_init_extra hlt_aot_RElex_init_extra
+#define RElex_destroy hlt_aot_RElex_destroy
+#define RErestart hlt_aot_RErestart
+#define RE_switch_to_buffer hlt_aot_RE_switch_to_buffer
+#define RE_create_buffer hlt_aot_RE_create_buffer
+#define RE_delete_buffer hlt_aot_RE_delete_buffer
+#define RE_flush_buffer hlt_aot_RE_flush_buffer
+#define REpush_buffer_state hlt_aot_REpush_buffer_state
+#define REpop_buffer_state hlt_aot_REpop_buffer_state
+#define RE_scan_buffer hlt_aot_RE_scan_buffer
+#define RE_scan_string hlt_aot_RE_scan_string
+#define RE_scan_bytes hlt_aot_RE_scan_bytes
+#define REget_extra hlt_aot_REget_extra
+#define REset_extra hlt_aot_REset_extra
+#define REget_in hlt_aot_REget_in
+#define REset_in hlt_aot_REset_in
+#define REget_out hlt_aot_REget_out
+#define REset_out hlt_aot_REset_out
+#define REget_leng hlt_aot_REget_leng
+#define REget_text hlt_aot_REget_text
+#define REget_lineno hlt_aot_REget_lineno
+#define REset_lineno hlt_aot_REset_lineno
+#define REget_column hlt_aot_REget_column
+#define REset_column hlt_aot_REset_column
+#define REget_debug hlt_aot_REget_debug
+#define REset_debug hlt_aot_REset_debug
+#define REget_lval hlt_aot_REget_lval
+#define REset_lval hlt_aot_REset_lval
+#define REalloc hlt_aot_REalloc
+#define RErealloc hlt_aot_RErealloc
+#define REfree hlt_aot_REfree
+
+#endif
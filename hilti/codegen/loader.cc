@@ -12,6 +12,14 @@
 #include "libhilti/port.h"
 #include "libhilti/regexp.h"
 
+extern "C" {
+#include "jrx-aot.h"
+#include "libhilti/justrx/src/jrx.h"
+}
+
+// Marks a missing transition in a jrx_dfa_image.
+static const jrx_dfa_state_id NoState = (jrx_dfa_state_id)-1;
+
 using namespace hilti;
 using namespace codegen;
 
@@ -630,6 +638,215 @@ void Loader::visit(ctor::Map* c)
     setResult(map, false, false);
 }
 
+// Generates a native matcher for a DFA; see jrx_dfa_native for its
+// semantics. Each DFA state becomes a block that switches on the class of
+// the next input byte.
+static llvm::Function* _regexpMatcher(CodeGen* cg, const jrx_dfa_image& image, llvm::Constant* classes, bool first_match)
+{
+    auto i32 = cg->llvmTypeInt(32);
+    auto run_type = cg->llvmTypeStruct("", { i32, i32, i32, i32 });
+
+    CodeGen::llvm_parameter_list params = {
+        std::make_pair("run", cg->llvmTypePtr(run_type)),
+        std::make_pair("data", cg->llvmTypePtr(cg->llvmTypeInt(8))),
+        std::make_pair("len", i32)
+    };
+
+    auto func = cg->llvmAddFunction("regexp-match", i32, params, true);
+    cg->pushFunction(func);
+
+    auto a = func->arg_begin();
+    llvm::Value* run = a++;
+    llvm::Value* data = a++;
+    llvm::Value* len = a++;
+
+    auto zero = cg->llvmGEPIdx(0);
+    auto run_state = cg->llvmGEP(run, zero, cg->llvmGEPIdx(0));
+    auto run_consumed = cg->llvmGEP(run, zero, cg->llvmGEPIdx(1));
+    auto run_accept = cg->llvmGEP(run, zero, cg->llvmGEPIdx(2));
+    auto run_accept_end = cg->llvmGEP(run, zero, cg->llvmGEPIdx(3));
+
+    auto rtype = builder::integer::type(32);
+    auto k = image.num_classes;
+
+    // Index of the next input byte.
+    auto idx = cg->llvmCreateAlloca(i32);
+    cg->llvmCreateStore(cg->llvmConstInt(0, 32), idx);
+
+    std::vector<IRBuilder*> states;
+
+    for ( uint32_t s = 0; s < image.num_states; s++ )
+        states.push_back(cg->newBuilder(::util::fmt("state-%d", s)));
+
+    auto jammed = cg->newBuilder("jammed");
+    auto sw = cg->builder()->CreateSwitch(cg->builder()->CreateLoad(run_state), jammed->GetInsertBlock(), image.num_states);
+
+    for ( uint32_t s = 0; s < image.num_states; s++ )
+        sw->addCase(cg->llvmConstInt(s, 32), states[s]->GetInsertBlock());
+
+    cg->pushBuilder(jammed);
+    cg->llvmReturn(rtype, cg->llvmConstInt(0, 32));
+    cg->popBuilder();
+
+    for ( uint32_t s = 0; s < image.num_states; s++ ) {
+        cg->pushBuilder(states[s]);
+
+        auto i = cg->builder()->CreateLoad(idx);
+        auto eod = cg->newBuilder("eod");
+        auto next = cg->newBuilder("next");
+        cg->llvmCreateCondBr(cg->builder()->CreateICmpEQ(i, len), eod, next);
+        cg->popBuilder();
+
+        cg->pushBuilder(eod);
+        cg->llvmCreateStore(cg->llvmConstInt(s, 32), run_state);
+        cg->llvmCreateStore(i, run_consumed);
+        cg->llvmReturn(rtype, cg->llvmConstInt(-1, 32));
+        cg->popBuilder();
+
+        cg->pushBuilder(next);
+
+        auto c = cg->builder()->CreateZExt(cg->builder()->CreateLoad(cg->llvmGEP(data, i)), i32);
+        auto cls = cg->builder()->CreateLoad(cg->llvmGEP(static_cast<llvm::Value*>(classes), zero, c));
+
+        auto stuck = cg->newBuilder("stuck");
+        auto csw = cg->builder()->CreateSwitch(cls, stuck->GetInsertBlock(), k);
+        cg->popBuilder();
+
+        cg->pushBuilder(stuck);
+        cg->llvmCreateStore(i, run_consumed);
+
+        if ( image.accepts[s] ) {
+            cg->llvmCreateStore(cg->llvmConstInt(NoState, 32), run_state);
+            cg->llvmReturn(rtype, cg->llvmConstInt(image.accepts[s], 32));
+        }
+
+        else
+            cg->llvmReturn(rtype, cg->llvmConstInt(0, 32));
+
+        cg->popBuilder();
+
+        // One block per successor, shared by all classes leading there.
+        std::map<jrx_dfa_state_id, IRBuilder*> succs;
+
+        for ( uint32_t cl = 0; cl < k; cl++ ) {
+            auto t = image.succ[s * k + cl];
+
+            if ( t == NoState )
+                continue;
+
+            auto b = succs[t];
+
+            if ( ! b ) {
+                b = succs[t] = cg->newBuilder("transition");
+
+                cg->pushBuilder(b);
+                auto ni = cg->builder()->CreateAdd(i, cg->llvmConstInt(1, 32));
+                cg->llvmCreateStore(ni, idx);
+
+                bool more = false;
+
+                for ( uint32_t d = 0; d < k; d++ )
+                    more = more || (image.succ[t * k + d] != NoState);
+
+                if ( image.accepts[t] && (first_match || ! more) ) {
+                    cg->llvmCreateStore(cg->llvmConstInt(t, 32), run_state);
+                    cg->llvmCreateStore(ni, run_consumed);
+                    cg->llvmReturn(rtype, cg->llvmConstInt(image.accepts[t], 32));
+                }
+
+                else {
+                    if ( image.accepts[t] ) {
+                        cg->llvmCreateStore(cg->llvmConstInt(image.accepts[t], 32), run_accept);
+                        cg->llvmCreateStore(ni, run_accept_end);
+                    }
+
+                    cg->llvmCreateBr(states[t]);
+                }
+
+                cg->popBuilder();
+            }
+
+            csw->addCase(cg->llvmConstInt(cl, 8), b->GetInsertBlock());
+        }
+    }
+
+    cg->popFunction();
+    return func;
+}
+
+// Computes the DFA for a set of patterns and returns a pointer to a
+// constant jrx_dfa_image describing it. Returns null if we can't do that,
+// in which case the patterns need to be compiled at run-time.
+static llvm::Constant* _regexpImage(CodeGen* cg, const ctor::RegExp::pattern_list& patterns, int flags)
+{
+    // Must match what libhilti uses for compiling at run-time.
+    int cflags = REG_EXTENDED | REG_LAZY | REG_NOSUB | REG_ANCHOR;
+
+    if ( flags & HLT_REGEXP_FIRST_MATCH )
+        cflags |= REG_FIRST_MATCH;
+
+    jrx_regex_t re;
+    jrx_regset_init(&re, -1, cflags);
+
+    for ( auto p : patterns ) {
+        if ( jrx_regset_add(&re, p.c_str(), p.size()) != REG_OK ) {
+            jrx_regfree(&re);
+            return nullptr;
+        }
+    }
+
+    jrx_dfa_image image;
+
+    if ( jrx_regset_finalize(&re) != REG_OK || jrx_regset_export(&re, &image) != REG_OK ) {
+        jrx_regfree(&re);
+        return nullptr;
+    }
+
+    std::vector<llvm::Constant*> classes;
+    std::vector<llvm::Constant*> succ;
+    std::vector<llvm::Constant*> accepts;
+
+    for ( int i = 0; i < 256; i++ )
+        classes.push_back(cg->llvmConstInt(image.classes[i], 8));
+
+    for ( uint32_t i = 0; i < image.num_states * image.num_classes; i++ )
+        succ.push_back(cg->llvmConstInt(image.succ[i], 32));
+
+    for ( uint32_t i = 0; i < image.num_states; i++ )
+        accepts.push_back(cg->llvmConstInt(image.accepts[i], 16));
+
+    auto gclasses = cg->llvmAddConst("regexp-classes", cg->llvmConstArray(classes));
+    auto gsucc = cg->llvmAddConst("regexp-succ", cg->llvmConstArray(succ));
+    auto gaccepts = cg->llvmAddConst("regexp-accepts", cg->llvmConstArray(accepts));
+
+    llvm::Constant* native = cg->llvmConstNull(cg->llvmTypePtr());
+
+    if ( cg->options().optimizing("regexp-native") )
+        native = cg->llvmCastConst(_regexpMatcher(cg, image, gclasses, flags & HLT_REGEXP_FIRST_MATCH), cg->llvmTypePtr());
+
+    CodeGen::constant_list elems = {
+        cg->llvmConstInt(image.num_states, 32),
+        cg->llvmConstInt(image.num_classes, 32),
+        cg->llvmConstInt(image.initial, 32),
+        cg->llvmCastConst(gclasses, cg->llvmTypePtr(cg->llvmTypeInt(8))),
+        cg->llvmCastConst(gsucc, cg->llvmTypePtr(cg->llvmTypeInt(32))),
+        cg->llvmCastConst(gaccepts, cg->llvmTypePtr(cg->llvmTypeInt(16))),
+        native
+    };
+
+    auto gimage = cg->llvmAddConst("regexp-image", cg->llvmConstStruct(elems));
+
+    if ( cg->options().cgDebugging("regexp") )
+        std::cerr << ::util::fmt("regexp: %d patterns compiled into DFA with %d states and %d classes%s",
+                               (int)patterns.size(), image.num_states, image.num_classes,
+                               (native->isNullValue() ? "" : ", native matcher")) << std::endl;
+
+    jrx_dfa_image_done(&image);
+    jrx_regfree(&re);
+
+    return cg->llvmCastConst(gimage, cg->llvmTypePtr());
+}
+
 void Loader::visit(ctor::RegExp* c)
 {
     int flags = 0;
@@ -647,7 +864,14 @@ void Loader::visit(ctor::RegExp* c)
 
     auto patterns = c->patterns();
 
-    if ( patterns.size() == 1 ) {
+    llvm::Constant* image = nullptr;
+
+    // Without subexpressions, we can compute the DFA right here and let the
+    // run-time use it directly.
+    if ( (flags & HLT_REGEXP_NOSUB) && cg()->options().optimize && cg()->options().optimizing("regexp") )
+        image = _regexpImage(cg(), patterns, flags);
+
+    if ( patterns.size() == 1 && ! image ) {
         // Just one pattern, we use regexp_compile().
         auto pattern = patterns.front();
         CodeGen::expr_list args;
@@ -657,8 +881,8 @@ void Loader::visit(ctor::RegExp* c)
     }
 
     else {
-        // More than one pattern. We built a list of the patterns and then
-        // call compile_set.
+        // More than one pattern, or a precomputed DFA. We built a list of
+        // the patterns and then call compile_set, or compile_image.
         auto ttmgr = builder::reference::type(builder::timer_mgr::type());
         auto tmgr = builder::codegen::create(ttmgr, cg()->llvmConstNull(cg()->llvmTypePtr(cg()->llvmLibType("hlt.timer_mgr"))));
         CodeGen::expr_list args = { builder::type::create(builder::string::type()), tmgr };
@@ -671,8 +895,15 @@ void Loader::visit(ctor::RegExp* c)
             cg()->llvmCall("hlt::list_push_back", args);
         }
 
-        args = { op1, builder::codegen::create(ltype, list) };
-        cg()->llvmCall("hlt::regexp_compile_set", args);
+        if ( image ) {
+            args = { op1, builder::codegen::create(ltype, list), builder::codegen::create(builder::caddr::type(), image) };
+            cg()->llvmCall("hlt::regexp_compile_image", args);
+        }
+
+        else {
+            args = { op1, builder::codegen::create(ltype, list) };
+            cg()->llvmCall("hlt::regexp_compile_set", args);
+        }
     }
 
     setResult(regexp, false, false);
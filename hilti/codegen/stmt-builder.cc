@@ -62,6 +62,10 @@ void StatementBuilder::preAccept(shared_ptr<ast::NodeBase> node)
     if ( ! stmt || block )
         return;
 
+    // Release what the previous statement kept referenced unless this one
+    // takes it over.
+    cg()->llvmFlushCarriedValues(stmt);
+
     _stmts.push_back(stmt);
 }
 
@@ -287,18 +287,13 @@ static llvm::Value* _castToWidth(CodeGen* cg, llvm::Value* val, int twidth, bool
     return val;
 }
 
-static void _integerUnpack(CodeGen* cg, const UnpackArgs& args, const UnpackResult& result, int width, bool sign, ABI::ByteOrder order, const std::list<int> bytes)
+// Extracts the bytes one at a time. This works across chunk boundaries.
+static llvm::Value* _integerUnpackSlow(CodeGen* cg, const UnpackArgs& args, const UnpackResult& result, int width, const std::list<int> bytes)
 {
-    auto iter_type = builder::iterator::typeBytes();
-    auto twidth = ast::as<type::Integer>(args.type)->width();
     auto itype = cg->llvmTypeInt(width);
 
-    // Copy the start iterator.
-    cg->llvmCreateStore(args.begin, result.iter_ptr);
-
     llvm::Value* unpacked = cg->llvmConstNull(itype);
 
-    // Extract the bytes.
     for ( auto i : bytes ) {
         llvm::Value* byte = cg->llvmCallC("__hlt_bytes_extract_one", { result.iter_ptr, args.end }, true);
 
@@ -310,6 +305,58 @@ static void _integerUnpack(CodeGen* cg, const UnpackArgs& args, const UnpackResu
         unpacked = cg->builder()->CreateOr(unpacked, byte);
     }
 
+    return unpacked;
+}
+
+static void _integerUnpack(CodeGen* cg, const UnpackArgs& args, const UnpackResult& result, int width, bool sign, ABI::ByteOrder order, const std::list<int> bytes)
+{
+    auto iter_type = builder::iterator::typeBytes();
+    auto twidth = ast::as<type::Integer>(args.type)->width();
+    auto itype = cg->llvmTypeInt(width);
+
+    // Copy the start iterator.
+    cg->llvmCreateStore(args.begin, result.iter_ptr);
+
+    llvm::Value* unpacked = nullptr;
+
+    if ( bytes.size() == 1 )
+        unpacked = _integerUnpackSlow(cg, args, result, width, bytes);
+
+    else {
+        // If all the bytes are inside the current chunk, we do a single
+        // load and swap bytes if necessary. Otherwise we fall back to
+        // extracting them one by one.
+        auto n = cg->llvmConstInt(bytes.size(), 64);
+        auto data = cg->llvmCallC("__hlt_bytes_extract_n", { result.iter_ptr, args.end, n }, true, false);
+        auto is_null = cg->llvmExpect(cg->llvmCreateIsNull(data), cg->llvmConstInt(0, 1));
+
+        auto tmp = cg->llvmAddTmp("unpacked", itype);
+        auto fast = cg->newBuilder("unpack-int-fast");
+        auto slow = cg->newBuilder("unpack-int-slow");
+        auto done = cg->newBuilder("unpack-int-done");
+
+        cg->llvmCreateCondBr(is_null, slow, fast);
+
+        cg->pushBuilder(fast);
+        auto ptr = cg->builder()->CreateBitCast(data, cg->llvmTypePtr(itype));
+        llvm::Value* val = cg->builder()->CreateAlignedLoad(ptr, 1);
+
+        if ( order != cg->abi()->byteOrder() )
+            val = cg->llvmCallIntrinsic(llvm::Intrinsic::bswap, { itype }, { val });
+
+        cg->llvmCreateStore(val, tmp);
+        cg->llvmCreateBr(done);
+        cg->popBuilder();
+
+        cg->pushBuilder(slow);
+        cg->llvmCreateStore(_integerUnpackSlow(cg, args, result, width, bytes), tmp);
+        cg->llvmCreateBr(done);
+        cg->popBuilder();
+
+        cg->pushBuilder(done); // leave on stack.
+        unpacked = cg->builder()->CreateLoad(tmp);
+    }
+
     unpacked = _castToWidth(cg, unpacked, twidth, sign);
 
     // Select subset of bits if requested.
@@ -229,7 +229,8 @@ bool CompilerContext::_finalizeModule(shared_ptr<Module> module, bool verify)
     passes::Validator             validator;
     passes::ScopeBuilder          scope_builder(this);
     passes::OptimizeCtors         optimize_ctors;
-    passes::OptimizePeepHole      optimize_peephole;
+    passes::OptimizePeepHole      optimize_peephole(this);
+    passes::EscapeAnalysis        escape_analysis(this);
 
     _beginPass(module, instruction_normalizer);
 
@@ -326,6 +327,13 @@ bool CompilerContext::_finalizeModule(shared_ptr<Module> module, bool verify)
 
     _endPass();
 
+    _beginPass(module, escape_analysis);
+
+    if ( ! escape_analysis.run(module) )
+        return false;
+
+    _endPass();
+
     _beginPass(module, optimize_ctors);
 
     if ( ! optimize_ctors.run(module) )
@@ -342,8 +350,9 @@ bool CompilerContext::_finalizeModule(shared_ptr<Module> module, bool verify)
 
     auto cfg = std::make_shared<passes::CFG>(this);
     auto liveness = std::make_shared<passes::Liveness>(this, cfg);
+    auto refcounts = std::make_shared<passes::RefCountElision>(this, cfg, liveness);
 
-    module->setPasses(cfg, liveness);
+    module->setPasses(cfg, liveness, refcounts);
 
     _beginPass(module, *cfg);
 
@@ -359,6 +368,13 @@ bool CompilerContext::_finalizeModule(shared_ptr<Module> module, bool verify)
 
     _endPass();
 
+    _beginPass(module, *refcounts);
+
+    if ( ! refcounts->run(module) )
+        return false;
+
+    _endPass();
+
 
     return true;
 }
@@ -786,6 +802,10 @@ bool CompilerContext::_optimize(llvm::Module* module, bool is_linked)
     if ( ! options().optimize )
         return true;
 
+    // With tiered JIT compilation, the JIT optimizes what's worth it later.
+    if ( is_linked && options().jit && options().jit_tiered )
+        return true;
+
     if ( options().cgDebugging("context" ) )
         std::cerr << "Optimizing final linked module ... " << std::endl;
 
@@ -12,6 +12,15 @@
 #include <llvm/IR/Module.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
 
 #ifndef HAVE_LLVM_33
 #include <llvm/ExecutionEngine/JITMemoryManager.h>
@@ -20,6 +29,7 @@
 #include "jit.h"
 #include "../options.h"
 #include "../codegen/common.h"
+#include "../codegen/optimizer.h"
 
 extern void* __hlt_internal_global_globals;
 
@@ -71,6 +81,10 @@ public:
     void installFunctionTable(const JIT::FunctionMapping* functions);
     void* lookupFunctionInTable(const std::string& name);
 
+    // Installs a map of symbols that take precedence over any other way of
+    // resolving them.
+    void installSymbolMap(const std::map<std::string, void*>* symbols);
+
     // This is one method we override with our own version.
     void* getPointerToNamedFunction(const std::string &Name, bool AbortOnFailure = true) override;
     uint64_t getSymbolAddress(const std::string &Name) override;
@@ -120,6 +134,7 @@ public:
 private:
     llvm::JITMemoryManager* _mm;
     const JIT::FunctionMapping* _functions = 0;
+    const std::map<std::string, void*>* _symbols = 0;
 };
 
 hilti::jit::MemoryManager::MemoryManager(llvm::JITMemoryManager *mm)
@@ -149,8 +164,28 @@ void* MemoryManager::lookupFunctionInTable(const std::string& name)
     return nullptr;
 }
 
+void MemoryManager::installSymbolMap(const std::map<std::string, void*>* symbols)
+{
+    _symbols = symbols;
+}
+
 uint64_t MemoryManager::getSymbolAddress(const std::string &Name)
 {
+    if ( _symbols ) {
+        auto name = Name;
+
+#ifdef __APPLE__
+        // Strip the leading underscore.
+        if ( name.size() && name[0] == '_' )
+            name = name.substr(1);
+#endif
+
+        auto i = _symbols->find(name);
+
+        if ( i != _symbols->end() )
+            return (uint64_t)i->second;
+    }
+
     return _mm->getSymbolAddress(Name);
 }
 
@@ -243,6 +278,420 @@ llvm::MemoryBuffer* hilti::jit::ObjectCache::getObject(const llvm::Module *modul
     return nullptr;
 }
 
+// Creates an MCJIT execution engine for a module. Code of different engines
+// can call into each other as long as they agree on tail_calls, as that
+// changes the calling convention.
+static llvm::ExecutionEngine* _createEngine(llvm::Module* module, MemoryManager* mm, llvm::CodeGenOpt::Level opt_level, bool tail_calls, string* errormsg)
+{
+    llvm::EngineBuilder builder(module);
+    builder.setEngineKind(llvm::EngineKind::JIT);
+    builder.setUseMCJIT(true);
+#ifdef HAVE_LLVM_33
+    builder.setJITMemoryManager(mm);
+#else
+    builder.setMCJITMemoryManager(mm);
+#endif
+    builder.setErrorStr(errormsg);
+    builder.setOptLevel(opt_level);
+    builder.setAllocateGVsWithCode(false);
+    builder.setCodeModel(llvm::CodeModel::JITDefault);
+    builder.setRelocationModel(llvm::Reloc::Default);
+    builder.setMArch("");
+    builder.setMCPU(llvm::sys::getHostCPUName());
+
+    llvm::TargetOptions Options;
+#ifdef HAVE_LLVM_33
+    Options.JITExceptionHandling = false;
+#endif
+    Options.JITEmitDebugInfo = true;
+    Options.JITEmitDebugInfoToDisk = false;
+    Options.UseSoftFloat = false;
+    Options.FloatABIType = llvm::FloatABI::Default;
+    Options.GuaranteedTailCallOpt = tail_calls;
+    // Options.PrintMachineCode = true;
+    // Options.EnableSegmentedStacks = true; // Leads to "varargs not supported".
+    builder.setTargetOptions(Options);
+
+    return builder.create();
+}
+
+// Returns the address of a global inside a JITed module.
+static void* _globalAddress(llvm::ExecutionEngine* ee, llvm::GlobalValue* gv)
+{
+#ifdef HAVE_LLVM_33
+    return ee->getPointerToGlobal(gv);
+#else
+    if ( llvm::isa<llvm::Function>(gv) )
+        return (void *)ee->getFunctionAddress(gv->getName().str());
+    else
+        return (void *)ee->getGlobalValueAddress(gv->getName().str());
+#endif
+}
+
+// Gives a global defined inside a module a linkage that makes it
+// resolvable by name from other modules.
+static void _externalize(llvm::GlobalValue* gv, int* cnt)
+{
+    if ( gv->isDeclaration() || gv->hasAppendingLinkage() || gv->hasAvailableExternallyLinkage() )
+        return;
+
+    if ( ! gv->hasName() )
+        gv->setName(::util::fmt("__hlt_jit_anon_%d", ++(*cnt)));
+
+    gv->setLinkage(llvm::GlobalValue::ExternalLinkage);
+}
+
+// Implements tiered compilation. Tier 0 instruments the module so that
+// each function counts its entries and forwards to a replacement if it
+// finds one in an indirection table; the module is then JITed without
+// optimization. A background thread periodically recompiles the functions
+// that have turned hot with full optimization (tier 1), and installs them
+// in the table.
+class hilti::jit::TieredCompiler
+{
+public:
+    TieredCompiler(CompilerContext* ctx, bool tail_calls);
+    ~TieredCompiler();
+
+    // Instruments a module for tier 0. Must be called before the module
+    // gets JITed.
+    void prepare(llvm::Module* module);
+
+    // Starts background compilation once the tier 0 engine for a prepared
+    // module has been created. Returns false on error.
+    bool start(llvm::ExecutionEngine* ee, llvm::Module* module, double tier0_time);
+
+private:
+    void run();
+    void tierUp(std::vector<int> hot);
+
+    CompilerContext* _ctx;
+    bool _tail_calls;
+
+    string _bitcode;                  // The prepared module before instrumentation.
+    std::vector<string> _functions;   // Names of all instrumented functions.
+    std::vector<bool> _attempted;     // Functions we have tried to tier up.
+    std::map<string, void*> _symbols; // Tier 0 addresses of all definitions.
+    uint64_t* _counters = nullptr;    // Entry counters, indexed like _functions.
+    void** _table = nullptr;          // Tier 1 replacements, indexed like _functions.
+
+    std::thread _thread;
+    std::mutex _lock;
+    std::condition_variable _wakeup;
+    bool _stop = false;
+
+    double _time[2] = { 0, 0 };       // Compile time spent per tier.
+    int _tier_ups = 0;
+};
+
+TieredCompiler::TieredCompiler(CompilerContext* ctx, bool tail_calls)
+{
+    llvm::llvm_start_multithreaded();
+
+    _ctx = ctx;
+    _tail_calls = tail_calls;
+}
+
+TieredCompiler::~TieredCompiler()
+{
+    if ( _thread.joinable() ) {
+        {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stop = true;
+        }
+
+        _wakeup.notify_all();
+        _thread.join();
+    }
+
+    // Note that we don't delete the tier 1 engines, as tier 0 code may
+    // still forward to them.
+
+    if ( _ctx->options().cgDebugging("jit") )
+        std::cerr << ::util::fmt("jit: compile time tier 0 %.2fs, tier 1 %.2fs; %d function(s) tiered up",
+                                 _time[0], _time[1], _tier_ups) << std::endl;
+}
+
+void TieredCompiler::prepare(llvm::Module* module)
+{
+    // Tier 1 code refers back to everything it doesn't compile itself, so
+    // all definitions need to be resolvable by name.
+    int cnt = 0;
+
+    for ( auto g = module->global_begin(); g != module->global_end(); g++ )
+        _externalize(&*g, &cnt);
+
+    for ( auto f = module->begin(); f != module->end(); f++ )
+        _externalize(&*f, &cnt);
+
+    llvm::raw_string_ostream out(_bitcode);
+    llvm::WriteBitcodeToFile(module, out);
+    out.flush();
+
+    std::list<llvm::Function*> funcs;
+
+    for ( auto f = module->begin(); f != module->end(); f++ ) {
+        if ( ! f->isDeclaration() && ! f->isVarArg() )
+            funcs.push_back(&*f);
+    }
+
+    auto& ctx = module->getContext();
+    auto counters_type = llvm::ArrayType::get(llvm::Type::getInt64Ty(ctx), funcs.size());
+    auto table_type = llvm::ArrayType::get(llvm::Type::getInt8PtrTy(ctx), funcs.size());
+
+    auto counters = new llvm::GlobalVariable(*module, counters_type, false, llvm::GlobalValue::ExternalLinkage,
+                                             llvm::ConstantAggregateZero::get(counters_type), "__hlt_jit_counters");
+
+    auto table = new llvm::GlobalVariable(*module, table_type, false, llvm::GlobalValue::ExternalLinkage,
+                                          llvm::ConstantAggregateZero::get(table_type), "__hlt_jit_table");
+
+    // Prepend each function with a prologue that counts the entry and then
+    // checks whether there's a replacement to forward to.
+    for ( auto f : funcs ) {
+        auto idx = _functions.size();
+        _functions.push_back(f->getName().str());
+
+        auto entry = &f->getEntryBlock();
+        auto check = llvm::BasicBlock::Create(ctx, "tier-check", f, entry);
+        auto forward = llvm::BasicBlock::Create(ctx, "tier-forward", f, entry);
+
+        llvm::IRBuilder<> builder(check);
+
+        auto counter = builder.CreateConstInBoundsGEP2_64(counters, 0, idx);
+        builder.CreateStore(builder.CreateAdd(builder.CreateLoad(counter), builder.getInt64(1)), counter);
+
+        auto target = builder.CreateLoad(builder.CreateConstInBoundsGEP2_64(table, 0, idx), true);
+        builder.CreateCondBr(builder.CreateIsNull(target), entry, forward);
+
+        builder.SetInsertPoint(forward);
+
+        std::vector<llvm::Value*> args;
+
+        for ( auto a = f->arg_begin(); a != f->arg_end(); a++ )
+            args.push_back(&*a);
+
+        auto call = builder.CreateCall(builder.CreateBitCast(target, f->getType()), args);
+        call->setCallingConv(f->getCallingConv());
+        call->setAttributes(f->getAttributes());
+        call->setTailCall();
+
+        if ( f->getReturnType()->isVoidTy() )
+            builder.CreateRetVoid();
+        else
+            builder.CreateRet(call);
+    }
+
+    _attempted.resize(_functions.size());
+}
+
+bool TieredCompiler::start(llvm::ExecutionEngine* ee, llvm::Module* module, double tier0_time)
+{
+    for ( auto g = module->global_begin(); g != module->global_end(); g++ ) {
+        if ( ! g->isDeclaration() && ! g->hasAppendingLinkage() && ! g->hasAvailableExternallyLinkage() )
+            _symbols[g->getName().str()] = _globalAddress(ee, &*g);
+    }
+
+    for ( auto f = module->begin(); f != module->end(); f++ ) {
+        if ( ! f->isDeclaration() && ! f->hasAvailableExternallyLinkage() )
+            _symbols[f->getName().str()] = _globalAddress(ee, &*f);
+    }
+
+    _counters = (uint64_t*)_symbols["__hlt_jit_counters"];
+    _table = (void**)_symbols["__hlt_jit_table"];
+
+    if ( ! (_counters && _table) )
+        return false;
+
+    _time[0] = tier0_time;
+
+    if ( _ctx->options().cgDebugging("jit") )
+        std::cerr << ::util::fmt("jit: tier 0 compiled %d function(s) in %.2fs", _functions.size(), tier0_time) << std::endl;
+
+    _thread = std::thread(&TieredCompiler::run, this);
+    return true;
+}
+
+void TieredCompiler::run()
+{
+    auto threshold = _ctx->options().jit_tier_threshold;
+    auto interval = std::chrono::milliseconds(_ctx->options().jit_tier_interval);
+
+    std::unique_lock<std::mutex> lock(_lock);
+
+    while ( ! _stop ) {
+        _wakeup.wait_for(lock, interval);
+
+        if ( _stop )
+            break;
+
+        // The counters aren't synchronized, but approximate is fine here.
+        std::vector<int> hot;
+
+        for ( unsigned int i = 0; i < _functions.size(); i++ ) {
+            if ( ! _attempted[i] && _counters[i] >= threshold ) {
+                _attempted[i] = true;
+                hot.push_back(i);
+            }
+        }
+
+        if ( hot.empty() )
+            continue;
+
+        std::sort(hot.begin(), hot.end(), [&] (int a, int b) { return _counters[a] > _counters[b]; });
+
+        lock.unlock();
+        tierUp(hot);
+        lock.lock();
+    }
+}
+
+void TieredCompiler::tierUp(std::vector<int> hot)
+{
+    auto t = ::util::currentTime();
+
+    // Each batch gets a private copy of the module, inside a context of
+    // its own so that we don't interfere with the main thread. Like the
+    // engine, these are never deleted.
+    auto context = new llvm::LLVMContext();
+    auto buffer = llvm::MemoryBuffer::getMemBuffer(_bitcode, "", false);
+
+#ifdef HAVE_LLVM_35
+    auto parsed = llvm::parseBitcodeFile(buffer, *context);
+    llvm::Module* module = parsed ? parsed.get() : nullptr;
+#else
+    string err;
+    llvm::Module* module = llvm::ParseBitcodeFile(buffer, *context, &err);
+#endif
+
+    delete buffer;
+
+    if ( ! module ) {
+        fprintf(stderr, "HILTI jit warning: cannot parse module for tier 1 compilation\n");
+        return;
+    }
+
+    // Keep the hot functions under a new name, with declarations of the
+    // original ones taking their place so that everything else keeps
+    // referring to tier 0 (which forwards to tier 1 once we are done).
+    // Drop the bodies of all other functions.
+    std::set<string> names;
+
+    for ( auto i : hot )
+        names.insert(_functions[i]);
+
+    std::map<llvm::Value*, llvm::Function*> renamed;
+    std::list<llvm::Function*> funcs;
+
+    for ( auto f = module->begin(); f != module->end(); f++ )
+        funcs.push_back(&*f);
+
+    for ( auto f : funcs ) {
+        if ( f->isDeclaration() )
+            continue;
+
+        auto name = f->getName().str();
+
+        if ( names.find(name) == names.end() ) {
+            f->deleteBody();
+            continue;
+        }
+
+        f->setName(name + ".tier1");
+
+        auto decl = llvm::Function::Create(f->getFunctionType(), llvm::GlobalValue::ExternalLinkage, name, module);
+        decl->setCallingConv(f->getCallingConv());
+        decl->setAttributes(f->getAttributes());
+        f->replaceAllUsesWith(decl);
+
+        renamed[decl] = f;
+    }
+
+    // Direct calls between hot functions can stay inside tier 1.
+    for ( auto f = module->begin(); f != module->end(); f++ ) {
+        for ( auto b = f->begin(); b != f->end(); b++ ) {
+            for ( auto i = b->begin(); i != b->end(); i++ ) {
+                auto call = llvm::dyn_cast<llvm::CallInst>(&*i);
+
+                if ( ! call )
+                    continue;
+
+                auto r = renamed.find(call->getCalledValue());
+
+                if ( r != renamed.end() )
+                    call->setCalledFunction(r->second);
+            }
+        }
+    }
+
+    // Globals all stay with tier 0.
+    std::list<llvm::GlobalVariable*> globals;
+
+    for ( auto g = module->global_begin(); g != module->global_end(); g++ )
+        globals.push_back(&*g);
+
+    for ( auto g : globals ) {
+        if ( g->hasAppendingLinkage() ) {
+            // Constructors and such, which tier 0 has already taken care of.
+            g->eraseFromParent();
+            continue;
+        }
+
+        if ( g->isDeclaration() )
+            continue;
+
+        g->setInitializer(nullptr);
+        g->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+
+    codegen::Optimizer optimizer(_ctx);
+
+    if ( ! optimizer.optimize(module, true) ) {
+        fprintf(stderr, "HILTI jit warning: optimizing for tier 1 failed\n");
+        return;
+    }
+
+    auto mm = new MemoryManager(llvm::JITMemoryManager::CreateDefaultMemManager());
+    mm->installSymbolMap(&_symbols);
+
+    string errormsg;
+    auto ee = _createEngine(module, mm, llvm::CodeGenOpt::Aggressive, _tail_calls, &errormsg);
+
+    if ( ! ee ) {
+        fprintf(stderr, "HILTI jit warning: tier 1 compilation failed, %s\n", errormsg.c_str());
+        return;
+    }
+
+    ee->DisableLazyCompilation(true);
+
+    std::list<string> installed;
+
+    for ( auto i : hot ) {
+        auto func = module->getFunction(_functions[i] + ".tier1");
+
+        if ( ! func )
+            continue;
+
+        auto addr = _globalAddress(ee, func);
+
+        if ( ! addr )
+            continue;
+
+        __atomic_store_n(&_table[i], addr, __ATOMIC_RELEASE);
+        installed.push_back(::util::fmt("%s (%lu)", _functions[i], _counters[i]));
+    }
+
+    t = ::util::currentTime() - t;
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    _time[1] += t;
+    _tier_ups += installed.size();
+
+    if ( _ctx->options().cgDebugging("jit") )
+        std::cerr << ::util::fmt("jit: tier 1 compiled %d hot function(s) in %.2fs: %s",
+                                 installed.size(), t, ::util::strjoin(installed, ", ")) << std::endl;
+}
+
 JIT::JIT(CompilerContext* ctx)
 {
     LLVMLinkInMCJIT();
@@ -253,10 +702,12 @@ JIT::JIT(CompilerContext* ctx)
     _ctx = ctx;
     _mm = new MemoryManager(llvm::JITMemoryManager::CreateDefaultMemManager());
     _cache = new ObjectCache(ctx);
+    _tiered = nullptr;
 }
 
 JIT::~JIT()
 {
+    delete _tiered;
 }
 
 llvm::ExecutionEngine* JIT::jitModule(llvm::Module* module)
@@ -268,40 +719,29 @@ llvm::ExecutionEngine* JIT::jitModule(llvm::Module* module)
 #endif
 
     auto opt = _ctx->options().optimize;
-    auto opt_level = opt ? llvm::CodeGenOpt::Default : llvm::CodeGenOpt::None;
+    auto tiered = _ctx->options().jit_tiered && ! _tiered;
 
-    string errormsg;
-
-    llvm::EngineBuilder builder(module);
-    builder.setEngineKind(llvm::EngineKind::JIT);
-    builder.setUseMCJIT(true);
 #ifdef HAVE_LLVM_33
-    builder.setJITMemoryManager(_mm);
-#else
-    builder.setMCJITMemoryManager(_mm);
+    if ( tiered ) {
+        warning("tiered JIT compilation requires LLVM 3.4 or newer, compiling in a single tier");
+        tiered = false;
+    }
 #endif
-    builder.setErrorStr(&errormsg);
-    builder.setOptLevel(opt_level);
-    builder.setAllocateGVsWithCode(false);
-    builder.setCodeModel(llvm::CodeModel::JITDefault);
-    builder.setRelocationModel(llvm::Reloc::Default);
-    builder.setMArch("");
-    builder.setMCPU(llvm::sys::getHostCPUName());
 
-    llvm::TargetOptions Options;
-#ifdef HAVE_LLVM_33
-    Options.JITExceptionHandling = false;
-#endif
-    Options.JITEmitDebugInfo = true;
-    Options.JITEmitDebugInfoToDisk = false;
-    Options.UseSoftFloat = false;
-    Options.FloatABIType = llvm::FloatABI::Default;
-    Options.GuaranteedTailCallOpt = opt;
-    // Options.PrintMachineCode = true;
-    // Options.EnableSegmentedStacks = true; // Leads to "varargs not supported".
-    builder.setTargetOptions(Options);
+    // With tiers, optimization is left to tier 1.
+    auto opt_level = (opt && ! tiered) ? llvm::CodeGenOpt::Default : llvm::CodeGenOpt::None;
+
+    auto t = ::util::currentTime();
+
+    if ( tiered ) {
+        _tiered = new TieredCompiler(_ctx, opt);
+        _tiered->prepare(module);
+    }
+
+    string errormsg;
+
+    auto ee = _createEngine(module, _mm, opt_level, opt, &errormsg);
 
-    auto ee = builder.create();
     if ( ! ee ) {
         error(util::fmt("LLVM jit error: %s", errormsg));
         return nullptr;
@@ -314,6 +754,11 @@ llvm::ExecutionEngine* JIT::jitModule(llvm::Module* module)
     ee->RegisterJITEventListener(llvm::JITEventListener::createOProfileJITEventListener());
     ee->RegisterJITEventListener(new HiltiJITEventListener());
 
+    if ( tiered && ! _tiered->start(ee, module, ::util::currentTime() - t) ) {
+        error("LLVM jit error: cannot set up tiered compilation");
+        return nullptr;
+    }
+
     return ee;
 }
 
@@ -17,6 +17,7 @@ namespace jit {
 
 class MemoryManager;
 class ObjectCache;
+class TieredCompiler;
 
 // Central JIT engine.
 class JIT : public ast::Logger
@@ -27,7 +28,10 @@ public:
     JIT(CompilerContext* ctx);
     ~JIT();
 
-    /// JITs an LLVM module retuned by linkModules().
+    /// JITs an LLVM module retuned by linkModules(). If the context's
+    /// options ask for tiered compilation, the module is compiled without
+    /// optimization first and its hot functions get replaced with optimized
+    /// versions later; that's supported for one module per JIT instance.
     ///
     /// module: The module. The function takes ownership.
     ///
@@ -66,6 +70,7 @@ private:
     CompilerContext* _ctx;
     MemoryManager* _mm;
     ObjectCache* _cache;
+    TieredCompiler* _tiered;
 };
 
 }
@@ -27,12 +27,12 @@ bool Options::cgDebugging(const string& label) const
 
 Options::string_set Options::cgDebugLabels() const
 {
-    return { "codegen", "linker", "parser", "scanner", "scopes", "context", "dump-ast", "print-ast", "visitors", "cache", "time", "liveness" };
+    return { "codegen", "linker", "parser", "scanner", "scopes", "context", "dump-ast", "print-ast", "visitors", "cache", "time", "liveness", "peephole", "refcount", "escape", "regexp", "jit" };
 }
 
 Options::string_set Options::optimizationLabels() const
 {
-    return string_set();
+    return { "peephole", "refcount", "escape", "regexp", "regexp-native" };
 }
 
 void Options::toCacheKey(::util::cache::FileCache::Key* key) const
@@ -41,6 +41,7 @@ void Options::toCacheKey(::util::cache::FileCache::Key* key) const
     key->options += (optimize ? "O" : "o");
     key->options += (profile ? ::util::fmt("P%d", profile) : "p");
     key->options += (verify ? "V" : "v");
+    key->options += (jit_tiered ? "T" : "t");
 
     for ( auto d : libdirs_hlt )
         key->dirs.insert(d);
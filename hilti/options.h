@@ -47,6 +47,23 @@ public:
     /// aborts if it's not set.
     bool jit = false;
 
+    /// If true, jitModule() compiles in tiers: it first JITs the module
+    /// quickly without LLVM-level optimization, and then recompiles
+    /// functions that turn out to be executed frequently with full
+    /// optimization in a background thread, swapping them in once ready.
+    /// This replaces the LLVM-level optimization \a optimize would
+    /// otherwise perform at link time; the HILTI-level passes remain
+    /// unaffected.
+    bool jit_tiered = false;
+
+    /// With \a jit_tiered, the number of entries after which a function
+    /// counts as hot and gets recompiled in tier 1.
+    unsigned int jit_tier_threshold = 1000;
+
+    /// With \a jit_tiered, the interval in milliseconds in which the
+    /// background thread looks for functions that have turned hot.
+    unsigned int jit_tier_interval = 100;
+
     /// List of directories to search for imports and other \c *.hlt library
     /// files. The current directory will always be tried first. By default,
     /// this set is set to the current directory plus the installation-wide
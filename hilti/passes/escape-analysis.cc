@@ -0,0 +1,300 @@
+
+#include "hilti/hilti-intern.h"
+#include "hilti/options.h"
+#include "hilti/autogen/instructions.h"
+
+#include "escape-analysis.h"
+
+using namespace hilti::passes;
+
+EscapeAnalysis::EscapeAnalysis(CompilerContext* context)
+    : Pass<>("hilti::EscapeAnalysis")
+{
+    _context = context;
+}
+
+EscapeAnalysis::~EscapeAnalysis()
+{
+}
+
+bool EscapeAnalysis::run(shared_ptr<Node> module)
+{
+    const auto& options = _context->options();
+
+    if ( ! (options.optimize && options.optimizing("escape")) )
+        return true;
+
+    return processAllPreOrder(module);
+}
+
+// Returns true if an expression references a local.
+static bool _mentions(shared_ptr<hilti::Expression> expr, shared_ptr<hilti::variable::Local> local)
+{
+    if ( ! expr )
+        return false;
+
+    if ( auto v = ast::tryCast<hilti::expression::Variable>(expr) )
+        return v->variable() == local;
+
+    if ( auto c = ast::tryCast<hilti::expression::Coerced>(expr) )
+        return _mentions(c->expression(), local);
+
+    if ( ast::isA<hilti::expression::Function>(expr) )
+        // Don't descend into function bodies.
+        return false;
+
+    for ( auto n : expr->childs(true) ) {
+        auto v = ast::tryCast<hilti::expression::Variable>(n);
+
+        if ( v && v->variable() == local )
+            return true;
+    }
+
+    return false;
+}
+
+// Returns true for calls to library functions that only look at their
+// arguments.
+static bool _nonRetainingCall(shared_ptr<hilti::statement::instruction::Resolved> ins)
+{
+    if ( ! ast::isA<hilti::statement::instruction::flow::CallVoid>(ins) )
+        return false;
+
+    auto fexpr = ast::tryCast<hilti::expression::Function>(ins->op1());
+
+    if ( ! fexpr )
+        return false;
+
+    auto func = fexpr->function();
+    auto ftype = func->type();
+
+    if ( ftype->callingConvention() != hilti::type::function::HILTI_C )
+        return false;
+
+    return func->module() && func->module()->id()->name() == "Hilti" && func->id()->local() == "print";
+}
+
+// Returns true if a struct type is one the code generator can build in
+// place on the stack.
+static bool _hoistableStruct(shared_ptr<hilti::type::Struct> stype)
+{
+    if ( stype->wildcard() || stype->fields().empty() )
+        return false;
+
+    // A custom destructor may not expect the object to live on the stack.
+    return ! stype->attributes().has(hilti::attribute::LIBHILTI_DTOR);
+}
+
+// Returns the struct type a reference refers to, or null if it's something
+// else.
+static shared_ptr<hilti::type::Struct> _structType(shared_ptr<hilti::Type> type)
+{
+    auto rtype = ast::tryCast<hilti::type::Reference>(type);
+    return rtype ? ast::tryCast<hilti::type::Struct>(rtype->argType()) : nullptr;
+}
+
+// Returns true if an instruction creates a fresh object in its target that
+// the code generator can build in place.
+static bool _createsFresh(shared_ptr<hilti::statement::instruction::Resolved> ins)
+{
+    using namespace hilti::statement::instruction;
+
+    if ( ast::isA<bytes::New>(ins) ||
+         ast::isA<bytes::Concat>(ins) ||
+         ast::isA<bytes::Copy>(ins) ||
+         ast::isA<bytes::Sub>(ins) ||
+         ast::isA<bytes::Lower>(ins) ||
+         ast::isA<bytes::Upper>(ins) ||
+         ast::isA<bytes::Strip>(ins) ||
+         ast::isA<bytes::Join>(ins) )
+        return true;
+
+    if ( ast::isA<struct_::New>(ins) ) {
+        auto stype = _structType(ins->target()->type());
+        return stype && _hoistableStruct(stype);
+    }
+
+    if ( ast::isA<operator_::Assign>(ins) ) {
+        auto c = ast::tryCast<hilti::expression::Ctor>(ins->op1());
+        return c && ast::isA<hilti::ctor::Bytes>(c->ctor());
+    }
+
+    return false;
+}
+
+bool EscapeAnalysis::candidate(shared_ptr<variable::Local> local) const
+{
+    if ( local->attributes().has(attribute::HOIST) )
+        return false;
+
+    auto rtype = ast::tryCast<type::Reference>(local->type());
+
+    if ( ! rtype )
+        return false;
+
+    auto init = local->init();
+
+    if ( ast::isA<type::Bytes>(rtype->argType()) ) {
+        if ( ! init )
+            // Must be assigned before use, see assignedFirst().
+            return true;
+
+        auto c = ast::tryCast<expression::Ctor>(init);
+        return c && ast::isA<ctor::Bytes>(c->ctor());
+    }
+
+    if ( auto stype = ast::tryCast<type::Struct>(rtype->argType()) )
+        return ! init && _hoistableStruct(stype);
+
+    return false;
+}
+
+bool EscapeAnalysis::assignedFirst(shared_ptr<statement::Block> entry, shared_ptr<variable::Local> local) const
+{
+    // Every path starts with the entry block, so it's enough to check
+    // that the local's first mention there creates a fresh object. A
+    // hoisted local is zero-initialized and would otherwise turn a
+    // NullReference into a silently empty object.
+    for ( auto stmt : entry->statements() ) {
+        auto ins = ast::tryCast<statement::instruction::Resolved>(stmt);
+
+        if ( ! ins ) {
+            for ( auto n : stmt->childs(true) ) {
+                auto v = ast::tryCast<expression::Variable>(n);
+
+                if ( v && v->variable() == local )
+                    return false;
+            }
+
+            continue;
+        }
+
+        bool defines = _mentions(ins->target(), local);
+        bool reads = _mentions(ins->op1(), local) || _mentions(ins->op2(), local) || _mentions(ins->op3(), local);
+
+        if ( reads )
+            return false;
+
+        if ( defines )
+            return _createsFresh(ins);
+    }
+
+    return false;
+}
+
+bool EscapeAnalysis::escapes(shared_ptr<statement::instruction::Resolved> ins, shared_ptr<variable::Local> local) const
+{
+    bool defines = _mentions(ins->target(), local);
+    bool reads = _mentions(ins->op1(), local) || _mentions(ins->op2(), local) || _mentions(ins->op3(), local);
+
+    if ( defines )
+        // Hoisted targets get initialized before the operands are read,
+        // so they can't be the source as well.
+        return reads || ! _createsFresh(ins);
+
+    if ( ! reads )
+        return false;
+
+    // These only read the object and don't keep a reference to it.
+    if ( ast::isA<statement::instruction::bytes::Cmp>(ins) ||
+         ast::isA<statement::instruction::bytes::Equal>(ins) ||
+         ast::isA<statement::instruction::bytes::Contains>(ins) ||
+         ast::isA<statement::instruction::bytes::Empty>(ins) ||
+         ast::isA<statement::instruction::bytes::Length>(ins) ||
+         ast::isA<statement::instruction::bytes::StartsWith>(ins) ||
+         ast::isA<statement::instruction::bytes::IsFrozenBytes>(ins) ||
+         ast::isA<statement::instruction::bytes::ToIntFromAscii>(ins) ||
+         ast::isA<statement::instruction::bytes::ToIntFromBinary>(ins) ||
+         ast::isA<statement::instruction::bytes::ToUIntFromBinary>(ins) ||
+         ast::isA<statement::instruction::bytes::Concat>(ins) ||
+         ast::isA<statement::instruction::bytes::Copy>(ins) ||
+         ast::isA<statement::instruction::bytes::Lower>(ins) ||
+         ast::isA<statement::instruction::bytes::Upper>(ins) ||
+         ast::isA<statement::instruction::bytes::Strip>(ins) ||
+         ast::isA<statement::instruction::struct_::Get>(ins) ||
+         ast::isA<statement::instruction::struct_::GetDefault>(ins) ||
+         ast::isA<statement::instruction::struct_::IsSet>(ins) ||
+         ast::isA<statement::instruction::struct_::Unset>(ins) )
+        return false;
+
+    // The struct itself is fine, but not the value stored into it.
+    if ( ast::isA<statement::instruction::struct_::Set>(ins) )
+        return _mentions(ins->op3(), local);
+
+    // The separator is fine, but not a list element.
+    if ( ast::isA<statement::instruction::bytes::Join>(ins) )
+        return _mentions(ins->op2(), local);
+
+    if ( _nonRetainingCall(ins) )
+        return _mentions(ins->op1(), local);
+
+    return true;
+}
+
+void EscapeAnalysis::visit(declaration::Function* f)
+{
+    auto body = ast::tryCast<statement::Block>(f->function()->body());
+
+    if ( ! body )
+        return;
+
+    std::list<shared_ptr<variable::Local>> candidates;
+
+    for ( auto d : body->declarations() ) {
+        auto var = ast::tryCast<declaration::Variable>(d);
+
+        if ( ! var )
+            continue;
+
+        auto local = ast::tryCast<variable::Local>(var->variable());
+
+        if ( local && candidate(local) )
+            candidates.push_back(local);
+    }
+
+    if ( candidates.empty() )
+        return;
+
+    shared_ptr<statement::Block> entry = nullptr;
+
+    for ( auto s : body->statements() ) {
+        if ( (entry = ast::tryCast<statement::Block>(s)) )
+            break;
+    }
+
+    if ( ! entry )
+        return;
+
+    candidates.remove_if([&] (shared_ptr<variable::Local> l) { return ! l->init() && ! this->assignedFirst(entry, l); });
+
+    for ( auto s : body->statements() ) {
+        auto block = ast::tryCast<statement::Block>(s);
+
+        if ( ! block )
+            continue;
+
+        for ( auto stmt : block->statements() ) {
+            auto ins = ast::tryCast<statement::instruction::Resolved>(stmt);
+
+            if ( ins ) {
+                candidates.remove_if([&] (shared_ptr<variable::Local> l) { return this->escapes(ins, l); });
+                continue;
+            }
+
+            // Something else, like a try statement. Give up on all locals
+            // it references anywhere.
+            for ( auto n : stmt->childs(true) ) {
+                auto v = ast::tryCast<expression::Variable>(n);
+
+                if ( v )
+                    candidates.remove_if([&] (shared_ptr<variable::Local> l) { return v->variable() == l; });
+            }
+        }
+    }
+
+    for ( auto l : candidates )
+        l->attributes().add(Attribute(attribute::HOIST));
+
+    if ( _context->options().cgDebugging("escape") && candidates.size() )
+        std::cerr << util::fmt("escape: function %s: %d locals moved to the stack", f->id()->name(), (int)candidates.size()) << std::endl;
+}
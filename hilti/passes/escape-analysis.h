@@ -0,0 +1,66 @@
+
+#ifndef HILTI_PASSES_ESCAPE_ANALYSIS_H
+#define HILTI_PASSES_ESCAPE_ANALYSIS_H
+
+#include "../pass.h"
+
+namespace hilti {
+
+class CompilerContext;
+
+namespace passes {
+
+/// Moves short-lived heap objects onto the stack. The pass looks for local
+/// variables of reference type whose objects never escape the function: all
+/// instructions assigning to them must create a fresh object, and all other
+/// uses must only read the object without keeping a reference to it. A local
+/// without a constant initializer must also be assigned such a fresh object
+/// before anything else uses it. Such locals receive the \c &hoist
+/// attribute, which makes the code generator allocate the object itself on
+/// the stack and skip reference counting for it.
+///
+/// Currently, \c ref<bytes> and \c ref<struct> locals are considered, as
+/// these are the objects the code generator knows how to hoist. Tuples are
+/// value types already. Spicy units are structs, but parse functions pass
+/// them on to other functions, which counts as escaping.
+///
+/// The pass only runs if the CompilerContext's options have optimization
+/// enabled, and the \c escape label is included in the optimization set.
+/// With code generation debug label \c escape, the pass reports the number
+/// of locals it has moved for each function.
+class EscapeAnalysis : public Pass<>
+{
+public:
+   /// Constructor.
+   ///
+   /// context: The context the module is compiled with.
+   EscapeAnalysis(CompilerContext* context);
+   virtual ~EscapeAnalysis();
+
+   /// Hoists all non-escaping locals of the module's functions.
+   ///
+   /// Returns: True if no error occured.
+   bool run(shared_ptr<hilti::Node> module) override;
+
+protected:
+   void visit(declaration::Function* f) override;
+
+private:
+   // Returns true if a local may be hoisted as far as its declaration is
+   // concerned.
+   bool candidate(shared_ptr<variable::Local> local) const;
+
+   // Returns true if the entry block assigns a fresh object to a local
+   // before anything else uses it.
+   bool assignedFirst(shared_ptr<statement::Block> entry, shared_ptr<variable::Local> local) const;
+
+   // Returns true if an instruction prevents hoisting a local.
+   bool escapes(shared_ptr<statement::instruction::Resolved> ins, shared_ptr<variable::Local> local) const;
+
+   CompilerContext* _context;
+};
+
+}
+}
+
+#endif
@@ -1,20 +1,607 @@
 
 #include "../statement.h"
 #include "../module.h"
+#include "../context.h"
+#include "../options.h"
 #include "../builder/nodes.h"
 
 #include "optimize-peephole.h"
+#include "cfg.h"
+#include "liveness.h"
+#include "instruction-resolver.h"
 #include "printer.h"
 #include "hilti/autogen/instructions.h"
 
 using namespace hilti;
 using namespace passes;
 
-OptimizePeepHole::OptimizePeepHole() : Pass<>("hilti::OptimizePeepHole", true)
+// Upper bound on the number of times we iterate over a module. Each round
+// may enable further rewrites in the next one, but we don't want to spend
+// unbounded time on pathological input.
+static const int MaxRounds = 5;
+
+OptimizePeepHole::OptimizePeepHole(CompilerContext* context) : Pass<>("hilti::OptimizePeepHole", true)
+{
+    _context = context;
+
+    _rules = {
+        { "jump-threading",        &OptimizePeepHole::threadJumps,             0 },
+        { "redundant-assign",      &OptimizePeepHole::removeRedundantAssigns,  0 },
+        { "constant-if-else",      &OptimizePeepHole::foldConstantIfElse,      0 },
+        { "bytes-incr-collapse",   &OptimizePeepHole::collapseBytesIncrs,      0 },
+        { "struct-get-set",        &OptimizePeepHole::removeStructGetSet,      0 },
+    };
+}
+
+OptimizePeepHole::~OptimizePeepHole()
+{
+}
+
+bool OptimizePeepHole::run(shared_ptr<hilti::Node> node)
+{
+    const auto& options = _context->options();
+
+    if ( ! (options.optimize && options.optimizing("peephole")) )
+        return true;
+
+    auto module = ast::checkedCast<Module>(node);
+
+    for ( int round = 0; round < MaxRounds; ++round ) {
+        // Liveness needs to be recomputed each round as the previous one
+        // may have changed the code.
+        auto cfg = std::make_shared<CFG>(_context);
+        _liveness = std::make_shared<Liveness>(_context, cfg);
+
+        if ( ! cfg->run(module) )
+            return false;
+
+        if ( ! _liveness->run(module) )
+            return false;
+
+        _functions.clear();
+
+        if ( ! processAllPreOrder(module) )
+            return false;
+
+        bool changed = false;
+
+        for ( auto f : _functions ) {
+            if ( optimizeFunction(f) )
+                changed = true;
+        }
+
+        if ( ! changed )
+            break;
+
+        // Resolve the instructions we have inserted, which also relinks
+        // the statements inside their blocks.
+        InstructionResolver resolver;
+
+        if ( ! resolver.run(module, true) )
+            return false;
+    }
+
+    _liveness = nullptr;
+    _functions.clear();
+
+    if ( options.cgDebugging("peephole") ) {
+        for ( auto r : _rules )
+            std::cerr << util::fmt("peephole: module %s: %-20s %lu hits", module->id()->name(), r.name, (unsigned long)r.hits) << std::endl;
+    }
+
+    return errors() == 0;
+}
+
+void OptimizePeepHole::visit(declaration::Function* f)
 {
+    if ( f->function()->body() )
+        _functions.push_back(f->sharedPtr<declaration::Function>());
+}
+
+bool OptimizePeepHole::optimizeFunction(shared_ptr<declaration::Function> func)
+{
+    auto body = ast::checkedCast<statement::Block>(func->function()->body());
+
+    // Record all blocks that consist of nothing than a jump.
+    _trampolines.clear();
+
+    for ( auto s : body->statements() ) {
+        auto b = ast::tryCast<statement::Block>(s);
+
+        if ( ! (b && b->id()) )
+            continue;
+
+        shared_ptr<statement::instruction::flow::Jump> jump = nullptr;
+        bool only_jump = true;
+
+        for ( auto bs : b->statements() ) {
+            if ( ast::isA<statement::instruction::Misc::Nop>(bs) )
+                continue;
+
+            auto j = ast::tryCast<statement::instruction::flow::Jump>(bs);
+
+            if ( j && ! jump ) {
+                jump = j;
+                continue;
+            }
+
+            only_jump = false;
+            break;
+        }
+
+        if ( ! (jump && only_jump) )
+            continue;
+
+        auto c = ast::tryCast<expression::Constant>(jump->op1());
+        auto label = c ? ast::tryCast<constant::Label>(c->constant()) : nullptr;
+
+        if ( label && label->value() != b->id()->name() )
+            _trampolines.insert(std::make_pair(b->id()->name(), label->value()));
+    }
+
+    bool changed = false;
+
+    for ( auto s : body->statements() ) {
+        auto b = ast::tryCast<statement::Block>(s);
+
+        if ( ! b )
+            continue;
+
+        stmt_vector stmts;
+
+        for ( auto bs : b->statements() )
+            stmts.push_back(bs);
+
+        bool block_changed = false;
+
+        for ( size_t i = 0; i < stmts.size(); ++i ) {
+            if ( ! stmts[i] )
+                continue;
+
+            for ( auto& r : _rules ) {
+                if ( (this->*r.func)(&stmts, i) ) {
+                    ++r.hits;
+                    block_changed = true;
+                    break;
+                }
+            }
+        }
+
+        if ( ! block_changed )
+            continue;
+
+        statement::Block::stmt_list nstmts;
+
+        for ( auto bs : stmts ) {
+            if ( bs )
+                nstmts.push_back(bs);
+        }
+
+        b->setStatements(nstmts);
+        changed = true;
+    }
+
+    return changed;
+}
+
+size_t OptimizePeepHole::next(stmt_vector* stmts, size_t i) const
+{
+    for ( ++i; i < stmts->size(); ++i ) {
+        if ( (*stmts)[i] )
+            return i;
+    }
+
+    return stmts->size();
+}
+
+bool OptimizePeepHole::deadAfter(shared_ptr<Statement> stmt, shared_ptr<Expression> e) const
+{
+    auto var = ast::tryCast<expression::Variable>(e);
+
+    if ( ! (var && ast::isA<variable::Local>(var->variable())) )
+        return false;
+
+    // Statements we have inserted in this round have no information yet.
+    if ( ! _liveness->have(stmt) )
+        return false;
+
+    return ! _liveness->liveOut(stmt, e);
+}
+
+string OptimizePeepHole::threadLabel(const string& label) const
+{
+    std::set<string> seen;
+    string cur = label;
+
+    while ( true ) {
+        auto i = _trampolines.find(cur);
+
+        if ( i == _trampolines.end() )
+            return cur;
+
+        if ( ! seen.insert(cur).second )
+            // A cycle, leave it alone.
+            return label;
+
+        cur = i->second;
+    }
+}
+
+// Returns the name of a variable or parameter for comparision, or an empty
+// string if the expression is neither.
+static string _variableName(shared_ptr<Expression> e)
+{
+    if ( auto p = ast::tryCast<expression::Parameter>(e) )
+        return Statement::FlowVariable(p).name;
+
+    if ( auto v = ast::tryCast<expression::Variable>(e) )
+        return Statement::FlowVariable(v).name;
+
+    return "";
+}
+
+static bool _sameVariable(shared_ptr<Expression> e1, shared_ptr<Expression> e2)
+{
+    auto n1 = _variableName(e1);
+    return n1.size() && n1 == _variableName(e2);
+}
+
+static string _labelValue(shared_ptr<Expression> e)
+{
+    auto c = ast::tryCast<expression::Constant>(e);
+    auto label = c ? ast::tryCast<constant::Label>(c->constant()) : nullptr;
+    return label ? label->value() : "";
+}
+
+static shared_ptr<Statement> _newInstruction(shared_ptr<Statement> old, shared_ptr<Instruction> ins, const instruction::Operands& ops)
+{
+    return std::make_shared<statement::instruction::Unresolved>(ins, ops, old->location());
+}
+
+bool OptimizePeepHole::threadJumps(stmt_vector* stmts, size_t i)
+{
+    // jump @a ... @a: jump @b  ->  jump @b
+    //
+    // Also turns if.else with identical targets into a jump.
+
+    auto stmt = (*stmts)[i];
+
+    if ( auto jump = ast::tryCast<statement::instruction::flow::Jump>(stmt) ) {
+        auto old = _labelValue(jump->op1());
+
+        if ( old.empty() )
+            return false;
+
+        auto target = threadLabel(old);
+
+        if ( target == old )
+            return false;
+
+        instruction::Operands ops = { nullptr, builder::label::create(target) };
+        (*stmts)[i] = _newInstruction(stmt, instruction::flow::Jump, ops);
+        return true;
+    }
+
+    if ( auto ifelse = ast::tryCast<statement::instruction::flow::IfElse>(stmt) ) {
+        auto old_true = _labelValue(ifelse->op2());
+        auto old_false = _labelValue(ifelse->op3());
+
+        if ( old_true.empty() || old_false.empty() )
+            return false;
+
+        auto target_true = threadLabel(old_true);
+        auto target_false = threadLabel(old_false);
+
+        if ( target_true == target_false ) {
+            instruction::Operands ops = { nullptr, builder::label::create(target_true) };
+            (*stmts)[i] = _newInstruction(stmt, instruction::flow::Jump, ops);
+            return true;
+        }
+
+        if ( target_true == old_true && target_false == old_false )
+            return false;
+
+        instruction::Operands ops = { nullptr, ifelse->op1(),
+                                      builder::label::create(target_true),
+                                      builder::label::create(target_false) };
+
+        (*stmts)[i] = _newInstruction(stmt, instruction::flow::IfElse, ops);
+        return true;
+    }
+
+    return false;
 }
 
-bool OptimizePeepHole::run(shared_ptr<hilti::Node> module)
+bool OptimizePeepHole::removeRedundantAssigns(stmt_vector* stmts, size_t i)
 {
-    return processAllPreOrder(module);
+    auto stmt = (*stmts)[i];
+    auto assign = ast::tryCast<statement::instruction::operator_::Assign>(stmt);
+
+    if ( ! assign )
+        return false;
+
+    // x = assign x  ->  (nothing)
+    //
+    // x = assign y  ->  (nothing), if x isn't used afterwards.
+
+    if ( _sameVariable(assign->target(), assign->op1()) ||
+         (deadAfter(stmt, assign->target()) && ! assign->hoisted()) ) {
+        (*stmts)[i] = nullptr;
+        return true;
+    }
+
+    // t = assign s; u = assign t  ->  u = assign s, if t isn't used
+    // afterwards and no coercion is involved.
+
+    auto j = next(stmts, i);
+
+    if ( j >= stmts->size() )
+        return false;
+
+    auto copy = ast::tryCast<statement::instruction::operator_::Assign>((*stmts)[j]);
+
+    if ( ! copy )
+        return false;
+
+    auto t = assign->target();
+    auto s = assign->op1();
+    auto u = copy->target();
+
+    if ( ! _sameVariable(copy->op1(), t) || _sameVariable(u, t) || ! deadAfter(copy, t) )
+        return false;
+
+    if ( ! (s->type()->equal(t->type()) && u->type()->equal(t->type())) )
+        return false;
+
+    instruction::Operands ops = { u, s };
+    (*stmts)[i] = nullptr;
+    (*stmts)[j] = _newInstruction(copy, instruction::operator_::Assign, ops);
+    return true;
+}
+
+static int64_t _signExtend(int64_t v, int width)
+{
+    if ( width <= 0 || width >= 64 )
+        return v;
+
+    auto shift = 64 - width;
+    return (int64_t)((uint64_t)v << shift) >> shift;
+}
+
+static uint64_t _zeroExtend(int64_t v, int width)
+{
+    if ( width <= 0 || width >= 64 )
+        return (uint64_t)v;
+
+    return (uint64_t)v & ((UINT64_C(1) << width) - 1);
+}
+
+// Evaluates a comparision of two constants. Returns false if the statement
+// isn't one we know how to fold.
+static bool _foldComparision(shared_ptr<statement::instruction::Resolved> cmp, bool* result)
+{
+    auto c1 = ast::tryCast<expression::Constant>(cmp->op1());
+    auto c2 = ast::tryCast<expression::Constant>(cmp->op2());
+
+    if ( ! (c1 && c2) )
+        return false;
+
+    if ( ast::isA<statement::instruction::boolean::Equal>(cmp) ) {
+        auto b1 = ast::tryCast<constant::Bool>(c1->constant());
+        auto b2 = ast::tryCast<constant::Bool>(c2->constant());
+
+        if ( ! (b1 && b2) )
+            return false;
+
+        *result = (b1->value() == b2->value());
+        return true;
+    }
+
+    auto i1 = ast::tryCast<constant::Integer>(c1->constant());
+    auto i2 = ast::tryCast<constant::Integer>(c2->constant());
+
+    if ( ! (i1 && i2) )
+        return false;
+
+    auto w1 = ast::checkedCast<type::Integer>(i1->type())->width();
+    auto w2 = ast::checkedCast<type::Integer>(i2->type())->width();
+
+    auto s1 = _signExtend(i1->value(), w1);
+    auto s2 = _signExtend(i2->value(), w2);
+    auto u1 = _zeroExtend(i1->value(), w1);
+    auto u2 = _zeroExtend(i2->value(), w2);
+
+    if ( ast::isA<statement::instruction::integer::Equal>(cmp) || ast::isA<statement::instruction::integer::Eq>(cmp) )
+        *result = (u1 == u2);
+
+    else if ( ast::isA<statement::instruction::integer::Slt>(cmp) )
+        *result = (s1 < s2);
+
+    else if ( ast::isA<statement::instruction::integer::Sleq>(cmp) )
+        *result = (s1 <= s2);
+
+    else if ( ast::isA<statement::instruction::integer::Sgt>(cmp) )
+        *result = (s1 > s2);
+
+    else if ( ast::isA<statement::instruction::integer::Sgeq>(cmp) )
+        *result = (s1 >= s2);
+
+    else if ( ast::isA<statement::instruction::integer::Ult>(cmp) )
+        *result = (u1 < u2);
+
+    else if ( ast::isA<statement::instruction::integer::Uleq>(cmp) )
+        *result = (u1 <= u2);
+
+    else if ( ast::isA<statement::instruction::integer::Ugt>(cmp) )
+        *result = (u1 > u2);
+
+    else if ( ast::isA<statement::instruction::integer::Ugeq>(cmp) )
+        *result = (u1 >= u2);
+
+    else
+        return false;
+
+    return true;
+}
+
+bool OptimizePeepHole::foldConstantIfElse(stmt_vector* stmts, size_t i)
+{
+    auto stmt = (*stmts)[i];
+
+    // if.else True @a @b  ->  jump @a
+
+    if ( auto ifelse = ast::tryCast<statement::instruction::flow::IfElse>(stmt) ) {
+        auto c = ast::tryCast<expression::Constant>(ifelse->op1());
+        auto b = c ? ast::tryCast<constant::Bool>(c->constant()) : nullptr;
+
+        if ( ! b )
+            return false;
+
+        instruction::Operands ops = { nullptr, b->value() ? ifelse->op2() : ifelse->op3() };
+        (*stmts)[i] = _newInstruction(stmt, instruction::flow::Jump, ops);
+        return true;
+    }
+
+    // c = int.slt 1 2; if.else c @a @b  ->  jump @a
+    //
+    // The comparision is removed as well if c isn't used afterwards.
+
+    auto cmp = ast::tryCast<statement::instruction::Resolved>(stmt);
+
+    if ( ! (cmp && cmp->target()) )
+        return false;
+
+    auto j = next(stmts, i);
+
+    if ( j >= stmts->size() )
+        return false;
+
+    auto ifelse = ast::tryCast<statement::instruction::flow::IfElse>((*stmts)[j]);
+
+    if ( ! (ifelse && _sameVariable(ifelse->op1(), cmp->target())) )
+        return false;
+
+    bool result;
+
+    if ( ! _foldComparision(cmp, &result) )
+        return false;
+
+    instruction::Operands ops = { nullptr, result ? ifelse->op2() : ifelse->op3() };
+    (*stmts)[j] = _newInstruction(ifelse, instruction::flow::Jump, ops);
+
+    if ( deadAfter(ifelse, cmp->target()) )
+        (*stmts)[i] = nullptr;
+
+    return true;
+}
+
+// Returns the constant amount by which a bytes iterator instruction
+// advances, or -1 if it's not one of those.
+static int64_t _bytesIncrAmount(shared_ptr<Statement> stmt)
+{
+    if ( ast::isA<statement::instruction::iterBytes::Incr>(stmt) )
+        return 1;
+
+    auto incr = ast::tryCast<statement::instruction::iterBytes::IncrBy>(stmt);
+
+    if ( ! incr )
+        return -1;
+
+    auto c = ast::tryCast<expression::Constant>(incr->op2());
+    auto i = c ? ast::tryCast<constant::Integer>(c->constant()) : nullptr;
+
+    if ( ! (i && i->value() >= 0) )
+        return -1;
+
+    return i->value();
+}
+
+bool OptimizePeepHole::collapseBytesIncrs(stmt_vector* stmts, size_t i)
+{
+    // t = incr i; u = incr t  ->  u = incr_by i 2, if t is u or isn't used
+    // afterwards.
+    //
+    // Works the same for any combination of incr and incr_by with constant
+    // amounts. Both clamp at the end of the bytes object, so the combined
+    // version moves the iterator to the same position.
+
+    auto n1 = _bytesIncrAmount((*stmts)[i]);
+
+    if ( n1 < 0 )
+        return false;
+
+    auto j = next(stmts, i);
+
+    if ( j >= stmts->size() )
+        return false;
+
+    auto n2 = _bytesIncrAmount((*stmts)[j]);
+
+    if ( n2 < 0 )
+        return false;
+
+    auto first = ast::checkedCast<statement::instruction::Resolved>((*stmts)[i]);
+    auto second = ast::checkedCast<statement::instruction::Resolved>((*stmts)[j]);
+
+    auto t = first->target();
+    auto u = second->target();
+
+    if ( ! _sameVariable(second->op1(), t) )
+        return false;
+
+    if ( ! (_sameVariable(u, t) || deadAfter(second, t)) )
+        return false;
+
+    instruction::Operands ops = { u, first->op1(), builder::integer::create(n1 + n2) };
+    (*stmts)[i] = nullptr;
+    (*stmts)[j] = _newInstruction(second, instruction::iterBytes::IncrBy, ops);
+    return true;
+}
+
+bool OptimizePeepHole::removeStructGetSet(stmt_vector* stmts, size_t i)
+{
+    // v = struct.get s "f"; struct.set s "f" v  ->  v = struct.get s "f"
+
+    auto get = ast::tryCast<statement::instruction::struct_::Get>((*stmts)[i]);
+
+    if ( ! get )
+        return false;
+
+    auto j = next(stmts, i);
+
+    if ( j >= stmts->size() )
+        return false;
+
+    auto set = ast::tryCast<statement::instruction::struct_::Set>((*stmts)[j]);
+
+    if ( ! set )
+        return false;
+
+    auto v = get->target();
+
+    if ( ! (_sameVariable(get->op1(), set->op1()) && _sameVariable(v, set->op3())) )
+        return false;
+
+    if ( _sameVariable(v, get->op1()) )
+        return false;
+
+    auto f1 = ast::tryCast<expression::Constant>(get->op2());
+    auto f2 = ast::tryCast<expression::Constant>(set->op2());
+    auto s1 = f1 ? ast::tryCast<constant::String>(f1->constant()) : nullptr;
+    auto s2 = f2 ? ast::tryCast<constant::String>(f2->constant()) : nullptr;
+
+    if ( ! (s1 && s2 && s1->value() == s2->value()) )
+        return false;
+
+    // For a field with a default, the get succeeds even if the field is
+    // unset, and the set then changes its state.
+    auto rtype = ast::tryCast<type::Reference>(get->op1()->type());
+    auto stype = rtype ? ast::tryCast<type::Struct>(rtype->argType()) : nullptr;
+    auto field = stype ? stype->lookup(s1->value()) : nullptr;
+
+    if ( ! field || field->default_() )
+        return false;
+
+    (*stmts)[j] = nullptr;
+    return true;
 }
@@ -2,22 +2,88 @@
 #ifndef HILTI_PASSES_OPTIMIZE_PEEPHOLE_H
 #define HILTI_PASSES_OPTIMIZE_PEEPHOLE_H
 
+#include <map>
+#include <vector>
+
 #include "../pass.h"
 
 namespace hilti {
+
+class CompilerContext;
+
 namespace passes {
 
+class Liveness;
+
 /// Bundles a set of small peep-hole optimizations that act locally on
-/// individual instructions without needing further global context.
+/// individual instructions, or short sequences of them. Each optimization
+/// is a rule that inspects a window of statements inside a flattened block
+/// and rewrites them if it matches. Rules may consult liveness information
+/// to decide if a variable's value is still needed.
+///
+/// The rules only run if the CompilerContext's options have optimization
+/// enabled, and the \c peephole label is included in the optimization set.
+/// With code generation debug label \c peephole, the pass reports how often
+/// each rule has fired.
 class OptimizePeepHole : public Pass<>
 {
 public:
-   OptimizePeepHole();
+   /// Constructor.
+   ///
+   /// context: The context the module is compiled with.
+   OptimizePeepHole(CompilerContext* context);
+   virtual ~OptimizePeepHole();
 
-   bool run(shared_ptr<hilti::Node> module);
+   /// Applies the rules to all functions of a module until no further
+   /// rewrites happen.
+   ///
+   /// Returns: True if no error occured.
+   bool run(shared_ptr<hilti::Node> module) override;
 
 protected:
+   void visit(declaration::Function* f) override;
+
+private:
+   typedef std::vector<shared_ptr<Statement>> stmt_vector;
+   typedef bool (OptimizePeepHole::*rule_func)(stmt_vector* stmts, size_t i);
+
+   struct Rule {
+       const char* name;  // Name reported in the debug output.
+       rule_func func;    // Method implementing the rule.
+       uint64_t hits;     // Number of times the rule has fired.
+   };
+
+   // Runs all rules over one function's blocks. Returns true if anything
+   // was rewritten.
+   bool optimizeFunction(shared_ptr<declaration::Function> func);
+
+   // The rules. Each gets the statements of the current block and the
+   // index of the one to look at. If a rule matches, it rewrites the
+   // vector in place (setting entries to null to remove them) and returns
+   // true.
+   bool threadJumps(stmt_vector* stmts, size_t i);
+   bool removeRedundantAssigns(stmt_vector* stmts, size_t i);
+   bool foldConstantIfElse(stmt_vector* stmts, size_t i);
+   bool collapseBytesIncrs(stmt_vector* stmts, size_t i);
+   bool removeStructGetSet(stmt_vector* stmts, size_t i);
+
+   // Returns the index of the next non-removed statement after i, or
+   // stmts->size() if none.
+   size_t next(stmt_vector* stmts, size_t i) const;
+
+   // Returns true if liveness information shows that a local's value is
+   // no longer needed after a statement. Returns false if not known.
+   bool deadAfter(shared_ptr<Statement> stmt, shared_ptr<Expression> e) const;
+
+   // Follows a chain of blocks that do nothing but jump elsewhere, and
+   // returns the final target label.
+   string threadLabel(const string& label) const;
 
+   CompilerContext* _context;
+   shared_ptr<Liveness> _liveness = nullptr;
+   std::vector<Rule> _rules;
+   std::list<shared_ptr<declaration::Function>> _functions;
+   std::map<string, string> _trampolines; // Block label to the label it jumps to.
 };
 
 }
@@ -14,7 +14,9 @@
 #include "block-flattener.h"
 #include "cfg.h"
 #include "liveness.h"
+#include "refcount-elision.h"
 #include "optimize-ctors.h"
 #include "optimize-peephole.h"
+#include "escape-analysis.h"
 
 #endif
@@ -0,0 +1,178 @@
+
+#include "hilti/hilti-intern.h"
+#include "hilti/options.h"
+#include "hilti/autogen/instructions.h"
+
+#include "refcount-elision.h"
+
+using namespace hilti::passes;
+
+RefCountElision::RefCountElision(CompilerContext* context, shared_ptr<CFG> cfg, shared_ptr<Liveness> liveness)
+    : Pass<>("hilti::RefCountElision")
+{
+    _context = context;
+    _cfg = cfg;
+    _liveness = liveness;
+}
+
+RefCountElision::~RefCountElision()
+{
+}
+
+bool RefCountElision::run(shared_ptr<Node> module)
+{
+    _carried.clear();
+
+    const auto& options = _context->options();
+
+    if ( ! (options.optimize && options.optimizing("refcount")) )
+        return true;
+
+    return processAllPreOrder(module);
+}
+
+RefCountElision::variable_set RefCountElision::carried(shared_ptr<Statement> stmt) const
+{
+    auto i = _carried.find(stmt);
+    return i != _carried.end() ? i->second.values : variable_set();
+}
+
+bool RefCountElision::carriedTo(shared_ptr<Statement> from, shared_ptr<Statement> stmt) const
+{
+    auto i = _carried.find(from);
+
+    if ( i == _carried.end() )
+        return false;
+
+    return i->second.path.find(stmt) != i->second.path.end();
+}
+
+shared_ptr<Statement> RefCountElision::straightSuccessor(shared_ptr<Statement> stmt) const
+{
+    auto succ = stmt->successor();
+
+    if ( ! succ )
+        return nullptr;
+
+    auto succs = _cfg->successors(stmt);
+
+    if ( succs.size() != 1 || *succs.begin() != succ )
+        return nullptr;
+
+    auto preds = _cfg->predecessors(succ);
+
+    if ( preds.size() != 1 || *preds.begin() != stmt )
+        return nullptr;
+
+    return succ;
+}
+
+bool RefCountElision::safepointCall(shared_ptr<Statement> stmt) const
+{
+    shared_ptr<type::Function> ftype = nullptr;
+
+    if ( ast::isA<statement::instruction::flow::CallResult>(stmt) ||
+         ast::isA<statement::instruction::flow::CallVoid>(stmt) ) {
+        auto call = ast::checkedCast<statement::instruction::Resolved>(stmt);
+        ftype = ast::tryCast<type::Function>(call->op1()->type());
+    }
+
+    else if ( ast::isA<statement::instruction::flow::CallCallableResult>(stmt) ||
+              ast::isA<statement::instruction::flow::CallCallableVoid>(stmt) ) {
+        auto call = ast::checkedCast<statement::instruction::Resolved>(stmt);
+        auto rt = ast::tryCast<type::Reference>(call->op1()->type());
+        ftype = rt ? ast::tryCast<type::Callable>(rt->argType()) : nullptr;
+    }
+
+    else if ( ast::isA<statement::instruction::hook::Run>(stmt) ) {
+        auto call = ast::checkedCast<statement::instruction::Resolved>(stmt);
+        ftype = ast::tryCast<type::Hook>(call->op1()->type());
+    }
+
+    return ftype && ftype->mayTriggerSafepoint();
+}
+
+RefCountElision::variable_set RefCountElision::protectedValues(shared_ptr<Statement> stmt) const
+{
+    // This must match what CodeGen::liveValues() selects.
+    auto ln = _liveness->liveness(stmt);
+
+    variable_set values;
+
+    for ( auto l : *ln.in ) {
+        if ( ln.dead->find(l) != ln.dead->end() )
+            continue;
+
+        if ( l->expression->hoisted() )
+            continue;
+
+        values.insert(l);
+    }
+
+    return values;
+}
+
+void RefCountElision::visit(declaration::Function* f)
+{
+    auto body = ast::tryCast<statement::Block>(f->function()->body());
+
+    if ( ! body )
+        return;
+
+    int elided = 0;
+
+    for ( auto s : body->statements() ) {
+        auto block = ast::tryCast<statement::Block>(s);
+
+        if ( ! block )
+            continue;
+
+        for ( auto stmt : block->statements() ) {
+            if ( ! safepointCall(stmt) )
+                continue;
+
+            // Follow the straight-line path to the next safepoint call,
+            // collecting everything changed on the way. The code
+            // generator adapts the stack only after a call's arguments
+            // have been evaluated but before its result is stored, so the
+            // first call's own changes count, the second's don't.
+            auto fi = stmt->flowInfo();
+            auto changed = util::set_union(util::set_union(fi.defined, fi.cleared), fi.modified);
+
+            Carry carry;
+            shared_ptr<Statement> next = nullptr;
+
+            for ( auto cur = straightSuccessor(stmt); cur; cur = straightSuccessor(cur) ) {
+                carry.path.insert(cur);
+
+                if ( safepointCall(cur) ) {
+                    next = cur;
+                    break;
+                }
+
+                auto cfi = cur->flowInfo();
+                changed = util::set_union(changed, util::set_union(util::set_union(cfi.defined, cfi.cleared), cfi.modified));
+            }
+
+            if ( ! next )
+                continue;
+
+            auto both = util::set_intersection(protectedValues(stmt), protectedValues(next));
+            carry.values = util::set_difference(both, changed);
+
+            if ( carry.values.empty() )
+                continue;
+
+            for ( auto v : carry.values ) {
+                if ( ! type::hasTrait<type::trait::Atomic>(v->expression->type()) )
+                    // One dtor and one cctor each.
+                    elided += 2;
+            }
+
+            _carried[stmt] = carry;
+        }
+    }
+
+    if ( _context->options().cgDebugging("refcount") && elided )
+        std::cerr << util::fmt("refcount: function %s: %d ref/unref operations elided", f->id()->name(), elided) << std::endl;
+}
@@ -0,0 +1,98 @@
+
+#ifndef HILTI_PASSES_REFCOUNT_ELISION_H
+#define HILTI_PASSES_REFCOUNT_ELISION_H
+
+#include <set>
+#include <unordered_map>
+
+#include "../pass.h"
+
+namespace hilti {
+
+class CompilerContext;
+
+namespace passes {
+
+class CFG;
+class Liveness;
+
+/// Finds reference count updates that the code generator can skip.
+///
+/// Around each call that may reach a safepoint, the code generator
+/// increments the reference counts of all live locals and parameters before
+/// the call, and decrements them again afterwards. Starting at each such
+/// call, the pass follows the control flow graph along the path on which
+/// every statement has exactly one successor and that successor exactly
+/// one predecessor. If that path reaches another safepoint call, the
+/// decrements after the first call and the increments before the second
+/// cancel each other out for all values that are live at both calls and
+/// that neither the first call nor any statement in between changes. This
+/// pass determines these values so that the code generator can carry the
+/// references over from one call to the next instead.
+class RefCountElision : public Pass<>
+{
+public:
+    /// Constructor.
+    ///
+    /// context: The context the module is compiled with.
+    ///
+    /// cfg: The control flow graph for the module; must have been run.
+    ///
+    /// liveness: The liveness analysis for the module; must have been run.
+    RefCountElision(CompilerContext* context, shared_ptr<CFG> cfg, shared_ptr<Liveness> liveness);
+    virtual ~RefCountElision();
+
+    /// Calculates the values that can be carried over for the module.
+    ///
+    /// Returns: True if no error occured.
+    bool run(shared_ptr<Node> module) override;
+
+    typedef Statement::variable_set variable_set;
+
+    /// Returns the variables whose references the code generator may keep
+    /// after a statement's call, handing them over to the call of the
+    /// statement's successor. Returns an empty set if there are none, or if
+    /// the pass didn't run.
+    variable_set carried(shared_ptr<Statement> stmt) const;
+
+    /// Returns true if the code generator must keep what it carries from a
+    /// statement's call when it gets to another statement, because that's
+    /// either in between the two calls or the one taking the values over.
+    ///
+    /// from: The statement whose call deferred the decrements.
+    ///
+    /// stmt: The statement the code generator is about to emit.
+    bool carriedTo(shared_ptr<Statement> from, shared_ptr<Statement> stmt) const;
+
+protected:
+    void visit(declaration::Function* f) override;
+
+private:
+    // Returns true if a statement is a call that may reach a safepoint.
+    bool safepointCall(shared_ptr<Statement> stmt) const;
+
+    // Returns the variables the code generator protects across a safepoint
+    // call in a statement.
+    variable_set protectedValues(shared_ptr<Statement> stmt) const;
+
+    // Returns the unique CFG successor of a statement if it's the
+    // statement's direct successor in its block and not reachable from
+    // anywhere else. Returns null otherwise.
+    shared_ptr<Statement> straightSuccessor(shared_ptr<Statement> stmt) const;
+
+    struct Carry {
+        variable_set values;                       // The values carried over.
+        std::set<shared_ptr<Statement>> path;      // The statements up to and including the next call.
+    };
+
+    CompilerContext* _context;
+    shared_ptr<CFG> _cfg;
+    shared_ptr<Liveness> _liveness;
+    std::unordered_map<shared_ptr<Statement>, Carry> _carried;
+};
+
+}
+
+}
+
+#endif
@@ -17,12 +17,22 @@ typedef struct __parser_state {
     struct __parser_state* next;
 } __parser_state;
 
+// Maximum number of levels of the skip list indexing the buffered chunks.
+// With a branching factor of 4, that's plenty for any realistic number of
+// chunks.
+#define __INDEX_LEVELS 16
+
+// Buffered chunks never overlap, so they are ordered by both rseq and
+// rupper. Level 0 of the skip list is the doubly-linked next/prev list, the
+// express lanes above it are in index[].
 typedef struct __chunk {
     struct __chunk* next;  // Next block. Has ownership.
     struct __chunk* prev;  // Previous block.
     uint64_t rseq;          // Sequence number of first byte.
     uint64_t rupper;        // Sequence number of last byte + 1.
     hlt_bytes* data;       // Data at +1.
+    int level;             // Number of skip list levels the chunk is linked into.
+    struct __chunk* index[]; // Successors on levels 1 to level - 1.
 } __chunk;
 
 struct binpac_sink {
@@ -40,7 +50,11 @@ struct binpac_sink {
     uint64_t trim_rseq;    // Sequence of last byte trimmed so far + 1.
     __chunk* first_chunk;  // First not yet reassembled chunk. Has ownership.
     __chunk* last_chunk;   // Last not yet reassembled chunk.
-
+    __chunk* index[__INDEX_LEVELS - 1]; // Heads of the skip list's levels 1 and up.
+    int index_levels;      // Number of skip list levels currently in use.
+    uint32_t index_rand;   // State for drawing random chunk levels.
+    uint64_t buffered;     // Number of data bytes currently buffered in chunks.
+    uint64_t max_buffered; // Limit for buffered bytes before we skip over holes; zero for no limit.
 };
 
 __HLT_RTTI_GC_TYPE(binpac_sink, HLT_TYPE_BINPAC_SINK);
@@ -182,17 +196,50 @@ static void __report_skip(binpac_sink* sink, uint64_t rseq, void* user, hlt_exce
     }
 }
 
-static void __report_overlap(binpac_sink* sink, hlt_bytes* old_data, hlt_bytes* new_data, uint64_t rseq, void* user, hlt_exception** excpt, hlt_execution_context* ctx)
+// Returns the part of a block's data corresponding to the range [rseq,
+// rupper), with data starting at data_rseq and ending at data_rupper. Copies
+// only if the range doesn't cover all of the data.
+static hlt_bytes* __sub_data(hlt_bytes* data, uint64_t data_rseq, uint64_t data_rupper, uint64_t rseq, uint64_t rupper, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( ! data )
+        return 0;
+
+    if ( rseq == data_rseq && rupper == data_rupper )
+        return data;
+
+    hlt_iterator_bytes i = hlt_bytes_begin(data, excpt, ctx);
+    i = hlt_iterator_bytes_incr_by(i, (rseq - data_rseq), excpt, ctx);
+    hlt_iterator_bytes j = hlt_iterator_bytes_incr_by(i, (rupper - rseq), excpt, ctx);
+    return hlt_bytes_sub(i, j, excpt, ctx);
+}
+
+// Reports an overlap of new data with a buffered chunk b for the range
+// [rseq, rupper). The overlapping bytes are extracted only if a parser is
+// actually interested in them.
+static void __report_overlap(binpac_sink* sink, __chunk* b, hlt_bytes* data, uint64_t data_rseq, uint64_t data_rupper, uint64_t rseq, uint64_t rupper, void* user, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     DBG_LOG("binpac-sinks", "reporting overlap in sink %p at rseq %" PRIu64, sink, rseq);
 
+    __parser_state* s;
+
+    for ( s = sink->head; s; s = s->next ) {
+        if ( s->parser->hook_overlap )
+            break;
+    }
+
+    if ( ! s )
+        return;
+
+    hlt_bytes* old_data = __sub_data(b->data, b->rseq, b->rupper, rseq, rupper, excpt, ctx);
+    hlt_bytes* new_data = __sub_data(data, data_rseq, data_rupper, rseq, rupper, excpt, ctx);
+
     if ( ! old_data )
         old_data = hlt_bytes_new_from_data((int8_t*)"<unavailable>", sizeof("<unavailable>"), excpt, ctx);
 
     if ( ! new_data )
         new_data = hlt_bytes_new_from_data((int8_t*)"<unavailable>", sizeof("<unavailable>"), excpt, ctx);
 
-    for ( __parser_state* s = sink->head; s; s = s->next ) {
+    for ( ; s; s = s->next ) {
         if ( s->parser->hook_overlap )
             (*s->parser->hook_overlap)(s->pobj, user, rseq + sink->initial_seq, old_data, new_data, excpt, ctx);
     }
@@ -229,19 +276,90 @@ static void __report_undelivered_up_to(binpac_sink* sink, uint64_t rupper, void*
     }
 }
 
-static __chunk* __new_chunk(hlt_bytes* data, uint64_t rseq, uint64_t len, hlt_exception** excpt, hlt_execution_context* ctx)
+// Draws a random skip list level for a new chunk, with each additional
+// level being a quarter as likely as the one below.
+static int __random_level(binpac_sink* sink)
+{
+    // xorshift32.
+    uint32_t x = sink->index_rand;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sink->index_rand = x;
+
+    int level = 1;
+
+    while ( (x & 3) == 0 && level < __INDEX_LEVELS ) {
+        x >>= 2;
+        level++;
+    }
+
+    return level;
+}
+
+// Returns the slot holding the successor of chunk c on the given skip list
+// level, with c == 0 referring to the head of the list.
+static inline __chunk** __index_next(binpac_sink* sink, __chunk* c, int level)
+{
+    if ( ! c )
+        return level ? &sink->index[level - 1] : &sink->first_chunk;
+
+    return level ? &c->index[level - 1] : &c->next;
+}
+
+// Returns the last chunk starting before rseq, or null if there's none. If
+// pred is given, fills it with the corresponding chunk for each level in
+// use.
+static __chunk* __find_before(binpac_sink* sink, uint64_t rseq, __chunk** pred)
 {
-    __chunk* c = hlt_malloc(sizeof(__chunk));
+    __chunk* c = 0;
+
+    for ( int l = sink->index_levels - 1; l >= 0; l-- ) {
+        __chunk* n;
+
+        while ( (n = *__index_next(sink, c, l)) && n->rseq < rseq )
+            c = n;
+
+        if ( pred )
+            pred[l] = c;
+    }
+
+    return c;
+}
+
+static __chunk* __new_chunk(binpac_sink* sink, hlt_bytes* data, uint64_t rseq, uint64_t len, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    int level = __random_level(sink);
+
+    __chunk* c = hlt_malloc(sizeof(__chunk) + (level - 1) * sizeof(__chunk*));
     c->next = 0;
     c->prev = 0;
     c->rseq = rseq;
     c->rupper = rseq + len;
+    c->level = level;
     GC_ASSIGN(c->data, data, hlt_bytes, ctx);
     return c;
 }
 
 static void __link_chunk(binpac_sink* sink, __chunk* prev, __chunk* c, hlt_exception** excpt, hlt_execution_context* ctx)
 {
+    if ( c->level > 1 ) {
+        while ( sink->index_levels < c->level )
+            sink->index[sink->index_levels++ - 1] = 0;
+
+        __chunk* pred[__INDEX_LEVELS];
+        __find_before(sink, c->rseq, pred);
+
+        for ( int l = 1; l < c->level; l++ ) {
+            __chunk** n = __index_next(sink, pred[l], l);
+            c->index[l - 1] = *n;
+            *n = c;
+        }
+    }
+
+    if ( c->data )
+        sink->buffered += (c->rupper - c->rseq);
+
     if ( prev ) {
         if ( prev->next )
             prev->next->prev = c;
@@ -268,6 +386,23 @@ static void __link_chunk(binpac_sink* sink, __chunk* prev, __chunk* c, hlt_excep
 
 static void __unlink_chunk(binpac_sink* sink, __chunk* c, hlt_exception** excpt, hlt_execution_context* ctx)
 {
+    if ( c->level > 1 ) {
+        __chunk* pred[__INDEX_LEVELS];
+        __find_before(sink, c->rseq, pred);
+
+        for ( int l = 1; l < c->level; l++ ) {
+            __chunk** n = __index_next(sink, pred[l], l);
+            assert(*n == c);
+            *n = c->index[l - 1];
+        }
+
+        while ( sink->index_levels > 1 && ! sink->index[sink->index_levels - 2] )
+            sink->index_levels--;
+    }
+
+    if ( c->data )
+        sink->buffered -= (c->rupper - c->rseq);
+
     if ( c->next )
         c->next->prev = c->prev;
     else
@@ -550,100 +685,103 @@ static void __try_deliver(binpac_sink* sink, __chunk* c, void* user, hlt_excepti
     }
 }
 
-static __chunk* __add_and_check(binpac_sink* sink, __chunk* b, uint64_t rseq, uint64_t rupper, hlt_bytes* data, void* user, hlt_exception** excpt, hlt_execution_context* ctx)
+// Inserts the range [rseq, rupper) of a new block into the buffer, with
+// data (which may be null for a gap) starting at data_rseq and ending at
+// data_rupper. Parts overlapping already buffered chunks are reported and
+// otherwise ignored, the rest goes into new chunks. Returns the first chunk
+// covering rseq afterwards.
+static __chunk* __add_and_check(binpac_sink* sink, uint64_t rseq, uint64_t rupper, hlt_bytes* data, uint64_t data_rseq, uint64_t data_rupper, void* user, hlt_exception** excpt, hlt_execution_context* ctx)
 {
-    assert(sink->first_chunk);
-    assert(sink->last_chunk);
-
-	// Special check for the common case of appending to the end.
-	if ( rseq == sink->last_chunk->rupper ) {
-        __chunk* c = __new_chunk(data, rseq, rupper - rseq, excpt, ctx);
-        __link_chunk(sink, sink->last_chunk, c, excpt, ctx);
-		return c;
-    }
+    __chunk* b = 0;
 
-	// Find the first block that doesn't come completely before the new data.
-	while ( b->next && b->rupper <= rseq )
-		b = b->next;
+    // Special check for the common case of appending to the end.
+    if ( ! sink->last_chunk || rseq >= sink->last_chunk->rupper )
+        b = 0;
 
-	if ( b->rupper <= rseq ) {
-		// b is the last block, and it comes completely before the new block.
-        __chunk* c = __new_chunk(data, rseq, rupper - rseq, excpt, ctx);
-        __link_chunk(sink, b, c, excpt, ctx);
-		return c;
-    }
+    else {
+        // Find the first block that doesn't come completely before the new data.
+        b = __find_before(sink, rseq + 1, 0);
 
-	if ( rupper <= b->rseq ) {
-		// The new block comes completely before b.
-        __chunk* c = __new_chunk(data, rseq, rupper - rseq, excpt, ctx);
-        __link_chunk(sink, b->prev, c, excpt, ctx);
-        return c;
-		}
+        if ( ! b )
+            b = sink->first_chunk;
 
-    __chunk* new_b = 0;
+        else if ( b->rupper <= rseq )
+            b = b->next;
+    }
 
-	// The blocks overlap, complain.
+    __chunk* first = 0;
 
-	if ( rseq < b->rseq ) {
-		// The new block has a prefix that comes before b.
-		int64_t prefix_len = b->rseq - rseq;
+    while ( rseq < rupper ) {
+        if ( ! b || rupper <= b->rseq ) {
+            // The (remaining) new data comes completely before b.
+            hlt_bytes* sub = __sub_data(data, data_rseq, data_rupper, rseq, rupper, excpt, ctx);
+            __chunk* c = __new_chunk(sink, sub, rseq, rupper - rseq, excpt, ctx);
+            __link_chunk(sink, b ? b->prev : sink->last_chunk, c, excpt, ctx);
+            return first ? first : c;
+        }
+
+        if ( rseq < b->rseq ) {
+            // The new data has a prefix that comes before b.
+            hlt_bytes* sub = __sub_data(data, data_rseq, data_rupper, rseq, b->rseq, excpt, ctx);
+            __chunk* c = __new_chunk(sink, sub, rseq, b->rseq - rseq, excpt, ctx);
+            __link_chunk(sink, b->prev, c, excpt, ctx);
 
-        if ( data ) {
-            hlt_iterator_bytes begin = hlt_bytes_begin(data, excpt, ctx);
-            hlt_iterator_bytes end = hlt_bytes_end(data, excpt, ctx);
-            hlt_iterator_bytes i = hlt_iterator_bytes_incr_by(begin, prefix_len, excpt, ctx);
-            hlt_bytes* sub = hlt_bytes_sub(begin, i, excpt, ctx);
-            new_b = __new_chunk(sub, rseq, prefix_len, excpt, ctx);
-            __link_chunk(sink, b->prev, new_b, excpt, ctx);
+            if ( ! first )
+                first = c;
 
-            data = hlt_bytes_sub(i, end, excpt, ctx);
+            rseq = b->rseq;
         }
 
-		rseq += prefix_len;
+        // The blocks overlap, complain.
+        uint64_t overlap_upper = (rupper < b->rupper ? rupper : b->rupper);
+        __report_overlap(sink, b, data, data_rseq, data_rupper, rseq, overlap_upper, user, excpt, ctx);
+
+        if ( ! first )
+            first = b;
+
+        rseq = overlap_upper;
+        b = b->next;
     }
 
-	else
-        new_b = b;
+    return first;
+}
 
-	uint64_t overlap_start = rseq;
-	int64_t overlap_offset = overlap_start - b->rseq;
-	int64_t new_b_len = rupper - rseq;
-	int64_t b_len = (b->rupper - overlap_start);
-	int64_t overlap_len = (new_b_len < b_len ? new_b_len : b_len);
+// Skips over holes in the buffered data as long as we're buffering more
+// than the sink's limit, reporting them as gaps. Afterwards delivers what
+// has become in-order.
+static void __enforce_max_buffered(binpac_sink* sink, void* user, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    while ( sink->max_buffered && sink->buffered > sink->max_buffered && ! *excpt ) {
+        __chunk* c = sink->first_chunk;
 
-    hlt_bytes* old_data = 0;
-    hlt_bytes* new_data = 0;
+        while ( c && (! c->data || c->rupper <= sink->last_reassem_rseq) )
+            c = c->next;
 
-    if ( b->data ) {
-        hlt_iterator_bytes i = hlt_bytes_begin(b->data, excpt, ctx);
-        i = hlt_iterator_bytes_incr_by(i, (overlap_start - b->rseq), excpt, ctx);
-        hlt_iterator_bytes j = hlt_iterator_bytes_incr_by(i, overlap_len, excpt, ctx);
-        old_data = hlt_bytes_sub(i, j, excpt, ctx);
-    }
+        if ( ! c )
+            break;
 
-    if ( data ) {
-        hlt_iterator_bytes i = hlt_bytes_begin(data, excpt, ctx);
-        hlt_iterator_bytes j = hlt_iterator_bytes_incr_by(i, overlap_len, excpt, ctx);
-        new_data = hlt_bytes_sub(i, j, excpt, ctx);
-    }
+        DBG_LOG("binpac-sinks", "sink %p exceeds buffer limit with %" PRIu64 " bytes, skipping to rseq %" PRIu64,
+                sink, sink->buffered, c->rseq);
 
-    __report_overlap(sink, old_data, new_data, overlap_start, user, excpt, ctx);
+        if ( c->rseq > sink->cur_rseq )
+            __report_gap(sink, sink->cur_rseq, (c->rseq - sink->cur_rseq), user, excpt, ctx);
 
-	if ( overlap_len < new_b_len ) {
-        // Recurse to resolve remainder of the new data.
-        hlt_iterator_bytes i = hlt_bytes_begin(data, excpt, ctx);
-        hlt_iterator_bytes end = hlt_bytes_end(data, excpt, ctx);
-        i = hlt_iterator_bytes_incr_by(i, overlap_len, excpt, ctx);
-        data = hlt_bytes_sub(i, end, excpt, ctx);
-		rseq += overlap_len;
+        if ( c->rseq > sink->last_reassem_rseq ) {
+            sink->cur_rseq = c->rseq;
+            sink->last_reassem_rseq = c->rseq;
+
+            if ( sink->auto_trim )
+                __trim(sink, c->rseq, user, excpt, ctx);
+        }
+
+        uint64_t buffered = sink->buffered;
 
-		if ( new_b == b )
-			new_b = __add_and_check(sink, b, rseq, rupper, data, user, excpt, ctx);
-		else
-			(void) __add_and_check(sink, b, rseq, rupper, data, user, excpt, ctx);
-		}
+        __try_deliver(sink, c, user, excpt, ctx);
 
-	return new_b;
+        if ( sink->buffered == buffered )
+            // No progress, can't do anything more.
+            break;
+    }
 }
 
 // data==null signals a gap.
@@ -663,35 +801,18 @@ static void __new_block(binpac_sink* sink, hlt_bytes* data, uint64_t rseq, hlt_b
 
     binpac_dbg_reassembler(sink, "buffering block", data, rseq, len, excpt, ctx);
 
+    uint64_t data_rseq = rseq;
     uint64_t rupper_rseq = rseq + len;
 
 	if ( rupper_rseq <= sink->trim_rseq )
 		// Old data, don't do any work for it.
         goto exit;
 
-	if ( rseq < sink->trim_rseq ) {
+	if ( rseq < sink->trim_rseq )
         // Partially old data, just keep the good stuff.
-		int64_t amount_old = sink->trim_rseq - rseq;
-        rseq += amount_old;
-
-        if ( data ) {
-            hlt_iterator_bytes begin = hlt_bytes_begin(data, excpt, ctx);
-            hlt_iterator_bytes end = hlt_bytes_end(data, excpt, ctx);
-            begin = hlt_iterator_bytes_incr_by(begin, amount_old, excpt, ctx);
-            data = hlt_bytes_sub(begin, end, excpt, ctx);
-        }
-    }
-
-    __chunk* c = 0;
-
-    if ( ! sink->first_chunk ) {
-        c = __new_chunk(data, rseq, len, excpt, ctx);
-        sink->first_chunk = c;
-        sink->last_chunk = c;
-    }
+        rseq = sink->trim_rseq;
 
-    else
-		c = __add_and_check(sink, sink->first_chunk, rseq, rupper_rseq, data, user, excpt, ctx);
+    __chunk* c = __add_and_check(sink, rseq, rupper_rseq, data, data_rseq, rupper_rseq, user, excpt, ctx);
 
     // See if we have data in order now to deliver.
 
@@ -700,11 +821,11 @@ static void __new_block(binpac_sink* sink, hlt_bytes* data, uint64_t rseq, hlt_b
     binpac_dbg_reassembler_buffer(sink, "buffer", excpt, ctx);
 #endif
 
-	if ( c->rseq > sink->last_reassem_rseq || c->rupper <= sink->last_reassem_rseq )
-        goto exit;
+	if ( c->rseq <= sink->last_reassem_rseq && c->rupper > sink->last_reassem_rseq )
+        // We've filled a leading hole. Deliver as much as possible.
+        __try_deliver(sink, c, user, excpt, ctx);
 
-	// We've filled a leading hole. Deliver as much as possible.
-    __try_deliver(sink, c, user, excpt, ctx);
+    __enforce_max_buffered(sink, user, excpt, ctx);
 
 exit:
     binpac_dbg_reassembler_buffer(sink, "buffer", excpt, ctx);
@@ -741,6 +862,10 @@ binpac_sink* binpachilti_sink_new(hlt_exception** excpt, hlt_execution_context*
     sink->trim_rseq = 0;
     sink->first_chunk = 0;
     sink->last_chunk = 0;
+    sink->index_levels = 1;
+    sink->index_rand = 2463534242;
+    sink->buffered = 0;
+    sink->max_buffered = 0;
     return sink;
 }
 
@@ -775,6 +900,11 @@ void binpachilti_sink_set_auto_trim(binpac_sink* sink, int8_t enable, void* user
     hlt_set_exception(excpt, &binpac_exception_notimplemented, msg, ctx);
 }
 
+void binpachilti_sink_set_max_buffered(binpac_sink* sink, uint64_t max, void* user, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    sink->max_buffered = max;
+}
+
 void binpachilti_sink_connect(binpac_sink* sink, const hlt_type_info* type, void** pobj, binpac_parser* parser, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     _binpachilti_sink_connect_intern(sink, type, pobj, parser, 0, excpt, ctx);
@@ -906,8 +1036,9 @@ void binpac_dbg_reassembler_buffer(binpac_sink* sink, const char* msg, hlt_excep
     DBG_LOG("binpac-sinks", "reassembler/%p: %s ("
             "cur_rseq=%" PRIu64 " "
             "last_reassem_rseq=%" PRIu64 " "
-            "trim_rseq=%" PRIu64 ")",
-            sink, msg, sink->cur_rseq, sink->last_reassem_rseq, sink->trim_rseq);
+            "trim_rseq=%" PRIu64 " "
+            "buffered=%" PRIu64 ")",
+            sink, msg, sink->cur_rseq, sink->last_reassem_rseq, sink->trim_rseq, sink->buffered);
 
     for ( __chunk* c = sink->first_chunk; c; c = c->next ) {
         snprintf(buffer, sizeof(buffer), "* chunk %d:", i);
@@ -1037,6 +1168,8 @@ void binpachilti_sink_close(binpac_sink* sink, void* user, hlt_exception** excpt
     __trim(sink, UINT64_MAX, user, excpt, ctx);
     assert(! sink->first_chunk);
     assert(! sink->last_chunk);
+    assert(sink->index_levels == 1);
+    assert(! sink->buffered);
 
     sink->cur_rseq = 0;
     sink->last_reassem_rseq = 0;
@@ -68,6 +68,20 @@ extern void binpachilti_sink_set_policy(binpac_sink* sink, int64_t policy, void*
 /// ctx: &
 extern void binpachilti_sink_set_auto_trim(binpac_sink* sink, int8_t enable, void* user, hlt_exception** excpt, hlt_execution_context* ctx);
 
+/// Sets a limit for the amount of out-of-order data a sink buffers. Once
+/// exceeded, the sink stops waiting for data to fill the leading hole,
+/// reports it as a gap, and continues with whatever comes next. The limit
+/// is checked whenever new data gets buffered.
+///
+/// sink: The sink to set it for.
+///
+/// max: The maximum number of bytes to buffer, or zero for no limit (which
+/// is the default).
+///
+/// excpt: &
+/// ctx: &
+extern void binpachilti_sink_set_max_buffered(binpac_sink* sink, uint64_t max, void* user, hlt_exception** excpt, hlt_execution_context* ctx);
+
 /// Connects a parser to a sink. Note that there can be only one parser of
 /// each type. If there's already one of the same kind, the request is
 /// silently ignored.
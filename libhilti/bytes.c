@@ -5,6 +5,10 @@
 #include <string.h>
 #include <stdio.h>
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #include "bytes.h"
 #include "memory_.h"
 #include "exceptions.h"
@@ -25,6 +29,15 @@ static const int _BYTES_FLAG_FROZEN = 1;
 // object aren't valid in this case, and set to null.
 static const int _BYTES_FLAG_OBJECT = 2;
 
+// Data of this node is borrowed from the caller, who will eventually release
+// it through hlt_bytes_unborrow(). to_free is null in this case.
+static const int _BYTES_FLAG_BORROWED = 4;
+
+// Data of this node has been copied out of borrowed memory by
+// hlt_bytes_unborrow(). to_free points to a __hlt_bytes_moved, and iterators
+// created earlier may still point into the old memory.
+static const int _BYTES_FLAG_MOVED = 8;
+
 // Layout here must match libhilti.ll!
 struct __hlt_bytes {
     __hlt_gchdr __gchdr;       // Header for memory management.
@@ -56,6 +69,14 @@ struct __hlt_bytes_hoisted {
 
 typedef struct __hlt_bytes_object __hlt_bytes_object;
 
+// Storage for the data of a node with _BYTES_FLAG_MOVED. We record where the
+// data was located before so that we can adjust iterators lazily.
+typedef struct {
+    int8_t* old_start; // Former start of the node's data.
+    int8_t* old_end;   // Former end of the node's data.
+    int8_t data[0];    // The data starts here.
+} __hlt_bytes_moved;
+
 static hlt_iterator_bytes GenericEndPos = { 0, 0 };
 
 static hlt_bytes* _hlt_bytes_new(const int8_t* data, hlt_bytes_size len, hlt_bytes_size reserve, hlt_execution_context* ctx);
@@ -200,11 +221,26 @@ static inline hlt_iterator_bytes __create_iterator(hlt_bytes* bytes, int8_t* cur
 void __hlt_iterator_bytes_incr_by(hlt_iterator_bytes* p, int64_t n, hlt_exception** excpt, hlt_execution_context* ctx, int8_t adj_ref, int8_t move_beyond_end);
 hlt_iterator_bytes hlt_bytes_offset(hlt_bytes* b, hlt_bytes_size p, hlt_exception** excpt, hlt_execution_context* ctx);
 
+// Moves an iterator pointing into borrowed memory over to where
+// hlt_bytes_unborrow() has copied the data.
+static inline void __fixup_moved(hlt_iterator_bytes* pos)
+{
+    if ( ! (pos->bytes && (pos->bytes->flags & _BYTES_FLAG_MOVED)) )
+        return;
+
+    __hlt_bytes_moved* m = (__hlt_bytes_moved*) pos->bytes->to_free;
+
+    if ( pos->cur >= m->old_start && pos->cur <= m->old_end )
+        pos->cur = m->data + (pos->cur - m->old_start);
+}
+
 // This version does not adjust the reference count and must be called only
 // when the potentiall changed iterator will not be visible to the HILTI
 // layer.
 static inline void __normalize_iter(hlt_iterator_bytes* pos)
 {
+    __fixup_moved(pos);
+
     if ( ! pos->bytes || __at_object(*pos) )
         return;
 
@@ -229,6 +265,8 @@ static inline void __normalize_iter(hlt_iterator_bytes* pos)
 // potentiall changed iterator will be visible to the HILTI layer.
 static inline void __normalize_iter_hilti(hlt_iterator_bytes* pos, hlt_execution_context* ctx)
 {
+    __fixup_moved(pos);
+
     if ( ! pos->bytes || __at_object(*pos) )
         return;
 
@@ -365,7 +403,7 @@ static inline void _hlt_bytes_init(hlt_bytes* b, const int8_t* data, hlt_bytes_s
     hlt_thread_mgr_blockable_init(&b->blockable);
 
     if ( data )
-        memcpy(b->data, data, len);
+        memcpy(b->start, data, len);
 }
 
 static inline void _hlt_bytes_init_reuse(hlt_bytes* b, int8_t* data, hlt_bytes_size len, hlt_execution_context* ctx)
@@ -382,6 +420,15 @@ static inline void _hlt_bytes_init_reuse(hlt_bytes* b, int8_t* data, hlt_bytes_s
     hlt_thread_mgr_blockable_init(&b->blockable);
 }
 
+static inline void _hlt_bytes_init_borrowed(hlt_bytes* b, int8_t* data, hlt_bytes_size len, hlt_execution_context* ctx)
+{
+    _hlt_bytes_init_reuse(b, data, len, ctx);
+    b->flags = _BYTES_FLAG_BORROWED;
+    b->to_free = 0;
+
+    __hlt_globals()->size_borrowed += len;
+}
+
 static void _hlt_bytes_init_object(__hlt_bytes_object* b, const hlt_type_info* type, void* obj, hlt_execution_context* ctx)
 {
     b->b.next = 0;
@@ -434,7 +481,7 @@ static inline void _hlt_bytes_init_hoisted(__hlt_bytes_hoisted* dst, const int8_
     hlt_thread_mgr_blockable_init(&b->blockable);
 
     if ( data )
-        memcpy(b->data, data, len);
+        memcpy(b->start, data, len);
 }
 
 static hlt_bytes* _hlt_bytes_new(const int8_t* data, hlt_bytes_size len, hlt_bytes_size reserve, hlt_execution_context* ctx)
@@ -502,7 +549,11 @@ void hlt_bytes_dtor(hlt_type_info* ti, hlt_bytes* b, hlt_execution_context* ctx)
 
         if ( b->marks )
             hlt_free(b->marks);
-}
+
+        // Hoisted instances may get reinitialized later.
+        b->to_free = 0;
+        b->marks = 0;
+    }
 }
 
 void hlt_iterator_bytes_dtor(hlt_type_info* ti, hlt_iterator_bytes* p, hlt_execution_context* ctx)
@@ -540,6 +591,78 @@ hlt_bytes* hlt_bytes_new_from_data_copy(const int8_t* data, hlt_bytes_size len,
     return _hlt_bytes_new(data, len, 0, ctx);
 }
 
+hlt_bytes* hlt_bytes_new_from_data_borrowed(int8_t* data, hlt_bytes_size len, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    hlt_bytes* b = GC_NEW_NO_INIT(hlt_bytes, ctx);
+    _hlt_bytes_init_borrowed(b, data, len, ctx);
+    return b;
+}
+
+hlt_bytes_size hlt_bytes_unborrow(hlt_bytes* b, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( ! b ) {
+        hlt_set_exception(excpt, &hlt_exception_null_reference, 0, ctx);
+        return 0;
+    }
+
+    if ( ! (b->flags & _BYTES_FLAG_BORROWED) )
+        return 0;
+
+    b->flags &= ~_BYTES_FLAG_BORROWED;
+
+    hlt_bytes_size len = b->end - b->start;
+
+    // If everything has been trimmed, there's nothing left to access. If
+    // the caller holds the only reference, nobody can get to the data
+    // anymore either. Either way we can leave the now dangling pointers in
+    // place. Note that the latter can only apply to the head chunk: a chunk
+    // appended by hlt_bytes_append_raw_borrowed() also has a reference from
+    // its predecessor for as long as it's linked in, and then always gets
+    // copied.
+    if ( ! len )
+        return 0;
+
+    if ( __atomic_load_n(&b->__gchdr.ref_cnt, __ATOMIC_SEQ_CST) <= 1 )
+        return 0;
+
+    __hlt_bytes_moved* m = hlt_malloc(sizeof(__hlt_bytes_moved) + len);
+    m->old_start = b->start;
+    m->old_end = b->end;
+    memcpy(m->data, b->start, len);
+
+    b->start = m->data;
+    b->end = b->reserved = m->data + len;
+    b->to_free = (int8_t*)m;
+    b->flags |= _BYTES_FLAG_MOVED;
+
+    __hlt_globals()->size_borrowed_copied += len;
+
+    return len;
+}
+
+hlt_bytes* __hlt_bytes_new_reusable(hlt_bytes_size reserve, hlt_execution_context* ctx)
+{
+    return _hlt_bytes_new_ref(0, 0, reserve, ctx);
+}
+
+int8_t __hlt_bytes_reuse(hlt_bytes* b, const int8_t* data, hlt_bytes_size len, hlt_execution_context* ctx)
+{
+    assert(! __get_object(b));
+
+    if ( b->to_free || b->reserved - b->data < len )
+        return 0;
+
+    hlt_bytes_size reserve = b->reserved - b->data;
+
+    GC_CLEAR(b->next, hlt_bytes, ctx);
+
+    if ( b->marks )
+        hlt_free(b->marks);
+
+    _hlt_bytes_init(b, data, len, reserve, ctx);
+    return 1;
+}
+
 void* hlt_bytes_clone_alloc(const hlt_type_info* ti, void* srcp, __hlt_clone_state* cstate, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     hlt_bytes* src = *(hlt_bytes**)srcp;
@@ -723,6 +846,30 @@ void hlt_bytes_append_raw_copy(hlt_bytes* b, int8_t* raw, hlt_bytes_size len, hl
     __hlt_bytes_append_raw(b, raw, len, excpt, ctx, 0);
 }
 
+hlt_bytes* hlt_bytes_append_raw_borrowed(hlt_bytes* b, int8_t* raw, hlt_bytes_size len, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( ! b ) {
+        hlt_set_exception(excpt, &hlt_exception_null_reference, 0, ctx);
+        return 0;
+    }
+
+    if ( __is_frozen(b) ) {
+        hlt_set_exception(excpt, &hlt_exception_value_error, 0, ctx);
+        return 0;
+    }
+
+    if ( ! len )
+        return 0;
+
+    hlt_bytes* c = GC_NEW_NO_INIT(hlt_bytes, ctx);
+    _hlt_bytes_init_borrowed(c, raw, len, ctx);
+    __add_chunk(__tail(b, true), c, ctx);
+
+    hlt_thread_mgr_unblock(&b->blockable, ctx);
+
+    return c;
+}
+
 static void _hlt_bytes_concat_into(hlt_bytes* dst, hlt_bytes* b1, hlt_bytes* b2, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     // Assumes that dst has enough space available.
@@ -963,44 +1110,295 @@ void __hlt_bytes_find_byte_from(hlt_iterator_bytes* p, hlt_iterator_bytes i, int
         __hlt_bytes_end(p, i.bytes, excpt, ctx);
 }
 
-int8_t __hlt_bytes_find_bytes(hlt_iterator_bytes* p, hlt_bytes* b, hlt_bytes* other, hlt_exception** excpt, hlt_execution_context* ctx)
+// Substring search.
+//
+// The needle gets flattened into a contiguous buffer (it's typically short),
+// while the haystack is searched in place, chunk by chunk, without copying.
+// Inside a chunk, we use a vectorized filter on the needle's first and last
+// byte (SSE2/AVX2 if available at compile time), or a Boyer-Moore-Horspool
+// skip table for long needles where skipping beats the filter. Candidate
+// positions within the last (len - 1) bytes of a chunk may continue into
+// subsequent chunks and are verified separately by __search_match_across().
+
+// Needles at least this long use the BMH skip table for in-chunk search.
+static const hlt_bytes_size __HLT_BYTES_SEARCH_BMH_MIN = 32;
+
+// Needles up to this size are flattened into a buffer on the stack.
+#define __HLT_BYTES_SEARCH_INLINE 64
+
+typedef struct {
+    const int8_t* data;                      // The needle's bytes, contiguous.
+    hlt_bytes_size len;                      // Length of needle; > 0.
+    uint8_t* skip;                           // BMH skip table with 256 entries, or null if not used.
+    int8_t* to_free;                         // Non-null if data must be freed.
+    int8_t buffer[__HLT_BYTES_SEARCH_INLINE]; // Inline storage for short needles.
+    uint8_t skip_buffer[256];                // Storage for skip; shifts are capped at 255 to keep this small.
+} __hlt_bytes_needle;
+
+// Prepares a needle for searching. The needle must not be empty (ignoring
+// objects). Must be followed by __search_needle_done().
+static void __search_needle_init(__hlt_bytes_needle* n, hlt_bytes* needle)
+{
+    n->to_free = 0;
+    n->skip = 0;
+    n->len = 0;
+
+    hlt_bytes* c;
+
+    for ( c = needle; c && ! __get_object(c); c = c->next )
+        n->len += (c->end - c->start);
+
+    // Fast-path: a single chunk holding all the data can be used directly.
+    for ( c = needle; c && c->start == c->end && ! __get_object(c); c = c->next )
+        ;
+
+    if ( c && ! __get_object(c) && (c->end - c->start) == n->len )
+        n->data = c->start;
+
+    else {
+        int8_t* dst = (n->len <= __HLT_BYTES_SEARCH_INLINE) ? n->buffer : (n->to_free = hlt_malloc(n->len));
+        int8_t* p = dst;
+
+        for ( c = needle; c && ! __get_object(c); c = c->next ) {
+            memcpy(p, c->start, c->end - c->start);
+            p += (c->end - c->start);
+        }
+
+        n->data = dst;
+    }
+
+    if ( n->len >= __HLT_BYTES_SEARCH_BMH_MIN ) {
+        // Shifting by less than the table says is always safe, so we cap
+        // them for needles longer than 255 bytes.
+        n->skip = n->skip_buffer;
+
+        for ( int i = 0; i < 256; i++ )
+            n->skip[i] = min(n->len, 255);
+
+        for ( hlt_bytes_size i = 0; i < n->len - 1; i++ )
+            n->skip[(uint8_t)n->data[i]] = min(n->len - 1 - i, 255);
+    }
+}
+
+static inline void __search_needle_done(__hlt_bytes_needle* n)
 {
-    if ( __is_empty(other, false) ) {
-        // Empty pattern returns start position.
-        __hlt_bytes_begin(p, b, excpt, ctx);
-        return 1;
+    if ( n->to_free )
+        hlt_free(n->to_free);
+}
+
+// Horspool search of a needle inside a contiguous block. Returns the first
+// match, or null if none.
+static const int8_t* __search_block_bmh(const int8_t* hay, hlt_bytes_size len, const __hlt_bytes_needle* n)
+{
+    const int8_t* needle = n->data;
+    hlt_bytes_size m = n->len;
+    uint8_t last = (uint8_t)needle[m - 1];
+
+    for ( hlt_bytes_size i = 0; i + m <= len; ) {
+        uint8_t c = (uint8_t)hay[i + m - 1];
+
+        if ( c == last && memcmp(hay + i, needle, m - 1) == 0 )
+            return hay + i;
+
+        i += n->skip[c];
     }
 
-    hlt_iterator_bytes begin;
-    hlt_iterator_bytes end;
-    __hlt_bytes_begin(&begin, other, excpt, ctx);
-    __hlt_bytes_end(&end, other, excpt, ctx);
+    return 0;
+}
 
+// Scalar search of a needle inside a contiguous block, using memchr() to
+// find candidates. Returns the first match, or null if none.
+static const int8_t* __search_block_scalar(const int8_t* hay, hlt_bytes_size len, const __hlt_bytes_needle* n)
+{
+    const int8_t* needle = n->data;
+    hlt_bytes_size m = n->len;
 
-    int8_t chr = *begin.cur;
+    if ( len < m )
+        return 0;
 
-    hlt_iterator_bytes i;
-    __hlt_bytes_begin(&i, b, excpt, ctx);
+    const int8_t* p = hay;
+    const int8_t* last = hay + len - m; // Last possible start position.
 
-    while ( 1 ) {
-        __hlt_bytes_find_byte_from(p, i, chr, excpt, ctx);
+    while ( p <= last ) {
+        p = memchr(p, needle[0], last - p + 1);
 
-        if ( __is_end(*p) ) {
-            // Not found.
-            break;
+        if ( ! p )
+            return 0;
+
+        if ( p[m - 1] == needle[m - 1] && memcmp(p + 1, needle + 1, m - 2) == 0 )
+            return p;
+
+        ++p;
+    }
+
+    return 0;
+}
+
+// Searches a needle of length >= 2 inside a contiguous block. Returns the
+// first match, or null if none.
+static const int8_t* __search_block(const int8_t* hay, hlt_bytes_size len, const __hlt_bytes_needle* n)
+{
+    hlt_bytes_size m = n->len;
+
+    if ( len < m )
+        return 0;
+
+    if ( n->skip )
+        return __search_block_bmh(hay, len, n);
+
+    hlt_bytes_size i = 0;
+
+#if defined(__AVX2__)
+    const __m256i first = _mm256_set1_epi8(n->data[0]);
+    const __m256i last = _mm256_set1_epi8(n->data[m - 1]);
+
+    for ( ; i + m - 1 + 32 <= len; i += 32 ) {
+        __m256i bf = _mm256_loadu_si256((const __m256i*)(hay + i));
+        __m256i bl = _mm256_loadu_si256((const __m256i*)(hay + i + m - 1));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, bf), _mm256_cmpeq_epi8(last, bl)));
+
+        while ( mask ) {
+            int bit = __builtin_ctz(mask);
+
+            if ( memcmp(hay + i + bit + 1, n->data + 1, m - 2) == 0 )
+                return hay + i + bit;
+
+            mask &= (mask - 1);
         }
+    }
+#elif defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(n->data[0]);
+    const __m128i last = _mm_set1_epi8(n->data[m - 1]);
 
-        if ( hlt_bytes_match_at(*p, other, excpt, ctx) )
-            // Found.
+    for ( ; i + m - 1 + 16 <= len; i += 16 ) {
+        __m128i bf = _mm_loadu_si128((const __m128i*)(hay + i));
+        __m128i bl = _mm_loadu_si128((const __m128i*)(hay + i + m - 1));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, bf), _mm_cmpeq_epi8(last, bl)));
+
+        while ( mask ) {
+            int bit = __builtin_ctz(mask);
+
+            if ( memcmp(hay + i + bit + 1, n->data + 1, m - 2) == 0 )
+                return hay + i + bit;
+
+            mask &= (mask - 1);
+        }
+    }
+#endif
+
+    // Remaining positions (or all of them without SIMD support).
+    return __search_block_scalar(hay + i, len - i, n);
+}
+
+// Checks whether the needle matches at a position that may extend into
+// subsequent chunks. Returns 1 if it does, 0 if not, and -1 if the input
+// ends before we could decide.
+static int8_t __search_match_across(hlt_bytes* c, const int8_t* cur, const __hlt_bytes_needle* n)
+{
+    const int8_t* needle = n->data;
+    hlt_bytes_size remaining = n->len;
+
+    while ( 1 ) {
+        hlt_bytes_size k = min(c->end - cur, remaining);
+
+        if ( memcmp(cur, needle, k) != 0 )
+            return 0;
+
+        needle += k;
+        remaining -= k;
+
+        if ( ! remaining )
             return 1;
 
-        __hlt_iterator_bytes_incr(&i, excpt, ctx, 0);
+        c = c->next;
 
-        if ( __is_end(i) )
-            // Not found.
-            break;
+        if ( ! c || __get_object(c) )
+            return -1;
+
+        cur = c->start;
     }
+}
+
+// Searches for a needle starting at a given position. Returns 1 if found,
+// with *p set to the first match; -1 if there's no match but the input ends
+// inside a partial match, with *p set to the start of the first such
+// partial match; and 0 if neither, with *p set to the end position.
+static int8_t __search(hlt_iterator_bytes* p, hlt_iterator_bytes i, const __hlt_bytes_needle* n, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    hlt_bytes_size m = n->len;
+    hlt_bytes* c = i.bytes;
+    const int8_t* cur = i.cur;
+
+    for ( ; c && ! __get_object(c); c = c->next, cur = c ? c->start : 0 ) {
+        hlt_bytes_size len = c->end - cur;
+
+        if ( len <= 0 )
+            continue;
+
+        // Matches fully inside this chunk.
+
+        if ( m == 1 ) {
+            const int8_t* f = memchr(cur, n->data[0], len);
+
+            if ( f ) {
+                *p = __create_iterator(c, (int8_t*)f);
+                return 1;
+            }
+
+            continue;
+        }
 
+        if ( len >= m ) {
+            const int8_t* f = __search_block(cur, len, n);
+
+            if ( f ) {
+                *p = __create_iterator(c, (int8_t*)f);
+                return 1;
+            }
+        }
+
+        // Candidates that cross into the next chunk(s).
+
+        const int8_t* end = c->end;
+        const int8_t* f = (len >= m) ? end - m + 1 : cur;
+
+        while ( (f = memchr(f, n->data[0], end - f)) ) {
+            int8_t rc = __search_match_across(c, f, n);
+
+            if ( rc != 0 ) {
+                *p = __create_iterator(c, (int8_t*)f);
+                return rc;
+            }
+
+            ++f;
+        }
+    }
+
+    __hlt_bytes_end(p, i.bytes, excpt, ctx);
+    return 0;
+}
+
+int8_t __hlt_bytes_find_bytes(hlt_iterator_bytes* p, hlt_bytes* b, hlt_bytes* other, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( __is_empty(other, false) ) {
+        // Empty pattern returns start position.
+        __hlt_bytes_begin(p, b, excpt, ctx);
+        return 1;
+    }
+
+    hlt_iterator_bytes i;
+    __hlt_bytes_begin(&i, b, excpt, ctx);
+
+    __hlt_bytes_needle n;
+    __search_needle_init(&n, other);
+    int8_t rc = __search(p, i, &n, excpt, ctx);
+    __search_needle_done(&n);
+
+    if ( rc > 0 )
+        // Found.
+        return 1;
+
+    // Not found, including partial matches at the end.
     __hlt_bytes_end(p, b, excpt, ctx);
     return 0;
 }
@@ -1085,45 +1483,22 @@ hlt_bytes_find_at_iter_result hlt_bytes_find_bytes_at_iter(hlt_iterator_bytes i,
         return r;
     }
 
-    hlt_iterator_bytes nbegin;
-    __hlt_bytes_begin(&nbegin, needle, excpt, ctx);
-    int8_t chr = *nbegin.cur;
-
     __normalize_iter(&r.iter);
 
-    while ( 1 ) {
-        __hlt_bytes_find_byte_from(&r.iter, r.iter, chr, excpt, ctx);
-
-        if ( __is_end(r.iter) ) {
-            // Not found. Leave r.iter at end.
-            r.success = 0;
-            break;
-        }
-
-        int rc = __hlt_bytes_match_at(r.iter, needle, excpt, ctx);
-
-        if ( rc > 0 ) {
-            // Found. Leave r.iter at start position.
-            r.success = 1;
-            break;
-        }
+    if ( ! r.iter.bytes ) {
+        // Generic end position.
+        r.success = 0;
+        return r;
+    }
 
-        if ( rc == -1 ) {
-            // Out of input, may still match. Leave r.iter at start position.
-            r.success = 0;
-            break;
-        }
+    __hlt_bytes_needle n;
+    __search_needle_init(&n, needle);
 
-        // Not found, advance.
+    // If not found, leaves r.iter at the end; if out of input but may still
+    // match, leaves r.iter at start position of the partial match.
+    r.success = (__search(&r.iter, r.iter, &n, excpt, ctx) > 0);
 
-        __hlt_iterator_bytes_incr(&r.iter, excpt, ctx, 0);
-
-        if ( __is_end(r.iter) ) {
-            // Not found. Leave r.iter at end.
-            r.success = 0;
-            break;
-        }
-    }
+    __search_needle_done(&n);
 
     return r;
 }
@@ -1349,7 +1724,7 @@ int8_t __hlt_bytes_extract_one_slowpath(hlt_iterator_bytes* p, hlt_iterator_byte
 // We optimize this for the common case and keep it small for inlining.
 int8_t __hlt_bytes_extract_one(hlt_iterator_bytes* p, hlt_iterator_bytes end, hlt_exception** excpt, hlt_execution_context* ctx)
 {
-    if ( p->bytes && ! __get_object(p->bytes) ) {
+    if ( p->bytes && ! (p->bytes->flags & (_BYTES_FLAG_OBJECT | _BYTES_FLAG_MOVED)) ) {
         if ( (p->bytes == end.bytes && (p->cur < end.cur - 1)) ||
              (p->bytes != end.bytes && (p->cur < p->bytes->end - 1)) )
                 return *(p->cur++);
@@ -1358,6 +1733,21 @@ int8_t __hlt_bytes_extract_one(hlt_iterator_bytes* p, hlt_iterator_bytes end, hl
     return __hlt_bytes_extract_one_slowpath(p, end, excpt, ctx);
 }
 
+// Also kept small for inlining.
+int8_t* __hlt_bytes_extract_n(hlt_iterator_bytes* p, hlt_iterator_bytes end, int64_t n, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( p->bytes && ! (p->bytes->flags & (_BYTES_FLAG_OBJECT | _BYTES_FLAG_MOVED)) ) {
+        if ( (p->bytes == end.bytes && (p->cur + n < end.cur)) ||
+             (p->bytes != end.bytes && (p->cur + n < p->bytes->end)) ) {
+            int8_t* data = p->cur;
+            p->cur += n;
+            return data;
+        }
+    }
+
+    return 0;
+}
+
 hlt_iterator_bytes hlt_bytes_offset(hlt_bytes* b, hlt_bytes_size p, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     if ( ! b ) {
@@ -1451,8 +1841,18 @@ void hlt_bytes_trim(hlt_bytes* b, hlt_iterator_bytes p, hlt_exception** excpt, h
 
     __hlt_bytes_object *o = p.bytes ? __get_object(p.bytes) : 0;
 
-    if ( __is_end(p) && ! o )
+    if ( __is_end(p) && ! o ) {
+        // We leave the chunks in place, but borrowed data is marked as
+        // consumed so that hlt_bytes_unborrow() won't need to copy it.
+        for ( hlt_bytes* c = b; c && ! __get_object(c); c = c->next ) {
+            if ( c->flags & _BYTES_FLAG_BORROWED ) {
+                c->offset += (c->end - c->start);
+                c->start = c->end;
+            }
+        }
+
         return;
+    }
 
     // Check if within first block, we just adjust the start pointer there
     // then.
@@ -1487,6 +1887,7 @@ void hlt_bytes_trim(hlt_bytes* b, hlt_iterator_bytes p, hlt_exception** excpt, h
     else if ( b->to_free ) {
         hlt_free(b->to_free);
         b->to_free = 0;
+        b->flags &= ~_BYTES_FLAG_MOVED;
 
         if ( b->marks )
             hlt_free(b->marks);
@@ -97,6 +97,20 @@ extern hlt_bytes* hlt_bytes_new_from_data(int8_t* data, hlt_bytes_size len, hlt_
 /// Returns: The new bytes object.
 extern hlt_bytes* hlt_bytes_new_from_data_copy(const int8_t* data, hlt_bytes_size len, hlt_exception** excpt, hlt_execution_context* ctx);
 
+/// Like hlt_new_bytes_from_data(), but neither takes ownership of data nor
+/// copies it: the bytes object refers to the caller's memory directly. The
+/// memory must remain valid and unchanged until the caller has called
+/// hlt_bytes_unborrow() on the returned object.
+///
+/// data: Pointer to the raw bytes.
+///
+/// len: Number of raw byes starting at *data*.
+///
+/// \hlt_c
+///
+/// Returns: The new bytes object.
+extern hlt_bytes* hlt_bytes_new_from_data_borrowed(int8_t* data, hlt_bytes_size len, hlt_exception** excpt, hlt_execution_context* ctx);
+
 /// Returns the number of individual bytes stored in a bytes object.
 ///
 /// b: The bytes object.
@@ -171,6 +185,36 @@ extern void hlt_bytes_append_raw(hlt_bytes* b, int8_t* raw, hlt_bytes_size len,
 /// Raises: ValueError - If *b* has been frozen.
 extern void hlt_bytes_append_raw_copy(hlt_bytes* b, int8_t* raw, hlt_bytes_size len, hlt_exception** excpt, hlt_execution_context* ctx);
 
+/// Appends a sequence of raw bytes in memory to a bytes object without
+/// copying it, nor taking ownership. The memory must remain valid and
+/// unchanged until the caller has called hlt_bytes_unborrow() on the
+/// returned chunk.
+///
+/// b: The bytes object to append to.
+///
+/// raw: A pointer to the beginning of the byte sequence to append.
+///
+/// len: The number of bytes to append starting from *raw*. \hlt_c
+///
+/// Returns: A handle for the part of *b* now referring to *raw*, to be
+/// passed to hlt_bytes_unborrow(). Null if *len* is zero.
+///
+/// Raises: ValueError - If *b* has been frozen.
+extern hlt_bytes* hlt_bytes_append_raw_borrowed(hlt_bytes* b, int8_t* raw, hlt_bytes_size len, hlt_exception** excpt, hlt_execution_context* ctx);
+
+/// Releases memory previously passed to hlt_bytes_new_from_data_borrowed()
+/// or hlt_bytes_append_raw_borrowed(). If parts of the data may still be
+/// accessed later, through the bytes object or iterators into it, they are
+/// copied now; otherwise no copy is made. Afterwards, the caller is free to
+/// reuse its memory.
+///
+/// b: The object returned by one of the two functions.
+///
+/// \hlt_c
+///
+/// Returns: The number of bytes that had to be copied.
+extern hlt_bytes_size hlt_bytes_unborrow(hlt_bytes* b, hlt_exception** excpt, hlt_execution_context* ctx);
+
 /// Searches for the first occurance of a specific byte in a bytes object. 
 ///
 /// b: The bytes object to search.
@@ -299,6 +343,23 @@ extern int8_t* hlt_bytes_to_raw(int8_t* dst, size_t dst_len, hlt_bytes* b, hlt_e
 /// should be optimized away. Check that.
 extern int8_t __hlt_bytes_extract_one(hlt_iterator_bytes* pos, hlt_iterator_bytes end, hlt_exception** excpt, hlt_execution_context* ctx);
 
+/// Returns a pointer to the next *n* bytes if they are all available
+/// contiguously inside the chunk the iterator is pointing into, and advances
+/// the iterator past them. If they aren't, returns null and leaves the
+/// iterator unchanged; the caller then needs to fall back to
+/// __hlt_bytes_extract_one(). Never raises an exception.
+///
+/// pos: The position where to start extracting.
+///
+/// end: The position of the end of the data range.
+///
+/// n: The number of bytes to extract.
+///
+/// Returns: The pointer to the first of the bytes, or null.
+///
+/// Note: This is used by ``unpack`` to read an integer with a single load.
+extern int8_t* __hlt_bytes_extract_n(hlt_iterator_bytes* pos, hlt_iterator_bytes end, int64_t n, hlt_exception** excpt, hlt_execution_context* ctx);
+
 /// Creates a new position object representing a specific offset.
 ///
 /// b: The bytes object to create the position for.
@@ -632,6 +693,18 @@ extern void hlt_bytes_upper_hoisted(__hlt_bytes_hoisted* dst, hlt_bytes* b, hlt_
 extern void hlt_bytes_strip_hoisted(__hlt_bytes_hoisted* dst, hlt_bytes* b, hlt_enum side, hlt_bytes* p, hlt_exception** excpt, hlt_execution_context* ctx);
 extern void hlt_bytes_join_hoisted(__hlt_bytes_hoisted* dst, hlt_bytes* sep, hlt_list* l, hlt_exception** excpt, hlt_execution_context* ctx);
 
+// Internal function creating a bytes object with room for \a reserve bytes
+// of inline data, for recycling through __hlt_bytes_reuse(). The object is
+// returned at +1.
+extern hlt_bytes* __hlt_bytes_new_reusable(hlt_bytes_size reserve, hlt_execution_context* ctx);
+
+// Internal function resetting a bytes object created by
+// __hlt_bytes_new_reusable() to a copy of \a data, as if it had just been
+// created. Must only be called when nobody else holds a reference to the
+// object, including through iterators. Returns false, and leaves the object
+// unchanged, if it doesn't have room for \a len bytes.
+extern int8_t __hlt_bytes_reuse(hlt_bytes* b, const int8_t* data, hlt_bytes_size len, hlt_execution_context* ctx);
+
 /// XXX
 
 /// @}
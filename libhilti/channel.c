@@ -168,6 +168,9 @@ static inline int _hlt_channel_write_item(hlt_channel* ch, void* data, hlt_excep
     GC_CCTOR_GENERIC(shared->tail, shared->type, ctx);
 #endif
 
+    // The reader may be running in a different thread.
+    GC_SHARE_GENERIC(shared->tail, shared->type, ctx);
+
     ++shared->wc->wcnt;
 
     shared->tail += shared->type->size;
@@ -6,6 +6,7 @@
 #include "classifier.h"
 #include "memory_.h"
 #include "debug.h"
+#include "hutil.h"
 
 typedef struct {
     int64_t priority;
@@ -13,6 +14,23 @@ typedef struct {
     void* value;
 } hlt_classifier_rule;
 
+// A set of rules that all compare the same number of bits and require the
+// same minimum value length for each of their fields. For a lookup, we mask
+// the values accordingly and then find the matching rule (if any) with a
+// single hash lookup. This is the "tuple space search" scheme: the number of
+// such sets usually remains small even for large rule sets, as rules tend
+// to share only a few distinct prefix lengths.
+typedef struct {
+    uint64_t* lens;              // Minimum value length per field.
+    uint64_t* bits;              // Number of bits compared per field.
+    int64_t key_len;             // Length of the masked key.
+    int64_t max_prio;            // Highest priority of all rules in the set.
+    uint64_t size;               // Number of hash slots; a power of two.
+    hlt_classifier_rule** slots; // The rules; null if slot is empty.
+    hlt_hash* hashes;            // The hash of each slot's key.
+    uint8_t* keys;               // key_len bytes for each slot.
+} hlt_classifier_tuple;
+
 struct __hlt_classifier {
     __hlt_gchdr __gchdr;   // Header for memory management.
     int64_t num_fields;
@@ -24,10 +42,34 @@ struct __hlt_classifier {
     int64_t num_rules;
     int64_t max_rules;
     hlt_classifier_rule** rules;
+
+    int8_t linear;                  // If true, lookups always scan the rules linearly.
+    int64_t num_tuples;
+    int64_t max_key_len;            // Largest key_len of all tuples.
+    hlt_classifier_tuple** tuples;  // Sorted by decreasing max_prio.
 };
 
+static void _tuples_delete(hlt_classifier* c)
+{
+    for ( int i = 0; i < c->num_tuples; i++ ) {
+        hlt_classifier_tuple* t = c->tuples[i];
+        hlt_free(t->lens);
+        hlt_free(t->slots);
+        hlt_free(t->hashes);
+        hlt_free(t->keys);
+        hlt_free(t);
+    }
+
+    hlt_free(c->tuples);
+    c->tuples = 0;
+    c->num_tuples = 0;
+    c->max_key_len = 0;
+}
+
 void hlt_classifier_dtor(hlt_type_info* ti, hlt_classifier* c, hlt_execution_context* ctx)
 {
+    _tuples_delete(c);
+
     if ( ! c->rules )
         return;
 
@@ -57,6 +99,11 @@ static inline void _hlt_classifier_init(hlt_classifier* c, int64_t num_fields, c
     c->num_rules = 0;
     c->max_rules = 0;
     c->rules = 0;
+
+    c->linear = 0;
+    c->num_tuples = 0;
+    c->max_key_len = 0;
+    c->tuples = 0;
 }
 
 hlt_classifier* hlt_classifier_new(int64_t num_fields, const hlt_type_info* rtype, const hlt_type_info* vtype, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -137,12 +184,231 @@ static int cmp_rules(const void* p1, const void* p2)
     return ((*r2)->priority - (*r1)->priority);
 }
 
-void hlt_classifier_compile(hlt_classifier* c, hlt_exception** excpt, hlt_execution_context* ctx)
+// Returns the number of leading bits that a rule's field compares.
+static inline uint64_t _field_bits(hlt_classifier_field* field)
+{
+    return field->bits < field->len * 8 ? field->bits : field->len * 8;
+}
+
+// Copies the leading bits of each field into a key, masking out the
+// remaining bits of the final byte.
+static void _make_key(hlt_classifier* c, hlt_classifier_tuple* t, hlt_classifier_field** fields, uint8_t* key)
+{
+    for ( int i = 0; i < c->num_fields; i++ ) {
+        uint64_t bits = t->bits[i];
+
+        if ( ! bits )
+            continue;
+
+        uint64_t bytes = (bits + 7) / 8;
+        memcpy(key, fields[i]->data, bytes);
+
+        if ( bits % 8 )
+            key[bytes - 1] &= (uint8_t)(0xff << (8 - bits % 8));
+
+        key += bytes;
+    }
+}
+
+static hlt_hash _hash_key(const uint8_t* key, int64_t len)
+{
+    hlt_hash hash = 0;
+
+    // hlt_hash_bytes() takes only 16-bit lengths.
+    while ( len > 0x4000 ) {
+        hash = hlt_hash_bytes((const int8_t*)key, 0x4000, hash);
+        key += 0x4000;
+        len -= 0x4000;
+    }
+
+    return hlt_hash_bytes((const int8_t*)key, len, hash);
+}
+
+// Returns the slot of the given key, which is either the one holding it or
+// the empty one where to insert it.
+static inline uint64_t _tuple_slot(hlt_classifier_tuple* t, const uint8_t* key, hlt_hash hash)
+{
+    uint64_t mask = t->size - 1;
+
+    for ( uint64_t i = hash & mask; ; i = (i + 1) & mask ) {
+        if ( ! t->slots[i] )
+            return i;
+
+        if ( t->hashes[i] == hash && memcmp(t->keys + i * t->key_len, key, t->key_len) == 0 )
+            return i;
+    }
+}
+
+typedef struct {
+    hlt_classifier_rule* rule;
+    int64_t num_fields;
+} _rule_ref;
+
+// Orders rules by the bits and lengths of their fields, and then by priority.
+static int cmp_rules_by_tuple(const void* p1, const void* p2)
+{
+    const _rule_ref* r1 = (const _rule_ref*) p1;
+    const _rule_ref* r2 = (const _rule_ref*) p2;
+
+    for ( int i = 0; i < r1->num_fields; i++ ) {
+        hlt_classifier_field* f1 = r1->rule->fields[i];
+        hlt_classifier_field* f2 = r2->rule->fields[i];
+
+        uint64_t b1 = _field_bits(f1);
+        uint64_t b2 = _field_bits(f2);
+
+        if ( b1 != b2 )
+            return b1 < b2 ? -1 : 1;
+
+        if ( f1->len != f2->len )
+            return f1->len < f2->len ? -1 : 1;
+    }
+
+    if ( r1->rule->priority != r2->rule->priority )
+        return r1->rule->priority > r2->rule->priority ? -1 : 1;
+
+    return 0;
+}
+
+// Compare tuples by their highest priority for sorting.
+static int cmp_tuples(const void* p1, const void* p2)
+{
+    hlt_classifier_tuple** t1 = (hlt_classifier_tuple**) p1;
+    hlt_classifier_tuple** t2 = (hlt_classifier_tuple**) p2;
+
+    // Reverse sort.
+    if ( (*t1)->max_prio != (*t2)->max_prio )
+        return (*t1)->max_prio > (*t2)->max_prio ? -1 : 1;
+
+    return 0;
+}
+
+// Returns true if two rules compare the same bits and lengths for all fields.
+static int8_t _same_layout(hlt_classifier* c, hlt_classifier_rule* r1, hlt_classifier_rule* r2)
+{
+    for ( int i = 0; i < c->num_fields; i++ ) {
+        hlt_classifier_field* f1 = r1->fields[i];
+        hlt_classifier_field* f2 = r2->fields[i];
+
+        if ( _field_bits(f1) != _field_bits(f2) || f1->len != f2->len )
+            return 0;
+    }
+
+    return 1;
+}
+
+// Builds a tuple for rules[0..n-1], which must all share the same field
+// layout and be sorted by decreasing priority.
+static hlt_classifier_tuple* _tuple_new(hlt_classifier* c, _rule_ref* rules, int64_t n)
+{
+    hlt_classifier_tuple* t = hlt_malloc(sizeof(hlt_classifier_tuple));
+    t->lens = hlt_malloc(2 * c->num_fields * sizeof(uint64_t));
+    t->bits = t->lens + c->num_fields;
+    t->key_len = 0;
+    t->max_prio = rules[0].rule->priority;
+
+    for ( int i = 0; i < c->num_fields; i++ ) {
+        hlt_classifier_field* f = rules[0].rule->fields[i];
+        t->lens[i] = f->len;
+        t->bits[i] = _field_bits(f);
+        t->key_len += (t->bits[i] + 7) / 8;
+    }
+
+    // Keep the load factor at or below 1/2.
+    t->size = 2;
+
+    while ( t->size < 2 * n )
+        t->size *= 2;
+
+    t->slots = hlt_calloc(t->size, sizeof(hlt_classifier_rule*));
+    t->hashes = hlt_malloc(t->size * sizeof(hlt_hash));
+    t->keys = hlt_malloc(t->size * (t->key_len ? t->key_len : 1));
+
+    uint8_t* key = hlt_malloc(t->key_len ? t->key_len : 1);
+
+    for ( int64_t j = 0; j < n; j++ ) {
+        hlt_classifier_rule* r = rules[j].rule;
+
+        _make_key(c, t, r->fields, key);
+        hlt_hash hash = _hash_key(key, t->key_len);
+        uint64_t i = _tuple_slot(t, key, hash);
+
+        if ( t->slots[i] )
+            // A rule with at least the same priority has the same key already.
+            continue;
+
+        t->slots[i] = r;
+        t->hashes[i] = hash;
+        memcpy(t->keys + i * t->key_len, key, t->key_len);
+    }
+
+    hlt_free(key);
+
+    if ( t->key_len > c->max_key_len )
+        c->max_key_len = t->key_len;
+
+    return t;
+}
+
+static void _compile(hlt_classifier* c, int8_t linear)
 {
+    // We may be compiled a second time, starting over then.
+    _tuples_delete(c);
+
     c->compiled = 1;
+    c->linear = linear;
 
     // Sort rules by priority.
     qsort(c->rules, c->num_rules, sizeof(hlt_classifier_rule*), cmp_rules);
+
+    if ( linear || ! c->num_rules )
+        return;
+
+    // Group the rules into tuples.
+    _rule_ref* refs = hlt_malloc(c->num_rules * sizeof(_rule_ref));
+
+    for ( int64_t i = 0; i < c->num_rules; i++ ) {
+        refs[i].rule = c->rules[i];
+        refs[i].num_fields = c->num_fields;
+    }
+
+    qsort(refs, c->num_rules, sizeof(_rule_ref), cmp_rules_by_tuple);
+
+    int64_t max_tuples = 0;
+
+    for ( int64_t i = 0; i < c->num_rules; ) {
+        int64_t j = i + 1;
+
+        while ( j < c->num_rules && _same_layout(c, refs[i].rule, refs[j].rule) )
+            j++;
+
+        if ( c->num_tuples >= max_tuples ) {
+            // Grow tuple array.
+            int64_t old_max_tuples = max_tuples;
+            max_tuples = (old_max_tuples ? old_max_tuples * 2 : 8);
+            c->tuples = (hlt_classifier_tuple**) hlt_realloc(c->tuples, max_tuples * sizeof(hlt_classifier_tuple*), old_max_tuples * sizeof(hlt_classifier_tuple*));
+        }
+
+        c->tuples[c->num_tuples++] = _tuple_new(c, refs + i, j - i);
+        i = j;
+    }
+
+    hlt_free(refs);
+
+    // Sort tuples by priority so that lookups can stop early.
+    qsort(c->tuples, c->num_tuples, sizeof(hlt_classifier_tuple*), cmp_tuples);
+
+    DBG_LOG("hilti-classifier", "%s: %d rules in %d tuples for classifier %p", "classifier_compile", c->num_rules, c->num_tuples, c);
+}
+
+void hlt_classifier_compile(hlt_classifier* c, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    _compile(c, 0);
+}
+
+void __hlt_classifier_compile_linear(hlt_classifier* c, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    _compile(c, 1);
 }
 
 static int8_t match_single_rule(hlt_classifier* c, hlt_classifier_rule* r, hlt_classifier_field** vals)
@@ -159,25 +425,92 @@ static int8_t match_single_rule(hlt_classifier* c, hlt_classifier_rule* r, hlt_c
             // Can't match.
             return 0;
 
+        uint64_t bits = _field_bits(field);
+
         // Compare complete bytes.
-        int bytes = (field->bits + 8 - 1) / 8;
-        if ( bytes > 1 && memcmp(&field->data, &val->data, bytes - 1) != 0 )
+        uint64_t bytes = bits / 8;
+        if ( bytes && memcmp(field->data, val->data, bytes) != 0 )
             // No match.
             return 0;
 
         // Compare "fractional" bits.
-        uint8_t bits = field->bits - ((bytes - 1) * 8) - 1;
-        uint8_t mask = 0xff << (8 - bits);
+        if ( bits % 8 ) {
+            uint8_t mask = 0xff << (8 - bits % 8);
 
-        if ( (val->data[bytes - 1] & mask) != (field->data[bytes - 1] & mask) )
-             // No match.
-            return 0;
+            if ( (val->data[bytes] & mask) != (field->data[bytes] & mask) )
+                // No match.
+                return 0;
+        }
     }
 
     // All fields matched.
     return 1;
 }
 
+// Returns the highest-priority rule matching the values, or null if none.
+// If first is true, returns the first match found, whatever its priority.
+static hlt_classifier_rule* _lookup(hlt_classifier* c, hlt_classifier_field** vals, int8_t first)
+{
+    int8_t linear = c->linear;
+
+    for ( int i = 0; i < c->num_fields && ! linear; i++ ) {
+        // We can't hash wildcards in values.
+        if ( ! vals[i]->bits )
+            linear = 1;
+    }
+
+    if ( linear ) {
+        for ( int i = 0; i < c->num_rules; i++ ) {
+            if ( match_single_rule(c, c->rules[i], vals) )
+                return c->rules[i];
+        }
+
+        return 0;
+    }
+
+    uint8_t buffer[256];
+    uint8_t* key = (c->max_key_len <= sizeof(buffer) ? buffer : hlt_malloc(c->max_key_len));
+
+    hlt_classifier_rule* best = 0;
+
+    for ( int i = 0; i < c->num_tuples; i++ ) {
+        hlt_classifier_tuple* t = c->tuples[i];
+
+        if ( best && t->max_prio <= best->priority )
+            // Can't find anything better anymore.
+            break;
+
+        int j;
+
+        for ( j = 0; j < c->num_fields; j++ ) {
+            if ( vals[j]->len < t->lens[j] )
+                break;
+        }
+
+        if ( j < c->num_fields )
+            // Values too short.
+            continue;
+
+        _make_key(c, t, vals, key);
+        hlt_hash hash = _hash_key(key, t->key_len);
+        hlt_classifier_rule* r = t->slots[_tuple_slot(t, key, hash)];
+
+        if ( ! r )
+            continue;
+
+        if ( ! best || r->priority > best->priority )
+            best = r;
+
+        if ( first )
+            break;
+    }
+
+    if ( key != buffer )
+        hlt_free(key);
+
+    return best;
+}
+
 int8_t hlt_classifier_matches(hlt_classifier* c, hlt_classifier_field** vals, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     if ( ! c->compiled ) {
@@ -190,11 +523,11 @@ int8_t hlt_classifier_matches(hlt_classifier* c, hlt_classifier_field** vals, hl
     dbg_print_fields(c, "classifier_matches", vals);
 #endif
 
-    for ( int i = 0; i < c->num_rules; i++ ) {
-        if ( match_single_rule(c, c->rules[i], vals) ) {
-            DBG_LOG("hilti-classifier", "%s: match found with rule %p", "classifier_matches", c->rules[i]);
-            return 1;
-        }
+    hlt_classifier_rule* r = _lookup(c, vals, 1);
+
+    if ( r ) {
+        DBG_LOG("hilti-classifier", "%s: match found with rule %p", "classifier_matches", r);
+        return 1;
     }
 
     DBG_LOG("hilti-classifier", "%s: no match", "classifier_matches");
@@ -213,11 +546,11 @@ void* hlt_classifier_get(hlt_classifier* c, hlt_classifier_field** vals, hlt_exc
     dbg_print_fields(c, "classifier_get", vals);
 #endif
 
-    for ( int i = 0; i < c->num_rules; i++ ) {
-        if ( match_single_rule(c, c->rules[i], vals) ) {
-            DBG_LOG("hilti-classifier", "%s: match found with rule %p", "classifier_get", c->rules[i]);
-            return c->rules[i]->value;
-        }
+    hlt_classifier_rule* r = _lookup(c, vals, 0);
+
+    if ( r ) {
+        DBG_LOG("hilti-classifier", "%s: match found with rule %p", "classifier_get", r);
+        return r->value;
     }
 
     DBG_LOG("hilti-classifier", "%s: no match", "classifier_get");
@@ -225,4 +558,3 @@ void* hlt_classifier_get(hlt_classifier* c, hlt_classifier_field** vals, hlt_exc
     hlt_set_exception(excpt, &hlt_exception_index_error, 0, ctx);
     return 0;
 }
-
@@ -74,6 +74,14 @@ extern void hlt_classifier_add_no_prio(hlt_classifier* c, hlt_classifier_field**
 /// excpt: &
 extern void hlt_classifier_compile(hlt_classifier* c, hlt_exception** excpt, hlt_execution_context* ctx);
 
+/// Like ~~hlt_classifier_compile, but subsequent lookups will check all
+/// rules one by one. This is for benchmarking only.
+///
+/// c: The classifier.
+///
+/// excpt: &
+extern void __hlt_classifier_compile_linear(hlt_classifier* c, hlt_exception** excpt, hlt_execution_context* ctx);
+
 /// Returns true if their as rule matching the given key. For each key field,
 /// this performs a longest-matching-prefix match.
 ///
@@ -41,6 +41,9 @@ void hlt_clone_for_thread(void* dstp, const hlt_type_info* ti, const void* srcp,
         return;
 
     _slowpath_clone(dstp, ti, srcp, __HLT_CLONE_DEEP, vid, excpt, ctx);
+
+    // The copy is created here but handed over to another thread.
+    GC_SHARE_GENERIC(dstp, ti, ctx);
 }
 
 void __hlt_clone(void* dstp, const hlt_type_info* ti, const void* srcp, __hlt_clone_state* cstate, hlt_exception** excpt, hlt_execution_context* ctx)
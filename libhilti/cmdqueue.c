@@ -10,6 +10,7 @@
 #include "config.h"
 #include "context.h"
 #include "debug.h"
+#include "file.h"
 #include "globals.h"
 #include "system.h"
 #include "threading.h"
@@ -101,11 +102,16 @@ void __hlt_cmd_worker_terminating(int worker)
     if ( ! hlt_is_multi_threaded() )
         return;
 
+    __hlt_files_flush(worker);
+
     hlt_thread_queue_terminate_writer(__hlt_globals()->cmd_queue, worker);
 }
 
 void __hlt_cmd_queue_done()
 {
+    // Pass on what the main thread still has buffered.
+    __hlt_files_flush(0);
+
     if ( ! hlt_is_multi_threaded() )
         return;
 
@@ -140,6 +146,11 @@ void __hlt_cmdqueue_init_cmd(__hlt_cmd *cmd, uint16_t type)
 }
 
 void __hlt_cmdqueue_push(__hlt_cmd *cmd, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    __hlt_cmdqueue_push_writer(cmd, ctx->worker ? ctx->worker->id : 0, excpt, ctx);
+}
+
+void __hlt_cmdqueue_push_writer(__hlt_cmd *cmd, int writer, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     if ( ! hlt_is_multi_threaded() ) {
         DBG_LOG(DBG_STREAM_QUEUE, "directly executing cmd %p of type %d", cmd, cmd->type);
@@ -148,7 +159,7 @@ void __hlt_cmdqueue_push(__hlt_cmd *cmd, hlt_exception** excpt, hlt_execution_co
 
     else {
         DBG_LOG(DBG_STREAM_QUEUE, "queuing cmd %p of type %d", cmd, cmd->type);
-        hlt_thread_queue_write(__hlt_globals()->cmd_queue, ctx->worker ? ctx->worker->id : 0, cmd);
+        hlt_thread_queue_write(__hlt_globals()->cmd_queue, writer, cmd);
     }
 }
 
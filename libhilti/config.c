@@ -29,6 +29,12 @@ hlt_config* __hlt_default_config()
     cfg->thread_stack_size = 2684354560; // This is generous.
     cfg->fiber_stack_size = 100 * 1024 * 1024; // This is generous.
     cfg->fiber_max_pool_size = 1000;
+    cfg->fiber_switch = HLT_FIBER_SWITCH_ASM;
+    cfg->job_queue = HLT_JOB_QUEUE_BATCHED;
+    cfg->scheduler = HLT_SCHEDULER_HASH;
+    cfg->timer_granularity = 0;
+    cfg->file_buffer_size = 64 * 1024;
+    cfg->time_file_flush = 1.0;
     cfg->debug_out = "hlt-debug.log";
     cfg->debug_streams = dbg;
     cfg->profiling = (profile && *profile);
@@ -9,6 +9,24 @@
 
 #include "types.h"
 
+/// Mechanisms for switching between fibers.
+typedef enum {
+    HLT_FIBER_SWITCH_ASM,      ///< Hand-written routines saving only callee-saved registers. x86-64 and AArch64 only.
+    HLT_FIBER_SWITCH_UCONTEXT  ///< ucontext(3) and setjmp(3). Portable, but slower.
+} hlt_fiber_switch_type;
+
+/// Implementations of the worker threads' job queues.
+typedef enum {
+    HLT_JOB_QUEUE_BATCHED,     ///< Writers pass on batches of jobs under a lock.
+    HLT_JOB_QUEUE_RINGS        ///< A lock-free ring per writer; the reader parks when idle.
+} hlt_job_queue_type;
+
+/// Strategies for mapping virtual threads to worker threads.
+typedef enum {
+    HLT_SCHEDULER_HASH,        ///< Each virtual thread always runs on the worker its ID hashes to.
+    HLT_SCHEDULER_STEALING     ///< Idle workers steal ready virtual threads from busy ones.
+} hlt_scheduler_type;
+
 /// Configuration parameters for the HILTI runtime system..
 struct __hlt_config
 {
@@ -30,6 +48,36 @@ struct __hlt_config
     /// Maximum size of pool of recycalable fibers.
     size_t fiber_max_pool_size;
 
+    /// How to switch between fibers. Default is HLT_FIBER_SWITCH_ASM; on
+    /// platforms where that's not available, HILTI always uses
+    /// HLT_FIBER_SWITCH_UCONTEXT.
+    hlt_fiber_switch_type fiber_switch;
+
+    /// Which queue to use for passing jobs to worker threads. Default is
+    /// HLT_JOB_QUEUE_BATCHED.
+    hlt_job_queue_type job_queue;
+
+    /// How to map virtual threads to worker threads. Default is
+    /// HLT_SCHEDULER_HASH.
+    hlt_scheduler_type scheduler;
+
+    /// If non-zero, the timer managers of execution contexts use a timing
+    /// wheel with buckets of this many seconds, rather than a priority
+    /// queue. Default is zero.
+    double timer_granularity;
+
+    /// Bytes each thread buffers per file before passing its writes on to
+    /// the command queue. Zero passes on every write right away. Default is
+    /// 64KB.
+    size_t file_buffer_size;
+
+    /// Seconds after which a thread passes on buffered writes to a file
+    /// even if the buffer isn't full yet. This is checked when writing, and
+    /// periodically by worker threads while they process jobs. Buffers are
+    /// also passed on when a file is closed and when a thread is idle or
+    /// terminates. Default is 1.0.
+    double time_file_flush;
+
     /// File where debug output is to be sent. Default is stderr.
     const char* debug_out;
 
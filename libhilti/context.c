@@ -26,7 +26,12 @@ hlt_execution_context* __hlt_execution_context_new_ref(hlt_vthread_id vid, int8_
     ctx->tcontext_type = 0;
     ctx->pstate = 0;
     ctx->blockable = 0;
-    ctx->tmgr = hlt_timer_mgr_new(&ctx->excpt, ctx);
+
+    if ( hlt_config_get()->timer_granularity > 0 )
+        ctx->tmgr = hlt_timer_mgr_new_wheel(hlt_interval_from_timestamp(hlt_config_get()->timer_granularity), &ctx->excpt, ctx);
+    else
+        ctx->tmgr = hlt_timer_mgr_new(&ctx->excpt, ctx);
+
     GC_CCTOR(ctx->tmgr, hlt_timer_mgr, ctx);
 
     __hlt_globals_init(ctx);
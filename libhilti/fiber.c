@@ -4,6 +4,7 @@
 //
 
 #include <stdio.h>
+#include <string.h>
 #include <setjmp.h>
 
 #include "fiber.h"
@@ -15,10 +16,23 @@
 
 #include "3rdparty/libtask/taskimpl.h"
 
+#if defined(__x86_64__) || defined(__aarch64__)
+#define HAVE_ASM_SWITCH 1
+
+// Implemented in fiber-switch.S.
+extern void __hlt_fiber_switch(void** save_sp, void* new_sp);
+extern void __hlt_fiber_entry();
+#endif
+
 enum __hlt_fiber_state { INIT, RUNNING, YIELDED, IDLE, FINISHED };
 
 struct __hlt_fiber {
     enum __hlt_fiber_state state;
+    int8_t asm_switch;        // True if using __hlt_fiber_switch() rather than ucontext.
+    void* sp;                 // With asm_switch, the fiber's stack pointer while suspended.
+    void* parent_sp;          // With asm_switch, the parent's stack pointer while the fiber runs.
+    void* stack;
+    size_t stack_size;
     ucontext_t uctx;
     jmp_buf fiber;
     jmp_buf trampoline;
@@ -38,20 +52,47 @@ struct __hlt_fiber_pool {
 static void __hlt_fiber_yield(hlt_fiber* fiber, enum __hlt_fiber_state state);
 static void __hlt_fiber_return(hlt_fiber* fiber, enum __hlt_fiber_state state);
 
-static void _fiber_trampoline(unsigned int y, unsigned int x)
+// Switches from the fiber back to its parent in hlt_fiber_start(). Returns
+// once the fiber is resumed.
+static inline void _fiber_suspend(hlt_fiber* fiber)
 {
-    hlt_fiber* fiber;
+#ifdef HAVE_ASM_SWITCH
+    if ( fiber->asm_switch ) {
+        __hlt_fiber_switch(&fiber->sp, fiber->parent_sp);
+        return;
+    }
+#endif
 
-    // Magic from from libtask/task.c to turn the two words back into a pointer.
-    unsigned long z;
-    z = (x << 16);
-    z <<= 16;
-    z |= y;
-    fiber = (hlt_fiber*)z;
+    if ( ! _setjmp(fiber->fiber) )
+        _longjmp(fiber->parent, 1);
+}
 
+// Switches into the fiber, starting it if init is true. Returns once the
+// fiber suspends itself.
+static inline void _fiber_resume(hlt_fiber* fiber, int init)
+{
+#ifdef HAVE_ASM_SWITCH
+    if ( fiber->asm_switch ) {
+        __hlt_fiber_switch(&fiber->parent_sp, fiber->sp);
+        return;
+    }
+#endif
+
+    if ( ! _setjmp(fiber->parent) ) {
+        if ( init )
+            setcontext(&fiber->uctx);
+        else
+            _longjmp(fiber->fiber, 1);
+
+        abort();
+    }
+}
+
+static void _fiber_run(hlt_fiber* fiber)
+{
     // Via recycling a fiber can run an arbitrary number of user jobs. So
-    // this trampoline is really a loop that yields after it has finished its
-    // run() function, and expects a new run function once it's resumed.
+    // this is really a loop that yields after it has finished its run()
+    // function, and expects a new run function once it's resumed.
 
     while ( 1 ) {
         assert(fiber->run);
@@ -65,18 +106,70 @@ static void _fiber_trampoline(unsigned int y, unsigned int x)
             (*run)(fiber, cookie);
         }
 
-        if ( ! _setjmp(fiber->fiber) ) {
-            fiber->run = 0;
-            fiber->cookie = 0;
-            fiber->state = IDLE;
-            _longjmp(fiber->parent, 1);
-        }
+        fiber->run = 0;
+        fiber->cookie = 0;
+        fiber->state = IDLE;
+        _fiber_suspend(fiber);
     }
 
     // Cannot be reached.
     abort();
 }
 
+static void _fiber_trampoline(unsigned int y, unsigned int x)
+{
+    hlt_fiber* fiber;
+
+    // Magic from from libtask/task.c to turn the two words back into a pointer.
+    unsigned long z;
+    z = (x << 16);
+    z <<= 16;
+    z |= y;
+    fiber = (hlt_fiber*)z;
+
+    _fiber_run(fiber);
+}
+
+#ifdef HAVE_ASM_SWITCH
+
+// Prepares a new fiber's stack so that the first __hlt_fiber_switch() to it
+// continues in __hlt_fiber_entry, which then calls _fiber_run(fiber). See
+// fiber-switch.S for the layout. Returns the initial stack pointer.
+static void* _fiber_init_stack(hlt_fiber* fiber)
+{
+    uintptr_t top = ((uintptr_t)fiber->stack + fiber->stack_size) & ~(uintptr_t)15;
+
+#if defined(__x86_64__)
+    // Once the return address is popped, the stack must be 16-byte aligned
+    // for the call in __hlt_fiber_entry.
+    void** sp = (void**)(top - 16);
+    *--sp = (void*)__hlt_fiber_entry; // Return address.
+    *--sp = 0;                        // rbp
+    *--sp = 0;                        // rbx
+    *--sp = fiber;                    // r12
+    *--sp = (void*)_fiber_run;        // r13
+    *--sp = 0;                        // r14
+    *--sp = 0;                        // r15
+    --sp;
+
+    // Default MXCSR and x87 control word per the ABI.
+    ((uint32_t*)sp)[0] = 0x1f80;
+    ((uint16_t*)sp)[2] = 0x037f;
+    ((uint16_t*)sp)[3] = 0;
+    return sp;
+
+#elif defined(__aarch64__)
+    void** sp = (void**)(top - 160);
+    memset(sp, 0, 160);
+    sp[0] = fiber;                     // x19
+    sp[1] = (void*)_fiber_run;         // x20
+    sp[11] = (void*)__hlt_fiber_entry; // x30
+    return sp;
+#endif
+}
+
+#endif
+
 static void fatal_error(const char* msg)
 {
     fprintf(stderr, "fibers: %s\n", msg);
@@ -107,20 +200,34 @@ static hlt_fiber* __hlt_fiber_create(hlt_execution_context* ctx)
 {
     hlt_fiber* fiber = (hlt_fiber*) hlt_malloc(sizeof(hlt_fiber));
 
+    fiber->state = INIT;
+    fiber->run = 0;
+    fiber->cookie = 0;
+    fiber->context = ctx;
+    fiber->stack_size = hlt_config_get()->fiber_stack_size;
+    fiber->stack = hlt_stack_alloc(fiber->stack_size);
+    fiber->next = 0;
+
+#ifdef HAVE_ASM_SWITCH
+    if ( hlt_config_get()->fiber_switch == HLT_FIBER_SWITCH_ASM ) {
+        fiber->asm_switch = 1;
+        fiber->sp = _fiber_init_stack(fiber);
+        fiber->parent_sp = 0;
+        return fiber;
+    }
+#endif
+
+    fiber->asm_switch = 0;
+
     if ( getcontext(&fiber->uctx) < 0 ) {
         fprintf(stderr, "getcontext failed in __hlt_fiber_create\n");
         abort();
     }
 
-    fiber->state = INIT;
-    fiber->run = 0;
-    fiber->cookie = 0;
-    fiber->context = ctx;
     fiber->uctx.uc_link = 0;
-    fiber->uctx.uc_stack.ss_size = hlt_config_get()->fiber_stack_size;
-    fiber->uctx.uc_stack.ss_sp = hlt_stack_alloc(fiber->uctx.uc_stack.ss_size);
+    fiber->uctx.uc_stack.ss_size = fiber->stack_size;
+    fiber->uctx.uc_stack.ss_sp = fiber->stack;
     fiber->uctx.uc_stack.ss_flags = 0;
-    fiber->next = 0;
 
     // Magic from from libtask/task.c to turn the pointer into two words.
     unsigned long z = (unsigned long)fiber;
@@ -139,7 +246,7 @@ static void __hlt_fiber_delete(hlt_fiber* fiber)
 {
     assert(fiber->state != RUNNING);
 
-    hlt_stack_free(fiber->uctx.uc_stack.ss_sp, fiber->uctx.uc_stack.ss_size);
+    hlt_stack_free(fiber->stack, fiber->stack_size);
     hlt_free(fiber);
 }
 
@@ -281,7 +388,7 @@ void hlt_fiber_delete(hlt_fiber* fiber, hlt_execution_context* ctx)
 
 return_to_local:
 
-    hlt_stack_invalidate(fiber->uctx.uc_stack.ss_sp, fiber->uctx.uc_stack.ss_size);
+    hlt_stack_invalidate(fiber->stack, fiber->stack_size);
 
     fiber->next = fiber_pool->head;
     fiber_pool->head = fiber;
@@ -294,16 +401,8 @@ int8_t hlt_fiber_start(hlt_fiber* fiber, hlt_execution_context* ctx)
 
     __hlt_context_set_fiber(fiber->context, fiber);
 
-    if ( ! _setjmp(fiber->parent) ) {
-        fiber->state = RUNNING;
-
-        if ( init )
-            setcontext(&fiber->uctx);
-        else
-            _longjmp(fiber->fiber, 1);
-
-        abort();
-    }
+    fiber->state = RUNNING;
+    _fiber_resume(fiber, init);
 
     switch ( fiber->state ) {
      case YIELDED:
@@ -324,10 +423,8 @@ int8_t hlt_fiber_start(hlt_fiber* fiber, hlt_execution_context* ctx)
 
 void hlt_fiber_yield(hlt_fiber* fiber)
 {
-    if ( ! _setjmp(fiber->fiber) ) {
-        fiber->state = YIELDED;
-        _longjmp(fiber->parent, 1);
-    }
+    fiber->state = YIELDED;
+    _fiber_suspend(fiber);
 }
 
 void hlt_fiber_return(hlt_fiber* fiber)
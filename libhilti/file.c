@@ -3,20 +3,51 @@
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
+#include <time.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/uio.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "file.h"
+#include "config.h"
 #include "memory_.h"
 #include "globals.h"
 #include "autogen/hilti-hlt.h"
 
+// Size of the chunks that write buffers are made of.
+#define __HLT_FILE_CHUNK_SIZE (16 * 1024)
+
+// A piece of a write buffer.
+typedef struct __hlt_file_chunk {
+    struct __hlt_file_chunk* next;    // The next chunk.
+    int len;                          // Number of bytes used.
+    char data[__HLT_FILE_CHUNK_SIZE]; // The data.
+} __hlt_file_chunk;
+
+// What a thread has written to a file but not yet passed on to the command
+// queue. Each thread has its own, so no locking needed.
+typedef struct {
+    __hlt_file_chunk* head;  // The first chunk, or null if empty.
+    __hlt_file_chunk* tail;  // The chunk currently being filled.
+    int num_chunks;          // Number of chunks.
+    uint64_t len;            // Number of bytes buffered.
+    uint64_t records;        // Number of writes buffered.
+    uint64_t since;          // When the first write was buffered, in nanoseconds.
+} __hlt_file_buffer;
+
 // This struct describes one currently open file. We memory-manage this ourselves.
 struct __hlt_file_info {
     hlt_string path;    // The path of the file.
     int fd;             // The file descriptor.
     int writers;        // The number of file objects having the file open from the OS perspective.
     bool error;         // True if we run into an error.
+    __hlt_file_buffer* buffers; // Write buffers indexed by writer thread, see _writer().
+    int num_buffers;    // Number of write buffers.
+    hlt_file_stats stats; // Updated by the command queue thread only.
 
     struct __hlt_file_info* next; // We keep them in a list.
     struct __hlt_file_info* prev;
@@ -36,16 +67,33 @@ struct __hlt_file {
 typedef struct __hlt_cmd_file {
     __hlt_cmd cmd;             // The common header for all commands.
     __hlt_file_info* info;     // The file to write to.
-    int type;                  // 1 for writing data; 1 if it's a close command; and 2 for a change in parameters.
-    char* data;                // Bytes to write.
-    int len;                   // Number of bytes to write.
-
-    hlt_enum param_type;       // For type 0: The type.
-    hlt_enum param_mode;       // For type 0: The mode.
+    int type;                  // 1 for opening; 2 for writing data; and 3 for closing.
+    __hlt_file_chunk* chunks;  // For type 2: The buffer to write.
+    int num_chunks;            // For type 2: The number of chunks.
+    uint64_t len;              // For type 2: The number of bytes to write.
+    uint64_t records;          // For type 2: The number of writes in the buffer.
+
+    hlt_enum param_type;       // For type 1: The type.
+    hlt_enum param_mode;       // For type 1: The mode.
 } __hlt_cmd_file;
 
+static void _flush_buffer(__hlt_file_info* info, int writer, hlt_exception** excpt, hlt_execution_context* ctx);
+
+// Returns the index of the write buffer for the thread a context belongs
+// to. These match the command queue's writer IDs.
+static inline int _writer(hlt_execution_context* ctx)
+{
+    return ctx->worker ? ctx->worker->id : 0;
+}
+
 void hlt_file_dtor(hlt_type_info* ti, hlt_file* f, hlt_execution_context* ctx)
 {
+    if ( f->open && f->info ) {
+        // Don't let our writes linger in the buffer.
+        hlt_exception* excpt = 0;
+        _flush_buffer(f->info, _writer(ctx), &excpt, ctx);
+    }
+
     GC_DTOR(f->path, hlt_string, ctx);
 }
 
@@ -55,6 +103,22 @@ static void fatal_error(const char* msg)
     exit(1);
 }
 
+static inline uint64_t _now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void _free_chunks(__hlt_file_chunk* c)
+{
+    while ( c ) {
+        __hlt_file_chunk* next = c->next;
+        hlt_free(c);
+        c = next;
+    }
+}
+
 static inline void acqire_lock(int* i)
 {
     if ( ! hlt_is_multi_threaded() )
@@ -92,7 +156,11 @@ void __hlt_files_done()
 
         GC_DTOR(info->path, hlt_string, hlt_global_execution_context());
 
+        for ( int i = 0; i < info->num_buffers; i++ )
+            _free_chunks(info->buffers[i].head);
+
         __hlt_file_info* next = info->next;
+        hlt_free(info->buffers);
         hlt_free(info);
         info = next;
     }
@@ -175,6 +243,8 @@ void hlt_file_open(hlt_file* file, hlt_string path, hlt_enum type, hlt_enum mode
     info->path = hlt_string_copy(path, excpt, ctx);
     info->writers = 1;
     info->error = 0;
+    info->num_buffers = hlt_is_multi_threaded() ? hlt_config_get()->num_workers + 1 : 1;
+    info->buffers = hlt_calloc(info->num_buffers, sizeof(__hlt_file_buffer));
     info->prev = 0;
     info->next = __hlt_globals()->files;
 
@@ -214,6 +284,8 @@ void hlt_file_close(hlt_file* file, hlt_exception** excpt, hlt_execution_context
         return;
     }
 
+    _flush_buffer(file->info, _writer(ctx), excpt, ctx);
+
     __hlt_cmd_file* cmd = hlt_malloc(sizeof(__hlt_cmd_file));
     __hlt_cmdqueue_init_cmd((__hlt_cmd*) cmd, __HLT_CMD_FILE);
     cmd->info = file->info;
@@ -238,12 +310,164 @@ void hlt_file_write_string(hlt_file* file, hlt_string str, hlt_exception** excpt
     hlt_file_write_bytes(file, b, excpt, ctx);
 }
 
-static void _add_to_cmd_data(__hlt_cmd_file* cmd, const int8_t* data, int len)
+// Appends data to a write buffer.
+static void _buffer_append(__hlt_file_buffer* buf, const int8_t* data, uint64_t len)
 {
-    int old_len = cmd->len;
-    cmd->len += len;
-    cmd->data = hlt_realloc(cmd->data, cmd->len, old_len);
-    memcpy(cmd->data + old_len, data, len);
+    buf->len += len;
+
+    while ( len ) {
+        __hlt_file_chunk* c = buf->tail;
+
+        if ( ! c || c->len == __HLT_FILE_CHUNK_SIZE ) {
+            c = hlt_malloc(sizeof(__hlt_file_chunk));
+            c->next = 0;
+            c->len = 0;
+
+            if ( buf->tail )
+                buf->tail->next = c;
+            else
+                buf->head = c;
+
+            buf->tail = c;
+            ++buf->num_chunks;
+        }
+
+        uint64_t n = __HLT_FILE_CHUNK_SIZE - c->len;
+
+        if ( n > len )
+            n = len;
+
+        memcpy(c->data + c->len, data, n);
+        c->len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+// Returns the first byte that's not printable ASCII, or end if none.
+static const int8_t* _find_unprintable(const int8_t* p, const int8_t* end)
+{
+#if defined(__AVX2__)
+    const __m256i lo = _mm256_set1_epi8(0x1f);
+    const __m256i hi = _mm256_set1_epi8(0x7f);
+
+    for ( ; p + 32 <= end; p += 32 ) {
+        __m256i c = _mm256_loadu_si256((const __m256i*)p);
+        __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi8(c, lo), _mm256_cmpgt_epi8(hi, c));
+        uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(ok);
+
+        if ( mask )
+            return p + __builtin_ctz(mask);
+    }
+#elif defined(__SSE2__)
+    const __m128i lo = _mm_set1_epi8(0x1f);
+    const __m128i hi = _mm_set1_epi8(0x7f);
+
+    for ( ; p + 16 <= end; p += 16 ) {
+        __m128i c = _mm_loadu_si128((const __m128i*)p);
+        __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(c, lo), _mm_cmpgt_epi8(hi, c));
+        uint32_t mask = ~(uint32_t)_mm_movemask_epi8(ok) & 0xffff;
+
+        if ( mask )
+            return p + __builtin_ctz(mask);
+    }
+#endif
+
+    // Remaining bytes (or all of them without SIMD support).
+    while ( p < end && *p > 0x1f && *p < 0x7f )
+        ++p;
+
+    return p;
+}
+
+// Appends data to a write buffer, escaping unprintable characters.
+static void _buffer_append_escaped(__hlt_file_buffer* buf, const int8_t* s, const int8_t* end)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    // FIXME: We don't honor the charset here yet, just encode everything
+    // that is not representable in our current locale.
+    while ( s < end ) {
+        const int8_t* e = _find_unprintable(s, end);
+
+        if ( e != s )
+            _buffer_append(buf, s, e - s);
+
+        if ( e == end )
+            break;
+
+        if ( isprint(*e) )
+            // Printable in the current locale even though it's not ASCII.
+            _buffer_append(buf, e, 1);
+
+        else {
+            // Same as we have always written, including the null byte.
+            uint8_t c = (uint8_t)*e;
+            int8_t esc[5] = { '\\', 'x', hex[c >> 4], hex[c & 0x0f], '\0' };
+            _buffer_append(buf, esc, sizeof(esc));
+        }
+
+        s = e + 1;
+    }
+}
+
+// Passes on a thread's buffered writes to a file to the command queue.
+static void _flush_buffer(__hlt_file_info* info, int writer, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    assert(writer < info->num_buffers);
+
+    __hlt_file_buffer* buf = &info->buffers[writer];
+
+    if ( ! buf->head )
+        return;
+
+    __hlt_cmd_file* cmd = hlt_malloc(sizeof(__hlt_cmd_file));
+    __hlt_cmdqueue_init_cmd((__hlt_cmd*) cmd, __HLT_CMD_FILE);
+    cmd->info = info;
+    cmd->type = 2; // Write.
+    cmd->chunks = buf->head;
+    cmd->num_chunks = buf->num_chunks;
+    cmd->len = buf->len;
+    cmd->records = buf->records;
+
+    memset(buf, 0, sizeof(__hlt_file_buffer));
+
+    __hlt_cmdqueue_push_writer((__hlt_cmd*) cmd, writer, excpt, ctx);
+}
+
+void __hlt_files_flush(int writer)
+{
+    hlt_execution_context* ctx = hlt_global_execution_context();
+    hlt_exception* excpt = 0;
+
+    int s = 0;
+    acqire_lock(&s);
+
+    for ( __hlt_file_info* info = __hlt_globals()->files; info; info = info->next )
+        _flush_buffer(info, writer, &excpt, ctx);
+
+    release_lock(s);
+}
+
+void __hlt_files_flush_expired(int writer)
+{
+    hlt_execution_context* ctx = hlt_global_execution_context();
+    hlt_exception* excpt = 0;
+
+    uint64_t timeout = hlt_config_get()->time_file_flush * 1e9;
+    uint64_t now = _now();
+
+    int s = 0;
+    acqire_lock(&s);
+
+    for ( __hlt_file_info* info = __hlt_globals()->files; info; info = info->next ) {
+        __hlt_file_buffer* buf = &info->buffers[writer];
+
+        if ( buf->head && now - buf->since >= timeout )
+            _flush_buffer(info, writer, &excpt, ctx);
+    }
+
+    release_lock(s);
 }
 
 void hlt_file_write_bytes(hlt_file* file, hlt_bytes* data, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -254,18 +478,23 @@ void hlt_file_write_bytes(hlt_file* file, hlt_bytes* data, hlt_exception** excpt
         return;
     }
 
-    __hlt_cmd_file* cmd = hlt_malloc(sizeof(__hlt_cmd_file));
-    __hlt_cmdqueue_init_cmd((__hlt_cmd*) cmd, __HLT_CMD_FILE);
-    cmd->info = file->info;
-    cmd->type = 2; // Write.
-    cmd->data = 0;
-    cmd->len = 0;
+    int8_t text = hlt_enum_equal(file->type, Hilti_FileType_Text, excpt, ctx);
+
+    if ( ! (text || hlt_enum_equal(file->type, Hilti_FileType_Binary, excpt, ctx)) )
+        fatal_error("unknown file type");
+
+    int writer = _writer(ctx);
+    assert(writer < file->info->num_buffers);
+
+    __hlt_file_buffer* buf = &file->info->buffers[writer];
+
+    if ( ! buf->head )
+        buf->since = _now();
 
     hlt_bytes_block block;
     hlt_iterator_bytes start = hlt_bytes_begin(data, excpt, ctx);
     hlt_iterator_bytes end = hlt_bytes_end(data, excpt, ctx);
     void* cookie = 0;
-    int8_t buf[5] = { '\\', 'x', 'X', 'X', '0' };
 
     while ( 1 ) {
         cookie = hlt_bytes_iterate_raw(&block, cookie, start, end, excpt, ctx);
@@ -273,48 +502,45 @@ void hlt_file_write_bytes(hlt_file* file, hlt_bytes* data, hlt_exception** excpt
         if ( block.start == block.end )
             break;
 
-        int8_t text = hlt_enum_equal(file->type, Hilti_FileType_Text, excpt, ctx);
-
-        if ( text ) {
-            // Need to escape unprintable characters. FIXME: We don't honor
-            // the charset here yet, just encode everything that is not
-            // representable in our current locale.
-            const int8_t* s = block.start;
-            const int8_t* e = s;
+        if ( text )
+            // Need to escape unprintable characters.
+            _buffer_append_escaped(buf, block.start, block.end);
 
-            while ( s < block.end ) {
-                while ( e < block.end && isprint(*e) )
-                    ++e;
+        else
+            // Just write data directly.
+            _buffer_append(buf, block.start, block.end - block.start);
 
-                if ( e != s )
-                    _add_to_cmd_data(cmd, s, e - s);
+        if ( ! cookie )
+            break;
+    }
 
-                if ( e < block.end ) {
-                    // Unprintable character.
-                    int n = hlt_util_uitoa_n(*e, (char*)buf + 2, 3, 16, 1);
-                    _add_to_cmd_data(cmd, buf, n + 2);
-                    ++e;
-                }
+    if ( text )
+        _buffer_append(buf, (int8_t*)"\n", 1);
 
-                s = e;
-            }
-        }
+    ++buf->records;
 
-        else if ( hlt_enum_equal(file->type, Hilti_FileType_Binary, excpt, ctx) )
-            // Just write data directly.
-            _add_to_cmd_data(cmd, block.start, block.end - block.start);
+    // Pass the buffer on once it's full, or has been sitting around for a
+    // while.
+    const hlt_config* cfg = hlt_config_get();
 
-        else
-            fatal_error("unknown file type");
+    if ( buf->len >= cfg->file_buffer_size || _now() - buf->since >= cfg->time_file_flush * 1e9 )
+        _flush_buffer(file->info, writer, excpt, ctx);
+}
 
-        if ( ! cookie )
-            break;
+void hlt_file_get_stats(hlt_file* file, hlt_file_stats* stats, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( ! file->open ) {
+        hlt_string err = hlt_string_from_asciiz("file not open", excpt, ctx);
+        hlt_set_exception(excpt, &hlt_exception_io_error, err, ctx);
+        return;
     }
 
-    if ( hlt_enum_equal(file->type, Hilti_FileType_Text, excpt, ctx) )
-        _add_to_cmd_data(cmd, (int8_t*)"\n", 1);
+    __hlt_file_info* info = file->info;
 
-    __hlt_cmdqueue_push((__hlt_cmd*) cmd, excpt, ctx);
+    stats->records = __atomic_load_n(&info->stats.records, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&info->stats.bytes, __ATOMIC_RELAXED);
+    stats->buffers = __atomic_load_n(&info->stats.buffers, __ATOMIC_RELAXED);
+    stats->syscalls = __atomic_load_n(&info->stats.syscalls, __ATOMIC_RELAXED);
 }
 
 void __hlt_file_cmd_internal(__hlt_cmd* c, hlt_execution_context* ctx)
@@ -362,21 +588,33 @@ void __hlt_file_cmd_internal(__hlt_cmd* c, hlt_execution_context* ctx)
          break;
 
       case 2: {
-          // Write comment.
+          // Write command. We write the whole buffer with one system call
+          // (unless it's huge).
+          __hlt_file_info* info = cmd->info;
 
-          if ( cmd->info->fd < 0 )
-              return;
+          if ( info->fd >= 0 && ! info->error ) {
+              struct iovec iov[cmd->num_chunks];
+              int i = 0;
 
-          if ( cmd->info->error )
-              return;
+              for ( __hlt_file_chunk* c = cmd->chunks; c; c = c->next, ++i ) {
+                  iov[i].iov_base = c->data;
+                  iov[i].iov_len = c->len;
+              }
 
-          if ( cmd->len ) {
-              if ( ! __hlt_safe_write(cmd->info->fd, cmd->data, cmd->len) )
-                  cmd->info->error = 1;
+              int calls = __hlt_safe_writev(info->fd, iov, cmd->num_chunks);
 
-              hlt_free(cmd->data);
+              if ( calls >= 0 ) {
+                  __atomic_store_n(&info->stats.records, info->stats.records + cmd->records, __ATOMIC_RELAXED);
+                  __atomic_store_n(&info->stats.bytes, info->stats.bytes + cmd->len, __ATOMIC_RELAXED);
+                  __atomic_store_n(&info->stats.buffers, info->stats.buffers + 1, __ATOMIC_RELAXED);
+                  __atomic_store_n(&info->stats.syscalls, info->stats.syscalls + calls, __ATOMIC_RELAXED);
+              }
+
+              else
+                  info->error = 1;
           }
 
+          _free_chunks(cmd->chunks);
           break;
       }
 
@@ -415,6 +653,11 @@ void __hlt_file_cmd_internal(__hlt_cmd* c, hlt_execution_context* ctx)
                   fatal_error("file to close not found");
 
               GC_DTOR(cmd->info->path, hlt_string, hlt_global_execution_context());
+
+              for ( int i = 0; i < cmd->info->num_buffers; i++ )
+                  _free_chunks(cmd->info->buffers[i].head);
+
+              hlt_free(cmd->info->buffers);
               hlt_free(cmd->info);
 
               cmd->info = 0;
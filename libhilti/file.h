@@ -125,6 +125,28 @@ void hlt_file_write_bytes(hlt_file* file, struct __hlt_bytes* bytes, hlt_excepti
 /// excpt: &
 hlt_string hlt_file_name(hlt_file* file, hlt_exception** excpt, hlt_execution_context* ctx);
 
+/// Throughput statistics for a file, as returned by ~~hlt_file_get_stats.
+/// They cover what has reached the file so far, not what threads still
+/// have buffered.
+typedef struct {
+    uint64_t records;   ///< Number of write operations.
+    uint64_t bytes;     ///< Number of bytes written, after escaping.
+    uint64_t buffers;   ///< Number of buffers threads have passed on for writing.
+    uint64_t syscalls;  ///< Number of system calls used for writing.
+} hlt_file_stats;
+
+/// Returns throughput statistics for a file. If several file objects
+/// reference the same path, they share the statistics.
+///
+/// file: The file.
+///
+/// stats: Will be filled with the statistics.
+///
+/// excpt: &
+///
+/// Raises: IOError if the file is not open.
+void hlt_file_get_stats(hlt_file* file, hlt_file_stats* stats, hlt_exception** excpt, hlt_execution_context* ctx);
+
 // Internal function called once at startup from the command queue threadto
 // initialize the file management.
 void __hlt_files_init();
@@ -133,6 +155,19 @@ void __hlt_files_init();
 // clean up.
 void __hlt_files_done();
 
+// Internal function passing on everything a thread has buffered for any
+// file to the command queue.
+//
+// writer: 0 for the main thread, or the ID of a worker thread.
+void __hlt_files_flush(int writer);
+
+// Internal function passing on what a thread has buffered for any file
+// longer than the configured time_file_flush. Busy worker threads call this
+// periodically, so that buffers they stop writing to don't linger.
+//
+// writer: 0 for the main thread, or the ID of a worker thread.
+void __hlt_files_flush_expired(int writer);
+
 typedef struct __hlt_cmd_write __hlt_cmd_write;
 
 // Internal function to perform the actual write from the queue manager. This
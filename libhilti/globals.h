@@ -80,6 +80,10 @@ struct __hlt_global_state {
     _Atomic(uint_fast64_t) size_stacks;
     _Atomic(uint_fast64_t) num_nullbuffer;
     _Atomic(uint_fast64_t) max_nullbuffer;
+    _Atomic(uint_fast64_t) num_nullbuffer_flushes;
+    _Atomic(uint_fast64_t) time_nullbuffer_flush;
+    _Atomic(uint_fast64_t) size_borrowed;
+    _Atomic(uint_fast64_t) size_borrowed_copied;
 };
 
 // A type holding all of libhilti's global state.
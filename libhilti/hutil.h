@@ -4,6 +4,7 @@
 
 #include <stdint.h>
 #include <pthread.h>
+#include <sys/uio.h>
 
 #include "types.h"
 
@@ -128,6 +129,12 @@ extern int8_t hlt_default_equal(const hlt_type_info* type1, const void* obj1, co
 /// Wrapper around the standard \a write(2) that restarts on \c EINTR.
 extern int8_t __hlt_safe_write(int fd, const char* data, int len);
 
+/// Wrapper around the standard \a writev(2) that restarts on \c EINTR and
+/// continues after partial writes. The iovecs may be modified.
+///
+/// Returns: The number of system calls made, or -1 on error.
+extern int __hlt_safe_writev(int fd, struct iovec* iov, int cnt);
+
 // XXX
 // These data structures are optimized for a small numbers of items.
 
@@ -2,8 +2,13 @@
 #include <pcap.h>
 
 #include "iosrc.h"
+#include "vector.h"
 #include "autogen/hilti-hlt.h"
 
+static const int64_t __HLT_IOSRC_MIN_BUFFERS = 4;
+static const int64_t __HLT_IOSRC_MAX_BUFFERS = 4096;
+static const hlt_bytes_size __HLT_IOSRC_MIN_BUFFER_SIZE = 2048;
+
 typedef struct  {
     hlt_iosrc* src;
     hlt_time t;
@@ -76,11 +81,62 @@ static void _strip_link_layer(hlt_iosrc* src, const char** pkt, int* caplen, int
     *caplen -= hdr_size;
 }
 
+// Returns a buffer holding a copy of the packet data. We keep a ring of
+// buffers that get recycled once nobody else holds on to them anymore, so
+// that in the common case of processing one packet at a time we don't need
+// to allocate memory for each packet.
+static hlt_bytes* _packet_buffer(hlt_iosrc* src, const int8_t* data, int caplen, hlt_execution_context* ctx)
+{
+    hlt_bytes** slot = &src->buffers[src->next_buffer];
+    src->next_buffer = (src->next_buffer + 1) % src->num_buffers;
+
+    hlt_bytes* b = *slot;
+
+    if ( b && __atomic_load_n(&((__hlt_gchdr*)b)->ref_cnt, __ATOMIC_SEQ_CST) == 1 && __hlt_bytes_reuse(b, data, caplen, ctx) )
+        return b;
+
+    // Either still in use elsewhere, or too small. Leave the old one to
+    // whoever still has it and start over.
+    GC_CLEAR(*slot, hlt_bytes, ctx);
+
+    hlt_bytes_size reserve = __HLT_IOSRC_MIN_BUFFER_SIZE;
+
+    while ( reserve < caplen )
+        reserve *= 2;
+
+    b = __hlt_bytes_new_reusable(reserve, ctx);
+    __hlt_bytes_reuse(b, data, caplen, ctx);
+    *slot = b;
+
+    return b;
+}
+
+static void _grow_buffers(hlt_iosrc* src, int64_t n)
+{
+    if ( n > __HLT_IOSRC_MAX_BUFFERS )
+        n = __HLT_IOSRC_MAX_BUFFERS;
+
+    if ( n <= src->num_buffers )
+        return;
+
+    src->buffers = hlt_realloc(src->buffers, n * sizeof(hlt_bytes*), src->num_buffers * sizeof(hlt_bytes*));
+    src->num_buffers = n;
+}
+
+static void _clear_buffers(hlt_iosrc* src, hlt_execution_context* ctx)
+{
+    for ( int64_t i = 0; i < src->num_buffers; i++ )
+        GC_CLEAR(src->buffers[i], hlt_bytes, ctx);
+}
+
 void hlt_iosrc_dtor(hlt_type_info* ti, hlt_iosrc* c, hlt_execution_context* ctx)
 {
     if ( c->handle )
         pcap_close(c->handle);
 
+    _clear_buffers(c, ctx);
+    hlt_free(c->buffers);
+
     GC_CLEAR(c->iface, hlt_string, ctx);
 }
 
@@ -106,6 +162,9 @@ hlt_iosrc* hlt_iosrc_new_live(hlt_string interface, hlt_exception** excpt, hlt_e
     src->type = Hilti_IOSrc_PcapLive;
     src->iface = hlt_string_copy(interface, excpt, ctx);
     GC_CCTOR(src->iface, hlt_string, ctx);
+    src->buffers = hlt_calloc(__HLT_IOSRC_MIN_BUFFERS, sizeof(hlt_bytes*));
+    src->num_buffers = __HLT_IOSRC_MIN_BUFFERS;
+    src->next_buffer = 0;
 
     char* iface = hlt_string_to_native(interface, excpt, ctx);
     if ( hlt_check_exception(excpt) )
@@ -151,6 +210,9 @@ hlt_iosrc* hlt_iosrc_new_offline(hlt_string interface, hlt_exception** excpt, hl
     src->type = Hilti_IOSrc_PcapOffline;
     src->iface = hlt_string_copy(interface, excpt, ctx);
     GC_CCTOR(src->iface, hlt_string, ctx);
+    src->buffers = hlt_calloc(__HLT_IOSRC_MIN_BUFFERS, sizeof(hlt_bytes*));
+    src->num_buffers = __HLT_IOSRC_MIN_BUFFERS;
+    src->next_buffer = 0;
 
     char* iface = hlt_string_to_native(interface, excpt, ctx);
     if ( hlt_check_exception(excpt) )
@@ -170,44 +232,40 @@ hlt_iosrc* hlt_iosrc_new_offline(hlt_string interface, hlt_exception** excpt, hl
     return src;
 }
 
-hlt_packet hlt_iosrc_read_try(hlt_iosrc* src, int8_t keep_link_layer, hlt_exception** excpt, hlt_execution_context* ctx)
+// Returns 1 if we got a packet, 0 if there's currently none available, -1
+// if the source is exhausted, and -2 if an exception has been raised.
+static int _read(hlt_iosrc* src, int8_t keep_link_layer, hlt_packet* result, hlt_exception** excpt, hlt_execution_context* ctx)
 {
-    hlt_packet result = { 0.0, NULL };
-
     if ( ! src->handle ) {
         _raise_error(src, "already closed", excpt, ctx);
-        return result;
+        return -2;
     }
 
     struct pcap_pkthdr* hdr;
     const u_char* data;
 
     int rc = pcap_next_ex(src->handle, &hdr, &data);
-    int caplen = hdr->caplen;
 
     if ( rc > 0 ) {
         // Got a packet.
+        int caplen = hdr->caplen;
+
         if ( ! keep_link_layer ) {
             _strip_link_layer(src, (const char**)&data, &caplen, pcap_datalink(src->handle), excpt, ctx);
             if ( hlt_check_exception(excpt) )
-                return result;
+                return -2;
         }
 
-        // We need to copy it to make sure it remains valid.
-        hlt_bytes* pkt = hlt_bytes_new_from_data_copy((const int8_t*)data, caplen, excpt, ctx);
-        if ( hlt_check_exception(excpt) )
-            return result;
-
-        // Build the result tuple.
-        result.t = hlt_time_value(hdr->ts.tv_sec, hdr->ts.tv_usec * 1000);
-        result.data = pkt;
-
-        return result;
+        // We need to copy it to make sure it remains valid, but can
+        // usually recycle the memory of an earlier packet.
+        result->t = hlt_time_value(hdr->ts.tv_sec, hdr->ts.tv_usec * 1000);
+        result->data = _packet_buffer(src, (const int8_t*)data, caplen, ctx);
+        return 1;
     }
 
     if ( rc == -2 ) {
         // No more packets.
-        return result;
+        return -1;
     }
 
     if ( rc < 0 ) {
@@ -215,20 +273,64 @@ hlt_packet hlt_iosrc_read_try(hlt_iosrc* src, int8_t keep_link_layer, hlt_except
         _raise_error(src, 0, excpt, ctx);
         pcap_close(src->handle);
         src->handle = 0;
-        return result;
+        return -2;
     }
 
     // Don't think we can get here when reading from a trace ...
     assert(! hlt_enum_equal(src->type, Hilti_IOSrc_PcapOffline, excpt, ctx));
 
     // No packet this time.
-    hlt_set_exception(excpt, &hlt_exception_would_block, 0, ctx);
+    return 0;
+}
+
+hlt_packet hlt_iosrc_read_try(hlt_iosrc* src, int8_t keep_link_layer, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    hlt_packet result = { 0.0, NULL };
+
+    if ( _read(src, keep_link_layer, &result, excpt, ctx) == 0 )
+        hlt_set_exception(excpt, &hlt_exception_would_block, 0, ctx);
+
     return result;
 }
 
+hlt_vector* hlt_iosrc_read_batch(hlt_iosrc* src, int64_t n, int8_t keep_link_layer, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    hlt_packet def = { 0.0, NULL };
+    hlt_vector* pkts = hlt_vector_new(&hlt_type_info_hlt_tuple_time_bytes, &def, 0, excpt, ctx);
+
+    if ( n <= 0 )
+        return pkts;
+
+    hlt_vector_reserve(pkts, n, excpt, ctx);
+
+    // The caller typically still holds on to the previous batch while
+    // reading the next.
+    _grow_buffers(src, 2 * n + 1);
+
+    for ( int64_t i = 0; i < n; i++ ) {
+        hlt_packet pkt = { 0.0, NULL };
+
+        int rc = _read(src, keep_link_layer, &pkt, excpt, ctx);
+
+        if ( rc == 1 ) {
+            hlt_vector_push_back(pkts, &hlt_type_info_hlt_tuple_time_bytes, &pkt, excpt, ctx);
+            continue;
+        }
+
+        if ( rc == -1 && i == 0 )
+            hlt_set_exception(excpt, &hlt_exception_iosrc_exhausted, 0, ctx);
+
+        break;
+    }
+
+    return pkts;
+}
+
 void hlt_iosrc_close(hlt_iosrc* src, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     pcap_close(src->handle);
     src->handle = 0;
+
+    _clear_buffers(src, ctx);
 }
 
@@ -23,6 +23,7 @@
 #include "enum.h"
 #include "time_.h"
 #include "bytes.h"
+#include "vector.h"
 
 /// The type of an IOSource as one of the Hilti::IOSrc constants.
 typedef hlt_enum hlt_iosrc_type;
@@ -32,6 +33,9 @@ struct __hlt_iosrc {
     hlt_iosrc_type type;  // Hilti_PktSrc_PcapLive or Hilti_PktSrc_PcapOffline.
     hlt_string iface;     // The name of the interface.
     void* handle;         // A kind-specific handle.
+    hlt_bytes** buffers;  // Ring of packet buffers, recycled once nobody else references them.
+    int64_t num_buffers;  // Number of slots in buffers.
+    int64_t next_buffer;  // Slot to use for the next packet.
 };
 
 /// tuple<time, ref<bytes>>
@@ -78,6 +82,25 @@ extern hlt_iosrc* hlt_iosrc_new_offline(hlt_string interface, hlt_exception** ex
 /// *keep_link_layer* is disabled.
 extern hlt_packet hlt_iosrc_read_try(hlt_iosrc* src, int8_t keep_link_layer, hlt_exception** excpt, hlt_execution_context* ctx);
 
+/// Reads up to *n* packets from a PCAP source at once. This amortizes the
+/// per-call overhead of hlt_iosrc_read_try() when processing packets in
+/// bulk. Returns fewer than *n* packets if the source doesn't have more
+/// available right now, or if it gets exhausted.
+///
+/// src: The packet source.
+///
+/// n: The maximum number of packets to read.
+///
+/// keep_link_layer: If not true, any link layer headers are stripped.
+///
+/// Returns: A vector of tuples <hlt_time, hlt_bytes*>, each as returned by
+/// hlt_iosrc_read_try(). The vector will be empty if no packet is currently
+/// available.
+///
+/// Raises: IOSrcExhausted if the source is permanently exhausted before any
+/// packet could be read; IOError as with hlt_iosrc_read_try().
+extern hlt_vector* hlt_iosrc_read_batch(hlt_iosrc* src, int64_t n, int8_t keep_link_layer, hlt_exception** excpt, hlt_execution_context* ctx);
+
 /// Closes a live PCAP packet source. Any attempt to read further packets
 /// will result in an IOSrcError exception.
 ///
@@ -33,8 +33,62 @@ static int _ccl_match(jrx_ccl* ccl, jrx_char cp, jrx_char *previous, jrx_asserti
     return 0;
 }
 
+// Advances using the transition table, for states that don't need to
+// consider assertions.
+static inline int _advance_with_row(jrx_match_state* ms, jrx_dfa_row* row, jrx_char cp)
+{
+    jrx_dfa_state_id succ_id = row->succ[ms->dfa->table->classes[cp]];
+
+    if ( succ_id == JRX_DFA_NO_STATE ) {
+        // Matching failed. Check if the start state is already an accepting one.
+        if ( row->accepting ) {
+            ms->state = -1; // Jam it.
+            return row->aid;
+        }
+
+        return 0;
+    }
+
+    ++ms->offset;
+
+    ms->state = succ_id;
+    ms->previous = cp;
+
+    jrx_dfa_row* succ_row = dfa_get_row(ms->dfa, succ_id);
+
+    if ( ! succ_row ) {
+        // Couldn't build the successor's row. Look at its state instead, as
+        // the interpreter would.
+        jrx_dfa_state* succ_state = dfa_get_state(ms->dfa, succ_id);
+
+        if ( ! succ_state )
+            return 0;
+
+        if ( succ_state->accepts )
+            // Accepting.
+            return vec_dfa_accept_get(succ_state->accepts, 0).aid;
+
+        // Partial match.
+        return -1;
+    }
+
+    if ( succ_row->accepting )
+        // Accepting.
+        return succ_row->aid;
+
+    // Partial match.
+    return -1;
+}
+
 int jrx_match_state_advance_min(jrx_match_state* ms, jrx_char cp, jrx_assertion assertions)
 {
+    if ( cp < 256 && ! (ms->dfa->options & JRX_OPTION_DEBUG) ) {
+        jrx_dfa_row* row = dfa_get_row(ms->dfa, ms->state);
+
+        if ( row && row->succ )
+            return _advance_with_row(ms, row, cp);
+    }
+
     jrx_dfa_state* state = dfa_get_state(ms->dfa, ms->state);
 
     if ( ! state )
@@ -100,3 +154,218 @@ int jrx_match_state_advance_min(jrx_match_state* ms, jrx_char cp, jrx_assertion
     return 0;
 }
 
+
+// A single matcher of an unanchored search.
+struct jrx_search_thread {
+    jrx_match_state ms; // The matcher's state.
+    jrx_offset so;      // Offset where the matcher started.
+    jrx_offset eo;      // End offset of the most recent accept.
+};
+
+typedef struct jrx_search_thread jrx_search_thread;
+
+jrx_search_state* jrx_search_state_init(const jrx_regex_t *preg, jrx_search_state* ss)
+{
+    ss->offset = 0;
+    ss->so = -1;
+    ss->eo = -1;
+    ss->acc = 0;
+    ss->dfa = preg->dfa;
+    ss->threads = 0;
+    ss->num_threads = 0;
+    ss->max_threads = 0;
+    ss->limit = JRX_OFFSET_MAX;
+    ss->seen = 0;
+    ss->num_seen = 0;
+    return ss;
+}
+
+void jrx_search_state_done(jrx_search_state* ss)
+{
+    free(ss->threads);
+    free(ss->seen);
+}
+
+// Records a matcher's accept as the search result if it started first.
+static void _search_record(jrx_search_state* ss, jrx_search_thread* t)
+{
+    if ( t->ms.acc <= 0 )
+        return;
+
+    if ( ss->acc > 0 && ss->so <= t->so )
+        return;
+
+    ss->acc = t->ms.acc;
+    ss->so = t->so;
+    ss->eo = t->eo;
+
+    if ( t->so < ss->limit )
+        ss->limit = t->so;
+}
+
+// Starts a new matcher at the current offset. Returns false if we're out
+// of memory.
+static int _search_spawn(jrx_search_state* ss)
+{
+    if ( ss->num_threads == ss->max_threads ) {
+        int max_threads = ss->max_threads ? ss->max_threads * 2 : 8;
+        jrx_search_thread* threads = (jrx_search_thread*)realloc(ss->threads, max_threads * sizeof(jrx_search_thread));
+
+        if ( ! threads )
+            return 0;
+
+        ss->threads = threads;
+        ss->max_threads = max_threads;
+    }
+
+    jrx_search_thread* t = &ss->threads[ss->num_threads++];
+    t->ms.offset = 1;
+    t->ms.begin = 0;
+    t->ms.dfa = ss->dfa;
+    t->ms.state = ss->dfa->initial;
+    t->ms.previous = 0;
+    t->ms.accepts = 0;
+    t->ms.current_tags = -1;
+    t->ms.tags1 = t->ms.tags2 = 0;
+    t->ms.tags1_size = t->ms.tags2_size = 0;
+    t->ms.acc = -1;
+    t->so = ss->offset;
+    t->eo = -1;
+    return 1;
+}
+
+// Returns true if another matcher has already reached the given state at
+// the current offset; otherwise marks it as reached. If we're out of memory,
+// returns false without marking; the matcher then just doesn't get merged.
+static int _search_seen(jrx_search_state* ss, jrx_dfa_state_id state)
+{
+    if ( state >= ss->num_seen ) {
+        // Other threads may be adding states concurrently, so we grow
+        // based on what we see rather than on the DFA's current size.
+        jrx_dfa_state_id n = ss->num_seen ? ss->num_seen : 16;
+
+        while ( state >= n )
+            n *= 2;
+
+        jrx_offset* seen = (jrx_offset*)realloc(ss->seen, n * sizeof(jrx_offset));
+
+        if ( ! seen )
+            return 0;
+
+        memset(seen + ss->num_seen, 0, (n - ss->num_seen) * sizeof(jrx_offset));
+        ss->seen = seen;
+        ss->num_seen = n;
+    }
+
+    jrx_offset stamp = ss->offset + 1;
+
+    if ( ss->seen[state] == stamp )
+        return 1;
+
+    ss->seen[state] = stamp;
+    return 0;
+}
+
+static void _search_advance(jrx_search_state* ss, jrx_char cp, jrx_assertion assertions)
+{
+    // Start a new matcher at this offset unless an earlier one has already
+    // accepted, in which case later ones can't be left-most anymore. If
+    // we're out of memory, we continue with the matchers we have.
+    if ( ss->limit == JRX_OFFSET_MAX )
+        _search_spawn(ss);
+
+    int first_match = (ss->dfa->options & JRX_OPTION_FIRST_MATCH);
+    int n = 0;
+    int i;
+
+    for ( i = 0; i < ss->num_threads; i++ ) {
+        jrx_search_thread* t = &ss->threads[i];
+
+        if ( t->so > ss->limit )
+            // Started after a matcher that has accepted already.
+            break;
+
+        jrx_accept_id rc = jrx_match_state_advance_min(&t->ms, cp, assertions);
+
+        if ( rc == 0 ) {
+            _search_record(ss, t);
+            continue;
+        }
+
+        if ( rc > 0 ) {
+            t->ms.acc = rc;
+            t->eo = t->so + t->ms.offset - 1;
+
+            if ( t->so < ss->limit )
+                ss->limit = t->so;
+
+            if ( first_match || ! jrx_can_transition(&t->ms) ) {
+                _search_record(ss, t);
+                continue;
+            }
+        }
+
+        if ( _search_seen(ss, t->ms.state) ) {
+            // Same future as an earlier matcher, which takes precedence.
+            _search_record(ss, t);
+            continue;
+        }
+
+        if ( n != i )
+            ss->threads[n] = *t;
+
+        ++n;
+    }
+
+    // Any matchers we skipped above due to the limit are dropped.
+    ss->num_threads = n;
+    ++ss->offset;
+}
+
+// Returns:
+//
+// 0: no match and none possible anymore.
+// >0: match with this accept ID, with ss->so and ss->eo set to its offsets.
+// -1: no decision yet; if final, a partial match may still continue with more input.
+int jrx_regexec_search_partial(const jrx_regex_t *preg, const char *buffer, unsigned int len, jrx_assertion first, jrx_assertion last, jrx_search_state* ss, int final)
+{
+    const char* p;
+    for ( p = buffer; len; --len ) {
+        jrx_assertion assertions = JRX_ASSERTION_NONE;
+
+        if ( p == buffer )
+            assertions |= first;
+
+        if ( len == 1 )
+            assertions |= last;
+
+        _search_advance(ss, (unsigned char)*p++, assertions);
+
+        if ( ss->limit != JRX_OFFSET_MAX && ss->num_threads == 0 )
+            // All matchers that could still be left-most have finished.
+            return ss->acc;
+    }
+
+    if ( ! final )
+        return -1;
+
+    // Out of input, take what the remaining matchers have.
+    int partial = 0;
+    int i;
+
+    for ( i = 0; i < ss->num_threads; i++ ) {
+        jrx_search_thread* t = &ss->threads[i];
+
+        if ( t->ms.acc > 0 )
+            _search_record(ss, t);
+        else
+            partial = 1;
+    }
+
+    ss->num_threads = 0;
+
+    if ( ss->acc > 0 )
+        return ss->acc;
+
+    return partial ? -1 : 0;
+}
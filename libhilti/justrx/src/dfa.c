@@ -3,6 +3,73 @@
 #include "jrx-intern.h"
 #include "dfa.h"
 
+static const jrx_dfa_state_id _DFA_INDEX_DEFAULT_SIZE = 16;
+
+static jrx_dfa_index* _dfa_index_create(jrx_dfa_state_id max, jrx_dfa_index* old)
+{
+    jrx_dfa_index* index = (jrx_dfa_index*)malloc(sizeof(jrx_dfa_index));
+    if ( ! index )
+        return 0;
+
+    index->max = max;
+    index->states = (jrx_dfa_state**)calloc(max, sizeof(jrx_dfa_state*));
+    index->rows = (jrx_dfa_row**)calloc(max, sizeof(jrx_dfa_row*));
+    index->retired = old;
+
+    if ( ! (index->states && index->rows) ) {
+        free(index->states);
+        free(index->rows);
+        free(index);
+        return 0;
+    }
+
+    if ( old ) {
+        memcpy(index->states, old->states, old->max * sizeof(jrx_dfa_state*));
+        memcpy(index->rows, old->rows, old->max * sizeof(jrx_dfa_row*));
+    }
+
+    return index;
+}
+
+static void _dfa_index_delete(jrx_dfa_index* index)
+{
+    while ( index ) {
+        jrx_dfa_index* retired = index->retired;
+        free(index->states);
+        free(index->rows);
+        free(index);
+        index = retired;
+    }
+}
+
+// Makes a computed state and/or row visible to lookups without locking.
+// Must be called with the DFA's lock held (or before the DFA is shared).
+static int _dfa_publish(jrx_dfa* dfa, jrx_dfa_state_id id, jrx_dfa_state* state, jrx_dfa_row* row)
+{
+    jrx_dfa_index* index = dfa->index;
+
+    if ( id >= index->max ) {
+        jrx_dfa_state_id max = index->max * 2;
+
+        while ( id >= max )
+            max *= 2;
+
+        index = _dfa_index_create(max, index);
+        if ( ! index )
+            return 0;
+
+        __atomic_store_n(&dfa->index, index, __ATOMIC_RELEASE);
+    }
+
+    if ( state )
+        __atomic_store_n(&index->states[id], state, __ATOMIC_RELEASE);
+
+    if ( row )
+        __atomic_store_n(&index->rows[id], row, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
 static jrx_dfa* _dfa_create()
 {
     jrx_dfa* dfa = (jrx_dfa*)malloc(sizeof(jrx_dfa));
@@ -13,6 +80,7 @@ static jrx_dfa* _dfa_create()
     dfa->nmatch = 0;
     dfa->initial = 0;
     dfa->initial_dstate = 0;
+    dfa->initial_ops = 0;
     dfa->states = vec_dfa_state_create(0);
     dfa->state_elems = vec_dfa_state_elem_create(0);
     dfa->hstates = kh_init(dfa_state_elem);
@@ -20,6 +88,16 @@ static jrx_dfa* _dfa_create()
     dfa->max_capture = -1;
     dfa->max_tag = -1;
     dfa->nfa = 0;
+    dfa->table = 0;
+    dfa->native = 0;
+    dfa->index = _dfa_index_create(_DFA_INDEX_DEFAULT_SIZE, 0);
+
+    if ( ! dfa->index ) {
+        free(dfa);
+        return 0;
+    }
+
+    pthread_mutex_init(&dfa->lock, 0);
 
     return dfa;
 }
@@ -281,10 +359,23 @@ int dfa_state_compute(jrx_nfa_context* ctx, jrx_dfa* dfa, jrx_dfa_state_id id, s
     dfastate->accepts = accepts;
 
     vec_dfa_state_set(dfa->states, id, dfastate);
-    return 1;
+    return _dfa_publish(dfa, id, dfastate, 0);
 }
 
-jrx_dfa_state* dfa_get_state(jrx_dfa* dfa, jrx_dfa_state_id id)
+jrx_dfa_state* dfa_peek_state(jrx_dfa* dfa, jrx_dfa_state_id id)
+{
+    jrx_dfa_index* index = __atomic_load_n(&dfa->index, __ATOMIC_ACQUIRE);
+    return id < index->max ? __atomic_load_n(&index->states[id], __ATOMIC_ACQUIRE) : 0;
+}
+
+static jrx_dfa_row* _dfa_peek_row(jrx_dfa* dfa, jrx_dfa_state_id id)
+{
+    jrx_dfa_index* index = __atomic_load_n(&dfa->index, __ATOMIC_ACQUIRE);
+    return id < index->max ? __atomic_load_n(&index->rows[id], __ATOMIC_ACQUIRE) : 0;
+}
+
+// Must be called with the DFA's lock held.
+static jrx_dfa_state* _dfa_get_state(jrx_dfa* dfa, jrx_dfa_state_id id)
 {
     jrx_dfa_state* state = vec_dfa_state_get(dfa->states, id);
 
@@ -301,6 +392,188 @@ jrx_dfa_state* dfa_get_state(jrx_dfa* dfa, jrx_dfa_state_id id)
     return state;
 }
 
+jrx_dfa_state* dfa_get_state(jrx_dfa* dfa, jrx_dfa_state_id id)
+{
+    jrx_dfa_state* state = dfa_peek_state(dfa, id);
+
+    if ( state || ! dfa->nfa )
+        return state;
+
+    pthread_mutex_lock(&dfa->lock);
+    state = _dfa_get_state(dfa, id);
+    pthread_mutex_unlock(&dfa->lock);
+
+    return state;
+}
+
+static int _ccl_contains(jrx_ccl* ccl, jrx_char cp)
+{
+    if ( ! ccl->ranges )
+        return 0;
+
+    set_for_each(char_range, ccl->ranges, r) {
+        if ( cp >= r.begin && cp < r.end )
+            return 1;
+    }
+
+    return 0;
+}
+
+static jrx_dfa_table* _dfa_table_create(jrx_dfa* dfa)
+{
+    jrx_dfa_table* table = (jrx_dfa_table*)malloc(sizeof(jrx_dfa_table));
+    if ( ! table )
+        return 0;
+
+    // Compute the byte classes by successively splitting them into the
+    // bytes inside and outside of each CCL.
+    memset(table->classes, 0, sizeof(table->classes));
+    int nclasses = 1;
+
+    vec_for_each(ccl, dfa->ccls->ccls, ccl) {
+        if ( ccl_is_empty(ccl) || ccl_is_epsilon(ccl) )
+            continue;
+
+        int16_t split[256 * 2];
+        memset(split, -1, sizeof(split));
+        int n = 0;
+
+        int c;
+        for ( c = 0; c < 256; c++ ) {
+            int idx = table->classes[c] * 2 + _ccl_contains(ccl, c);
+
+            if ( split[idx] < 0 )
+                split[idx] = n++;
+
+            table->classes[c] = split[idx];
+        }
+
+        nclasses = n;
+    }
+
+    int c;
+    for ( c = 255; c >= 0; c-- )
+        table->reps[table->classes[c]] = c;
+
+    table->nclasses = nclasses;
+    return table;
+}
+
+static void _dfa_table_delete(jrx_dfa* dfa)
+{
+    jrx_dfa_state_id id;
+    for ( id = 0; id < dfa->index->max; id++ ) {
+        jrx_dfa_row* row = dfa->index->rows[id];
+
+        if ( ! row )
+            continue;
+
+        if ( row->succ && dfa->nfa )
+            // Imported rows point into the image.
+            free(row->succ);
+
+        free(row);
+    }
+
+    free(dfa->table);
+}
+
+static jrx_dfa_row* _dfa_row_create(jrx_dfa* dfa, jrx_dfa_state* state)
+{
+    jrx_dfa_table* table = dfa->table;
+
+    jrx_dfa_row* row = (jrx_dfa_row*)malloc(sizeof(jrx_dfa_row));
+    if ( ! row )
+        return 0;
+
+    row->succ = 0;
+    row->accepting = (state->accepts != 0);
+    row->aid = state->accepts ? vec_dfa_accept_get(state->accepts, 0).aid : 0;
+
+    vec_for_each(dfa_transition, state->trans, trans) {
+        jrx_ccl* ccl = vec_ccl_get(dfa->ccls->ccls, trans.ccl);
+
+        if ( ccl->assertions )
+            // Needs the interpreter.
+            return row;
+    }
+
+    row->succ = (jrx_dfa_state_id*)malloc(table->nclasses * sizeof(jrx_dfa_state_id));
+    if ( ! row->succ ) {
+        free(row);
+        return 0;
+    }
+
+    // Like the interpreter, take the first transition that matches.
+    int c;
+    for ( c = 0; c < table->nclasses; c++ ) {
+        row->succ[c] = JRX_DFA_NO_STATE;
+
+        vec_for_each(dfa_transition, state->trans, t) {
+            jrx_ccl* ccl = vec_ccl_get(dfa->ccls->ccls, t.ccl);
+
+            if ( _ccl_contains(ccl, table->reps[c]) ) {
+                row->succ[c] = t.succ;
+                break;
+            }
+        }
+    }
+
+    return row;
+}
+
+// Must be called with the DFA's lock held.
+static jrx_dfa_row* _dfa_get_row(jrx_dfa* dfa, jrx_dfa_state_id id)
+{
+    if ( id >= vec_dfa_state_size(dfa->states) )
+        return 0;
+
+    if ( ! dfa->table ) {
+        dfa->table = _dfa_table_create(dfa);
+
+        if ( ! dfa->table )
+            return 0;
+    }
+
+    // Another thread may have computed it in the meantime.
+    jrx_dfa_row* row = id < dfa->index->max ? dfa->index->rows[id] : 0;
+
+    if ( row )
+        return row;
+
+    jrx_dfa_state* state = _dfa_get_state(dfa, id);
+
+    if ( ! state )
+        return 0;
+
+    row = _dfa_row_create(dfa, state);
+
+    if ( row && ! _dfa_publish(dfa, id, 0, row) ) {
+        free(row->succ);
+        free(row);
+        return 0;
+    }
+
+    return row;
+}
+
+jrx_dfa_row* dfa_get_row(jrx_dfa* dfa, jrx_dfa_state_id id)
+{
+    if ( dfa->options & JRX_OPTION_NO_TABLE )
+        return 0;
+
+    jrx_dfa_row* row = _dfa_peek_row(dfa, id);
+
+    if ( row )
+        return row;
+
+    pthread_mutex_lock(&dfa->lock);
+    row = _dfa_get_row(dfa, id);
+    pthread_mutex_unlock(&dfa->lock);
+
+    return row;
+}
+
 jrx_dfa* dfa_from_nfa(jrx_nfa* nfa)
 {
     jrx_dfa* dfa = _dfa_create();
@@ -365,6 +638,9 @@ void dfa_delete(jrx_dfa* dfa)
     if ( dfa->initial_ops )
         vec_tag_op_delete(dfa->initial_ops);
 
+    if ( dfa->table )
+        _dfa_table_delete(dfa);
+
     vec_for_each(dfa_state, dfa->states, dstate) {
         if ( dstate )
             _dfa_state_delete(dstate);
@@ -379,14 +655,307 @@ void dfa_delete(jrx_dfa* dfa)
 
     vec_dfa_state_delete(dfa->states);
     kh_destroy(dfa_state_elem, dfa->hstates);
-    ccl_group_delete(dfa->ccls);
+
+    if ( dfa->ccls )
+        ccl_group_delete(dfa->ccls);
 
     if ( dfa->initial_dstate )
         set_dfa_state_elem_delete(dfa->initial_dstate);
 
+    _dfa_index_delete(dfa->index);
+    pthread_mutex_destroy(&dfa->lock);
     free(dfa);
 }
 
+// Context for sorting states by their signature during minimization.
+typedef struct {
+    uint32_t nclasses;
+    const jrx_dfa_state_id* succ;
+    const uint32_t* block;
+} _minimize_ctx;
+
+static uint32_t _succ_block(const _minimize_ctx* ctx, uint32_t s, uint32_t c)
+{
+    jrx_dfa_state_id succ = ctx->succ[s * ctx->nclasses + c];
+    return succ == JRX_DFA_NO_STATE ? UINT32_MAX : ctx->block[succ];
+}
+
+static int _signature_cmp(const _minimize_ctx* ctx, uint32_t a, uint32_t b)
+{
+    if ( ctx->block[a] != ctx->block[b] )
+        return ctx->block[a] < ctx->block[b] ? -1 : 1;
+
+    uint32_t c;
+    for ( c = 0; c < ctx->nclasses; c++ ) {
+        uint32_t sa = _succ_block(ctx, a, c);
+        uint32_t sb = _succ_block(ctx, b, c);
+
+        if ( sa != sb )
+            return sa < sb ? -1 : 1;
+    }
+
+    return 0;
+}
+
+// Merge sort, as qsort() doesn't pass a context to the comparision.
+static void _signature_sort(const _minimize_ctx* ctx, uint32_t* states, uint32_t* tmp, uint32_t n)
+{
+    if ( n < 2 )
+        return;
+
+    uint32_t half = n / 2;
+    _signature_sort(ctx, states, tmp, half);
+    _signature_sort(ctx, states + half, tmp, n - half);
+
+    uint32_t i = 0, j = half, k = 0;
+
+    while ( i < half && j < n )
+        tmp[k++] = _signature_cmp(ctx, states[i], states[j]) <= 0 ? states[i++] : states[j++];
+
+    while ( i < half )
+        tmp[k++] = states[i++];
+
+    while ( j < n )
+        tmp[k++] = states[j++];
+
+    memcpy(states, tmp, n * sizeof(uint32_t));
+}
+
+// Minimizes a table-driven DFA by partition refinement: starting with the
+// states grouped by their accept ID, blocks are split until all states in a
+// block have their successors in the same blocks. Returns the block of each
+// state, numbered densely in order of first appearance so that the initial
+// state 0 stays at 0, and the number of blocks.
+static uint32_t* _minimize(uint32_t n, uint32_t nclasses, const jrx_dfa_state_id* succ, const jrx_accept_id* accepts, uint32_t* nblocks)
+{
+    uint32_t* block = (uint32_t*)malloc(n * sizeof(uint32_t));
+    uint32_t* nblock = (uint32_t*)malloc(n * sizeof(uint32_t));
+    uint32_t* states = (uint32_t*)malloc(n * sizeof(uint32_t));
+    uint32_t* tmp = (uint32_t*)malloc(n * sizeof(uint32_t));
+
+    uint32_t i;
+    for ( i = 0; i < n; i++ ) {
+        block[i] = (uint16_t)accepts[i];
+        states[i] = i;
+    }
+
+    _minimize_ctx ctx = { nclasses, succ, block };
+    uint32_t count = 0;
+
+    while ( 1 ) {
+        // Sort by signature so that equivalent states end up next to each
+        // other, then number the runs.
+        _signature_sort(&ctx, states, tmp, n);
+
+        uint32_t ncount = 0;
+
+        for ( i = 0; i < n; i++ ) {
+            if ( i > 0 && _signature_cmp(&ctx, states[i - 1], states[i]) != 0 )
+                ++ncount;
+
+            nblock[states[i]] = ncount;
+        }
+
+        ++ncount;
+
+        memcpy(block, nblock, n * sizeof(uint32_t));
+
+        if ( ncount == count )
+            break;
+
+        count = ncount;
+    }
+
+    // Renumber by first appearance.
+    uint32_t* renumber = tmp;
+    memset(renumber, 0xff, n * sizeof(uint32_t));
+    uint32_t next = 0;
+
+    for ( i = 0; i < n; i++ ) {
+        if ( renumber[block[i]] == UINT32_MAX )
+            renumber[block[i]] = next++;
+
+        block[i] = renumber[block[i]];
+    }
+
+    free(nblock);
+    free(states);
+    free(tmp);
+
+    *nblocks = next;
+    return block;
+}
+
+// The states collected for exporting a DFA.
+typedef struct {
+    jrx_dfa_row** rows;        // Row of each state, in the order found.
+    uint32_t n;                // Number of states found.
+    uint32_t max;              // Number of rows allocated.
+    jrx_dfa_state_id* number;  // DFA state ID to position in rows + 1, or 0 if not found yet.
+    uint32_t max_number;       // Number of numbers allocated.
+} _export_states;
+
+// Adds a state to the set if not yet there. Returns false if the state
+// isn't table-driven.
+static int _export_add(jrx_dfa* dfa, _export_states* states, jrx_dfa_state_id id)
+{
+    if ( id >= states->max_number ) {
+        uint32_t nmax = (id + 1) * 2;
+        states->number = (jrx_dfa_state_id*)realloc(states->number, nmax * sizeof(jrx_dfa_state_id));
+        memset(states->number + states->max_number, 0, (nmax - states->max_number) * sizeof(jrx_dfa_state_id));
+        states->max_number = nmax;
+    }
+
+    if ( states->number[id] )
+        return 1;
+
+    jrx_dfa_row* row = dfa_get_row(dfa, id);
+
+    if ( ! (row && row->succ) )
+        // Needs the interpreter.
+        return 0;
+
+    if ( states->n == states->max ) {
+        states->max = states->max ? states->max * 2 : 16;
+        states->rows = (jrx_dfa_row**)realloc(states->rows, states->max * sizeof(jrx_dfa_row*));
+    }
+
+    states->rows[states->n++] = row;
+    states->number[id] = states->n;
+    return 1;
+}
+
+int dfa_export(jrx_dfa* dfa, jrx_dfa_image* image)
+{
+    if ( dfa->options & (JRX_OPTION_STD_MATCHER | JRX_OPTION_NO_TABLE) )
+        return 0;
+
+    // Collect all states reachable from the initial one, which will
+    // become state 0.
+    _export_states states = { 0, 0, 0, 0, 0 };
+    int ok = _export_add(dfa, &states, dfa->initial);
+
+    uint32_t i;
+    for ( i = 0; ok && i < states.n; i++ ) {
+        uint32_t c;
+        for ( c = 0; ok && c < dfa->table->nclasses; c++ ) {
+            jrx_dfa_state_id s = states.rows[i]->succ[c];
+
+            if ( s != JRX_DFA_NO_STATE )
+                ok = _export_add(dfa, &states, s);
+        }
+    }
+
+    if ( ! ok ) {
+        free(states.rows);
+        free(states.number);
+        return 0;
+    }
+
+    uint32_t n = states.n;
+    jrx_dfa_row** rows = states.rows;
+    jrx_dfa_state_id* number = states.number;
+
+    uint32_t k = dfa->table->nclasses;
+    jrx_dfa_state_id* succ = (jrx_dfa_state_id*)malloc(n * k * sizeof(jrx_dfa_state_id));
+    jrx_accept_id* accepts = (jrx_accept_id*)malloc(n * sizeof(jrx_accept_id));
+
+    for ( i = 0; i < n; i++ ) {
+        uint32_t c;
+        for ( c = 0; c < k; c++ ) {
+            jrx_dfa_state_id s = rows[i]->succ[c];
+            succ[i * k + c] = (s == JRX_DFA_NO_STATE ? JRX_DFA_NO_STATE : number[s] - 1);
+        }
+
+        accepts[i] = rows[i]->accepting ? rows[i]->aid : 0;
+    }
+
+    free(number);
+    free(rows);
+
+    // Merge equivalent states.
+    uint32_t nblocks;
+    uint32_t* block = _minimize(n, k, succ, accepts, &nblocks);
+
+    jrx_dfa_state_id* msucc = (jrx_dfa_state_id*)malloc(nblocks * k * sizeof(jrx_dfa_state_id));
+    jrx_accept_id* maccepts = (jrx_accept_id*)malloc(nblocks * sizeof(jrx_accept_id));
+
+    for ( i = 0; i < n; i++ ) {
+        uint32_t b = block[i];
+        uint32_t c;
+        for ( c = 0; c < k; c++ ) {
+            jrx_dfa_state_id s = succ[i * k + c];
+            msucc[b * k + c] = (s == JRX_DFA_NO_STATE ? JRX_DFA_NO_STATE : block[s]);
+        }
+
+        maccepts[b] = accepts[i];
+    }
+
+    free(block);
+    free(succ);
+    free(accepts);
+
+    uint8_t* classes = (uint8_t*)malloc(256);
+    memcpy(classes, dfa->table->classes, 256);
+
+    image->num_states = nblocks;
+    image->num_classes = k;
+    image->initial = 0;
+    image->classes = classes;
+    image->succ = msucc;
+    image->accepts = maccepts;
+    image->native = 0;
+
+    return 1;
+}
+
+jrx_dfa* dfa_from_image(const jrx_dfa_image* image, jrx_option options)
+{
+    jrx_dfa* dfa = _dfa_create();
+    if ( ! dfa )
+        return 0;
+
+    dfa->options = options;
+    dfa->initial = image->initial;
+    dfa->native = image->native;
+
+    dfa->table = (jrx_dfa_table*)malloc(sizeof(jrx_dfa_table));
+    if ( ! dfa->table ) {
+        dfa_delete(dfa);
+        return 0;
+    }
+
+    memcpy(dfa->table->classes, image->classes, sizeof(dfa->table->classes));
+    dfa->table->nclasses = image->num_classes;
+
+    int c;
+    for ( c = 255; c >= 0; c-- )
+        dfa->table->reps[dfa->table->classes[c]] = c;
+
+    // The rows point directly into the image, which hence must stay around
+    // as long as the DFA.
+    jrx_dfa_state_id id;
+    for ( id = 0; id < image->num_states; id++ ) {
+        jrx_dfa_row* row = (jrx_dfa_row*)malloc(sizeof(jrx_dfa_row));
+        if ( ! row ) {
+            dfa_delete(dfa);
+            return 0;
+        }
+
+        row->succ = (jrx_dfa_state_id*)&image->succ[id * image->num_classes];
+        row->aid = image->accepts[id];
+        row->accepting = (image->accepts[id] != 0);
+
+        if ( ! _dfa_publish(dfa, id, 0, row) ) {
+            free(row);
+            dfa_delete(dfa);
+            return 0;
+        }
+    }
+
+    return dfa;
+}
+
 jrx_dfa* dfa_compile(const char* pattern, int len, jrx_option options, int8_t nmatch, const char** errmsg)
 {
     jrx_nfa* nfa = nfa_compile(pattern, len, options, nmatch, errmsg);
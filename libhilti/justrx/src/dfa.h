@@ -3,6 +3,8 @@
 #ifndef JRX_DFA_H
 #define JRX_DFA_H
 
+#include <pthread.h>
+
 #include "jrx-intern.h"
 #include "set.h"
 #include "khash.h"
@@ -76,6 +78,38 @@ typedef struct {
 DECLARE_VECTOR(dfa_state, jrx_dfa_state*, jrx_dfa_state_id);
 DECLARE_VECTOR(dfa_state_elem, set_dfa_state_elem*, jrx_dfa_state_id);
 
+// Marks a missing transition in a jrx_dfa_row.
+static const jrx_dfa_state_id JRX_DFA_NO_STATE = (jrx_dfa_state_id)-1;
+
+// A state's row in the transition table used by the minimal matcher.
+typedef struct {
+    jrx_dfa_state_id* succ; // Successor indexed by byte class; null if the state must be interpreted.
+    jrx_accept_id aid;      // ID to accept with if accepting.
+    int8_t accepting;       // True if the state is accepting.
+} jrx_dfa_row;
+
+// Dense transition table for the minimal matcher, built lazily. Input bytes
+// are mapped to equivalence classes that all CCLs treat the same; each state
+// then gets a row mapping class to successor (stored in the jrx_dfa_index).
+// States with transitions requiring assertions don't get a row and are left
+// to the interpreter.
+typedef struct {
+    uint8_t classes[256];  // Equivalence class for each byte.
+    uint8_t reps[256];     // One representative byte for each class.
+    uint16_t nclasses;     // Number of classes.
+} jrx_dfa_table;
+
+// The states and rows computed so far, for lookup without locking. A slot
+// is written once and doesn't change afterwards. To grow, a larger copy
+// replaces the index, and the old one is kept around until the DFA is
+// deleted, as concurrent matchers may still be reading from it.
+typedef struct jrx_dfa_index {
+    jrx_dfa_state_id max;          // Number of slots.
+    jrx_dfa_state** states;        // States indexed by ID; null if not computed yet.
+    jrx_dfa_row** rows;            // Rows indexed by ID; null if not computed yet.
+    struct jrx_dfa_index* retired; // The index this one has replaced.
+} jrx_dfa_index;
+
 typedef struct jrx_dfa {
     jrx_option options;       // Options specified for compilation.
     int8_t nmatch;            // Max. number of captures the user is interested in.
@@ -88,15 +122,29 @@ typedef struct jrx_dfa {
     vec_dfa_state_elem* state_elems; // Array of states, indexed by their ID.
     hash_dfa_state* hstates;  // Hash of states indexed by set of NFA states.
     jrx_ccl_group *ccls;      // CCLs for the DFA.
-    jrx_nfa* nfa;             // The underlying NFA.
+    jrx_nfa* nfa;             // The underlying NFA; null if imported from an image, which provides rows only.
+    jrx_dfa_table* table;     // Transition table for the minimal matcher; null if not yet built.
+    jrx_dfa_index* index;     // Computed states and rows; read with atomic loads.
+    jrx_dfa_native native;    // Native matcher if imported with one; null otherwise.
+    pthread_mutex_t lock;     // Serializes lazy computation, which modifies all of the above.
 } jrx_dfa;
 
 
 extern jrx_dfa* dfa_compile(const char* pattern, int len, jrx_option options, int8_t nmatch, const char** errmsg);
 extern jrx_dfa* dfa_from_nfa(jrx_nfa* nfa);
 extern int dfa_state_compute(jrx_nfa_context* ctx, jrx_dfa* dfa, jrx_dfa_state_id id, set_dfa_state_elem* dstate, int recurse);
+
+// The following two compute states and rows on demand. They are safe to
+// call concurrently from multiple threads sharing the DFA.
 extern jrx_dfa_state* dfa_get_state(jrx_dfa* dfa, jrx_dfa_state_id id);
+extern jrx_dfa_row* dfa_get_row(jrx_dfa* dfa, jrx_dfa_state_id id);
+
+// Returns a state if it has already been computed, or null otherwise.
+extern jrx_dfa_state* dfa_peek_state(jrx_dfa* dfa, jrx_dfa_state_id id);
+
 extern void dfa_delete(jrx_dfa* dfa);
+extern int dfa_export(jrx_dfa* dfa, jrx_dfa_image* image);
+extern jrx_dfa* dfa_from_image(const jrx_dfa_image* image, jrx_option options);
 extern void dfa_print(jrx_dfa* dfa, FILE* file);
 
 #endif
@@ -25,6 +25,7 @@ static const jrx_option JRX_OPTION_NO_CAPTURE = 1 << 3;          // Do not captu
 static const jrx_option JRX_OPTION_STD_MATCHER = 1 << 4;         // Use the standard matcher.
 static const jrx_option JRX_OPTION_DONT_ANCHOR = 1 << 5;         // Don't anchor RE at the beginning.
 static const jrx_option JRX_OPTION_FIRST_MATCH = 1 << 6;         // Take first match, rather than longest.
+static const jrx_option JRX_OPTION_NO_TABLE = 1 << 7;            // Don't use a transition table with the minimal matcher.
 //static const jrx_option OPTIONS_INCREMENTAL_DFA = 1 << 4;  // Build DFA incrementally.
 
 // Predefined standard character classes.
@@ -42,6 +42,9 @@ static jrx_option _options(jrx_regex_t *preg)
     if ( cflags & REG_FIRST_MATCH )
         options |= JRX_OPTION_FIRST_MATCH;
 
+    if ( cflags & REG_NO_TABLE )
+        options |= JRX_OPTION_NO_TABLE;
+
     return options;
 }
 
@@ -99,7 +102,7 @@ static int _regexec_partial_std(const jrx_regex_t *preg, const char *buffer, uns
         if ( len == 1 )
             assertions |= last;
 
-        if ( jrx_match_state_advance(ms, *p++, assertions) == 0 ) {
+        if ( jrx_match_state_advance(ms, (unsigned char)*p++, assertions) == 0 ) {
             jrx_match_accept acc = _pick_accept(ms->accepts);
             return acc.aid ? acc.aid : 0;
         }
@@ -132,7 +135,54 @@ static int _regexec_partial_min(const jrx_regex_t *preg, const char *buffer, uns
         if ( len == 1 )
             assertions |= last;
 
-        jrx_accept_id rc = jrx_match_state_advance_min(ms, *p++, assertions);
+        jrx_accept_id rc = jrx_match_state_advance_min(ms, (unsigned char)*p++, assertions);
+
+        if ( ! rc ) {
+            ms->offset = eo;
+            return ms->acc > 0 ? ms->acc : 0;
+        }
+
+        if ( rc > 0 ) {
+            eo = ms->offset;
+            ms->acc = rc;
+
+            if ( preg->cflags & REG_FIRST_MATCH || ! jrx_can_transition(ms) )
+                return ms->acc;
+        }
+    }
+
+    ms->offset = eo;
+
+    if ( ! find_partial_matches && jrx_can_transition(ms) )
+        return -1;
+
+    return ms->acc;
+}
+
+// Like _regexec_partial_min(), but lets a native matcher consume the input
+// up to the next event.
+static int _regexec_partial_native(const jrx_regex_t *preg, const char *buffer, unsigned int len, jrx_match_state* ms, int find_partial_matches)
+{
+    jrx_offset eo = ms->offset;
+    const uint8_t* p = (const uint8_t*)buffer;
+
+    while ( len ) {
+        jrx_dfa_native_run run = { ms->state, 0, 0, 0 };
+        int rc = (*ms->dfa->native)(&run, p, len);
+
+        if ( run.accept > 0 ) {
+            eo = ms->offset + run.accept_end;
+            ms->acc = run.accept;
+        }
+
+        ms->state = run.state;
+
+        if ( run.consumed ) {
+            ms->offset += run.consumed;
+            ms->previous = p[run.consumed - 1];
+            p += run.consumed;
+            len -= run.consumed;
+        }
 
         if ( ! rc ) {
             ms->offset = eo;
@@ -223,6 +273,9 @@ int jrx_regexec_partial(const jrx_regex_t *preg, const char *buffer, unsigned in
 
     if ( preg->cflags & REG_STD_MATCHER )
         rc = _regexec_partial_std(preg, buffer, len, first, last, ms, find_partial_matches);
+    else if ( preg->dfa->native && ! (preg->dfa->options & JRX_OPTION_DEBUG) )
+        // Imported DFAs have no assertions, so we can ignore first/last.
+        rc = _regexec_partial_native(preg, buffer, len, ms, find_partial_matches);
     else
         rc = _regexec_partial_min(preg, buffer, len, first, last, ms, find_partial_matches);
 
@@ -300,6 +353,38 @@ void jrx_regfree(jrx_regex_t *preg)
         dfa_delete(preg->dfa);
 }
 
+int jrx_regset_export(jrx_regex_t *preg, jrx_dfa_image* image)
+{
+    if ( ! preg->dfa )
+        return REG_BADPAT;
+
+    return dfa_export(preg->dfa, image) ? REG_OK : REG_NOTSUPPORTED;
+}
+
+int jrx_regset_import(jrx_regex_t *preg, int cflags, const jrx_dfa_image* image)
+{
+    jrx_regset_init(preg, 0, cflags);
+
+    jrx_option options = _options(preg);
+
+    if ( options == REG_NOTSUPPORTED || (options & JRX_OPTION_STD_MATCHER) )
+        return REG_NOTSUPPORTED;
+
+    jrx_dfa* dfa = dfa_from_image(image, options & ~JRX_OPTION_NO_TABLE);
+    if ( ! dfa )
+        return REG_EMEM;
+
+    preg->dfa = dfa;
+    return REG_OK;
+}
+
+void jrx_dfa_image_done(jrx_dfa_image* image)
+{
+    free((void*)image->classes);
+    free((void*)image->succ);
+    free((void*)image->accepts);
+}
+
 size_t jrx_regerror(int errcode, const jrx_regex_t *preg, char *errbuf, size_t errbuf_size)
 {
     char buffer[127];
@@ -342,7 +427,23 @@ int jrx_num_groups(jrx_regex_t *preg)
 
 int jrx_can_transition(jrx_match_state* ms)
 {
-    jrx_dfa_state* state = vec_dfa_state_get(ms->dfa->states, ms->state);
+    if ( ! ms->dfa->nfa ) {
+        // Imported, only rows available.
+        jrx_dfa_row* row = dfa_get_row(ms->dfa, ms->state);
+
+        if ( ! row )
+            return 0;
+
+        int c;
+        for ( c = 0; c < ms->dfa->table->nclasses; c++ ) {
+            if ( row->succ[c] != JRX_DFA_NO_STATE )
+                return 1;
+        }
+
+        return 0;
+    }
+
+    jrx_dfa_state* state = dfa_peek_state(ms->dfa, ms->state);
 
     if ( ! state ) {
         if ( ms->dfa->options & JRX_OPTION_DEBUG )
@@ -368,6 +469,11 @@ int jrx_current_accept(jrx_match_state* ms)
         return acc.aid ? acc.aid : 0;
     }
 
+    else if ( ! ms->dfa->nfa ) {
+        jrx_dfa_row* row = dfa_get_row(ms->dfa, ms->state);
+        return row && row->accepting ? row->aid : 0;
+    }
+
     else {
         jrx_dfa_state* state = dfa_get_state(ms->dfa, ms->state);
         return state->accepts ? vec_dfa_accept_get(state->accepts, 0).aid : 0;
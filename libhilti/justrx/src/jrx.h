@@ -54,6 +54,27 @@ struct jrx_match_state {
     jrx_accept_id acc;
 };
 
+struct jrx_search_thread;
+
+/// State for an unanchored search with the minimal matcher, see
+/// jrx_regexec_search_partial(). The search runs one matcher per start
+/// offset, but merges all matchers reaching the same DFA state into the one
+/// that started first. That keeps the number of matchers bounded by the
+/// number of DFA states and the search linear in the input length.
+typedef struct {
+    jrx_offset offset;     ///< Offset of the next input byte, relative to the start of the search.
+    jrx_offset so;         ///< Start offset of the match if one has been found.
+    jrx_offset eo;         ///< End offset of the match if one has been found.
+    jrx_accept_id acc;     ///< Accept ID of the best match so far, or 0 if none.
+    struct jrx_dfa* dfa;   // The DFA we're matching with.
+    struct jrx_search_thread* threads; // Matchers still running, ordered by their start offset.
+    int num_threads;       // Number of matchers running.
+    int max_threads;       // Number of matchers allocated.
+    jrx_offset limit;      // Smallest start offset of any matcher that has accepted.
+    jrx_offset* seen;      // Indexed by DFA state, the offset + 1 when a matcher last reached it.
+    jrx_dfa_state_id num_seen; // Number of entries allocated for seen.
+} jrx_search_state;
+
 typedef struct {
     size_t re_nsub;            ///< Number of capture expressions in regular expression (POSIX).
 
@@ -64,6 +85,39 @@ typedef struct {
     const char* errmsg;        // Most recent error message, or NULL if none.
 } jrx_regex_t;
 
+/// State passed to a native matcher, see jrx_dfa_native.
+typedef struct {
+    jrx_dfa_state_id state; ///< Current state; updated by the matcher.
+    uint32_t consumed;      ///< Set to the number of transitions taken.
+    int32_t accept;         ///< Set to the ID of the last accepting state passed through, or left alone if none.
+    uint32_t accept_end;    ///< Set to the number of transitions taken when passing through that state.
+} jrx_dfa_native_run;
+
+/// A matcher compiled to native code for a DFA exported with
+/// jrx_regset_export(). It consumes input starting in the current state
+/// until it finds no transition, or reaches the end of the data. Accepting
+/// states that have further transitions are recorded in \a run but don't
+/// stop it, unless it was compiled for reporting the first match. Returns -1
+/// when reaching the end of the data, and 0 if there's no transition. If it
+/// stops in an accepting state, either right after entering it or because
+/// there's no transition out of it, it returns that state's ID instead; in
+/// the latter case, it sets \a run's state to (jrx_dfa_state_id)-1.
+typedef int32_t (*jrx_dfa_native)(jrx_dfa_native_run* run, const uint8_t* data, uint32_t len);
+
+/// The tables of a fully computed DFA for the minimal matcher, as created by
+/// jrx_regset_export(). They can be stored elsewhere, such as in generated
+/// code, and later be turned back into a matcher with jrx_regset_import()
+/// without compiling the patterns again.
+typedef struct {
+    uint32_t num_states;           ///< Number of states.
+    uint32_t num_classes;          ///< Number of byte equivalence classes.
+    jrx_dfa_state_id initial;      ///< The initial state.
+    const uint8_t* classes;        ///< The equivalence class for each byte value; 256 entries.
+    const jrx_dfa_state_id* succ;  ///< Successors, with num_classes entries per state; (jrx_dfa_state_id)-1 if none.
+    const jrx_accept_id* accepts;  ///< Accept ID for each state; 0 if not accepting.
+    jrx_dfa_native native;         ///< Optional native matcher for the DFA; null if none.
+} jrx_dfa_image;
+
 typedef jrx_offset regoff_t;
 
 typedef struct jrx_regmatch_t {
@@ -89,6 +143,7 @@ typedef struct jrx_regmatch_t {
 #define REG_ANCHOR       (1 << 8)   //< Anchor matching at beginning. The effect is that of an implicit '^' at the beginning.
 #define REG_LAZY         (1 << 9)   //< Build DFA incrementally.
 #define REG_FIRST_MATCH  (1 << 10)  //< Take first match, rather than longest.
+#define REG_NO_TABLE     (1 << 11)  //< Always interpret the DFA with the minimal matcher, don't build a transition table.
 
 // Non-standard error codes..
 #define REG_OK           0       //< Everything is fine.
@@ -139,5 +194,11 @@ extern int jrx_num_groups(jrx_regex_t *preg);
 extern int jrx_can_transition(jrx_match_state* ms);
 extern jrx_match_state* jrx_match_state_init(const jrx_regex_t *preg, jrx_offset begin, jrx_match_state* ms);
 extern void jrx_match_state_done(jrx_match_state* ms);
+extern int jrx_regexec_search_partial(const jrx_regex_t *preg, const char *buffer, unsigned int len, jrx_assertion first, jrx_assertion last, jrx_search_state* ss, int final);
+extern jrx_search_state* jrx_search_state_init(const jrx_regex_t *preg, jrx_search_state* ss);
+extern void jrx_search_state_done(jrx_search_state* ss);
+extern int jrx_regset_export(jrx_regex_t *preg, jrx_dfa_image* image);
+extern int jrx_regset_import(jrx_regex_t *preg, int cflags, const jrx_dfa_image* image);
+extern void jrx_dfa_image_done(jrx_dfa_image* image);
 
 #endif
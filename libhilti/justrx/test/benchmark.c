@@ -0,0 +1,121 @@
+// $Id$
+//
+// Compares the throughput of the minimal matcher with and without the DFA
+// transition table, using token regexps from the Spicy HTTP grammar
+// (libbinpac/parsers/http.pac2). Each pattern is matched as a look-ahead
+// token at every position of an HTTP header block; both variants must agree
+// on the matches found.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <jrx.h>
+
+static const char* patterns[] = {
+    "[^ \\t\\r\\n]+",      // Token, URI
+    "\\r?\\n",             // NewLine
+    "[^\\r\\n]*",          // RestOfLine, HeaderValue
+    "[^\\r\\n]*\\r?\\n",   // FullLine
+    "[0-9]+",              // Integer
+    "[0-9a-zA-Z]+",        // HexInteger
+    "[ \\t]+",             // WhiteSpace
+    "HTTP\\/",             // Version
+    "[0-9]+\\.[0-9]*",     // Version number
+    "[^:\\r\\n]+",         // HeaderName
+    ":[\\t ]*",            // Header separator
+    0
+};
+
+static const char* request =
+    "GET /index.html?q=spicy&lang=en HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:40.0) Gecko/20100101 Firefox/40.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Cookie: session=0123456789abcdef0123456789abcdef; tracking=no\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Length: 12345\r\n"
+    "\r\n";
+
+static double current_time()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return (double)(tv.tv_sec) + (double)(tv.tv_usec) / 1e6;
+}
+
+// Matches the regexp as a token at each position of the input, returning
+// the total number of bytes covered by matches.
+static long run(jrx_regex_t* re, const char* data, int len, int rounds)
+{
+    long total = 0;
+
+    int r;
+    for ( r = 0; r < rounds; r++ ) {
+        int i;
+        for ( i = 0; i < len; i++ ) {
+            jrx_match_state ms;
+            jrx_match_state_init(re, 0, &ms);
+
+            int rc = jrx_regexec_partial(re, data + i, len - i, JRX_ASSERTION_BOL | JRX_ASSERTION_BOD, JRX_ASSERTION_EOL | JRX_ASSERTION_EOD, &ms, 1);
+
+            if ( rc > 0 )
+                total += ms.offset - 1;
+
+            jrx_match_state_done(&ms);
+        }
+    }
+
+    return total;
+}
+
+static int compile(jrx_regex_t* re, const char* pattern, int cflags)
+{
+    int rc = jrx_regcomp(re, pattern, REG_EXTENDED | REG_NOSUB | REG_ANCHOR | REG_LAZY | cflags);
+
+    if ( rc != REG_OK ) {
+        char buffer[128];
+        jrx_regerror(rc, re, buffer, sizeof(buffer));
+        fprintf(stderr, "cannot compile %s: %s\n", pattern, buffer);
+    }
+
+    return rc == REG_OK;
+}
+
+int main(int argc, char** argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+    int len = strlen(request);
+    double mbytes = (double)len * rounds / 1024 / 1024;
+    int failed = 0;
+
+    const char** p;
+    for ( p = patterns; *p; p++ ) {
+        jrx_regex_t table;
+        jrx_regex_t interp;
+
+        if ( ! (compile(&table, *p, 0) && compile(&interp, *p, REG_NO_TABLE)) )
+            return 1;
+
+        double t1 = current_time();
+        long m1 = run(&table, request, len, rounds);
+        double t2 = current_time();
+        long m2 = run(&interp, request, len, rounds);
+        double t3 = current_time();
+
+        printf("%-20s table %8.2f MB/s  interpreter %8.2f MB/s  (%.2fx)%s\n", *p,
+               mbytes / (t2 - t1), mbytes / (t3 - t2), (t3 - t2) / (t2 - t1),
+               m1 != m2 ? "  MISMATCH" : "");
+
+        if ( m1 != m2 )
+            failed = 1;
+
+        jrx_regfree(&table);
+        jrx_regfree(&interp);
+    }
+
+    return failed;
+}
@@ -8,7 +8,8 @@
 
 ; The header of garbage collected objects.
 %hlt.gchdr = type {
-    i64 ;; Reference count.
+    i32, ;; Reference count.
+    i32  ;; Shared flag.
 }
 
 ; The per-thread execution context.
@@ -181,6 +182,7 @@ declare i8*          @__hlt_bytes_append(%hlt.bytes*, %hlt.bytes*, %hlt.exceptio
 
 
 declare i8 @__hlt_bytes_extract_one(%hlt.iterator.bytes*, %hlt.iterator.bytes, %hlt.exception**, %hlt.execution_context*)
+declare i8* @__hlt_bytes_extract_n(%hlt.iterator.bytes*, %hlt.iterator.bytes, i64, %hlt.exception**, %hlt.execution_context*)
 
 declare void            @__hlt_exception_print_uncaught_abort(%hlt.exception*, %hlt.execution_context*)
 declare i8              @__hlt_exception_match(%hlt.exception*, %hlt.exception.type*)
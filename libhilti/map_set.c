@@ -4,9 +4,14 @@
 #include "timer.h"
 #include "interval.h"
 #include "enum.h"
+#include "hutil.h"
 
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 typedef hlt_hash khint_t;
 typedef void* __val_t;
 
@@ -19,6 +24,39 @@ typedef hlt_timer* __khval_set_t; // The value stored for sets. Not memory-manag
 
 #include "3rdparty/khash/khash.h"
 
+// Maps and sets with keys and values of at most this size store them
+// inline in an open-addressing table, rather than in khash as pointers to
+// separately allocated copies.
+#define __HLT_SWISS_MAX_SIZE 64
+
+// Number of slots whose control bytes we probe in one go.
+#define __HLT_SWISS_GROUP 16
+
+// Control bytes. Full slots store the lower 7 bits of their hash.
+#define __HLT_SWISS_EMPTY   ((int8_t)-128)
+#define __HLT_SWISS_DELETED ((int8_t)-2)
+
+// An open-addressing hash table storing keys and values inline. It's
+// organized like Google's "Swiss tables": each slot has a control byte
+// that's either empty, deleted, or holds 7 bits of the hash of the slot's
+// entry, and lookups scan the control bytes of a group of slots at once,
+// comparing keys only for slots whose bits match. Slots refer to the entries
+// by index; the entries themselves are kept in separate arrays in order of
+// insertion, which is the order in which we iterate over them.
+typedef struct {
+    uint64_t capacity;    // Number of slots; zero or a power of two no smaller than __HLT_SWISS_GROUP.
+    uint64_t size;        // Number of entries that haven't been removed.
+    uint64_t num_entries; // Number of entries used, including removed ones.
+    uint64_t max_entries; // Number of entries allocated.
+    int8_t* ctrl;         // Control byte per slot.
+    uint64_t* index;      // Entry per slot.
+    hlt_hash* hashes;     // Hash per entry.
+    int8_t* live;         // Per entry, true if it hasn't been removed.
+    int8_t* keys;         // Key per entry.
+    int8_t* vals;         // Value per entry. Null for sets.
+    hlt_timer** timers;   // Timer per entry, or null if none is set. Not memory-managed to avoid cycles.
+} __hlt_swiss_table;
+
 enum MapDefaultType {
     HLT_MAP_DEFAULT_NONE,
     HLT_MAP_DEFAULT_VALUE,
@@ -41,6 +79,9 @@ typedef struct __hlt_map {
     void *cache_result;                // Cache for deref's result tuple.
     void *cache_default;               // Cache for DEFAULT_FUNCTION's result value.
 
+    int8_t swiss;                // True if entries are stored in *st* rather than via khash.
+    __hlt_swiss_table st;        // The entries if *swiss* is true.
+
     // These are used by khash and copied from there (see README.HILTI).
     khint_t n_buckets, size, n_occupied, upper_bound;
     uint32_t *flags;
@@ -55,6 +96,9 @@ typedef struct __hlt_set {
     hlt_interval timeout;        // The timeout value, or 0 if disabled
     hlt_enum strategy;           // Expiration strategy if set; zero otherwise.
 
+    int8_t swiss;                // True if entries are stored in *st* rather than via khash.
+    __hlt_swiss_table st;        // The entries if *swiss* is true.
+
     // These are used by khash and copied from there (see README.HILTI).
     khint_t n_buckets, size, n_occupied, upper_bound;
     uint32_t *flags;
@@ -75,6 +119,443 @@ static inline int8_t _kh_hash_equal(const void* obj1, const void* obj2, const hl
 KHASH_INIT(map, __khkey_t, __khval_map_t, 1, _kh_hash_func, _kh_hash_equal)
 KHASH_INIT(set, __khkey_t, __khval_set_t, 1, _kh_hash_func, _kh_hash_equal)
 
+//////////// Inline hash table.
+
+// Bitmask of the slots in the group starting at ctrl whose control byte equals c.
+static inline uint32_t _swiss_group_match(const int8_t* ctrl, int8_t c)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(c)));
+#else
+    uint32_t mask = 0;
+
+    for ( int i = 0; i < __HLT_SWISS_GROUP; i++ ) {
+        if ( ctrl[i] == c )
+            mask |= (1 << i);
+    }
+
+    return mask;
+#endif
+}
+
+// Bitmask of the slots in the group starting at ctrl that are empty or deleted.
+static inline uint32_t _swiss_group_free(const int8_t* ctrl)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return _mm_movemask_epi8(group);
+#else
+    uint32_t mask = 0;
+
+    for ( int i = 0; i < __HLT_SWISS_GROUP; i++ ) {
+        if ( ctrl[i] < 0 )
+            mask |= (1 << i);
+    }
+
+    return mask;
+#endif
+}
+
+static inline int8_t _swiss_use(const hlt_type_info* tkey, const hlt_type_info* tvalue)
+{
+    return tkey->size <= __HLT_SWISS_MAX_SIZE && (! tvalue || tvalue->size <= __HLT_SWISS_MAX_SIZE);
+}
+
+static inline hlt_hash _swiss_hash(const hlt_type_info* tkey, const void* key)
+{
+    hlt_hash h;
+
+    if ( tkey->hash == hlt_default_hash ) {
+        // Hash the bytes directly, word-wise.
+        const int8_t* p = (const int8_t*)key;
+        int16_t n = tkey->size;
+        h = n;
+
+        for ( ; n >= 8; p += 8, n -= 8 ) {
+            uint64_t w;
+            memcpy(&w, p, 8);
+            h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+            h ^= h >> 32;
+        }
+
+        if ( n )
+            h = hlt_hash_bytes(p, n, h);
+    }
+
+    else
+        h = (*tkey->hash)(tkey, key, 0, 0);
+
+    // Mix so that both the lower 7 bits and the remaining ones are usable.
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline int8_t _swiss_equal(const hlt_type_info* tkey, const void* key1, const void* key2)
+{
+    if ( tkey->equal == hlt_default_equal )
+        return memcmp(key1, key2, tkey->size) == 0;
+
+    return (*tkey->equal)(tkey, key1, tkey, key2, 0, 0);
+}
+
+static inline int8_t _swiss_exist(const __hlt_swiss_table* t, uint64_t i)
+{
+    return t->live[i];
+}
+
+static inline uint64_t _swiss_start(const __hlt_swiss_table* t, hlt_hash hash)
+{
+    return (hash >> 7) & (t->capacity - 1) & ~(uint64_t)(__HLT_SWISS_GROUP - 1);
+}
+
+// Returns the slot of a key with the given hash, or the table's capacity if
+// it doesn't exist.
+static uint64_t _swiss_find(const __hlt_swiss_table* t, const hlt_type_info* tkey, const void* key, hlt_hash hash)
+{
+    if ( ! t->size )
+        return t->capacity;
+
+    int8_t h2 = hash & 0x7f;
+    uint64_t mask = t->capacity - 1;
+    uint64_t pos = _swiss_start(t, hash);
+
+    for ( uint64_t step = __HLT_SWISS_GROUP; ; step += __HLT_SWISS_GROUP ) {
+        const int8_t* group = t->ctrl + pos;
+
+        for ( uint32_t m = _swiss_group_match(group, h2); m; m &= m - 1 ) {
+            uint64_t i = pos + __builtin_ctz(m);
+            uint64_t e = t->index[i];
+
+            if ( t->hashes[e] == hash && _swiss_equal(tkey, t->keys + e * tkey->size, key) )
+                return i;
+        }
+
+        if ( _swiss_group_match(group, __HLT_SWISS_EMPTY) )
+            return t->capacity;
+
+        // Quadratic probing over the groups visits all of them eventually,
+        // and there's always at least one empty slot.
+        pos = (pos + step) & mask;
+    }
+}
+
+// Returns the entry of a key, or the table's number of entries if it
+// doesn't exist.
+static inline uint64_t _swiss_get(const __hlt_swiss_table* t, const hlt_type_info* tkey, const void* key)
+{
+    uint64_t i = _swiss_find(t, tkey, key, _swiss_hash(tkey, key));
+    return i != t->capacity ? t->index[i] : t->num_entries;
+}
+
+// Returns a free slot for a new entry with the given hash.
+static uint64_t _swiss_find_free(const __hlt_swiss_table* t, hlt_hash hash)
+{
+    uint64_t mask = t->capacity - 1;
+    uint64_t pos = _swiss_start(t, hash);
+
+    for ( uint64_t step = __HLT_SWISS_GROUP; ; step += __HLT_SWISS_GROUP ) {
+        uint32_t m = _swiss_group_free(t->ctrl + pos);
+
+        if ( m )
+            return pos + __builtin_ctz(m);
+
+        pos = (pos + step) & mask;
+    }
+}
+
+static void _swiss_destroy(__hlt_swiss_table* t)
+{
+    hlt_free(t->ctrl);
+    hlt_free(t->index);
+    hlt_free(t->hashes);
+    hlt_free(t->live);
+    hlt_free(t->keys);
+    hlt_free(t->vals);
+    hlt_free(t->timers);
+    memset(t, 0, sizeof(__hlt_swiss_table));
+}
+
+// Allocates an empty table of the given capacity.
+static void _swiss_alloc(__hlt_swiss_table* t, uint64_t capacity, int16_t key_size, int16_t val_size)
+{
+    // Keeping the load factor at or below 7/8 guarantees that there's
+    // always an empty slot.
+    uint64_t max_entries = capacity - capacity / 8;
+
+    t->capacity = capacity;
+    t->size = 0;
+    t->num_entries = 0;
+    t->max_entries = max_entries;
+    t->ctrl = hlt_malloc(capacity);
+    t->index = hlt_malloc(capacity * sizeof(uint64_t));
+    t->hashes = hlt_malloc(max_entries * sizeof(hlt_hash));
+    t->live = hlt_malloc(max_entries);
+    t->keys = hlt_malloc(max_entries * key_size);
+    t->vals = (val_size ? hlt_malloc(max_entries * val_size) : 0);
+    t->timers = hlt_malloc(max_entries * sizeof(hlt_timer*));
+    memset(t->ctrl, __HLT_SWISS_EMPTY, capacity);
+}
+
+// Moves all entries that haven't been removed into a table of the given
+// capacity, keeping their order. Timer cookies point to their entry's key,
+// so we update them to the new location. That needs to know whether this
+// is a map or a set, as the cookie's type differs.
+static void _swiss_rehash(__hlt_swiss_table* t, uint64_t capacity, int16_t key_size, int16_t val_size, int8_t is_map)
+{
+    __hlt_swiss_table old = *t;
+    _swiss_alloc(t, capacity, key_size, val_size);
+
+    for ( uint64_t i = 0; i < old.num_entries; i++ ) {
+        if ( ! old.live[i] )
+            continue;
+
+        uint64_t e = t->num_entries++;
+        hlt_hash hash = old.hashes[i];
+        uint64_t j = _swiss_find_free(t, hash);
+
+        t->ctrl[j] = hash & 0x7f;
+        t->index[j] = e;
+        t->hashes[e] = hash;
+        t->live[e] = 1;
+        t->timers[e] = old.timers[i];
+        memcpy(t->keys + e * key_size, old.keys + i * key_size, key_size);
+
+        if ( val_size )
+            memcpy(t->vals + e * val_size, old.vals + i * val_size, val_size);
+
+        if ( t->timers[e] ) {
+            void* key = t->keys + e * key_size;
+
+            if ( is_map )
+                t->timers[e]->cookie.map.key = key;
+            else
+                t->timers[e]->cookie.set.key = key;
+        }
+    }
+
+    t->size = t->num_entries;
+
+    _swiss_destroy(&old);
+}
+
+// Returns the entry of a key, adding it if it doesn't exist yet. In that
+// case, the key is copied into the entry and *ret is set to 1, the entry's
+// timer is cleared, and its value (if any) is left uninitialized. The key is
+// not ref'ed.
+static uint64_t _swiss_put(__hlt_swiss_table* t, const hlt_type_info* tkey, const hlt_type_info* tvalue, void* key, int* ret, int8_t is_map)
+{
+    hlt_hash hash = _swiss_hash(tkey, key);
+    uint64_t i = _swiss_find(t, tkey, key, hash);
+
+    if ( i != t->capacity ) {
+        *ret = 0;
+        return t->index[i];
+    }
+
+    if ( t->num_entries == t->max_entries ) {
+        // If many entries have been removed, just reclaim them; otherwise
+        // grow.
+        uint64_t capacity = t->capacity;
+
+        if ( ! capacity )
+            capacity = __HLT_SWISS_GROUP;
+
+        else if ( t->size >= t->max_entries / 2 )
+            capacity *= 2;
+
+        _swiss_rehash(t, capacity, tkey->size, (tvalue ? tvalue->size : 0), is_map);
+    }
+
+    uint64_t e = t->num_entries++;
+    i = _swiss_find_free(t, hash);
+
+    t->ctrl[i] = hash & 0x7f;
+    t->index[i] = e;
+    t->hashes[e] = hash;
+    t->live[e] = 1;
+    t->timers[e] = 0;
+    memcpy(t->keys + e * tkey->size, key, tkey->size);
+    ++t->size;
+
+    *ret = 1;
+    return e;
+}
+
+// Removes an entry. Its slot stays marked as deleted until the next rehash.
+static void _swiss_del(__hlt_swiss_table* t, uint64_t e)
+{
+    hlt_hash hash = t->hashes[e];
+    int8_t h2 = hash & 0x7f;
+    uint64_t mask = t->capacity - 1;
+    uint64_t pos = _swiss_start(t, hash);
+
+    for ( uint64_t step = __HLT_SWISS_GROUP; ; step += __HLT_SWISS_GROUP ) {
+        for ( uint32_t m = _swiss_group_match(t->ctrl + pos, h2); m; m &= m - 1 ) {
+            uint64_t i = pos + __builtin_ctz(m);
+
+            if ( t->index[i] == e ) {
+                t->ctrl[i] = __HLT_SWISS_DELETED;
+                t->live[e] = 0;
+                --t->size;
+                return;
+            }
+        }
+
+        pos = (pos + step) & mask;
+    }
+}
+
+static inline void _swiss_clear(__hlt_swiss_table* t)
+{
+    if ( ! t->capacity )
+        return;
+
+    memset(t->ctrl, __HLT_SWISS_EMPTY, t->capacity);
+    t->size = 0;
+    t->num_entries = 0;
+}
+
+//////////// Entry access for both storage schemes.
+
+static inline khiter_t _map_end(const hlt_map* m)
+{
+    return m->swiss ? m->st.num_entries : kh_end(m);
+}
+
+static inline int8_t _map_exist(const hlt_map* m, khiter_t i)
+{
+    return m->swiss ? _swiss_exist(&m->st, i) : kh_exist(m, i);
+}
+
+static inline void* _map_key(const hlt_map* m, khiter_t i)
+{
+    return m->swiss ? m->st.keys + i * m->tkey->size : kh_key(m, i);
+}
+
+static inline void* _map_val(const hlt_map* m, khiter_t i)
+{
+    return m->swiss ? m->st.vals + i * m->tvalue->size : kh_value(m, i).val;
+}
+
+static inline hlt_timer** _map_timer(hlt_map* m, khiter_t i)
+{
+    return m->swiss ? &m->st.timers[i] : &kh_value(m, i).timer;
+}
+
+static inline khiter_t _map_get(hlt_map* m, const hlt_type_info* type, void* key)
+{
+    return m->swiss ? _swiss_get(&m->st, m->tkey, key) : kh_get_map(m, key, type);
+}
+
+// Returns the entry for a key, adding it if it doesn't exist yet. See
+// _swiss_put() for the semantics.
+static inline khiter_t _map_put(hlt_map* m, const hlt_type_info* type, void* key, int* ret)
+{
+    if ( m->swiss )
+        return _swiss_put(&m->st, m->tkey, m->tvalue, key, ret, 1);
+
+    void* keytmp = hlt_malloc(type->size);
+    memcpy(keytmp, key, type->size);
+
+    khiter_t i = kh_put_map(m, keytmp, ret, type);
+
+    if ( ! *ret )
+        // The hash table keeps the old key, so we don't need the new one.
+        hlt_free(keytmp);
+
+    else {
+        kh_value(m, i).val = hlt_malloc(m->tvalue->size);
+        kh_value(m, i).timer = 0;
+    }
+
+    return i;
+}
+
+// Unrefs an entry's key and value and removes it. Does not touch the timer.
+static inline void _map_del(hlt_map* m, khiter_t i, hlt_execution_context* ctx)
+{
+    void* key = _map_key(m, i);
+    void* val = _map_val(m, i);
+
+    GC_DTOR_GENERIC(key, m->tkey, ctx);
+    GC_DTOR_GENERIC(val, m->tvalue, ctx);
+
+    if ( m->swiss ) {
+        _swiss_del(&m->st, i);
+        return;
+    }
+
+    hlt_free(key);
+    hlt_free(val);
+    kh_del_map(m, i);
+}
+
+static inline khiter_t _set_end(const hlt_set* m)
+{
+    return m->swiss ? m->st.num_entries : kh_end(m);
+}
+
+static inline int8_t _set_exist(const hlt_set* m, khiter_t i)
+{
+    return m->swiss ? _swiss_exist(&m->st, i) : kh_exist(m, i);
+}
+
+static inline void* _set_key(const hlt_set* m, khiter_t i)
+{
+    return m->swiss ? m->st.keys + i * m->tkey->size : kh_key(m, i);
+}
+
+static inline hlt_timer** _set_timer(hlt_set* m, khiter_t i)
+{
+    return m->swiss ? &m->st.timers[i] : &kh_value(m, i);
+}
+
+static inline khiter_t _set_get(hlt_set* m, const hlt_type_info* type, void* key)
+{
+    return m->swiss ? _swiss_get(&m->st, m->tkey, key) : kh_get_set(m, key, type);
+}
+
+// Returns the entry for a key, adding it if it doesn't exist yet. See
+// _swiss_put() for the semantics.
+static inline khiter_t _set_put(hlt_set* m, const hlt_type_info* type, void* key, int* ret)
+{
+    if ( m->swiss )
+        return _swiss_put(&m->st, m->tkey, 0, key, ret, 0);
+
+    void* keytmp = hlt_malloc(type->size);
+    memcpy(keytmp, key, type->size);
+
+    khiter_t i = kh_put_set(m, keytmp, ret, type);
+
+    if ( ! *ret )
+        // The hash table keeps the old key, so we don't need the new one.
+        hlt_free(keytmp);
+
+    else
+        kh_value(m, i) = 0;
+
+    return i;
+}
+
+// Unrefs an entry's key and removes it. Does not touch the timer.
+static inline void _set_del(hlt_set* m, khiter_t i, hlt_execution_context* ctx)
+{
+    void* key = _set_key(m, i);
+
+    GC_DTOR_GENERIC(key, m->tkey, ctx);
+
+    if ( m->swiss ) {
+        _swiss_del(&m->st, i);
+        return;
+    }
+
+    hlt_free(key);
+    kh_del_set(m, i);
+}
+
 static inline void _map_clear_default(hlt_map* m, hlt_execution_context* ctx)
 {
     switch ( m->default_type ) {
@@ -97,18 +578,15 @@ static inline void _map_clear_default(hlt_map* m, hlt_execution_context* ctx)
 
 void hlt_map_dtor(hlt_type_info* ti, hlt_map* m, hlt_execution_context* ctx)
 {
-    for ( khiter_t i = kh_begin(m); i != kh_end(m); i++ ) {
-        if ( kh_exist(m, i) ) {
+    for ( khiter_t i = 0; i != _map_end(m); i++ ) {
+        if ( _map_exist(m, i) ) {
 
-            if ( kh_value(m, i).timer ) {
+            if ( *_map_timer(m, i) ) {
                 hlt_exception* excpt = 0;
-                hlt_timer_cancel(kh_value(m, i).timer, &excpt, ctx);
+                hlt_timer_cancel(*_map_timer(m, i), &excpt, ctx);
             }
 
-            GC_DTOR_GENERIC(kh_key(m, i), m->tkey, ctx);
-            GC_DTOR_GENERIC(kh_value(m, i).val, m->tvalue, ctx);
-            hlt_free(kh_key(m, i));
-            hlt_free(kh_value(m, i).val);
+            _map_del(m, i, ctx);
         }
     }
 
@@ -118,7 +596,10 @@ void hlt_map_dtor(hlt_type_info* ti, hlt_map* m, hlt_execution_context* ctx)
     hlt_free(m->cache_result);
     hlt_free(m->cache_default);
 
-    kh_destroy_map(m);
+    if ( m->swiss )
+        _swiss_destroy(&m->st);
+    else
+        kh_destroy_map(m);
 }
 
 void hlt_iterator_map_cctor(hlt_type_info* ti, hlt_iterator_map* i, hlt_execution_context* ctx)
@@ -148,21 +629,24 @@ const hlt_type_info* hlt_map_value_type(const hlt_type_info* type, hlt_exception
 
 void hlt_set_dtor(hlt_type_info* ti, hlt_set* s, hlt_execution_context* ctx)
 {
-    for ( khiter_t i = kh_begin(s); i != kh_end(s); i++ ) {
-        if ( kh_exist(s, i) ) {
+    for ( khiter_t i = 0; i != _set_end(s); i++ ) {
+        if ( _set_exist(s, i) ) {
 
-            if ( kh_value(s, i) ) {
+            if ( *_set_timer(s, i) ) {
                 hlt_exception* excpt = 0;
-                hlt_timer_cancel(kh_value(s, i), &excpt, ctx);
+                hlt_timer_cancel(*_set_timer(s, i), &excpt, ctx);
             }
 
-            GC_DTOR_GENERIC(kh_key(s, i), s->tkey, ctx);
-            hlt_free(kh_key(s, i));
+            _set_del(s, i, ctx);
         }
     }
 
     GC_DTOR(s->tmgr, hlt_timer_mgr, ctx);
-    kh_destroy_set(s);
+
+    if ( s->swiss )
+        _swiss_destroy(&s->st);
+    else
+        kh_destroy_set(s);
 }
 
 void hlt_iterator_set_cctor(hlt_type_info* ti, hlt_iterator_set* i, hlt_execution_context* ctx)
@@ -175,24 +659,18 @@ void hlt_iterator_set_dtor(hlt_type_info* ti, hlt_iterator_set* i, hlt_execution
     GC_DTOR(i->set, hlt_set, ctx);
 }
 
-// Does not ref copied element.
-static inline void* _to_voidp(const hlt_type_info* type, void* data)
-{
-    void* z = hlt_malloc(type->size);
-    memcpy(z, data, type->size);
-    return z;
-}
-
 static inline void _access_map(hlt_map* m, khiter_t i, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     if ( ! m->tmgr || ! hlt_enum_equal(m->strategy, Hilti_ExpireStrategy_Access, excpt, ctx) || m->timeout == 0 )
         return;
 
-    if ( ! kh_value(m, i).timer )
+    hlt_timer* timer = *_map_timer(m, i);
+
+    if ( ! timer )
         return;
 
     hlt_time t = hlt_timer_mgr_current(m->tmgr, excpt, ctx) + m->timeout;
-    hlt_timer_update(kh_value(m, i).timer, t, excpt, ctx);
+    hlt_timer_update(timer, t, excpt, ctx);
 }
 
 static inline void _access_set(hlt_set* m, khiter_t i, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -200,11 +678,13 @@ static inline void _access_set(hlt_set* m, khiter_t i, hlt_exception** excpt, hl
     if ( ! m->tmgr || ! hlt_enum_equal(m->strategy, Hilti_ExpireStrategy_Access, excpt, ctx) || m->timeout == 0 )
         return;
 
-    if ( ! kh_value(m, i) )
+    hlt_timer* timer = *_set_timer(m, i);
+
+    if ( ! timer )
         return;
 
     hlt_time t = hlt_timer_mgr_current(m->tmgr, excpt, ctx) + m->timeout;
-    hlt_timer_update(kh_value(m, i), t, excpt, ctx);
+    hlt_timer_update(timer, t, excpt, ctx);
 }
 
 //////////// Maps.
@@ -218,6 +698,7 @@ static inline void _hlt_map_init(hlt_map* m, const hlt_type_info* key, const hlt
     m->strategy = hlt_enum_unset(excpt, ctx);
     m->cache_result = 0;
     m->cache_default = 0;
+    m->swiss = _swiss_use(key, value);
 
     _map_clear_default(m, ctx);
 }
@@ -238,11 +719,11 @@ static void _clone_init_in_thread_map(const hlt_type_info* ti, void* dstp, hlt_e
     dst->tmgr = ctx->tmgr;
     GC_CCTOR(dst->tmgr, hlt_timer_mgr, ctx);
 
-    for ( khiter_t i = kh_begin(dst); i != kh_end(dst); i++ ) {
-        if ( ! kh_exist(dst, i) )
+    for ( khiter_t i = 0; i != _map_end(dst); i++ ) {
+        if ( ! _map_exist(dst, i) )
             continue;
 
-        hlt_timer* t = kh_value(dst, i).timer;
+        hlt_timer* t = *_map_timer(dst, i);
 
         if ( ! t )
             continue;
@@ -276,6 +757,7 @@ void hlt_map_clone_init(void* dstp, const hlt_type_info* ti, void* srcp, __hlt_c
     dst->default_type = src->default_type;
     dst->cache_result = 0;
     dst->cache_default = 0;
+    dst->swiss = src->swiss;
 
     switch ( src->default_type ) {
      case HLT_MAP_DEFAULT_NONE:
@@ -292,32 +774,29 @@ void hlt_map_clone_init(void* dstp, const hlt_type_info* ti, void* srcp, __hlt_c
         break;
     }
 
-    for ( khiter_t i = kh_begin(src); i != kh_end(src); i++ ) {
-        if ( ! kh_exist(src, i) )
-            continue;
+    if ( src->swiss && src->st.size )
+        _swiss_alloc(&dst->st, src->st.capacity, src->tkey->size, src->tvalue->size);
 
-        void* key = hlt_malloc(src->tkey->size);
-        void* val = hlt_malloc(src->tvalue->size);
+    for ( khiter_t i = 0; i != _map_end(src); i++ ) {
+        if ( ! _map_exist(src, i) )
+            continue;
 
-        __hlt_clone(key, src->tkey, kh_key(src, i), cstate, excpt, ctx);
-        __hlt_clone(val, src->tvalue, kh_value(src, i).val, cstate, excpt, ctx);
+        int8_t key[src->tkey->size];
+        __hlt_clone(key, src->tkey, _map_key(src, i), cstate, excpt, ctx);
 
         int ret;
-        khiter_t i = kh_put_map(dst, key, &ret, src->tkey);
+        khiter_t j = _map_put(dst, src->tkey, key, &ret);
         assert(ret); // Cannot exist yet.
 
         if ( src->tmgr && src->timeout ) {
             GC_CCTOR(dst, hlt_map, ctx);
-            __hlt_map_timer_cookie cookie = { dst, key };
+            __hlt_map_timer_cookie cookie = { dst, _map_key(dst, j) };
             hlt_timer* t = __hlt_timer_new_map(cookie, excpt, ctx);
-            t->time = kh_value(src, i).timer->time;
-            kh_value(dst, i).timer = t;
+            t->time = (*_map_timer(src, i))->time;
+            *_map_timer(dst, j) = t;
         }
 
-        else
-            kh_value(dst, i).timer = 0;
-
-        kh_value(dst, i).val = val;
+        __hlt_clone(_map_val(dst, j), src->tvalue, _map_val(src, i), cstate, excpt, ctx);
     }
 
     if ( src->tmgr )
@@ -331,9 +810,9 @@ void* hlt_map_get(hlt_map* m, const hlt_type_info* type, void* key, hlt_exceptio
         return 0;
     }
 
-    khiter_t i = kh_get_map(m, key, type);
+    khiter_t i = _map_get(m, type, key);
 
-    if ( i == kh_end(m) ) {
+    if ( i == _map_end(m) ) {
 
         switch ( m->default_type ) {
          case HLT_MAP_DEFAULT_NONE:
@@ -363,7 +842,7 @@ void* hlt_map_get(hlt_map* m, const hlt_type_info* type, void* key, hlt_exceptio
 
     _access_map(m, i, excpt, ctx);
 
-    return kh_value(m, i).val;
+    return _map_val(m, i);
 }
 
 void* hlt_map_get_default(hlt_map* m, const hlt_type_info* tkey, void* key, const hlt_type_info* tdef, void* def, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -373,14 +852,14 @@ void* hlt_map_get_default(hlt_map* m, const hlt_type_info* tkey, void* key, cons
         return 0;
     }
 
-    khiter_t i = kh_get_map(m, key, tkey);
+    khiter_t i = _map_get(m, tkey, key);
 
-    if ( i == kh_end(m) )
+    if ( i == _map_end(m) )
         return def;
 
     _access_map(m, i, excpt, ctx);
 
-    return kh_value(m, i).val;
+    return _map_val(m, i);
 }
 
 void hlt_map_insert(hlt_map* m, const hlt_type_info* tkey, void* key, const hlt_type_info* tval, void* value, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -390,22 +869,17 @@ void hlt_map_insert(hlt_map* m, const hlt_type_info* tkey, void* key, const hlt_
         return;
     }
 
-    void* keytmp = _to_voidp(tkey, key);
-    void* valtmp = _to_voidp(tval, value);
+    // Ref the new value first, it might be the same as the old one.
+    GC_CCTOR_GENERIC(value, m->tvalue, ctx);
 
     int ret;
-    khiter_t i = kh_put_map(m, keytmp, &ret, tkey);
+    khiter_t i = _map_put(m, tkey, key, &ret);
 
     if ( ! ret ) {
         // Entry already exists.
 
-        // The hash table keeps the old key, so we don't need the new one.
-        hlt_free(keytmp);
-
         // Delete the old value.
-        void* val = kh_value(m, i).val;
-        GC_DTOR_GENERIC(val, m->tvalue, ctx);
-        hlt_free(val);
+        GC_DTOR_GENERIC(_map_val(m, i), m->tvalue, ctx);
 
         // Update timer.
         _access_map(m, i, excpt, ctx);
@@ -415,20 +889,18 @@ void hlt_map_insert(hlt_map* m, const hlt_type_info* tkey, void* key, const hlt_
         // New entry.
         if ( m->tmgr && m->timeout ) {
             // Create timer.
-            __hlt_map_timer_cookie cookie = { m, keytmp };
-            kh_value(m, i).timer = __hlt_timer_new_map(cookie, excpt, ctx);
+            __hlt_map_timer_cookie cookie = { m, _map_key(m, i) };
+            hlt_timer* timer = __hlt_timer_new_map(cookie, excpt, ctx);
+            *_map_timer(m, i) = timer;
             hlt_time t = hlt_timer_mgr_current(m->tmgr, excpt, ctx) + m->timeout;
-            hlt_timer_mgr_schedule(m->tmgr, t, kh_value(m, i).timer, excpt, ctx);
-            GC_DTOR(kh_value(m, i).timer, hlt_timer, ctx); // Not memory-managed on our end.
+            hlt_timer_mgr_schedule(m->tmgr, t, timer, excpt, ctx);
+            GC_DTOR(timer, hlt_timer, ctx); // Not memory-managed on our end.
         }
-        else
-            kh_value(m, i).timer = 0;
 
-        GC_CCTOR_GENERIC(keytmp, m->tkey, ctx);
+        GC_CCTOR_GENERIC(_map_key(m, i), m->tkey, ctx);
     }
 
-    kh_value(m, i).val = valtmp;
-    GC_CCTOR_GENERIC(valtmp, m->tvalue, ctx);
+    memcpy(_map_val(m, i), value, m->tvalue->size);
 }
 
 int8_t hlt_map_exists(hlt_map* m, const hlt_type_info* type, void* key, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -438,8 +910,8 @@ int8_t hlt_map_exists(hlt_map* m, const hlt_type_info* type, void* key, hlt_exce
         return 0;
     }
 
-    khiter_t i = kh_get_map(m, key, type);
-    if ( i == kh_end(m) )
+    khiter_t i = _map_get(m, type, key);
+    if ( i == _map_end(m) )
         return 0;
 
     _access_map(m, i, excpt, ctx);
@@ -453,47 +925,33 @@ void hlt_map_remove(hlt_map* m, const hlt_type_info* type, void* key, hlt_except
         return;
     }
 
-    khiter_t i = kh_get_map(m, key, type);
-
-    if ( i != kh_end(m) ) {
-        if ( kh_value(m, i).timer ) {
-            hlt_timer_cancel(kh_value(m, i).timer, excpt, ctx);
-            kh_value(m, i).timer = 0;
-        }
+    khiter_t i = _map_get(m, type, key);
 
-        void* key = kh_key(m, i);
-        GC_DTOR_GENERIC(key, m->tkey, ctx);
-        hlt_free(key);
+    if ( i != _map_end(m) ) {
+        hlt_timer** timer = _map_timer(m, i);
 
-        void* val = kh_value(m, i).val;
-        GC_DTOR_GENERIC(val, m->tvalue, ctx);
-        hlt_free(val);
+        if ( *timer ) {
+            hlt_timer_cancel(*timer, excpt, ctx);
+            *timer = 0;
+        }
 
-        kh_del_map(m, i);
+        _map_del(m, i, ctx);
     }
 }
 
 void hlt_map_expire(__hlt_map_timer_cookie cookie, hlt_exception** excpt, hlt_execution_context* ctx)
 {
-    khiter_t i = kh_get_map(cookie.map, cookie.key, cookie.map->tkey);
+    khiter_t i = _map_get(cookie.map, cookie.map->tkey, cookie.key);
 
-    if ( i == kh_end(cookie.map) )
+    if ( i == _map_end(cookie.map) )
         // Removed in the mean-time, nothing to do.
         return;
 
     // Don't need to cancel the timer, as it has already expired anyway when
     // this method runs.
-    kh_value(cookie.map, i).timer = 0;
-
-    void* key = kh_key(cookie.map, i);
-    GC_DTOR_GENERIC(key, cookie.map->tkey, ctx);
-    hlt_free(key);
+    *_map_timer(cookie.map, i) = 0;
 
-    void* val = kh_value(cookie.map, i).val;
-    GC_DTOR_GENERIC(val, cookie.map->tvalue, ctx);
-    hlt_free(val);
-
-    kh_del_map(cookie.map, i);
+    _map_del(cookie.map, i, ctx);
 }
 
 int64_t hlt_map_size(hlt_map* m, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -503,7 +961,7 @@ int64_t hlt_map_size(hlt_map* m, hlt_exception** excpt, hlt_execution_context* c
         return 0;
     }
 
-    return kh_size(m);
+    return m->swiss ? m->st.size : kh_size(m);
 }
 
 void hlt_map_clear(hlt_map* m, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -513,19 +971,25 @@ void hlt_map_clear(hlt_map* m, hlt_exception** excpt, hlt_execution_context* ctx
         return;
     }
 
-    for ( khiter_t i = kh_begin(m); i != kh_end(m); i++ ) {
-        if ( kh_exist(m, i) ) {
-            if ( kh_value(m, i).timer )
-                hlt_timer_cancel(kh_value(m, i).timer, excpt, ctx);
+    for ( khiter_t i = 0; i != _map_end(m); i++ ) {
+        if ( _map_exist(m, i) ) {
+            if ( *_map_timer(m, i) )
+                hlt_timer_cancel(*_map_timer(m, i), excpt, ctx);
+
+            GC_DTOR_GENERIC(_map_key(m, i), m->tkey, ctx);
+            GC_DTOR_GENERIC(_map_val(m, i), m->tvalue, ctx);
 
-            GC_DTOR_GENERIC(kh_key(m, i), m->tkey, ctx);
-            GC_DTOR_GENERIC(kh_value(m, i).val, m->tvalue, ctx);
-            hlt_free(kh_key(m, i));
-            hlt_free(kh_value(m, i).val);
+            if ( ! m->swiss ) {
+                hlt_free(kh_key(m, i));
+                hlt_free(kh_value(m, i).val);
+            }
         }
     }
 
-    kh_clear_map(m);
+    if ( m->swiss )
+        _swiss_clear(&m->st);
+    else
+        kh_clear_map(m);
 }
 
 void hlt_map_default(hlt_map* m, const hlt_type_info* tdef, void* def, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -572,8 +1036,8 @@ hlt_iterator_map hlt_map_begin(hlt_map* m, hlt_exception** excpt, hlt_execution_
 
     hlt_iterator_map i;
 
-    for ( i.iter = kh_begin(m); i.iter != kh_end(m); i.iter++ ) {
-        if ( kh_exist(m, i.iter) ) {
+    for ( i.iter = 0; i.iter != _map_end(m); i.iter++ ) {
+        if ( _map_exist(m, i.iter) ) {
             i.map = m;
             return i;
         }
@@ -594,9 +1058,9 @@ hlt_iterator_map hlt_iterator_map_incr(hlt_iterator_map i, hlt_exception** excpt
         // End already reached.
         return i;
 
-    while ( i.iter != kh_end(i.map) ) {
+    while ( i.iter != _map_end(i.map) ) {
         ++i.iter; // Don't do that inside kh_exit. It will be evaluated twice ...
-        if ( kh_exist(i.map, i.iter) )
+        if ( i.iter != _map_end(i.map) && _map_exist(i.map, i.iter) )
             return i;
     }
 
@@ -611,8 +1075,8 @@ void* hlt_iterator_map_deref(const hlt_type_info* tuple, hlt_iterator_map i, hlt
     }
 
     // Build return tuple.
-    void* key = kh_key(i.map, i.iter);
-    void* val = kh_value(i.map, i.iter).val;
+    void* key = _map_key(i.map, i.iter);
+    void* val = _map_val(i.map, i.iter);
 
     if ( ! i.map->cache_result )
         i.map->cache_result = hlt_malloc(tuple->size);
@@ -639,7 +1103,7 @@ void* hlt_iterator_map_deref_key(hlt_iterator_map i, hlt_exception** excpt, hlt_
     }
 
     // Build return tuple.
-    return kh_key(i.map, i.iter);
+    return _map_key(i.map, i.iter);
 }
 
 void* hlt_iterator_map_deref_value(hlt_iterator_map i, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -650,7 +1114,7 @@ void* hlt_iterator_map_deref_value(hlt_iterator_map i, hlt_exception** excpt, hl
     }
 
     // Build return tuple.
-    return kh_value(i.map, i.iter).val;
+    return _map_val(i.map, i.iter);
 }
 
 int8_t hlt_iterator_map_eq(hlt_iterator_map i1, hlt_iterator_map i2, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -672,15 +1136,15 @@ hlt_string hlt_map_to_string(const hlt_type_info* type, const void* obj, int32_t
 
     hlt_string s = hlt_string_from_asciiz("{ ", excpt, ctx);
 
-    for ( khiter_t i = kh_begin(m); i != kh_end(m); i++ ) {
-        if ( ! kh_exist(m, i) )
+    for ( khiter_t i = 0; i != _map_end(m); i++ ) {
+        if ( ! _map_exist(m, i) )
             continue;
 
         if ( ! first )
             s = hlt_string_concat(s, separator, excpt, ctx);
 
-        hlt_string key = __hlt_object_to_string(m->tkey, kh_key(m, i), options, seen, excpt, ctx);
-        hlt_string value = __hlt_object_to_string(m->tvalue, kh_value(m, i).val, options, seen, excpt, ctx);
+        hlt_string key = __hlt_object_to_string(m->tkey, _map_key(m, i), options, seen, excpt, ctx);
+        hlt_string value = __hlt_object_to_string(m->tvalue, _map_val(m, i), options, seen, excpt, ctx);
 
         s = hlt_string_concat(s, key, excpt, ctx);
         s = hlt_string_concat(s, colon, excpt, ctx);
@@ -705,6 +1169,7 @@ static inline void _hlt_set_init(hlt_set* m, const hlt_type_info* key, hlt_timer
     m->tkey = key;
     m->timeout = 0.0;
     m->strategy = hlt_enum_unset(excpt, ctx);
+    m->swiss = _swiss_use(key, 0);
 }
 
 hlt_set* hlt_set_new(const hlt_type_info* key, hlt_timer_mgr* tmgr, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -723,11 +1188,11 @@ static void _clone_init_in_thread_set(const hlt_type_info* ti, void* dstp, hlt_e
     dst->tmgr = ctx->tmgr;
     GC_CCTOR(dst->tmgr, hlt_timer_mgr, ctx);
 
-    for ( khiter_t i = kh_begin(dst); i != kh_end(dst); i++ ) {
-        if ( ! kh_exist(dst, i) )
+    for ( khiter_t i = 0; i != _set_end(dst); i++ ) {
+        if ( ! _set_exist(dst, i) )
             continue;
 
-        hlt_timer* t = kh_value(dst, i);
+        hlt_timer* t = *_set_timer(dst, i);
 
         if ( ! t )
             continue;
@@ -757,28 +1222,28 @@ void hlt_set_clone_init(void* dstp, const hlt_type_info* ti, void* srcp, __hlt_c
     dst->tkey = src->tkey;
     dst->timeout = src->timeout;
     dst->strategy = src->strategy;
+    dst->swiss = src->swiss;
 
-    for ( khiter_t i = kh_begin(src); i != kh_end(src); i++ ) {
-        if ( ! kh_exist(src, i) )
-            continue;
+    if ( src->swiss && src->st.size )
+        _swiss_alloc(&dst->st, src->st.capacity, src->tkey->size, 0);
 
-        void* key = hlt_malloc(src->tkey->size);
+    for ( khiter_t i = 0; i != _set_end(src); i++ ) {
+        if ( ! _set_exist(src, i) )
+            continue;
 
-        __hlt_clone(key, src->tkey, kh_key(src, i), cstate, excpt, ctx);
+        int8_t key[src->tkey->size];
+        __hlt_clone(key, src->tkey, _set_key(src, i), cstate, excpt, ctx);
 
         int ret;
-        khiter_t i = kh_put_set(dst, key, &ret, src->tkey);
+        khiter_t j = _set_put(dst, src->tkey, key, &ret);
         assert(ret); // Cannot exist yet.
 
         if ( src->tmgr && src->timeout ) {
-            __hlt_set_timer_cookie cookie = { dst, key };
+            __hlt_set_timer_cookie cookie = { dst, _set_key(dst, j) };
             hlt_timer* t = __hlt_timer_new_set(cookie, excpt, ctx);
-            t->time = kh_value(src, i)->time;
-            kh_value(dst, i) = t;
+            t->time = (*_set_timer(src, i))->time;
+            *_set_timer(dst, j) = t;
         }
-
-        else
-            kh_value(dst, i) = 0;
     }
 
     if ( src->tmgr )
@@ -792,14 +1257,9 @@ void hlt_set_insert(hlt_set* m, const hlt_type_info* tkey, void* key, hlt_except
         return;
     }
 
-    void* keytmp = _to_voidp(tkey, key);
-
 	int ret;
-	khiter_t i = kh_put_set(m, keytmp, &ret, tkey);
+	khiter_t i = _set_put(m, tkey, key, &ret);
     if ( ! ret ) {
-        // The hash table keeps the old key, so we don't need the new one.
-        hlt_free(keytmp);
-
         // Already exists, update timer.
         _access_set(m, i, excpt, ctx);
     }
@@ -808,16 +1268,15 @@ void hlt_set_insert(hlt_set* m, const hlt_type_info* tkey, void* key, hlt_except
         // New entry.
         if ( m->tmgr && m->timeout ) {
             // Create timer.
-            __hlt_set_timer_cookie cookie = { m, keytmp };
-            kh_value(m, i) = __hlt_timer_new_set(cookie, excpt, ctx);
+            __hlt_set_timer_cookie cookie = { m, _set_key(m, i) };
+            hlt_timer* timer = __hlt_timer_new_set(cookie, excpt, ctx);
+            *_set_timer(m, i) = timer;
             hlt_interval t = hlt_timer_mgr_current(m->tmgr, excpt, ctx) + m->timeout;
-            hlt_timer_mgr_schedule(m->tmgr, t, kh_value(m, i), excpt, ctx);
-            GC_DTOR(kh_value(m, i), hlt_timer, ctx); // Not memory-managed on our end.
+            hlt_timer_mgr_schedule(m->tmgr, t, timer, excpt, ctx);
+            GC_DTOR(timer, hlt_timer, ctx); // Not memory-managed on our end.
         }
-        else
-            kh_value(m, i) = 0;
 
-        GC_CCTOR_GENERIC(keytmp, m->tkey, ctx);
+        GC_CCTOR_GENERIC(_set_key(m, i), m->tkey, ctx);
     }
 }
 
@@ -828,8 +1287,8 @@ int8_t hlt_set_exists(hlt_set* m, const hlt_type_info* type, void* key, hlt_exce
         return 0;
     }
 
-    khiter_t i = kh_get_set(m, key, type);
-    if ( i == kh_end(m) )
+    khiter_t i = _set_get(m, type, key);
+    if ( i == _set_end(m) )
         return 0;
 
     _access_set(m, i, excpt, ctx);
@@ -843,39 +1302,33 @@ void hlt_set_remove(hlt_set* m, const hlt_type_info* type, void* key, hlt_except
         return;
     }
 
-    khiter_t i = kh_get_set(m, key, type);
+    khiter_t i = _set_get(m, type, key);
 
-    if ( i != kh_end(m) ) {
-        if ( kh_value(m, i) ) {
-            hlt_timer_cancel(kh_value(m, i), excpt, ctx);
-            kh_value(m, i) = 0;
-        }
+    if ( i != _set_end(m) ) {
+        hlt_timer** timer = _set_timer(m, i);
 
-        void* key = kh_key(m, i);
-        GC_DTOR_GENERIC(key, m->tkey, ctx);
-        hlt_free(key);
+        if ( *timer ) {
+            hlt_timer_cancel(*timer, excpt, ctx);
+            *timer = 0;
+        }
 
-        kh_del_set(m, i);
+        _set_del(m, i, ctx);
     }
 }
 
 void hlt_set_expire(__hlt_set_timer_cookie cookie, hlt_exception** excpt, hlt_execution_context* ctx)
 {
-    khiter_t i = kh_get_set(cookie.set, cookie.key, cookie.set->tkey);
+    khiter_t i = _set_get(cookie.set, cookie.set->tkey, cookie.key);
 
-    if ( i == kh_end(cookie.set) )
+    if ( i == _set_end(cookie.set) )
         // Removed in the mean-time, nothing to do.
         return;
 
     // Don't need to cancel the timer, as it has already expired anyway when
     // this method runs.
-    kh_value(cookie.set, i) = 0;
+    *_set_timer(cookie.set, i) = 0;
 
-    void* key = kh_key(cookie.set, i);
-    GC_DTOR_GENERIC(key, cookie.set->tkey, ctx);
-    hlt_free(key);
-
-    kh_del_set(cookie.set, i);
+    _set_del(cookie.set, i, ctx);
 }
 
 int64_t hlt_set_size(hlt_set* m, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -885,7 +1338,7 @@ int64_t hlt_set_size(hlt_set* m, hlt_exception** excpt, hlt_execution_context* c
         return 0;
     }
 
-    return kh_size(m);
+    return m->swiss ? m->st.size : kh_size(m);
 }
 
 void hlt_set_clear(hlt_set* m, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -895,17 +1348,22 @@ void hlt_set_clear(hlt_set* m, hlt_exception** excpt, hlt_execution_context* ctx
         return;
     }
 
-    for ( khiter_t i = kh_begin(m); i != kh_end(m); i++ ) {
-        if ( kh_exist(m, i) ) {
-            if ( kh_value(m, i) )
-                hlt_timer_cancel(kh_value(m, i), excpt, ctx);
+    for ( khiter_t i = 0; i != _set_end(m); i++ ) {
+        if ( _set_exist(m, i) ) {
+            if ( *_set_timer(m, i) )
+                hlt_timer_cancel(*_set_timer(m, i), excpt, ctx);
+
+            GC_DTOR_GENERIC(_set_key(m, i), m->tkey, ctx);
 
-            GC_DTOR_GENERIC(kh_key(m, i), m->tkey, ctx);
-            hlt_free(kh_key(m, i));
+            if ( ! m->swiss )
+                hlt_free(kh_key(m, i));
         }
     }
 
-    kh_clear_set(m);
+    if ( m->swiss )
+        _swiss_clear(&m->st);
+    else
+        kh_clear_set(m);
 }
 
 void hlt_set_timeout(hlt_set* m, hlt_enum strategy, hlt_interval timeout, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -926,8 +1384,8 @@ hlt_iterator_set hlt_set_begin(hlt_set* m, hlt_exception** excpt, hlt_execution_
 
     hlt_iterator_set i;
 
-    for ( i.iter = kh_begin(m); i.iter != kh_end(m); i.iter++ ) {
-        if ( kh_exist(m, i.iter) ) {
+    for ( i.iter = 0; i.iter != _set_end(m); i.iter++ ) {
+        if ( _set_exist(m, i.iter) ) {
             i.set = m;
             return i;
         }
@@ -948,9 +1406,9 @@ hlt_iterator_set hlt_iterator_set_incr(hlt_iterator_set i, hlt_exception** excpt
         // End already reached.
         return i;
 
-    while ( i.iter != kh_end(i.set) ) {
+    while ( i.iter != _set_end(i.set) ) {
         ++i.iter; // Don't do that inside kh_exit. It will be evaluated twice ...
-        if ( kh_exist(i.set, i.iter) )
+        if ( i.iter != _set_end(i.set) && _set_exist(i.set, i.iter) )
             return i;
     }
 
@@ -964,7 +1422,7 @@ void* hlt_iterator_set_deref(hlt_iterator_set i, hlt_exception** excpt, hlt_exec
         return 0;
     }
 
-    return kh_key(i.set, i.iter);
+    return _set_key(i.set, i.iter);
 }
 
 int8_t hlt_iterator_set_eq(hlt_iterator_set i1, hlt_iterator_set i2, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -985,14 +1443,14 @@ hlt_string hlt_set_to_string(const hlt_type_info* type, const void* obj, int32_t
 
     hlt_string s = hlt_string_from_asciiz("{ ", excpt, ctx);
 
-    for ( khiter_t i = kh_begin(m); i != kh_end(m); i++ ) {
-        if ( ! kh_exist(m, i) )
+    for ( khiter_t i = 0; i != _set_end(m); i++ ) {
+        if ( ! _set_exist(m, i) )
             continue;
 
         if ( ! first )
             s = hlt_string_concat(s, separator, excpt, ctx);
 
-        hlt_string key = __hlt_object_to_string(m->tkey, kh_key(m, i), options, seen, excpt, ctx);
+        hlt_string key = __hlt_object_to_string(m->tkey, _set_key(m, i), options, seen, excpt, ctx);
         s = hlt_string_concat(s, key, excpt, ctx);
 
         if ( hlt_check_exception(excpt) )
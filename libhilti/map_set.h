@@ -64,7 +64,9 @@ extern hlt_map* hlt_map_new(const hlt_type_info* key, const hlt_type_info* value
 ///
 /// excpt: &
 ///
-/// Returns: The value.
+/// Returns: A pointer to the value. The value may be stored inside the map
+/// itself, so the pointer remains valid only until the map is modified
+/// next; copy the value out before inserting or removing elements.
 ///
 /// Raises: IndexError - If the key does not exist.
 extern void* hlt_map_get(hlt_map* m, const hlt_type_info* type, void* key, hlt_exception** excpt, hlt_execution_context* ctx);
@@ -80,7 +82,9 @@ extern void* hlt_map_get(hlt_map* m, const hlt_type_info* type, void* key, hlt_e
 ///
 /// excpt: &
 ///
-/// Returns: The value, or the default if key does not exist.
+/// Returns: A pointer to the value, or the default if key does not exist.
+/// As with hlt_map_get(), the pointer remains valid only until the map is
+/// modified next.
 ///
 /// Raises: KeyError - If the key does not exist and not default has been set via ~~hlt_map_default.
 extern void* hlt_map_get_default(hlt_map* m, const hlt_type_info* tkey, void* key, const hlt_type_info* tdef, void* def, hlt_exception** excpt, hlt_execution_context* ctx);
@@ -4,6 +4,7 @@
 #include <inttypes.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/mman.h>
 
 #include "memory_.h"
@@ -12,22 +13,30 @@
 #include "debug.h"
 #include "context.h"
 
-#ifndef HLT_DEEP_COPY_VALUES_ACROSS_THREADS
-#define HLT_ATOMIC_REF_COUNTING
-#endif
-
 static const size_t __INITIAL_NULLBUFFER_SIZE = 20;
+static const size_t __INITIAL_NULLBUFFER_INDEX_SIZE = 64; // Power of two, >= 2 * __INITIAL_NULLBUFFER_SIZE.
 
 struct __obj_with_rtti {
     const hlt_type_info* ti;
     void* obj;
 };
 
+// Slot of the open-addressing table mapping objects to their position in the
+// nullbuffer. A slot is empty if obj is null. A slot may refer to a position
+// that has since been reset or reused for another object; it's only valid if
+// the object at that position is still the same.
+struct __nullbuffer_slot {
+    void* obj;
+    int64_t pos;
+};
+
 struct __hlt_memory_nullbuffer {
     size_t used;
     size_t allocated;
     int64_t flush_pos;
     struct __obj_with_rtti* objs;
+    size_t index_size;                // Number of slots in index; power of two, >= 2 * allocated.
+    struct __nullbuffer_slot* index;
 };
 
 #ifdef DEBUG
@@ -79,7 +88,7 @@ static void _dbg_mem_gc(const char* op, const hlt_type_info* ti, void* gcobj, co
     const char* nb = (ctx && gcobj && __hlt_memory_nullbuffer_contains(ctx->nullbuffer, gcobj)) ? " (in nullbuffer)" : "";
 
     __hlt_gchdr* hdr = (__hlt_gchdr*)gcobj;
-    DBG_LOG("hilti-mem", "%10s %p %" PRIu64 " %" PRIu64 " %s %s%s%s", op, gcobj, 0, hdr->ref_cnt, ti->tag, location, nb, buf);
+    DBG_LOG("hilti-mem", "%10s %p %" PRIu64 " %" PRIu64 " %s %s%s%s", op, gcobj, 0, (uint64_t)hdr->ref_cnt, ti->tag, location, nb, buf);
 }
 
 static void _internal_memory_error(void* gcobj, const char* func, const char* msg, const hlt_type_info* ti)
@@ -206,6 +215,19 @@ void __hlt_free(void *memory, const char* type, const char* location)
     free(memory);
 }
 
+// Returns whether newly allocated objects need atomic reference counting
+// from the start. If values are deep-copied across threads, an object
+// remains owned by its creating thread until it's explicitly marked as
+// shared. Otherwise references may be passed between threads freely, and we
+// can't track where they go.
+static inline int32_t _new_objects_shared()
+{
+#ifdef HLT_DEEP_COPY_VALUES_ACROSS_THREADS
+    return 0;
+#else
+    return __hlt_globals()->multi_threaded;
+#endif
+}
 
 void* __hlt_object_new_ref(const hlt_type_info* ti, uint64_t size, const char* location, hlt_execution_context* ctx)
 {
@@ -213,6 +235,7 @@ void* __hlt_object_new_ref(const hlt_type_info* ti, uint64_t size, const char* l
 
     __hlt_gchdr* hdr = (__hlt_gchdr*)__hlt_malloc(size, ti->tag, location);
     hdr->ref_cnt = 1;
+    hdr->shared = _new_objects_shared();
 
 #ifdef DEBUG
     _dbg_mem_gc("new_ref", ti, hdr, location, 0, ctx);
@@ -228,6 +251,7 @@ void* __hlt_object_new(const hlt_type_info* ti, uint64_t size, const char* locat
 
     __hlt_gchdr* hdr = (__hlt_gchdr*)__hlt_malloc(size, ti->tag, location);
     hdr->ref_cnt = 0;
+    hdr->shared = _new_objects_shared();
     __hlt_memory_nullbuffer_add(ctx->nullbuffer, ti, hdr, ctx);
 
 #ifdef DEBUG
@@ -243,6 +267,7 @@ void* __hlt_object_new_no_init_ref(const hlt_type_info* ti, uint64_t size, const
 
     __hlt_gchdr* hdr = (__hlt_gchdr*)__hlt_malloc_no_init(size, ti->tag, location);
     hdr->ref_cnt = 1;
+    hdr->shared = _new_objects_shared();
 
 #ifdef DEBUG
     _dbg_mem_gc("new_ref", ti, hdr, location, 0, ctx);
@@ -258,6 +283,7 @@ void* __hlt_object_new_no_init(const hlt_type_info* ti, uint64_t size, const cha
 
     __hlt_gchdr* hdr = (__hlt_gchdr*)__hlt_malloc_no_init(size, ti->tag, location);
     hdr->ref_cnt = 0;
+    hdr->shared = _new_objects_shared();
     __hlt_memory_nullbuffer_add(ctx->nullbuffer, ti, hdr, ctx);
 
 #ifdef DEBUG
@@ -278,11 +304,10 @@ void __hlt_object_ref(const hlt_type_info* ti, void* obj, hlt_execution_context*
     }
 #endif
 
-#ifdef HLT_ATOMIC_REF_COUNTING
-    __atomic_add_fetch(&hdr->ref_cnt, 1, __ATOMIC_SEQ_CST);
-#else
-    ++hdr->ref_cnt;
-#endif
+    if ( hdr->shared )
+        __atomic_add_fetch(&hdr->ref_cnt, 1, __ATOMIC_SEQ_CST);
+    else
+        ++hdr->ref_cnt;
 
 #if 0
     // This is ok now!
@@ -313,11 +338,12 @@ void __hlt_object_unref(const hlt_type_info* ti, void* obj, hlt_execution_contex
     }
 #endif
 
-#ifdef HLT_ATOMIC_REF_COUNTING
-    int64_t new_ref_cnt = __atomic_sub_fetch(&hdr->ref_cnt, 1, __ATOMIC_SEQ_CST);
-#else
-    int64_t new_ref_cnt = --hdr->ref_cnt;
-#endif
+    int64_t new_ref_cnt;
+
+    if ( hdr->shared )
+        new_ref_cnt = __atomic_sub_fetch(&hdr->ref_cnt, 1, __ATOMIC_SEQ_CST);
+    else
+        new_ref_cnt = --hdr->ref_cnt;
 
 #ifdef DEBUG
     const char* aux = 0;
@@ -343,6 +369,25 @@ void __hlt_object_unref(const hlt_type_info* ti, void* obj, hlt_execution_contex
         __hlt_memory_nullbuffer_add(ctx->nullbuffer, ti, hdr, ctx);
 }
 
+void __hlt_object_share(const hlt_type_info* ti, void* obj, hlt_execution_context* ctx)
+{
+    if ( ! (obj && ti->gc) )
+        return;
+
+    __hlt_gchdr* hdr = *(__hlt_gchdr**)obj;
+
+    if ( ! hdr || hdr->shared )
+        return;
+
+    // Make sure all plain updates so far are visible before another thread
+    // can start updating the count atomically.
+    __atomic_store_n(&hdr->shared, 1, __ATOMIC_SEQ_CST);
+
+#ifdef DEBUG
+    _dbg_mem_gc("share", ti, hdr, 0, 0, ctx);
+#endif
+}
+
 void __hlt_object_destroy(const hlt_type_info* ti, void* obj, const char* location, hlt_execution_context* ctx)
 {
     assert(ti->gc);
@@ -612,13 +657,20 @@ void  hlt_memory_pool_free(hlt_memory_pool* p, void* b)
     // Do nothing.
 }
 
-__hlt_memory_nullbuffer* __hlt_memory_nullbuffer_new()
+static inline void _nullbuffer_init(__hlt_memory_nullbuffer* nbuf)
 {
-    __hlt_memory_nullbuffer* nbuf = (__hlt_memory_nullbuffer*) hlt_malloc(sizeof(__hlt_memory_nullbuffer));
     nbuf->used = 0;
     nbuf->allocated = __INITIAL_NULLBUFFER_SIZE;
-    nbuf->flush_pos = -1;
     nbuf->objs = (struct __obj_with_rtti*) hlt_malloc(sizeof(struct __obj_with_rtti) * nbuf->allocated);
+    nbuf->index_size = __INITIAL_NULLBUFFER_INDEX_SIZE;
+    nbuf->index = (struct __nullbuffer_slot*) hlt_calloc(nbuf->index_size, sizeof(struct __nullbuffer_slot));
+}
+
+__hlt_memory_nullbuffer* __hlt_memory_nullbuffer_new()
+{
+    __hlt_memory_nullbuffer* nbuf = (__hlt_memory_nullbuffer*) hlt_malloc(sizeof(__hlt_memory_nullbuffer));
+    nbuf->flush_pos = -1;
+    _nullbuffer_init(nbuf);
     return nbuf;
 }
 
@@ -626,18 +678,63 @@ void __hlt_memory_nullbuffer_delete(__hlt_memory_nullbuffer* nbuf, hlt_execution
 {
     __hlt_memory_nullbuffer_flush(nbuf, ctx);
     hlt_free(nbuf->objs);
+    hlt_free(nbuf->index);
     hlt_free(nbuf);
 }
 
+static inline size_t _nullbuffer_hash(__hlt_memory_nullbuffer* nbuf, void* obj)
+{
+    // Objects are at least 16-byte aligned; Fibonacci hashing spreads the
+    // remaining bits.
+    return (((uintptr_t)obj >> 4) * 11400714819323198485ull) >> 32 & (nbuf->index_size - 1);
+}
+
+// Returns the index slot for an object, which is either the one that has
+// been used for it before or an empty one.
+static inline struct __nullbuffer_slot* _nullbuffer_slot(__hlt_memory_nullbuffer* nbuf, void* obj)
+{
+    size_t mask = nbuf->index_size - 1;
+
+    for ( size_t i = _nullbuffer_hash(nbuf, obj); ; i = (i + 1) & mask ) {
+        struct __nullbuffer_slot* slot = &nbuf->index[i];
+
+        if ( slot->obj == obj || ! slot->obj )
+            return slot;
+    }
+}
+
 static inline int64_t _nullbuffer_index(__hlt_memory_nullbuffer* nbuf, void *obj)
 {
-    // TODO: Unclear if it's worth keeping the buffer sorted to speed this up?
+    struct __nullbuffer_slot* slot = _nullbuffer_slot(nbuf, obj);
+
+    if ( ! slot->obj )
+        return -1;
+
+    if ( slot->pos >= nbuf->used || nbuf->objs[slot->pos].obj != obj )
+        // Stale.
+        return -1;
+
+    return slot->pos;
+}
+
+// Doubles the size of the index, dropping stale slots.
+static void _nullbuffer_grow_index(__hlt_memory_nullbuffer* nbuf)
+{
+    hlt_free(nbuf->index);
+
+    nbuf->index_size *= 2;
+    nbuf->index = (struct __nullbuffer_slot*) hlt_calloc(nbuf->index_size, sizeof(struct __nullbuffer_slot));
+
     for ( int64_t i = 0; i < nbuf->used; i++ ) {
-        if ( nbuf->objs[i].obj == obj )
-            return i;
-    }
+        void* obj = nbuf->objs[i].obj;
 
-    return -1;
+        if ( ! obj )
+            continue;
+
+        struct __nullbuffer_slot* slot = _nullbuffer_slot(nbuf, obj);
+        slot->obj = obj;
+        slot->pos = i;
+    }
 }
 
 void __hlt_memory_nullbuffer_add(__hlt_memory_nullbuffer* nbuf, const hlt_type_info* ti, void *obj, hlt_execution_context* ctx)
@@ -689,19 +786,28 @@ void __hlt_memory_nullbuffer_add(__hlt_memory_nullbuffer* nbuf, const hlt_type_i
                                                            sizeof(struct __obj_with_rtti) * nsize,
                                                            sizeof(struct __obj_with_rtti) * nbuf->allocated);
         nbuf->allocated = nsize;
+
+        // Keep the index at most half full.
+        while ( nbuf->index_size < 2 * nbuf->allocated )
+            _nullbuffer_grow_index(nbuf);
     }
 
     struct __obj_with_rtti x;
     x.ti = ti;
     x.obj = obj;
+
+    struct __nullbuffer_slot* slot = _nullbuffer_slot(nbuf, obj);
+    slot->obj = obj;
+    slot->pos = nbuf->used;
+
     nbuf->objs[nbuf->used++] = x;
 
 #ifdef DEBUG
-    ++__hlt_globals()->num_nullbuffer;
-
     if ( nbuf->used > __hlt_globals()->max_nullbuffer )
         // Not thread-safe, but doesn't matter.
         __hlt_globals()->max_nullbuffer = nbuf->used;
+
+    ++__hlt_globals()->num_nullbuffer;
 #endif
 }
 
@@ -712,17 +818,17 @@ int8_t __hlt_memory_nullbuffer_contains(__hlt_memory_nullbuffer* nbuf, void *obj
 
 void __hlt_memory_nullbuffer_remove(__hlt_memory_nullbuffer* nbuf, void *obj)
 {
-    // TODO: Unclear if it's worth keeping the buffer sorted to speed this up?
-    for ( size_t i = 0; i < nbuf->used; i++ ) {
-        struct __obj_with_rtti x = nbuf->objs[i];
+    int64_t nbpos = _nullbuffer_index(nbuf, obj);
 
-        if ( x.obj == obj ) {
-            // Mark as done.
-            x.obj = 0;
-            --__hlt_globals()->num_nullbuffer;
-            break;
-        }
-    }
+    if ( nbpos < 0 )
+        return;
+
+    // Mark as done. This leaves the index slot stale.
+    nbuf->objs[nbpos].obj = 0;
+
+#ifdef DEBUG
+    --__hlt_globals()->num_nullbuffer;
+#endif
 }
 
 void __hlt_memory_nullbuffer_flush(__hlt_memory_nullbuffer* nbuf, hlt_execution_context* ctx)
@@ -730,8 +836,14 @@ void __hlt_memory_nullbuffer_flush(__hlt_memory_nullbuffer* nbuf, hlt_execution_
     if ( nbuf->flush_pos >= 0 )
         return;
 
+    if ( ! nbuf->used )
+        return;
+
 #ifdef DEBUG
     _dbg_mem_raw("nullbuffer_flush", nbuf, nbuf->used, 0, "start", 0, ctx);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 #endif
 
     // Note, flush_pos is examined during flushing by nullbuffer_add().
@@ -758,15 +870,24 @@ void __hlt_memory_nullbuffer_flush(__hlt_memory_nullbuffer* nbuf, hlt_execution_
         __hlt_free(x.obj, x.ti->tag, "nullbuffer_flush");
     }
 
-    nbuf->used = 0;
-
     if ( nbuf->allocated > __INITIAL_NULLBUFFER_SIZE ) {
         hlt_free(nbuf->objs);
-        nbuf->allocated = __INITIAL_NULLBUFFER_SIZE;
-        nbuf->objs = (struct __obj_with_rtti*) hlt_malloc(sizeof(struct __obj_with_rtti) * nbuf->allocated);
+        hlt_free(nbuf->index);
+        _nullbuffer_init(nbuf);
+    }
+
+    else {
+        nbuf->used = 0;
+        memset(nbuf->index, 0, nbuf->index_size * sizeof(struct __nullbuffer_slot));
     }
 
 #ifdef DEBUG
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    __hlt_globals()->num_nullbuffer_flushes++;
+    __hlt_globals()->time_nullbuffer_flush += (end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec);
+
     _dbg_mem_raw("nullbuffer_flush", nbuf, nbuf->used, 0, "end", 0, ctx);
 #endif
 
@@ -787,6 +908,10 @@ hlt_memory_stats hlt_memory_statistics()
     stats.num_stacks = globals->num_stacks;
     stats.num_nullbuffer = globals->num_nullbuffer;
     stats.max_nullbuffer = globals->max_nullbuffer;
+    stats.num_nullbuffer_flushes = globals->num_nullbuffer_flushes;
+    stats.time_nullbuffer_flush = globals->time_nullbuffer_flush;
+    stats.size_borrowed = globals->size_borrowed;
+    stats.size_borrowed_copied = globals->size_borrowed_copied;
 
     return stats;
 }
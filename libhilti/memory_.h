@@ -20,7 +20,8 @@ extern const char* __hlt_make_location(const char* file, int line);
 ///
 /// If you change something here, also adapt ``hlt.gcdhr`` in ``libhilti.ll``.
 typedef struct {
-    int64_t ref_cnt;  /// The number of references to the object currently retained.
+    int32_t ref_cnt;  /// The number of references to the object currently retained.
+    int32_t shared;   /// True if the object may be accessed by more than one thread; its reference count is then updated atomically.
 } __hlt_gchdr;
 
 /// Statistics about the current state of memory allocations. Some are only
@@ -34,8 +35,12 @@ typedef struct {
     uint64_t num_deallocs;   /// Total number of calls to deallocation functions (debug-only).
     uint64_t num_refs;       /// Total number of reference count increments (debug-only).
     uint64_t num_unrefs;     /// Total number of reference count decrements (debug-only).
-    uint64_t num_nullbuffer; /// Maximal size of any nullbuffer so far (debug-only).
+    uint64_t num_nullbuffer; /// Total number of objects currently in nullbuffers (debug-only).
     uint64_t max_nullbuffer; /// Maximal size of any nullbuffer so far (debug-only).
+    uint64_t num_nullbuffer_flushes; /// Total number of non-empty nullbuffer flushes (debug-only).
+    uint64_t time_nullbuffer_flush;  /// Total time spent flushing nullbuffers, in nanoseconds (debug-only).
+    uint64_t size_borrowed;          /// Total number of bytes handed to bytes objects by reference, without copying.
+    uint64_t size_borrowed_copied;   /// Total number of borrowed bytes that had to be copied later.
 } hlt_memory_stats;
 
 /// Returns statistics about the current state of memory allocations.
@@ -174,6 +179,13 @@ extern void __hlt_object_ref(const hlt_type_info* ti, void* obj, hlt_execution_c
 // one. Not to be used directly from user code.
 extern void __hlt_object_unref(const hlt_type_info* ti, void* obj, hlt_execution_context* ctx);
 
+// Internal function marking a memory managed object as potentially being
+// accessed by more than one thread, so that its reference count will be
+// updated atomically from now on. obj is a pointer to the reference, as with
+// __hlt_object_cctor(). Only the object itself is marked, not anything it
+// refers to. Not to be used directly from user code.
+extern void __hlt_object_share(const hlt_type_info* ti, void* obj, hlt_execution_context* ctx);
+
 /// XXX For heap types only. Runs their object destructor without releasing memory. obj is a *direct* pointer to the object.
 extern void __hlt_object_destroy(const hlt_type_info* ti, void* obj, const char* location, hlt_execution_context* ctx);
 
@@ -278,6 +290,15 @@ extern void  __hlt_memory_safepoint(hlt_execution_context* ctx, const char* loca
        __hlt_object_cctor(ti, objptr, __hlt_make_location(__FILE__,__LINE__), ctx); \
    }
 
+/// Marks the object that *objptr* points to as potentially accessed by
+/// more than one thread, so that its reference count is updated atomically
+/// from then on. Call this before handing the object to another thread.
+/// Objects it refers to are not marked.
+#define GC_SHARE_GENERIC(objptr, ti, ctx) \
+   { \
+       __hlt_object_share(ti, objptr, ctx); \
+   }
+
 /// XXX
 #define GC_CLEAR(obj, tag, ctx) \
    { \
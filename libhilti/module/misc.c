@@ -38,3 +38,12 @@ void hilti_wait_for_threads()
     hlt_thread_mgr_set_state(hlt_global_thread_mgr(), HLT_THREAD_MGR_FINISH);
 }
 
+hlt_vector* hilti_iosrc_read_batch(hlt_iosrc* src, int64_t n, int8_t keep_link_layer, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    return hlt_iosrc_read_batch(src, n, keep_link_layer, excpt, ctx);
+}
+
+hlt_timer_mgr* hilti_timer_mgr_new_wheel(hlt_interval granularity, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    return hlt_timer_mgr_new_wheel(granularity, excpt, ctx);
+}
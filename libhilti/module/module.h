@@ -14,5 +14,7 @@ extern void hilti_abort(hlt_exception** excpt);
 extern void hilti_sleep(double secs, hlt_exception** excpt, hlt_execution_context* ctx); // Doesn't yield!
 extern void hilti_wait_for_threads();
 extern void hilti_terminate(hlt_exception** excpt, hlt_execution_context* ctx);
+extern hlt_vector* hilti_iosrc_read_batch(hlt_iosrc* src, int64_t n, int8_t keep_link_layer, hlt_exception** excpt, hlt_execution_context* ctx);
+extern hlt_timer_mgr* hilti_timer_mgr_new_wheel(hlt_interval granularity, hlt_exception** excpt, hlt_execution_context* ctx);
 
 #endif
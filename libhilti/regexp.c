@@ -7,12 +7,21 @@
 #include "memory_.h"
 #include "autogen/hilti-hlt.h"
 
+// A compiled set of patterns. As the DFA is safe to extend concurrently,
+// all regexps with the same patterns can share one instance, including
+// copies cloned into other threads. That way, each state computed lazily
+// becomes available to all of them.
+typedef struct {
+    int64_t ref_cnt;     // Number of regexps using this; updated atomically.
+    jrx_regex_t regexp;  // The compiled patterns.
+} __hlt_regexp_compiled;
+
 struct __hlt_regexp {
     __hlt_gchdr __gchdr; // Header for memory management.
     int32_t num; // Number of patterns in set.
     hlt_string* patterns;
     hlt_regexp_flags flags;
-    jrx_regex_t regexp;
+    __hlt_regexp_compiled* compiled; // Null if not compiled yet.
 };
 
 struct __hlt_match_token_state {
@@ -41,6 +50,41 @@ static inline int _cflags(hlt_regexp_flags flags)
     return cflags | ((cflags & REG_NOSUB) ? REG_ANCHOR : 0);
 }
 
+// Returns a new instance with its regexp still to be initialized.
+static __hlt_regexp_compiled* _compiled_alloc()
+{
+    __hlt_regexp_compiled* c = hlt_malloc(sizeof(__hlt_regexp_compiled));
+    c->ref_cnt = 1;
+    return c;
+}
+
+static __hlt_regexp_compiled* _compiled_new(hlt_regexp_flags flags)
+{
+    __hlt_regexp_compiled* c = _compiled_alloc();
+    jrx_regset_init(&c->regexp, -1, _cflags(flags));
+    return c;
+}
+
+static __hlt_regexp_compiled* _compiled_ref(__hlt_regexp_compiled* c)
+{
+    if ( c )
+        __atomic_add_fetch(&c->ref_cnt, 1, __ATOMIC_SEQ_CST);
+
+    return c;
+}
+
+static void _compiled_unref(__hlt_regexp_compiled* c)
+{
+    if ( ! c )
+        return;
+
+    if ( __atomic_sub_fetch(&c->ref_cnt, 1, __ATOMIC_SEQ_CST) > 0 )
+        return;
+
+    jrx_regfree(&c->regexp);
+    hlt_free(c);
+}
+
 // patter not net ref'ed.
 static void _compile_one(hlt_regexp* re, hlt_string pattern, int idx, int re_refed, hlt_exception** excpt, hlt_execution_context* ctx)
 {
@@ -54,7 +98,7 @@ static void _compile_one(hlt_regexp* re, hlt_string pattern, int idx, int re_ref
     int8_t* praw = hlt_bytes_to_raw(tmp, plen, p, excpt, ctx);
     assert(praw);
 
-    if ( jrx_regset_add(&re->regexp, (const char*)praw, plen) != 0 ) {
+    if ( jrx_regset_add(&re->compiled->regexp, (const char*)praw, plen) != 0 ) {
         hlt_set_exception(excpt, &hlt_exception_pattern_error, pattern, ctx);
         return;
     }
@@ -72,8 +116,7 @@ void hlt_regexp_dtor(hlt_type_info* ti, hlt_regexp* re, hlt_execution_context* c
 
     hlt_free(re->patterns);
 
-    if ( re->num > 0 )
-        jrx_regfree(&re->regexp);
+    _compiled_unref(re->compiled);
 }
 
 void hlt_match_token_state_dtor(hlt_type_info* ti, hlt_match_token_state* t, hlt_execution_context* ctx)
@@ -90,6 +133,7 @@ static inline void _hlt_regexp_init(hlt_regexp* re, hlt_regexp_flags flags, hlt_
     re->num = 0;
     re->patterns = 0;
     re->flags = flags;
+    re->compiled = 0;
 }
 
 hlt_regexp* hlt_regexp_new(hlt_regexp_flags flags, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -116,17 +160,7 @@ void hlt_regexp_clone_init(void* dstp, const hlt_type_info* ti, void* srcp, __hl
     for ( int i = 0; i < src->num; i++ )
         __hlt_clone(&dst->patterns[i], &hlt_type_info_hlt_string, &src->patterns[i], cstate, excpt, ctx);
 
-    // TODO: Figure out a way to reuse the compiled regexp. Need to make that
-    // thread-safe though.
-
-    jrx_regset_init(&dst->regexp, -1, _cflags(dst->flags));
-
-    for ( int idx = 0; idx < dst->num; idx++ ) {
-        hlt_string pattern = dst->patterns[idx];
-        _compile_one(dst, pattern, idx, 1, excpt, ctx);
-    }
-
-    jrx_regset_finalize(&dst->regexp);
+    dst->compiled = _compiled_ref(src->compiled);
 }
 
 static void _hlt_regexp_new_from_regexp_init(hlt_regexp* dst, hlt_regexp* other, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -134,17 +168,13 @@ static void _hlt_regexp_new_from_regexp_init(hlt_regexp* dst, hlt_regexp* other,
     dst->flags = other->flags;
     dst->num = other->num;
     dst->patterns = hlt_malloc(dst->num * sizeof(hlt_string));
-    jrx_regset_init(&dst->regexp, -1, _cflags(dst->flags));
 
     for ( int idx = 0; idx < other->num; idx++ ) {
-        hlt_string pattern = other->patterns[idx];
-        _compile_one(dst, pattern, idx, 0, excpt, ctx);
-
-         if ( hlt_check_exception(excpt) )
-            return;
+        dst->patterns[idx] = other->patterns[idx];
+        GC_CCTOR(dst->patterns[idx], hlt_string, ctx);
     }
 
-    jrx_regset_finalize(&dst->regexp);
+    dst->compiled = _compiled_ref(other->compiled);
 }
 
 hlt_regexp* hlt_regexp_new_from_regexp(hlt_regexp* other, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -163,25 +193,21 @@ void hlt_regexp_compile(hlt_regexp* re, const hlt_string pattern, hlt_exception*
 
     re->num = 1;
     re->patterns = hlt_malloc(sizeof(hlt_string));
-    jrx_regset_init(&re->regexp, -1, _cflags(re->flags));
+    re->compiled = _compiled_new(re->flags);
     _compile_one(re, pattern, 0, 0, excpt, ctx);
 
     if ( hlt_check_exception(excpt) )
 	return;
 
-    jrx_regset_finalize(&re->regexp);
+    jrx_regset_finalize(&re->compiled->regexp);
 }
 
-void hlt_regexp_compile_set(hlt_regexp* re, hlt_list* patterns, hlt_exception** excpt, hlt_execution_context* ctx)
+// Copies a list of patterns into the regexp. If compile is true, also adds
+// each of them to re->compiled.
+static void _set_patterns(hlt_regexp* re, hlt_list* patterns, int8_t compile, hlt_exception** excpt, hlt_execution_context* ctx)
 {
-    if ( re->num != 0 ) {
-        hlt_set_exception(excpt, &hlt_exception_value_error, 0, ctx);
-        return;
-    }
-
     re->num = hlt_list_size(patterns, excpt, ctx);
     re->patterns = hlt_malloc(re->num * sizeof(hlt_string));
-    jrx_regset_init(&re->regexp, -1, _cflags(re->flags));
 
     hlt_iterator_list i = hlt_list_begin(patterns, excpt, ctx);
     hlt_iterator_list end = hlt_list_end(patterns, excpt, ctx);
@@ -189,16 +215,61 @@ void hlt_regexp_compile_set(hlt_regexp* re, hlt_list* patterns, hlt_exception**
 
     while ( ! hlt_iterator_list_eq(i, end, excpt, ctx) ) {
         hlt_string* pattern = hlt_iterator_list_deref(i, excpt, ctx);
-        _compile_one(re, *pattern, idx, 0, excpt, ctx);
 
-         if ( hlt_check_exception(excpt) )
-            return;
+        if ( compile ) {
+            _compile_one(re, *pattern, idx, 0, excpt, ctx);
+
+            if ( hlt_check_exception(excpt) )
+                return;
+        }
+
+        else {
+            GC_CCTOR(*pattern, hlt_string, ctx);
+            re->patterns[idx] = *pattern;
+        }
 
         i = hlt_iterator_list_incr(i, excpt, ctx);
         idx++;
     }
+}
+
+void hlt_regexp_compile_set(hlt_regexp* re, hlt_list* patterns, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( re->num != 0 ) {
+        hlt_set_exception(excpt, &hlt_exception_value_error, 0, ctx);
+        return;
+    }
+
+    re->compiled = _compiled_new(re->flags);
 
-    jrx_regset_finalize(&re->regexp);
+    _set_patterns(re, patterns, 1, excpt, ctx);
+
+    if ( hlt_check_exception(excpt) )
+        return;
+
+    jrx_regset_finalize(&re->compiled->regexp);
+}
+
+void hlt_regexp_compile_image(hlt_regexp* re, hlt_list* patterns, void* image, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( re->num != 0 ) {
+        hlt_set_exception(excpt, &hlt_exception_value_error, 0, ctx);
+        return;
+    }
+
+    __hlt_regexp_compiled* c = _compiled_alloc();
+
+    if ( jrx_regset_import(&c->regexp, _cflags(re->flags), (const jrx_dfa_image*)image) != REG_OK ) {
+        // Can't use the image, compile at run-time instead.
+        hlt_free(c);
+        hlt_regexp_compile_set(re, patterns, excpt, ctx);
+        return;
+    }
+
+    re->compiled = c;
+
+    // We still keep the patterns, e.g., for printing.
+    _set_patterns(re, patterns, 0, excpt, ctx);
 }
 
 hlt_string hlt_regexp_to_string(const hlt_type_info* type, const void* obj, int32_t options, __hlt_pointer_stack* seen, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -260,6 +331,57 @@ hlt_vector *hlt_regexp_string_groups(hlt_regexp* re, const hlt_string s, hlt_exc
 
 // Bytes versions.
 
+// Searches for an anchored REG_NOSUB regexp at arbitrary starting positions
+// in a single pass and returns the left-most match. Reports partial matches
+// at the end of the data as -1.
+//
+// begin/end not yet ref'ed.
+static jrx_accept_id _search_pattern_linear(hlt_regexp* re, const hlt_iterator_bytes begin, const hlt_iterator_bytes end,
+                                            jrx_offset* so, jrx_offset* eo,
+                                            hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    hlt_bytes_block block;
+    jrx_assertion first = JRX_ASSERTION_BOL | JRX_ASSERTION_BOD;
+    jrx_assertion last = 0;
+    void* cookie = 0;
+    jrx_accept_id acc = 0;
+
+    jrx_search_state ss;
+    jrx_search_state_init(&re->compiled->regexp, &ss);
+
+    while ( 1 ) {
+        cookie = hlt_bytes_iterate_raw(&block, cookie, begin, end, excpt, ctx);
+
+        if ( ! cookie )
+            // Final chunk.
+            last |= JRX_ASSERTION_EOL | JRX_ASSERTION_EOD;
+
+#ifdef _DEBUG_MATCHING
+        fprintf(stderr, "feeding |");
+        print_bytes_raw((const char*)block.start, block.end - block.start, excpt, ctx);
+        fprintf(stderr, "|\n");
+#endif
+
+        acc = jrx_regexec_search_partial(&re->compiled->regexp, (const char*)block.start, block.end - block.start, first, last, &ss, ! cookie);
+
+        if ( acc >= 0 || ! cookie )
+            break;
+
+        first = 0;
+    }
+
+    if ( acc > 0 ) {
+        if ( so )
+            *so = ss.so;
+
+        if ( eo )
+            *eo = ss.eo;
+    }
+
+    jrx_search_state_done(&ss);
+    return acc;
+}
+
 // Searches for the regexp at arbitrary starting positions and returns the
 // first match.
 //
@@ -278,130 +400,108 @@ static jrx_accept_id _search_pattern(hlt_regexp* re, jrx_match_state* ms,
     // start with an implicit ".*") and we just need a single matching
     // process over all the data.
     //
-    // (2) If we compiled with REG_NOSUB, we iterate ourselves over all
-    // possible starting positions so that even though using the more
-    // efficinet minimal matcher, we can still get starting and end
-    // positions. (Setting do_anchor to 1 prevents the iteration and will
-    // only match right from the beginning. Note that this flag only works
-    // with REG_NOSUB).
+    // (2) If we compiled with REG_NOSUB, the regexp is anchored and we
+    // use the minimal matcher's search mode, which tracks all possible
+    // starting positions in a single pass over the data; see
+    // _search_pattern_linear(). (Setting do_anchor to 1 prevents that and
+    // will only match right from the beginning. Note that this flag only
+    // works with REG_NOSUB).
     //
     // If find_partial_matches is 0, we don't report a match as long as more
     // input could still change the result (i.e., there are still DFA
     // transitions possible after processing the last bytes). In this case,
     // the function returns -1 as if there wasn't any match yet.
 
-    // FIXME: In (2), we might be doing a bit more comparisions than with an
-    // implicit .*, and the manual loop also adds a bit overhead. That seems
-    // worth it but should reevaluate the trade-off later.
-
     hlt_bytes_block block;
     jrx_assertion first = JRX_ASSERTION_BOL | JRX_ASSERTION_BOD;
     jrx_assertion last = 0;
     void* cookie = 0;
     jrx_accept_id acc = 0;
-    int8_t need_msdone = 0;
     hlt_bytes_size offset = 0;
     int block_len = 0;
     int bytes_seen = 0;
 
-    hlt_iterator_bytes cur = begin;
+    int8_t stdmatcher = ! (re->compiled->regexp.cflags & REG_NOSUB);
 
-    int8_t stdmatcher = ! (re->regexp.cflags & REG_NOSUB);
+    assert( (! do_anchor) || (re->compiled->regexp.cflags & REG_NOSUB));
 
-    assert( (! do_anchor) || (re->regexp.cflags & REG_NOSUB));
+    // Callers expect the match state to be initialized in all cases.
+    jrx_match_state_init(&re->compiled->regexp, offset, ms);
 
-    if ( hlt_iterator_bytes_eq(cur, end, excpt, ctx) ) {
-        // Nothing to do, but still need to init the match state.
-        jrx_match_state_init(&re->regexp, offset, ms);
+    if ( hlt_iterator_bytes_eq(begin, end, excpt, ctx) )
+        // Nothing to do.
         return -1;
-    }
-
-    while ( acc <= 0 && ! hlt_iterator_bytes_eq(cur, end, excpt, ctx) ) {
-
-        if ( need_msdone )
-            jrx_match_state_done(ms);
 
-        need_msdone = 1;
-        cookie = 0;
-        bytes_seen = 0;
+    if ( ! (stdmatcher || do_anchor) )
+        return _search_pattern_linear(re, begin, end, so, eo, excpt, ctx);
 
-        jrx_match_state_init(&re->regexp, offset, ms);
+    // We compiled with an implicit ".*", or are asked to anchor.
 
-        while ( 1 ) {
-            cookie = hlt_bytes_iterate_raw(&block, cookie, cur, end, excpt, ctx);
+    while ( 1 ) {
+        cookie = hlt_bytes_iterate_raw(&block, cookie, begin, end, excpt, ctx);
 
-            if ( ! cookie )
-                // Final chunk.
-                last |= JRX_ASSERTION_EOL | JRX_ASSERTION_EOD;
+        if ( ! cookie )
+            // Final chunk.
+            last |= JRX_ASSERTION_EOL | JRX_ASSERTION_EOD;
 
-            block_len = block.end - block.start;
-            int fpm = (! cookie) && find_partial_matches;
+        block_len = block.end - block.start;
+        int fpm = (! cookie) && find_partial_matches;
 
 #ifdef _DEBUG_MATCHING
-            fprintf(stderr, "feeding |");
-            print_bytes_raw((const char*)block.start, block_len, excpt, ctx);
-            fprintf(stderr, "|\n");
+        fprintf(stderr, "feeding |");
+        print_bytes_raw((const char*)block.start, block_len, excpt, ctx);
+        fprintf(stderr, "|\n");
 #endif
-            jrx_accept_id rc = jrx_regexec_partial(&re->regexp, (const char*)block.start, block_len, first, last, ms, fpm);
+        jrx_accept_id rc = jrx_regexec_partial(&re->compiled->regexp, (const char*)block.start, block_len, first, last, ms, fpm);
 
 #ifdef _DEBUG_MATCHING
-            fprintf(stderr, "rc=%d ms->offset=%d\n", rc, ms->offset);
+        fprintf(stderr, "rc=%d ms->offset=%d\n", rc, ms->offset);
 #endif
 
-            if ( rc == 0 )
-                // No further match.
-                return acc;
+        if ( rc == 0 )
+            // No further match.
+            return acc;
 
-            if ( rc > 0 ) {
-                // Match.
-                acc = rc;
+        if ( rc > 0 ) {
+            // Match.
+            acc = rc;
 #ifdef _DEBUG_MATCHING
-                fprintf(stderr, "offset=%ld ms->offset=%d bytes_seen=%d eo=%p so=%p\n", offset, ms->offset-1, bytes_seen, eo, so);
+            fprintf(stderr, "offset=%ld ms->offset=%d bytes_seen=%d eo=%p so=%p\n", offset, ms->offset-1, bytes_seen, eo, so);
 #endif
 
-                if ( ! stdmatcher ) {
-                    if ( so )
-                        *so = offset;
-                    if ( eo ) {
-                        // FIXME: The match_state intializes the offset with
-                        // 1. Not sure why right now but changing that would
-                        // probably break other things we adjust that here
-                        // for the calculation.
-                        *eo = offset + ms->offset - 1;
-                    }
-                }
-                else if ( so || eo ) {
-                    jrx_regmatch_t pmatch;
-                    jrx_reggroups(&re->regexp, ms, 1, &pmatch);
-
-                    if ( so )
-                        *so = pmatch.rm_so;
-
-                    if ( eo )
-                        *eo = pmatch.rm_eo;
+            if ( ! stdmatcher ) {
+                if ( so )
+                    *so = offset;
+                if ( eo ) {
+                    // FIXME: The match_state intializes the offset with
+                    // 1. Not sure why right now but changing that would
+                    // probably break other things we adjust that here
+                    // for the calculation.
+                    *eo = offset + ms->offset - 1;
                 }
-
-                return acc;
             }
+            else if ( so || eo ) {
+                jrx_regmatch_t pmatch;
+                jrx_reggroups(&re->compiled->regexp, ms, 1, &pmatch);
 
-            bytes_seen += block_len;
+                if ( so )
+                    *so = pmatch.rm_so;
 
-            if ( ! cookie ) {
-                if ( rc < 0 && acc == 0 )
-                    // At least one could match with more data.
-                    acc = -1;
-                break;
+                if ( eo )
+                    *eo = pmatch.rm_eo;
             }
-        }
 
-        if ( stdmatcher || do_anchor )
-            // We compiled with an implicit ".*", or are asked to anchor.
-            break;
+            return acc;
+        }
 
-        cur = hlt_iterator_bytes_incr(cur, excpt, ctx);
+        bytes_seen += block_len;
 
-        offset++;
-        first = 0;
+        if ( ! cookie ) {
+            if ( rc < 0 )
+                // Could match with more data.
+                acc = -1;
+            break;
+        }
     }
 
     return acc;
@@ -476,12 +576,12 @@ hlt_vector *hlt_regexp_bytes_groups(hlt_regexp* re, const hlt_iterator_bytes beg
     if ( rc > 0 ) {
         _set_group(vec, begin, 0, so, eo, excpt, ctx);
 
-        int num_groups = jrx_num_groups(&re->regexp);
+        int num_groups = jrx_num_groups(&re->compiled->regexp);
         if ( num_groups < 1 )
             num_groups = 1;
 
         jrx_regmatch_t pmatch[num_groups];
-        jrx_reggroups(&re->regexp, &ms, num_groups, pmatch);
+        jrx_reggroups(&re->compiled->regexp, &ms, num_groups, pmatch);
 
         for ( int i = 1; i < num_groups; i++ ) {
             if ( pmatch[i].rm_so >= 0 )
@@ -499,7 +599,7 @@ static hlt_match_token_state* _match_token_init(hlt_regexp* re, hlt_exception**
     GC_INIT(state->re, re, hlt_regexp, ctx);
     state->acc = 0;
     state->first = JRX_ASSERTION_BOL | JRX_ASSERTION_BOD;
-    jrx_match_state_init(&re->regexp, 0, &state->ms);
+    jrx_match_state_init(&re->compiled->regexp, 0, &state->ms);
 
     return state;
 }
@@ -543,7 +643,7 @@ static int _match_token_advance(hlt_match_token_state* state,
             fprintf(stderr, "|\n");
 #endif
 
-        rc = jrx_regexec_partial(&state->re->regexp, (const char*)block.start, block_len, state->first, last, &state->ms, (last != 0));
+        rc = jrx_regexec_partial(&state->re->compiled->regexp, (const char*)block.start, block_len, state->first, last, &state->ms, (last != 0));
 
 #ifdef _DEBUG_MATCHING
         fprintf(stderr, "%p rc=%d ms->offset=%d\n", state, rc, state->ms.offset);
@@ -595,7 +695,7 @@ hlt_regexp_match_token hlt_regexp_bytes_match_token(hlt_regexp* re, const hlt_it
         return dummy;
     }
 
-    if ( ! (re->regexp.cflags & REG_NOSUB) ) {
+    if ( ! (re->compiled->regexp.cflags & REG_NOSUB) ) {
         // Must be a REG_NOSUB pattern.
         hlt_set_exception(excpt, &hlt_exception_pattern_error, 0, ctx);
         hlt_regexp_match_token dummy;
@@ -627,7 +727,7 @@ hlt_match_token_state* hlt_regexp_match_token_init(hlt_regexp* re, hlt_exception
         return 0;
     }
 
-    if ( ! (re->regexp.cflags & REG_NOSUB) ) {
+    if ( ! (re->compiled->regexp.cflags & REG_NOSUB) ) {
         // Must be a REG_NOSUB pattern.
         hlt_set_exception(excpt, &hlt_exception_pattern_error, 0, ctx);
         return 0;
@@ -84,6 +84,23 @@ extern void hlt_regexp_compile(hlt_regexp* re, hlt_string pattern, hlt_exception
 /// Raises: ~~hlt_exception_value_error - If a pattern was already compiled into *re*.
 extern void hlt_regexp_compile_set(hlt_regexp* re, hlt_list* patterns, hlt_exception** excpt, hlt_execution_context* ctx);
 
+/// Initializes a set of patterns from a DFA that the compiler has already
+/// computed, without compiling the patterns at run-time. If the DFA cannot
+/// be used with the regexp's flags, falls back to ~~hlt_regexp_compile_set.
+///
+/// re: The regexp instance to initialize. An already compiled regexp cannot
+/// be reused.
+///
+/// patterns: The list of patterns the DFA was computed for.
+///
+/// image: A ``jrx_dfa_image`` describing the DFA. It must remain valid for
+/// the lifetime of the process; the compiler emits it as a constant.
+///
+/// excpt: &
+///
+/// Raises: ~~hlt_exception_value_error - If a pattern was already compiled into *re*.
+extern void hlt_regexp_compile_image(hlt_regexp* re, hlt_list* patterns, void* image, hlt_exception** excpt, hlt_execution_context* ctx);
+
 /// Searches a regexp within a ~~string.
 ///
 /// re: The compiled pattern to search.
@@ -6,8 +6,13 @@
 
 #ifdef __linux__
 #include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <unistd.h>
 #endif
 
+#include <time.h>
+
 #include "system.h"
 
 void hlt_set_thread_name(const char* s)
@@ -92,3 +97,24 @@ void hlt_memory_usage(uint64_t* heap, uint64_t* alloced)
         *heap = r.ru_maxrss * 1024;
 #endif
 }
+
+void hlt_thread_park(int32_t* addr, int32_t val, uint64_t timeout)
+{
+    struct timespec ts;
+    ts.tv_sec = timeout / 1000000000;
+    ts.tv_nsec = timeout % 1000000000;
+
+#ifdef __linux__
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, &ts, 0, 0);
+#else
+    if ( __atomic_load_n(addr, __ATOMIC_SEQ_CST) == val )
+        nanosleep(&ts, 0);
+#endif
+}
+
+void hlt_thread_unpark(int32_t* addr)
+{
+#ifdef __linux__
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT32_MAX, 0, 0, 0);
+#endif
+}
@@ -41,4 +41,13 @@ void hlt_reset_getopt();
 /// set to null if not supported.
 void hlt_memory_usage(uint64_t* heap, uint64_t* alloced);
 
+/// Blocks the calling thread while \a *addr still has the value \a val,
+/// for at most \a timeout nanoseconds. The function may return early, so
+/// callers need to recheck whatever they are waiting for. On Linux, this
+/// uses a futex; elsewhere it just sleeps.
+void hlt_thread_park(int32_t* addr, int32_t val, uint64_t timeout);
+
+/// Wakes up all threads blocked in hlt_thread_park() on \a addr.
+void hlt_thread_unpark(int32_t* addr);
+
 #endif
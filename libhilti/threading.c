@@ -25,6 +25,7 @@
 #include "context.h"
 #include "globals.h"
 #include "exceptions.h"
+#include "file.h"
 #include "autogen/hilti-hlt.h"
 
 typedef hlt_hash khint_t;
@@ -57,6 +58,7 @@ KHASH_INIT(blocked_jobs, const void*, hlt_blocked_job*, 1, __kh_ptr_hash_func, _
 
 // Batch size for the jobs queues.
 #define QUEUE_BATCH_SIZE 100
+#define QUEUE_RING_SIZE  4096
 
 // Number of pending elements across all job qeueus that correspond to the
 // maximum load of 1.0.
@@ -68,6 +70,8 @@ static void _fatal_error(const char* msg)
     exit(1);
 }
 
+static hlt_worker_thread* _vthread_to_worker(hlt_thread_mgr* mgr, hlt_vthread_id vid);
+
 // Returns the execution context to use for a given virtual thread ID.
 static hlt_execution_context* _worker_get_ctx(hlt_worker_thread* thread, hlt_vthread_id vid)
 {
@@ -83,6 +87,7 @@ static hlt_execution_context* _worker_get_ctx(hlt_worker_thread* thread, hlt_vth
             new_max *= 2;
 
         thread->ctxs = hlt_realloc(thread->ctxs, (new_max+1) * sizeof(hlt_execution_context*), (max+1) * sizeof(hlt_execution_context*));
+        thread->ctx_deadlines = hlt_realloc(thread->ctx_deadlines, (new_max+1) * sizeof(hlt_time), (max+1) * sizeof(hlt_time));
         thread->max_vid = new_max;
     }
 
@@ -98,6 +103,87 @@ static hlt_execution_context* _worker_get_ctx(hlt_worker_thread* thread, hlt_vth
     return ctx;
 }
 
+// Returns the execution context a job runs in.
+static hlt_execution_context* _job_ctx(hlt_worker_thread* thread, hlt_job* job)
+{
+    return job->vthread ? job->vthread->ctx : _worker_get_ctx(thread, job->vid);
+}
+
+static inline void _spin_lock(PTHREAD_SPINLOCK_T* lock)
+{
+    if ( PTHREAD_SPIN_LOCK(lock) != 0 )
+        _fatal_error("cannot acquire lock");
+}
+
+static inline void _spin_unlock(PTHREAD_SPINLOCK_T* lock)
+{
+    if ( PTHREAD_SPIN_UNLOCK(lock) != 0 )
+        _fatal_error("cannot release lock");
+}
+
+// Adds an entry to a deadline heap.
+static void _deadlines_push(hlt_deadlines* heap, hlt_time time, hlt_vthread_id vid)
+{
+    if ( heap->size == heap->capacity ) {
+        int capacity = heap->capacity ? heap->capacity * 2 : 16;
+        heap->entries = hlt_realloc(heap->entries, capacity * sizeof(hlt_deadline), heap->capacity * sizeof(hlt_deadline));
+        heap->capacity = capacity;
+    }
+
+    int i = heap->size++;
+
+    while ( i > 0 ) {
+        int parent = (i - 1) / 2;
+
+        if ( heap->entries[parent].time <= time )
+            break;
+
+        heap->entries[i] = heap->entries[parent];
+        i = parent;
+    }
+
+    heap->entries[i].time = time;
+    heap->entries[i].vid = vid;
+}
+
+// Removes the earliest entry from a deadline heap, which must not be empty.
+static hlt_deadline _deadlines_pop(hlt_deadlines* heap)
+{
+    assert(heap->size);
+
+    hlt_deadline top = heap->entries[0];
+    hlt_deadline last = heap->entries[--heap->size];
+
+    int i = 0;
+
+    while ( 1 ) {
+        int child = 2 * i + 1;
+
+        if ( child >= heap->size )
+            break;
+
+        if ( child + 1 < heap->size && heap->entries[child + 1].time < heap->entries[child].time )
+            ++child;
+
+        if ( last.time <= heap->entries[child].time )
+            break;
+
+        heap->entries[i] = heap->entries[child];
+        i = child;
+    }
+
+    if ( heap->size )
+        heap->entries[i] = last;
+
+    return top;
+}
+
+// Returns the time of the earliest entry in a deadline heap, or 0 if empty.
+static inline hlt_time _deadlines_next(const hlt_deadlines* heap)
+{
+    return heap->size ? heap->entries[0].time : 0;
+}
+
 static void _hlt_job_delete(hlt_job* j, hlt_execution_context* ctx)
 {
     DBG_LOG(DBG_STREAM, "deleting job %lu", j->id);
@@ -120,7 +206,7 @@ static void _hlt_worker_thread_delete(hlt_worker_thread* t)
         hlt_job* job = hlt_thread_queue_read(t->jobs, 10);
         assert(job);
 
-        hlt_execution_context* ctx = _worker_get_ctx(t, job->vid);
+        hlt_execution_context* ctx = _job_ctx(t, job);
         _hlt_job_delete(job, ctx);
     }
 
@@ -135,7 +221,7 @@ static void _hlt_worker_thread_delete(hlt_worker_thread* t)
         while ( bjob ) {
             hlt_blocked_job* next = bjob->next;
 
-            hlt_execution_context* ctx = _worker_get_ctx(t, bjob->job->vid);
+            hlt_execution_context* ctx = _job_ctx(t, bjob->job);
             _hlt_job_delete(bjob->job, ctx);
 
             hlt_free(bjob);
@@ -151,6 +237,14 @@ static void _hlt_worker_thread_delete(hlt_worker_thread* t)
     kh_destroy_blocked_jobs(t->jobs_blocked);
     hlt_free(t->jobs_blocked);
 
+    // The virtual threads in here are deleted by the manager.
+    if ( PTHREAD_SPIN_DESTROY(&t->ready_lock) != 0 )
+        _fatal_error("cannot destroy lock");
+
+    hlt_free(t->ready);
+
+    hlt_free(t->timers.entries);
+    hlt_free(t->ctx_deadlines);
     hlt_free(t->ctxs);
     hlt_free(t->name);
     __hlt_fiber_pool_delete(t->fiber_pool);
@@ -171,6 +265,36 @@ void hlt_thread_mgr_delete(hlt_thread_mgr* mgr)
     for ( int i = 0; i < mgr->num_workers; i++ )
         _hlt_worker_thread_delete(mgr->workers[i]);
 
+    for ( int i = 0; i <= mgr->max_vid; i++ ) {
+        hlt_vthread* vt = mgr->vthreads[i];
+
+        if ( ! vt )
+            continue;
+
+        // The workers are gone, the context needs to use its own fiber pool.
+        vt->ctx->worker = 0;
+
+        while ( vt->jobs_head ) {
+            hlt_job* job = vt->jobs_head;
+            vt->jobs_head = job->next;
+            _hlt_job_delete(job, vt->ctx);
+        }
+
+        // The global context isn't ours to delete.
+        if ( vt->vid != 0 )
+            hlt_execution_context_delete(vt->ctx);
+
+        if ( PTHREAD_SPIN_DESTROY(&vt->lock) != 0 )
+            _fatal_error("cannot destroy lock");
+
+        hlt_free(vt);
+    }
+
+    if ( PTHREAD_SPIN_DESTROY(&mgr->vthreads_lock) != 0 )
+        _fatal_error("cannot destroy lock");
+
+    hlt_free(mgr->deadlines.entries);
+    hlt_free(mgr->vthreads);
     hlt_free(mgr->workers);
     hlt_free(mgr);
 }
@@ -180,11 +304,65 @@ int8_t __hlt_thread_mgr_terminating()
     return __hlt_globals()->thread_mgr_terminate;
 }
 
+// Wakes up a worker parked by _worker_park().
+static void _worker_unpark(hlt_worker_thread* thread)
+{
+    if ( ! __atomic_exchange_n(&thread->parked, 0, __ATOMIC_SEQ_CST) )
+        return;
+
+    __atomic_add_fetch(&thread->wakeups, 1, __ATOMIC_SEQ_CST);
+    hlt_thread_unpark(&thread->wakeups);
+}
+
+void __hlt_thread_mgr_global_time_changed(hlt_time t)
+{
+    hlt_thread_mgr* mgr = hlt_global_thread_mgr();
+
+    if ( ! mgr || (mgr->state != HLT_THREAD_MGR_RUN && mgr->state != HLT_THREAD_MGR_FINISH) )
+        return;
+
+    if ( mgr->stealing ) {
+        // Any idle worker can take care of it.
+        hlt_time next = __atomic_load_n(&mgr->next_deadline, __ATOMIC_SEQ_CST);
+
+        if ( ! next || next > t || ! __atomic_load_n(&mgr->num_parked, __ATOMIC_SEQ_CST) )
+            return;
+
+        for ( int i = 0; i < mgr->num_workers; i++ ) {
+            if ( __atomic_load_n(&mgr->workers[i]->parked, __ATOMIC_SEQ_CST) ) {
+                _worker_unpark(mgr->workers[i]);
+                return;
+            }
+        }
+
+        return;
+    }
+
+    for ( int i = 0; i < mgr->num_workers; i++ ) {
+        hlt_worker_thread* thread = mgr->workers[i];
+        hlt_time next = __atomic_load_n(&thread->next_deadline, __ATOMIC_SEQ_CST);
+
+        if ( next && next <= t )
+            hlt_thread_queue_wakeup(thread->jobs);
+    }
+}
+
+// Wakes up all workers blocking while idle, so that they notice a state
+// change. Safe to call from all threads.
+static void _wakeup_all_workers(hlt_thread_mgr* mgr)
+{
+    for ( int i = 0; i < mgr->num_workers; i++ ) {
+        hlt_thread_queue_wakeup(mgr->workers[i]->jobs);
+        _worker_unpark(mgr->workers[i]);
+    }
+}
+
 // Flag all threads to terminate immediately. Safe to call from all threads.
 void _kill_all_threads(hlt_thread_mgr* mgr)
 {
     DBG_LOG(DBG_STREAM, "terminating all threads");
     __hlt_globals()->thread_mgr_terminate = 1;
+    _wakeup_all_workers(mgr);
 }
 
 void __hlt_thread_mgr_uncaught_exception_in_thread(hlt_exception* excpt, hlt_execution_context* ctx)
@@ -203,6 +381,334 @@ void __hlt_thread_mgr_uncaught_exception_in_thread(hlt_exception* excpt, hlt_exe
     _kill_all_threads(thread->mgr);
 }
 
+// Appends a virtual thread to a worker's ready deque.
+static void _ready_push(hlt_worker_thread* thread, hlt_vthread* vt)
+{
+    _spin_lock(&thread->ready_lock);
+
+    if ( thread->ready_size == thread->ready_capacity ) {
+        // Need to grow the buffer.
+        int capacity = thread->ready_capacity ? thread->ready_capacity * 2 : 16;
+        hlt_vthread** ready = hlt_malloc(capacity * sizeof(hlt_vthread*));
+
+        for ( int i = 0; i < thread->ready_size; i++ )
+            ready[i] = thread->ready[(thread->ready_head + i) % thread->ready_capacity];
+
+        hlt_free(thread->ready);
+        thread->ready = ready;
+        thread->ready_head = 0;
+        thread->ready_capacity = capacity;
+    }
+
+    thread->ready[(thread->ready_head + thread->ready_size) % thread->ready_capacity] = vt;
+
+    // Pairs with the check in _worker_park().
+    __atomic_store_n(&thread->ready_size, thread->ready_size + 1, __ATOMIC_SEQ_CST);
+
+    _spin_unlock(&thread->ready_lock);
+
+    // If the worker is idle, wake it up. Otherwise wake up another idle
+    // one, if any, to steal.
+    hlt_thread_mgr* mgr = thread->mgr;
+
+    if ( __atomic_load_n(&thread->parked, __ATOMIC_SEQ_CST) ) {
+        _worker_unpark(thread);
+        return;
+    }
+
+    if ( ! __atomic_load_n(&mgr->num_parked, __ATOMIC_SEQ_CST) )
+        return;
+
+    for ( int i = 0; i < mgr->num_workers; i++ ) {
+        hlt_worker_thread* other = mgr->workers[i];
+
+        if ( other != thread && __atomic_load_n(&other->parked, __ATOMIC_SEQ_CST) ) {
+            _worker_unpark(other);
+            return;
+        }
+    }
+}
+
+// Takes the virtual thread at the front of a worker's ready deque. Returns
+// null if empty.
+static hlt_vthread* _ready_pop(hlt_worker_thread* thread)
+{
+    if ( ! __atomic_load_n(&thread->ready_size, __ATOMIC_ACQUIRE) )
+        return 0;
+
+    hlt_vthread* vt = 0;
+
+    _spin_lock(&thread->ready_lock);
+
+    if ( thread->ready_size ) {
+        vt = thread->ready[thread->ready_head];
+        thread->ready_head = (thread->ready_head + 1) % thread->ready_capacity;
+        __atomic_store_n(&thread->ready_size, thread->ready_size - 1, __ATOMIC_RELEASE);
+    }
+
+    _spin_unlock(&thread->ready_lock);
+
+    return vt;
+}
+
+// Takes a virtual thread from the back of another worker's ready deque,
+// skipping those that are pinned by blocked jobs. Returns null if there's
+// nothing to steal.
+static hlt_vthread* _ready_steal(hlt_worker_thread* thread)
+{
+    hlt_thread_mgr* mgr = thread->mgr;
+
+    for ( int i = 1; i < mgr->num_workers; i++ ) {
+        hlt_worker_thread* victim = mgr->workers[(thread->id - 1 + i) % mgr->num_workers];
+
+        if ( ! __atomic_load_n(&victim->ready_size, __ATOMIC_ACQUIRE) )
+            continue;
+
+        hlt_vthread* vt = 0;
+
+        _spin_lock(&victim->ready_lock);
+
+        for ( int j = victim->ready_size - 1; j >= 0; j-- ) {
+            hlt_vthread* candidate = victim->ready[(victim->ready_head + j) % victim->ready_capacity];
+
+            if ( __atomic_load_n(&candidate->num_blocked, __ATOMIC_SEQ_CST) )
+                continue;
+
+            // Close the gap.
+            for ( int k = j; k < victim->ready_size - 1; k++ )
+                victim->ready[(victim->ready_head + k) % victim->ready_capacity] = victim->ready[(victim->ready_head + k + 1) % victim->ready_capacity];
+
+            __atomic_store_n(&victim->ready_size, victim->ready_size - 1, __ATOMIC_RELEASE);
+            vt = candidate;
+            break;
+        }
+
+        _spin_unlock(&victim->ready_lock);
+
+        if ( vt ) {
+            DBG_LOG(DBG_STREAM, "%s stole vid %" PRId64 " from %s", thread->name, vt->vid, victim->name);
+            ++thread->num_steals;
+            __atomic_add_fetch(&victim->num_stolen, 1, __ATOMIC_RELAXED);
+            return vt;
+        }
+    }
+
+    return 0;
+}
+
+// Returns the state for a virtual thread, creating it if it doesn't exist
+// yet. A new one starts out at the worker its ID hashes to.
+static hlt_vthread* _vthread_get(hlt_thread_mgr* mgr, hlt_vthread_id vid)
+{
+    assert(vid >= 0);
+
+    _spin_lock(&mgr->vthreads_lock);
+    hlt_vthread* vt = (vid <= mgr->max_vid ? mgr->vthreads[vid] : 0);
+    _spin_unlock(&mgr->vthreads_lock);
+
+    if ( vt )
+        return vt;
+
+    // Create the context outside of the lock, its module initialization
+    // may end up scheduling jobs itself.
+    vt = hlt_malloc(sizeof(hlt_vthread));
+    vt->vid = vid;
+    vt->time = 0;
+    vt->deadline = 0;
+    vt->timers_due = 0;
+    vt->num_blocked = 0;
+    vt->state = HLT_VTHREAD_IDLE;
+    vt->owner = _vthread_to_worker(mgr, vid);
+    vt->jobs_head = vt->jobs_tail = 0;
+    vt->num_jobs = 0;
+
+    if ( vid == 0 )
+        // Same as with _worker_get_ctx(), this one runs in the global context.
+        vt->ctx = hlt_global_execution_context();
+
+    else {
+        vt->ctx = __hlt_execution_context_new_ref(vid, 1);
+        vt->ctx->worker = vt->owner;
+    }
+
+    if ( PTHREAD_SPIN_INIT(&vt->lock) != 0 )
+        _fatal_error("cannot init lock");
+
+    _spin_lock(&mgr->vthreads_lock);
+
+    hlt_vthread_id max = mgr->max_vid;
+
+    if ( max < vid ) {
+        // Need to grow the array.
+        hlt_vthread_id new_max = max;
+        while ( new_max < vid )
+            new_max *= 2;
+
+        mgr->vthreads = hlt_realloc(mgr->vthreads, (new_max+1) * sizeof(hlt_vthread*), (max+1) * sizeof(hlt_vthread*));
+        mgr->max_vid = new_max;
+    }
+
+    hlt_vthread* other = mgr->vthreads[vid];
+
+    if ( ! other )
+        mgr->vthreads[vid] = vt;
+
+    _spin_unlock(&mgr->vthreads_lock);
+
+    if ( other ) {
+        // Somebody else was faster.
+        if ( vid != 0 ) {
+            vt->ctx->worker = 0;
+            hlt_execution_context_delete(vt->ctx);
+        }
+
+        PTHREAD_SPIN_DESTROY(&vt->lock);
+        hlt_free(vt);
+        return other;
+    }
+
+    return vt;
+}
+
+// Queues a job with its virtual thread. If the virtual thread was idle, it
+// becomes ready on the worker it last ran on.
+static void _vthread_schedule_job(hlt_vthread* vt, hlt_job* job)
+{
+    hlt_worker_thread* target = 0;
+
+    job->next = 0;
+
+    _spin_lock(&vt->lock);
+
+    if ( vt->jobs_tail )
+        vt->jobs_tail->next = job;
+    else
+        vt->jobs_head = job;
+
+    vt->jobs_tail = job;
+    ++vt->num_jobs;
+
+    if ( vt->state == HLT_VTHREAD_IDLE ) {
+        vt->state = HLT_VTHREAD_READY;
+        target = vt->owner;
+    }
+
+    _spin_unlock(&vt->lock);
+
+    if ( target )
+        _ready_push(target, vt);
+}
+
+// Makes sure virtual threads with timers due by the given global time get
+// them advanced. Idle ones become ready, and whoever runs them next does the
+// advancing. Those without timers due catch up lazily once they run.
+static void _vthreads_advance(hlt_thread_mgr* mgr, hlt_time gt)
+{
+    hlt_time t = __atomic_load_n(&mgr->vthreads_time, __ATOMIC_SEQ_CST);
+
+    if ( t >= gt )
+        return;
+
+    // One worker is enough to do this.
+    if ( ! __atomic_compare_exchange_n(&mgr->vthreads_time, &t, gt, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) )
+        return;
+
+    hlt_time next = __atomic_load_n(&mgr->next_deadline, __ATOMIC_SEQ_CST);
+
+    if ( ! next || next > gt )
+        return;
+
+    _spin_lock(&mgr->vthreads_lock);
+
+    while ( mgr->deadlines.size && _deadlines_next(&mgr->deadlines) <= gt ) {
+        hlt_deadline d = _deadlines_pop(&mgr->deadlines);
+        hlt_vthread* vt = mgr->vthreads[d.vid];
+        hlt_worker_thread* target = 0;
+
+        if ( vt->deadline != d.time )
+            // Superseded by an earlier one.
+            continue;
+
+        vt->deadline = 0;
+
+        _spin_lock(&vt->lock);
+
+        vt->timers_due = 1;
+
+        if ( vt->state == HLT_VTHREAD_IDLE ) {
+            vt->state = HLT_VTHREAD_READY;
+            target = vt->owner;
+        }
+
+        _spin_unlock(&vt->lock);
+
+        if ( target )
+            _ready_push(target, vt);
+    }
+
+    __atomic_store_n(&mgr->next_deadline, _deadlines_next(&mgr->deadlines), __ATOMIC_SEQ_CST);
+
+    _spin_unlock(&mgr->vthreads_lock);
+}
+
+// Records when a virtual thread has timers due next.
+static void _vthread_track_timers(hlt_thread_mgr* mgr, hlt_vthread* vt)
+{
+    hlt_time next = hlt_timer_mgr_next(vt->ctx->tmgr, 0, vt->ctx);
+
+    if ( ! next )
+        return;
+
+    // A timer wheel reports only the start of the slot, which may be
+    // where we are already.
+    if ( next <= vt->time )
+        next = vt->time + 1;
+
+    _spin_lock(&mgr->vthreads_lock);
+
+    if ( ! vt->deadline || next < vt->deadline ) {
+        vt->deadline = next;
+        _deadlines_push(&mgr->deadlines, next, vt->vid);
+        __atomic_store_n(&mgr->next_deadline, _deadlines_next(&mgr->deadlines), __ATOMIC_SEQ_CST);
+    }
+
+    // If global time has passed the deadline already, _vthreads_advance()
+    // may have run before we added it. In that case, we take care of it
+    // ourselves; the heap entry will be skipped as superseded.
+    int8_t due = 0;
+
+    if ( vt->deadline && vt->deadline <= __hlt_globals()->global_time ) {
+        vt->deadline = 0;
+        due = 1;
+    }
+
+    _spin_unlock(&mgr->vthreads_lock);
+
+    if ( due ) {
+        _spin_lock(&vt->lock);
+        vt->timers_due = 1;
+        _spin_unlock(&vt->lock);
+    }
+}
+
+// Returns the number of jobs pending for a worker.
+static uint64_t _worker_pending(hlt_worker_thread* thread)
+{
+    uint64_t pending = hlt_thread_queue_size(thread->jobs);
+
+    if ( ! thread->mgr->stealing )
+        return pending;
+
+    _spin_lock(&thread->ready_lock);
+
+    for ( int i = 0; i < thread->ready_size; i++ )
+        pending += thread->ready[(thread->ready_head + i) % thread->ready_capacity]->num_jobs;
+
+    _spin_unlock(&thread->ready_lock);
+
+    return pending;
+}
+
 // Terminates all worker threads. The specifics depend on the given state:
 //
 // FINISH: Terminate once all workers are idle.
@@ -222,6 +728,8 @@ static void _terminate_threads(hlt_thread_mgr* mgr, hlt_thread_mgr_state state)
     for ( int i = 0; i < mgr->num_workers; ++i )
         hlt_thread_queue_terminate_writer(mgr->workers[i]->jobs, 0);
 
+    _wakeup_all_workers(mgr);
+
     switch ( state ) {
       case HLT_THREAD_MGR_FINISH:
         DBG_LOG(DBG_STREAM, "waiting for all threads to become idle");
@@ -232,7 +740,7 @@ static void _terminate_threads(hlt_thread_mgr* mgr, hlt_thread_mgr_state state)
             int idle = 0;
 
             for ( int i = 0; i < mgr->num_workers; ++i ) {
-                if ( mgr->workers[i]->idle && hlt_thread_queue_size(mgr->workers[i]->jobs) == 0 )
+                if ( mgr->workers[i]->idle && _worker_pending(mgr->workers[i]) == 0 )
                     ++idle;
             }
 
@@ -243,6 +751,7 @@ static void _terminate_threads(hlt_thread_mgr* mgr, hlt_thread_mgr_state state)
         }
 
         mgr->state = state = HLT_THREAD_MGR_STOP;
+        _wakeup_all_workers(mgr);
         // Fall-through.
 
       case HLT_THREAD_MGR_STOP:
@@ -290,6 +799,10 @@ static void _add_to_blocked(hlt_worker_thread* thread, __hlt_thread_mgr_blockabl
     kh_value(thread->jobs_blocked, i) = bjob;
 
     ++resource->num_blocked;
+
+    if ( job->vthread )
+        // Pins the virtual thread to this worker.
+        __atomic_add_fetch(&job->vthread->num_blocked, 1, __ATOMIC_SEQ_CST);
 }
 
 // The top-level function to run inside a job's fiber. The received argument is the callable to execute.
@@ -313,10 +826,14 @@ static void _worker_schedule_job(hlt_worker_thread* current, hlt_worker_thread*
 {
     DBG_LOG(DBG_STREAM, "scheduling job %lu for vid %d to %s", job->id, job->vid, target->name);
 
-    if ( ! job->blockable )
-        hlt_thread_queue_write(target->jobs, current ? current->id : 0, job);
-    else
+    if ( job->blockable )
         _add_to_blocked(target, job->blockable, job);
+
+    else if ( job->vthread )
+        _vthread_schedule_job(job->vthread, job);
+
+    else
+        hlt_thread_queue_write(target->jobs, current ? current->id : 0, job);
 }
 
 static void _unblock_blocked(hlt_worker_thread* thread, __hlt_thread_mgr_blockable* resource, hlt_execution_context* ctx)
@@ -336,6 +853,10 @@ static void _unblock_blocked(hlt_worker_thread* thread, __hlt_thread_mgr_blockab
         assert(job->blockable == resource);
         job->blockable = 0;
         --resource->num_blocked;
+
+        if ( job->vthread )
+            __atomic_sub_fetch(&job->vthread->num_blocked, 1, __ATOMIC_SEQ_CST);
+
         _worker_schedule_job(thread, thread, job);
 
         hlt_blocked_job* next = bjob->next;
@@ -356,8 +877,10 @@ static void _worker_schedule(hlt_worker_thread* current, hlt_worker_thread* targ
     }
 
     hlt_job* job = hlt_malloc(sizeof(hlt_job));
-    job->fiber = hlt_fiber_create(_worker_fiber_entry, _worker_get_ctx(target, vid), func, ctx);
     job->vid = vid;
+    job->vthread = target->mgr->stealing ? _vthread_get(target->mgr, vid) : 0;
+    job->next = 0;
+    job->fiber = hlt_fiber_create(_worker_fiber_entry, _job_ctx(target, job), func, ctx);
     job->tcontext_type = tcontext_type;
     job->tcontext = tcontext;
 #if DEBUG
@@ -367,6 +890,12 @@ static void _worker_schedule(hlt_worker_thread* current, hlt_worker_thread* targ
     // We get the func at +1, so no ref needed.
     // we also get the tcontext at +1, so no ref needed either.
 
+    // Both are now accessed from the target thread.
+    GC_SHARE_GENERIC(&func, &hlt_type_info_hlt_callable, ctx);
+
+    if ( tcontext_type )
+        GC_SHARE_GENERIC(&tcontext, tcontext_type, ctx);
+
     _worker_schedule_job(current, target, job);
 }
 
@@ -374,8 +903,20 @@ static void _worker_schedule(hlt_worker_thread* current, hlt_worker_thread* targ
 
 static void _debug_print_queue_stats(const hlt_thread_queue_stats* stats)
 {
-    fprintf(stderr, " elems=%" PRIu64 "  batches=%" PRIu64 "  blocked=%" PRIu64 "  locked=%" PRIu64 "\n",
-            stats->elems, stats->batches, stats->blocked, stats->locked);
+    fprintf(stderr, " elems=%" PRIu64 "  batches=%" PRIu64 "  blocked=%" PRIu64 "  locked=%" PRIu64 "  wakeups=%" PRIu64 "  wasted=%" PRIu64 "\n",
+            stats->elems, stats->batches, stats->blocked, stats->locked, stats->wakeups, stats->wasted_wakeups);
+}
+
+static void _debug_print_queue_histogram(const char* name, const uint64_t* hist)
+{
+    fprintf(stderr, "  %20s : ", name);
+
+    for ( int i = 0; i < HLT_THREAD_QUEUE_HIST_BUCKETS; i++ ) {
+        if ( hist[i] )
+            fprintf(stderr, " <2^%d=%" PRIu64, i, hist[i]);
+    }
+
+    fprintf(stderr, "\n");
 }
 
 static void _debug_print_job_summary(hlt_thread_mgr* mgr)
@@ -390,6 +931,8 @@ static void _debug_print_job_summary(hlt_thread_mgr* mgr)
         fprintf(stderr, "=== %s\n", thread->name);
         fprintf(stderr, "  %20s : ", "read");
         _debug_print_queue_stats(hlt_thread_queue_stats_reader(queue));
+        _debug_print_queue_histogram("latency (ns)", hlt_thread_queue_stats_reader(queue)->latency);
+        _debug_print_queue_histogram("occupancy", hlt_thread_queue_stats_reader(queue)->occupancy);
         fprintf(stderr, "  %20s : %" PRIu64 "   queue size: %" PRIu64 "  batches pending: %" PRIu64 "\n", "blocked jobs", kh_size(thread->jobs_blocked), hlt_thread_queue_size(thread->jobs), size);
         for ( int j = 0; j < mgr->num_workers + 1; j++ ) {
             fprintf(stderr, "  %20s[%d] : ", (j==0 ? "writer-main" : "writer-worker"), j);
@@ -419,6 +962,120 @@ void __hlt_thread_mgr_unblock(__hlt_thread_mgr_blockable *resource, hlt_executio
     _unblock_blocked(thread, resource, ctx);
 }
 
+// Advances a context's timers to the given global time.
+static void _ctx_advance(hlt_execution_context* ctx, hlt_time t)
+{
+    hlt_exception* excpt = 0;
+
+    DBG_LOG(DBG_STREAM, "advancing vid %" PRIu64 "'s time to %" PRIu64, ctx->vid, t);
+
+    hlt_timer_mgr_advance(ctx->tmgr, t, &excpt, ctx);
+
+    if ( excpt ) {
+        __hlt_thread_mgr_uncaught_exception_in_thread(excpt, ctx);
+        GC_DTOR(excpt, hlt_exception, ctx);
+    }
+}
+
+// Records when one of the worker's contexts has timers due next.
+static void _worker_track_timers(hlt_worker_thread* thread, hlt_execution_context* ctx)
+{
+    hlt_time next = hlt_timer_mgr_next(ctx->tmgr, 0, ctx);
+
+    if ( ! next )
+        return;
+
+    // A timer wheel reports only the start of the slot, which may be
+    // where we are already.
+    if ( next <= thread->global_time )
+        next = thread->global_time + 1;
+
+    hlt_time* current = &thread->ctx_deadlines[ctx->vid];
+
+    if ( *current && *current <= next )
+        return;
+
+    *current = next;
+    _deadlines_push(&thread->timers, next, ctx->vid);
+
+    // Pairs with the check in __hlt_thread_mgr_global_time_changed().
+    __atomic_store_n(&thread->next_deadline, _deadlines_next(&thread->timers), __ATOMIC_SEQ_CST);
+}
+
+// Advances the timers of those of the worker's contexts that have some due
+// by the given global time. The others catch up once they run their next
+// job.
+static void _worker_advance(hlt_worker_thread* thread, hlt_time gt)
+{
+    thread->global_time = gt;
+
+    while ( thread->timers.size && _deadlines_next(&thread->timers) <= gt ) {
+        hlt_deadline d = _deadlines_pop(&thread->timers);
+
+        if ( thread->ctx_deadlines[d.vid] != d.time )
+            // Superseded by an earlier one.
+            continue;
+
+        thread->ctx_deadlines[d.vid] = 0;
+
+        hlt_execution_context* ctx = thread->ctxs[d.vid];
+        _ctx_advance(ctx, gt);
+        _worker_track_timers(thread, ctx);
+    }
+
+    __atomic_store_n(&thread->next_deadline, _deadlines_next(&thread->timers), __ATOMIC_SEQ_CST);
+}
+
+// Returns true if global time has passed a virtual thread's deadline that
+// nobody has processed yet.
+static int8_t _vthreads_due(hlt_thread_mgr* mgr)
+{
+    hlt_time gt = __hlt_globals()->global_time;
+    hlt_time next = __atomic_load_n(&mgr->next_deadline, __ATOMIC_SEQ_CST);
+
+    return next && next <= gt && __atomic_load_n(&mgr->vthreads_time, __ATOMIC_SEQ_CST) < gt;
+}
+
+// Blocks an idle worker until somebody makes a virtual thread ready for it,
+// a deadline passes, or the timeout expires. Returns immediately if the
+// manager has moved on from the given state.
+static void _worker_park(hlt_worker_thread* thread, hlt_thread_mgr_state state, uint64_t timeout)
+{
+    hlt_thread_mgr* mgr = thread->mgr;
+    int32_t wakeups = __atomic_load_n(&thread->wakeups, __ATOMIC_SEQ_CST);
+
+    __atomic_store_n(&thread->parked, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&mgr->num_parked, 1, __ATOMIC_SEQ_CST);
+
+    // Check again now that we have announced that we're parking; whoever
+    // changes any of this afterwards will wake us up.
+    if ( ! (__atomic_load_n(&thread->ready_size, __ATOMIC_SEQ_CST) ||
+            _vthreads_due(mgr) ||
+            mgr->state != state ||
+            __hlt_thread_mgr_terminating()) )
+        hlt_thread_park(&thread->wakeups, wakeups, timeout);
+
+    __atomic_store_n(&thread->parked, 0, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&mgr->num_parked, 1, __ATOMIC_SEQ_CST);
+}
+
+// Returns true if there is anything for an idle worker to do when
+// work-stealing.
+static int8_t _worker_has_work(hlt_worker_thread* thread)
+{
+    hlt_thread_mgr* mgr = thread->mgr;
+
+    if ( _vthreads_due(mgr) )
+        return 1;
+
+    for ( int i = 0; i < mgr->num_workers; i++ ) {
+        if ( __atomic_load_n(&mgr->workers[i]->ready_size, __ATOMIC_SEQ_CST) )
+            return 1;
+    }
+
+    return 0;
+}
+
 static void _worker_run_job(hlt_worker_thread* thread, hlt_job* job)
 {
     assert(job->fiber);
@@ -429,6 +1086,13 @@ static void _worker_run_job(hlt_worker_thread* thread, hlt_job* job)
 
     hlt_exception* excpt = 0;
 
+    int8_t track = (! job->vthread && ctx->vid > 0);
+
+    // Let the context catch up with global time if it had no timers due
+    // so far. With work-stealing, _vthread_run() does that.
+    if ( track && hlt_timer_mgr_current(ctx->tmgr, 0, ctx) < thread->global_time )
+        _ctx_advance(ctx, thread->global_time);
+
     __hlt_context_set_fiber(ctx, job->fiber);
     __hlt_context_set_thread_context(ctx, job->tcontext_type, job->tcontext);
 
@@ -455,6 +1119,98 @@ static void _worker_run_job(hlt_worker_thread* thread, hlt_job* job)
         job->fiber = 0; // This is deleted already.
         _hlt_job_delete(job, ctx);
     }
+
+    if ( track )
+        _worker_track_timers(thread, ctx);
+}
+
+// Executes a batch of jobs of a ready virtual thread, which the worker has
+// taken from a ready deque.
+static void _vthread_run(hlt_worker_thread* thread, hlt_vthread* vt)
+{
+    _spin_lock(&vt->lock);
+
+    assert(vt->state == HLT_VTHREAD_READY);
+    vt->state = HLT_VTHREAD_RUNNING;
+    vt->owner = thread;
+    vt->timers_due = 0; // We advance them below.
+
+    // Take up to a batch of jobs, so that we don't get stuck with a busy
+    // virtual thread.
+    hlt_job* jobs = vt->jobs_head;
+    hlt_job* last = 0;
+    int n = 0;
+
+    for ( hlt_job* j = jobs; j && n < QUEUE_BATCH_SIZE; j = j->next ) {
+        last = j;
+        ++n;
+    }
+
+    if ( last ) {
+        vt->jobs_head = last->next;
+        last->next = 0;
+
+        if ( ! vt->jobs_head )
+            vt->jobs_tail = 0;
+
+        vt->num_jobs -= n;
+    }
+
+    _spin_unlock(&vt->lock);
+
+    // The context migrates along with the virtual thread. The locking
+    // above orders our accesses after those of the previous worker.
+    hlt_execution_context* ctx = vt->ctx;
+    ctx->worker = thread;
+
+    hlt_time gt = __hlt_globals()->global_time;
+
+    if ( vt->time < gt ) {
+        _ctx_advance(ctx, gt);
+        vt->time = gt;
+    }
+
+    while ( jobs ) {
+        hlt_job* job = jobs;
+        jobs = job->next;
+        job->next = 0;
+
+        if ( __hlt_thread_mgr_terminating() ) {
+            // Leave it for cleanup.
+            _vthread_schedule_job(vt, job);
+            continue;
+        }
+
+        if ( ! job->blockable ) {
+            _worker_run_job(thread, job);
+            ++thread->num_jobs_run;
+        }
+        else
+            // Move to blocked queue.
+            _add_to_blocked(thread, job->blockable, job);
+    }
+
+    // Free what the jobs left behind now, rather than in whatever thread
+    // the context moves to next.
+    __hlt_memory_nullbuffer_flush(ctx->nullbuffer, ctx);
+
+    _vthread_track_timers(thread->mgr, vt);
+
+    int ready = 0;
+
+    _spin_lock(&vt->lock);
+
+    if ( vt->jobs_head || vt->timers_due ) {
+        vt->state = HLT_VTHREAD_READY;
+        ready = 1;
+    }
+    else
+        vt->state = HLT_VTHREAD_IDLE;
+
+    _spin_unlock(&vt->lock);
+
+    if ( ready )
+        _ready_push(thread, vt);
 }
 
 // Entry function for the worker threads.
@@ -468,21 +1224,60 @@ static void* _worker(void* worker_thread_ptr)
     DBG_LOG(DBG_STREAM, "processing started");
 
     int finished = 0;
+    int iterations = 0;
+
+    // How long to block at most when idle, in nanoseconds.
+    uint64_t idle_timeout = hlt_config_get()->time_idle * 1e9;
 
 #ifdef DEBUG
     int cnt = 0;
 #endif
 
-    while ( ! (__hlt_thread_mgr_terminating() || hlt_thread_queue_terminated(thread->jobs)) ) {
+    while ( ! (__hlt_thread_mgr_terminating() || (hlt_thread_queue_terminated(thread->jobs) && ! _worker_pending(thread))) ) {
         // Process next job.
 
-        hlt_job* job = hlt_thread_queue_read(thread->jobs, 10);
+        hlt_job* job = 0;
+        hlt_vthread* vt = 0;
+        hlt_thread_mgr_state state = mgr->state;
+        int woken = 0;
+
+        if ( mgr->stealing ) {
+            // Run the next virtual thread that's ready, preferably one of
+            // ours.
+            vt = _ready_pop(thread);
+
+            if ( ! vt )
+                vt = _ready_steal(thread);
+
+            if ( ! vt ) {
+                // We're idle. Don't hold on to buffered file output.
+                __hlt_files_flush(thread->id);
+                _worker_park(thread, state, idle_timeout);
+                woken = 1;
+            }
+        }
+
+        else {
+            job = hlt_thread_queue_read(thread->jobs, -1);
+
+            if ( ! job ) {
+                // We're idle. Make sure whatever we have queued for the
+                // other workers gets to them before we block, and don't
+                // hold on to buffered file output either.
+                for ( int i = 0; i < mgr->num_workers; ++i )
+                    hlt_thread_queue_flush(mgr->workers[i]->jobs, thread->id);
+
+                __hlt_files_flush(thread->id);
+
+                job = hlt_thread_queue_read(thread->jobs, idle_timeout / 1000);
+            }
+        }
 
         if ( mgr->state == HLT_THREAD_MGR_FINISH ) {
             // If the manager wants to finish once everybody is idle, check
             // whether we are idle. But even if, make sure we get whatever is
             // still queued *from* us to the other workers.
-            if ( ! job ) {
+            if ( ! (job || vt) ) {
                 if ( ! thread->idle ) {
                     for ( int i = 0; i < mgr->num_workers; ++i )
                         hlt_thread_queue_flush(mgr->workers[i]->jobs, thread->id);
@@ -495,13 +1290,21 @@ static void* _worker(void* worker_thread_ptr)
         }
 
         if ( job ) {
-            if ( ! job->blockable )
+            if ( ! job->blockable ) {
                 _worker_run_job(thread, job);
+                ++thread->num_jobs_run;
+            }
             else
                 // Move to blocked queue.
                 _add_to_blocked(thread, job->blockable, job);
+
+            for ( int i = 0; i < mgr->num_workers; ++i )
+                hlt_thread_queue_writer_update(mgr->workers[i]->jobs, thread->id);
         }
 
+        if ( vt )
+            _vthread_run(thread, vt);
+
         if ( mgr->state == HLT_THREAD_MGR_STOP && ! finished ) {
             DBG_LOG(DBG_STREAM, "wrapping up job processing");
 
@@ -512,38 +1315,24 @@ static void* _worker(void* worker_thread_ptr)
             finished = 1;
         }
 
+        // Advance the timers that are due now that global time has moved.
         hlt_time gt = __hlt_globals()->global_time;
 
-        for ( int i = 0; i < mgr->num_workers; ++i ) {
-            hlt_worker_thread* worker = mgr->workers[i];
-
-            hlt_thread_queue_writer_update(worker->jobs, thread->id);
+        if ( mgr->stealing )
+            _vthreads_advance(mgr, gt);
 
-            // Advance all the virtual threads' time if the global one has
-            // changed.
+        else if ( thread->global_time < gt )
+            _worker_advance(thread, gt);
 
-            if ( worker->global_time >= gt )
-                continue;
+        // See if parking ended for nothing. (Without work-stealing, the job
+        // queue keeps track of that.)
+        if ( mgr->stealing && woken && mgr->state == state && ! __hlt_thread_mgr_terminating() && ! _worker_has_work(thread) )
+            ++thread->num_wasted_wakeups;
 
-            for ( int j = 1; j <= worker->max_vid; j++ ) {
-                hlt_execution_context* tctx = worker->ctxs[j];
-                hlt_exception* excpt = 0;
-
-                if ( ! tctx )
-                    continue;
-
-                DBG_LOG(DBG_STREAM, "advancing vid %" PRIu64 "'s time to %" PRIu64, tctx->vid, gt);
-
-                hlt_timer_mgr_advance(tctx->tmgr, gt, &excpt, tctx);
-
-                if ( excpt ) {
-                    __hlt_thread_mgr_uncaught_exception_in_thread(excpt, tctx);
-                    GC_DTOR(excpt, hlt_exception, tctx);
-                }
-            }
-
-            worker->global_time = gt;
-        }
+        // A busy worker may stop writing to a file before its buffer fills
+        // up. Pass such writes on once they get old.
+        if ( ++iterations % 256 == 0 )
+            __hlt_files_flush_expired(thread->id);
 
 #ifdef DEBUG
         hlt_thread_queue_size(thread->jobs);
@@ -676,12 +1465,41 @@ double hlt_threading_load(hlt_exception** excpt)
     const double high_mark = QUEUE_MAX_LOAD; // Corresponds to 1.0
 
     for ( int i = 0; i < mgr->num_workers; i++ )
-        pending += hlt_thread_queue_size(mgr->workers[i]->jobs);
+        pending += _worker_pending(mgr->workers[i]);
 
     double load = (double)pending / high_mark;
     return load <= 1 ? load : 1;
 }
 
+double hlt_threading_load_worker(int worker, hlt_threading_worker_load* load, hlt_exception** excpt)
+{
+    if ( ! hlt_is_multi_threaded() ) {
+        hlt_set_exception(excpt, &hlt_exception_no_threading, 0, hlt_global_execution_context());
+        return 0.0;
+    }
+
+    hlt_thread_mgr* mgr = hlt_global_thread_mgr();
+
+    if ( worker < 0 || worker >= mgr->num_workers ) {
+        hlt_set_exception(excpt, &hlt_exception_index_error, 0, hlt_global_execution_context());
+        return 0.0;
+    }
+
+    hlt_worker_thread* thread = mgr->workers[worker];
+
+    // Same scale as the total, with each worker getting its share.
+    const double high_mark = QUEUE_MAX_LOAD / mgr->num_workers;
+
+    double l = (double)_worker_pending(thread) / high_mark;
+    load->load = l <= 1 ? l : 1;
+    load->jobs = thread->num_jobs_run;
+    load->steals = thread->num_steals;
+    load->stolen = __atomic_load_n(&thread->num_stolen, __ATOMIC_RELAXED);
+    load->wasted_wakeups = thread->num_wasted_wakeups + hlt_thread_queue_stats_reader(thread->jobs)->wasted_wakeups;
+
+    return load->load;
+}
+
 hlt_thread_mgr* hlt_thread_mgr_new()
 {
     // Create the manager object.
@@ -696,6 +1514,18 @@ hlt_thread_mgr* hlt_thread_mgr_new()
     mgr->num_excpts = 0;
     mgr->workers = hlt_malloc(sizeof(hlt_worker_thread*) * num);
 
+    mgr->stealing = (hlt_config_get()->scheduler == HLT_SCHEDULER_STEALING);
+    mgr->vthreads = hlt_calloc(3, sizeof(hlt_vthread*));
+    mgr->max_vid = 2;
+    mgr->vthreads_time = 0;
+    mgr->deadlines.entries = 0;
+    mgr->deadlines.size = mgr->deadlines.capacity = 0;
+    mgr->next_deadline = 0;
+    mgr->num_parked = 0;
+
+    if ( PTHREAD_SPIN_INIT(&mgr->vthreads_lock) != 0 )
+        _fatal_error("cannot init lock");
+
     return mgr;
 }
 
@@ -725,14 +1555,29 @@ void hlt_thread_mgr_start(hlt_thread_mgr* mgr)
         // We must not give a size limit for the queue here as otherwise the
         // scheduler will deadlock when blocking because each thread is both
         // reader and writer.
-        thread->jobs = hlt_thread_queue_new(hlt_config_get()->num_workers + 1, QUEUE_BATCH_SIZE, 0);
+        if ( hlt_config_get()->job_queue == HLT_JOB_QUEUE_RINGS )
+            thread->jobs = hlt_thread_queue_new_rings(hlt_config_get()->num_workers + 1, QUEUE_RING_SIZE);
+        else
+            thread->jobs = hlt_thread_queue_new(hlt_config_get()->num_workers + 1, QUEUE_BATCH_SIZE, 0);
         thread->ctxs = hlt_calloc(3, sizeof(hlt_execution_context*));
+        thread->ctx_deadlines = hlt_calloc(3, sizeof(hlt_time));
         thread->max_vid = 2;
         thread->global_time = 0;
+        thread->timers.entries = 0;
+        thread->timers.size = thread->timers.capacity = 0;
+        thread->next_deadline = 0;
+        thread->wakeups = thread->parked = 0;
         thread->fiber_pool = __hlt_fiber_pool_new();
         thread->id = i + 1; // We leave zero for the main thread so that we can use that as its writer id.
         thread->idle = 0;
         thread->jobs_blocked = kh_init(blocked_jobs);
+        thread->ready = 0;
+        thread->ready_head = thread->ready_size = thread->ready_capacity = 0;
+        thread->num_jobs_run = thread->num_steals = thread->num_stolen = 0;
+        thread->num_wasted_wakeups = 0;
+
+        if ( PTHREAD_SPIN_INIT(&thread->ready_lock) != 0 )
+            _fatal_error("cannot init lock");
 
         char* name = (char*) hlt_malloc(20);
         snprintf(name, 20, "worker-%d", thread->id);
@@ -5,11 +5,13 @@
 #include <pthread.h>
 
 #include "types.h"
+#include "system.h"
 #include "tqueue.h"
 #include "fiber.h"
 #include "time_.h"
 
 struct __kh_blocked_jobs_t;
+struct __hlt_vthread;
 
 /// Returns whether the HILTI runtime environment is configured for running
 /// multiple threads.
@@ -63,11 +65,54 @@ typedef struct __hlt_job {
     hlt_type_info* tcontext_type; // The type of the thread context.
     void* tcontext;           // The jobs thread context to use when executing.
     __hlt_thread_mgr_blockable* blockable; // For moving into the blocked queue.
+    struct __hlt_vthread* vthread; // The virtual thread's state if work-stealing, null otherwise.
+    struct __hlt_job* next;   // For queueing at the virtual thread if work-stealing.
 #ifdef DEBUG
     uint64_t id;            // For debugging, we assign numerical IDs for easier identification.
 #endif
 } hlt_job;
 
+// A point in global time by which the timers of a virtual thread need to
+// be advanced next.
+typedef struct {
+    hlt_time time;       // The time.
+    hlt_vthread_id vid;  // The virtual thread.
+} hlt_deadline;
+
+// A min-heap of deadlines, ordered by time.
+typedef struct {
+    hlt_deadline* entries;
+    int size;
+    int capacity;
+} hlt_deadlines;
+
+// States of a virtual thread when scheduling with work-stealing.
+typedef enum {
+    HLT_VTHREAD_IDLE,    // No jobs queued.
+    HLT_VTHREAD_READY,   // Jobs queued, and sitting in a worker's ready deque.
+    HLT_VTHREAD_RUNNING  // A worker is executing its jobs.
+} hlt_vthread_state;
+
+// A virtual thread when scheduling with work-stealing. A virtual thread is
+// in at most one worker's ready deque at any time, and only the worker that
+// has taken it from there executes its jobs. That keeps its jobs in order
+// even if it migrates from worker to worker.
+typedef struct __hlt_vthread {
+    hlt_vthread_id vid;            // The virtual thread's ID.
+    hlt_execution_context* ctx;    // The context, which migrates along with the virtual thread.
+    hlt_time time;                 // Global time the context's timers have been advanced to.
+    int num_blocked;               // Jobs in the worker's blocked table; the vthread can't migrate while non-zero.
+    hlt_time deadline;             // The vthread's entry in the manager's deadlines, or 0 if none. Protected by vthreads_lock.
+
+    // Access to these must be protected by the lock.
+    PTHREAD_SPINLOCK_T lock;
+    hlt_vthread_state state;       // The current state.
+    struct __hlt_worker_thread* owner; // The worker whose deque it's in, or that runs it or ran it last.
+    hlt_job* jobs_head;            // Queued jobs.
+    hlt_job* jobs_tail;            // Last queued job.
+    uint64_t num_jobs;             // Number of queued jobs.
+    int8_t timers_due;             // True if global time has passed the deadline.
+} hlt_vthread;
 
 // A struct that encapsulates data related to a single worker thread.
 typedef struct __hlt_worker_thread {
@@ -75,14 +120,23 @@ typedef struct __hlt_worker_thread {
     hlt_thread_mgr* mgr;          // The manager this thread is part of.
     hlt_execution_context** ctxs; // Execution contexts indexed by virtual thread id.
     hlt_vthread_id max_vid;       // Largest vid allocated space for in ctxs.
-    hlt_time global_time;         // Last global time all virtual threads have been advanced to.
+    hlt_time global_time;         // Last global time seen; contexts catch up to it lazily.
     __hlt_fiber_pool* fiber_pool; // The pool of available fiber objects for this worker.
+    hlt_deadlines timers;         // When contexts have timers due next, earliest first.
+    hlt_time* ctx_deadlines;      // The current entry in *timers* indexed by virtual thread id, or 0 if none.
+    uint64_t num_wasted_wakeups;  // Wakeups that found nothing to do.
 
     // This can be *read* from different threads without further locking.
     int id;                       // ID of this worker thread in the range 1..*num_workers*.
     char* name;                   // A string identifying the worker.
     int idle;                     // When in state FINISH, the worker will set this when idle.
     pthread_t handle;             // The pthread handle for this thread.
+    hlt_time next_deadline;       // The earliest entry in *timers*, or 0 if none. Updated atomically.
+
+    // When work-stealing, an idle worker parks on *wakeups* while *parked*
+    // is set. Both are updated atomically.
+    int32_t wakeups;
+    int32_t parked;
 
     // Write accesses to the main jobs queue can be made from all worker
     // threads and the main thread, while read accesses come only from the
@@ -95,6 +149,22 @@ typedef struct __hlt_worker_thread {
     // This is in fact a hash table indexed by the corresponding
     // hlt_thread_mgr_blockable address.
     struct __kh_blocked_jobs_t* jobs_blocked;
+
+    // When work-stealing, the virtual threads ready to run on this worker.
+    // This is a circular buffer that the worker takes from at the front
+    // and other workers steal from at the back. Access must be protected
+    // by the lock.
+    PTHREAD_SPINLOCK_T ready_lock;
+    hlt_vthread** ready;
+    int ready_head;
+    int ready_size;
+    int ready_capacity;
+
+    // Statistics, written by the worker itself only, except for *stolen*
+    // which other workers update atomically.
+    uint64_t num_jobs_run;        // Jobs executed.
+    uint64_t num_steals;          // Virtual threads stolen from other workers.
+    uint64_t num_stolen;          // Virtual threads other workers stole from us.
 } hlt_worker_thread;
 
 // A thread manager encapsulates the global state that all threads share.
@@ -104,8 +174,29 @@ struct __hlt_thread_mgr {
     int num_excpts;                // The number of worker's that have raised exceptions.
     hlt_worker_thread** workers;   // The worker threads.
     pthread_key_t id;              // A per-thread key storing a string identifying the string.
+
+    // When work-stealing, the virtual threads indexed by ID. Access must be
+    // protected by the lock.
+    int8_t stealing;               // True if work-stealing.
+    PTHREAD_SPINLOCK_T vthreads_lock;
+    hlt_vthread** vthreads;
+    hlt_vthread_id max_vid;        // Largest vid allocated space for in vthreads.
+    hlt_time vthreads_time;        // Last global time all virtual threads have been scheduled to advance to.
+    hlt_deadlines deadlines;       // When virtual threads have timers due next, earliest first.
+    hlt_time next_deadline;        // The earliest entry in *deadlines*, or 0 if none. Updated atomically.
+    int num_parked;                // Number of idle workers currently parked. Updated atomically.
 };
 
+/// Scheduler statistics for a single worker thread, as returned by
+/// ~~hlt_threading_load_worker.
+typedef struct {
+    double load;        ///< Jobs currently pending for the worker, normalized like ~~hlt_threading_load.
+    uint64_t jobs;      ///< Number of jobs the worker has executed so far.
+    uint64_t steals;    ///< Number of virtual threads the worker has stolen from others.
+    uint64_t stolen;    ///< Number of virtual threads others have stolen from the worker.
+    uint64_t wasted_wakeups; ///< Number of times the idle worker woke up without finding anything to do.
+} hlt_threading_worker_load;
+
 /// Returns whether the HILTI runtime environment is configured for running
 /// multiple threads.
 ///
@@ -152,6 +243,20 @@ extern void __hlt_threading_done(hlt_exception** excpt);
 /// excpt: &
 extern double hlt_threading_load(hlt_exception** excpt);
 
+/// Returns scheduler statistics for a single worker thread. The steal
+/// counts remain zero unless the scheduler is configured for work-stealing
+/// (see ~~hlt_config).
+///
+/// worker: The worker's index, between zero and the number of workers
+/// minus one.
+///
+/// load: Receives the statistics.
+///
+/// excpt: &
+///
+/// Returns: The worker's load, as also stored in *load*.
+extern double hlt_threading_load_worker(int worker, hlt_threading_worker_load* load, hlt_exception** excpt);
+
 /// Creates a new thread manager. A thread manager coordinates a set of
 /// worker threads and encapsulates all the state that they share. The new
 /// manager will be initialized to state ~~NEW.
@@ -273,6 +378,14 @@ extern void __hlt_thread_mgr_init_native_thread(hlt_thread_mgr* mgr, const char*
 /// must terminate immediately without doing any furhter work.
 extern int8_t __hlt_thread_mgr_terminating();
 
+/// Tells the workers that global time has moved forward. Workers advance
+/// their contexts' timers lazily, and idle ones block; this wakes up those
+/// that have timers due by the new time. Called by
+/// ~~hlt_timer_mgr_advance_global.
+///
+/// t: The new global time.
+extern void __hlt_thread_mgr_global_time_changed(hlt_time t);
+
 inline static void hlt_thread_mgr_blockable_init(__hlt_thread_mgr_blockable* resource)
 {
     resource->num_blocked = 0;
@@ -3,6 +3,7 @@
 #include "int.h"
 #include "string_.h"
 #include "timer.h"
+#include "threading.h"
 #include "vector.h"
 #include "map_set.h"
 #include "autogen/hilti-hlt.h"
@@ -17,12 +18,264 @@
 #define HLT_TIMER_VECTOR   5
 #define HLT_TIMER_PROFILER 6
 
+// Layout of a timing wheel: each level has 2^BITS slots, with one slot of
+// level n covering 2^(n * BITS) ticks.
+#define __HLT_TIMER_WHEEL_LEVELS 5
+#define __HLT_TIMER_WHEEL_BITS   8
+#define __HLT_TIMER_WHEEL_SLOTS  (1 << __HLT_TIMER_WHEEL_BITS)
+#define __HLT_TIMER_WHEEL_MASK   (__HLT_TIMER_WHEEL_SLOTS - 1)
+
+// A hierarchical timing wheel. A timer expiring at tick e sits at the
+// lowest level n where e is less than 2^((n + 1) * BITS) ticks ahead, in
+// slot (e >> (n * BITS)) & MASK. Once the wheel reaches the start of
+// the slot's range, its timers move down to a lower level ("cascade") until
+// they end up in level 0, which fires them.
+typedef struct {
+    hlt_interval granularity;  // Length of one tick.
+    uint64_t tick;             // The current tick. All earlier ticks have been processed.
+    uint64_t size;             // Number of timers in the wheel.
+    uint64_t used[__HLT_TIMER_WHEEL_LEVELS][__HLT_TIMER_WHEEL_SLOTS / 64]; // Bitmaps of non-empty slots.
+    hlt_timer* slots[__HLT_TIMER_WHEEL_LEVELS][__HLT_TIMER_WHEEL_SLOTS];   // Doubly-linked lists of timers.
+} __hlt_timer_wheel;
+
 struct __hlt_timer_mgr {
     __hlt_gchdr __gchdr; // Header for memory management.
     hlt_time time;       // The current time.
-    priority_queue_t* timers;    // Priority list of all timers.
+    priority_queue_t* timers;    // Priority list of all timers, if not using a wheel.
+    __hlt_timer_wheel* wheel;    // Timing wheel holding all timers, if using one.
 };
 
+static void __hlt_timer_fire(hlt_timer* timer, hlt_exception** excpt, hlt_execution_context* ctx);
+
+static void _wheel_link(__hlt_timer_wheel* w, int level, int idx, hlt_timer* timer)
+{
+    hlt_timer** slot = &w->slots[level][idx];
+
+    timer->wheel.slot = slot;
+    timer->wheel.prev = 0;
+    timer->wheel.next = *slot;
+
+    if ( *slot )
+        (*slot)->wheel.prev = timer;
+
+    *slot = timer;
+    w->used[level][idx / 64] |= ((uint64_t)1 << (idx % 64));
+}
+
+static void _wheel_unlink(__hlt_timer_wheel* w, hlt_timer* timer)
+{
+    hlt_timer** slot = timer->wheel.slot;
+
+    if ( timer->wheel.prev )
+        timer->wheel.prev->wheel.next = timer->wheel.next;
+    else
+        *slot = timer->wheel.next;
+
+    if ( timer->wheel.next )
+        timer->wheel.next->wheel.prev = timer->wheel.prev;
+
+    timer->wheel.slot = 0;
+
+    if ( *slot || slot < &w->slots[0][0] || slot > &w->slots[__HLT_TIMER_WHEEL_LEVELS - 1][__HLT_TIMER_WHEEL_MASK] )
+        // Not empty yet, or a temporary list outside of the wheel.
+        return;
+
+    int n = slot - &w->slots[0][0];
+    int level = n / __HLT_TIMER_WHEEL_SLOTS;
+    int idx = n % __HLT_TIMER_WHEEL_SLOTS;
+    w->used[level][idx / 64] &= ~((uint64_t)1 << (idx % 64));
+}
+
+// Takes all timers out of a slot, returning them as a list linked through
+// wheel.next.
+static hlt_timer* _wheel_take(__hlt_timer_wheel* w, int level, int idx)
+{
+    hlt_timer* list = w->slots[level][idx];
+    w->slots[level][idx] = 0;
+    w->used[level][idx / 64] &= ~((uint64_t)1 << (idx % 64));
+
+    for ( hlt_timer* t = list; t; t = t->wheel.next )
+        t->wheel.slot = 0;
+
+    return list;
+}
+
+static void _wheel_insert(__hlt_timer_wheel* w, hlt_timer* timer)
+{
+    uint64_t expire = timer->time / w->granularity;
+
+    if ( expire < w->tick )
+        expire = w->tick;
+
+    uint64_t delta = expire - w->tick;
+
+    int level = 0;
+
+    while ( level < __HLT_TIMER_WHEEL_LEVELS - 1 && (delta >> ((level + 1) * __HLT_TIMER_WHEEL_BITS)) )
+        ++level;
+
+    if ( (delta >> ((level + 1) * __HLT_TIMER_WHEEL_BITS)) )
+        // Beyond what the wheel covers. Park it in the last slot, it will
+        // get reinserted from there once it comes up.
+        expire = w->tick + ((uint64_t)1 << (__HLT_TIMER_WHEEL_LEVELS * __HLT_TIMER_WHEEL_BITS)) - 1;
+
+    int idx = (expire >> (level * __HLT_TIMER_WHEEL_BITS)) & __HLT_TIMER_WHEEL_MASK;
+    _wheel_link(w, level, idx, timer);
+}
+
+// Returns the offset of the first non-empty slot at or after index idx of
+// a level, wrapping around at the end, or -1 if all are empty.
+static inline int _wheel_find(const uint64_t* used, int idx)
+{
+    int word = idx / 64;
+    uint64_t bits = used[word] & (~(uint64_t)0 << (idx % 64));
+
+    for ( int i = 0; i <= __HLT_TIMER_WHEEL_SLOTS / 64; i++ ) {
+        if ( bits )
+            return (word * 64 + __builtin_ctzll(bits) - idx) & __HLT_TIMER_WHEEL_MASK;
+
+        word = (word + 1) % (__HLT_TIMER_WHEEL_SLOTS / 64);
+        bits = used[word];
+    }
+
+    return -1;
+}
+
+// Returns the next tick at or after the current one at which the wheel
+// needs to process a non-empty slot. Returns UINT64_MAX if there's none.
+static uint64_t _wheel_next(__hlt_timer_wheel* w)
+{
+    uint64_t next = UINT64_MAX;
+
+    int k = _wheel_find(w->used[0], w->tick & __HLT_TIMER_WHEEL_MASK);
+
+    if ( k >= 0 )
+        next = w->tick + k;
+
+    for ( int level = 1; level < __HLT_TIMER_WHEEL_LEVELS; level++ ) {
+        int shift = level * __HLT_TIMER_WHEEL_BITS;
+        uint64_t start = ((w->tick >> shift) + 1) << shift;
+
+        if ( start >= next )
+            break;
+
+        int k = _wheel_find(w->used[level], (start >> shift) & __HLT_TIMER_WHEEL_MASK);
+
+        if ( k >= 0 && start + ((uint64_t)k << shift) < next )
+            next = start + ((uint64_t)k << shift);
+    }
+
+    return next;
+}
+
+// Moves the wheel forward to the given tick, cascading timers down from
+// all slots coming up there.
+static void _wheel_set_tick(__hlt_timer_wheel* w, uint64_t tick)
+{
+    w->tick = tick;
+
+    // Go top-down so that timers cascading from a higher level get
+    // cascaded further if they land in a slot coming up now as well.
+    for ( int level = __HLT_TIMER_WHEEL_LEVELS - 1; level > 0; level-- ) {
+        int shift = level * __HLT_TIMER_WHEEL_BITS;
+
+        if ( tick & (((uint64_t)1 << shift) - 1) )
+            continue;
+
+        hlt_timer* list = _wheel_take(w, level, (tick >> shift) & __HLT_TIMER_WHEEL_MASK);
+
+        while ( list ) {
+            hlt_timer* timer = list;
+            list = list->wheel.next;
+            _wheel_insert(w, timer);
+        }
+    }
+}
+
+static int32_t _wheel_advance(hlt_timer_mgr* mgr, hlt_time t, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    __hlt_timer_wheel* w = mgr->wheel;
+    uint64_t target = t / w->granularity;
+    int32_t count = 0;
+
+    while ( w->size ) {
+        uint64_t next = _wheel_next(w);
+
+        if ( next > target )
+            break;
+
+        if ( next != w->tick )
+            _wheel_set_tick(w, next);
+
+        // Firing a timer may change others in the same slot, so we unlink
+        // one at a time. Timers that have been updated to a later time
+        // without moving them, or that expire later within the current
+        // tick, go back into the wheel.
+        hlt_timer* pending = _wheel_take(w, 0, next & __HLT_TIMER_WHEEL_MASK);
+
+        for ( hlt_timer* i = pending; i; i = i->wheel.next )
+            i->wheel.slot = &pending;
+
+        while ( pending ) {
+            hlt_timer* timer = pending;
+            pending = timer->wheel.next;
+
+            if ( pending )
+                pending->wheel.prev = 0;
+
+            if ( timer->time <= t ) {
+                timer->wheel.slot = 0;
+                --w->size;
+                __hlt_timer_fire(timer, excpt, ctx);
+                ++count;
+            }
+
+            else
+                _wheel_insert(w, timer);
+        }
+
+        if ( next == target )
+            break;
+
+        _wheel_set_tick(w, next + 1);
+    }
+
+    if ( target > w->tick )
+        _wheel_set_tick(w, target);
+
+    return count;
+}
+
+static void _wheel_remove(__hlt_timer_wheel* w, hlt_timer* timer)
+{
+    if ( ! timer->wheel.slot )
+        return;
+
+    _wheel_unlink(w, timer);
+    --w->size;
+}
+
+// Removes and returns an arbitrary timer from the wheel, or null if it's
+// empty.
+static hlt_timer* _wheel_pop(__hlt_timer_wheel* w)
+{
+    if ( ! w->size )
+        return 0;
+
+    for ( int level = 0; level < __HLT_TIMER_WHEEL_LEVELS; level++ ) {
+        int k = _wheel_find(w->used[level], 0);
+
+        if ( k < 0 )
+            continue;
+
+        hlt_timer* timer = w->slots[level][k];
+        _wheel_remove(w, timer);
+        return timer;
+    }
+
+    abort(); // Can't be reached.
+}
+
 void hlt_timer_dtor(hlt_type_info* ti, hlt_timer* timer, hlt_execution_context* ctx)
 {
     hlt_exception* excpt = 0;
@@ -61,7 +314,11 @@ void hlt_timer_mgr_dtor(hlt_type_info* ti, hlt_timer_mgr* mgr, hlt_execution_con
 {
     hlt_exception* excpt = 0;
     hlt_timer_mgr_expire(mgr, 0, &excpt, ctx);
-    priority_queue_free(mgr->timers);
+
+    if ( mgr->wheel )
+        hlt_free(mgr->wheel);
+    else
+        priority_queue_free(mgr->timers);
 }
 
 static void __hlt_timer_fire(hlt_timer* timer, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -179,13 +436,32 @@ void hlt_timer_update(hlt_timer* timer, hlt_time t, hlt_exception** excpt, hlt_e
         return;
     }
 
+    __hlt_timer_wheel* w = timer->mgr->wheel;
+
     if ( t > timer->mgr->time ) {
-        timer->time = t;
-        priority_queue_change_priority(timer->mgr->timers, t, timer);
+        if ( ! w ) {
+            timer->time = t;
+            priority_queue_change_priority(timer->mgr->timers, t, timer);
+        }
+
+        else if ( t > timer->time )
+            // Leave it where it is, it will be reinserted when its current
+            // slot comes up.
+            timer->time = t;
+
+        else {
+            _wheel_unlink(w, timer);
+            timer->time = t;
+            _wheel_insert(w, timer);
+        }
     }
 
     else {
-        priority_queue_remove(timer->mgr->timers, timer);
+        if ( w )
+            _wheel_remove(w, timer);
+        else
+            priority_queue_remove(timer->mgr->timers, timer);
+
         __hlt_timer_fire(timer, excpt, ctx);
     }
 }
@@ -197,7 +473,11 @@ void hlt_timer_cancel(hlt_timer* timer, hlt_exception** excpt, hlt_execution_con
         return;
     }
 
-    priority_queue_remove(timer->mgr->timers, timer);
+    if ( timer->mgr->wheel )
+        _wheel_remove(timer->mgr->wheel, timer);
+    else
+        priority_queue_remove(timer->mgr->timers, timer);
+
     GC_DTOR(timer, hlt_timer, ctx);
 
     timer->mgr = 0;
@@ -248,8 +528,10 @@ void hlt_timer_mgr_advance_global(hlt_time t, hlt_exception** excpt, hlt_executi
 
     hlt_timer_mgr_advance(ctx->tmgr, t, excpt, ctx);
 
-    if ( t > __hlt_globals()->global_time )
+    if ( t > __hlt_globals()->global_time ) {
         __hlt_globals()->global_time = t;
+        __hlt_thread_mgr_global_time_changed(t);
+    }
 }
 
 static inline void _hlt_timer_mgr_init(hlt_timer_mgr* mgr, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -262,6 +544,7 @@ hlt_timer_mgr* hlt_timer_mgr_new(hlt_exception** excpt, hlt_execution_context* c
     hlt_timer_mgr* mgr = GC_NEW(hlt_timer_mgr, ctx);
 
     mgr->timers = priority_queue_init(100);
+    mgr->wheel = 0;
 
     if ( ! mgr->timers ) {
         hlt_set_exception(excpt, &hlt_exception_out_of_memory, 0, ctx);
@@ -271,6 +554,22 @@ hlt_timer_mgr* hlt_timer_mgr_new(hlt_exception** excpt, hlt_execution_context* c
     return mgr;
 }
 
+hlt_timer_mgr* hlt_timer_mgr_new_wheel(hlt_interval granularity, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( ! granularity ) {
+        hlt_set_exception(excpt, &hlt_exception_value_error, 0, ctx);
+        return 0;
+    }
+
+    hlt_timer_mgr* mgr = GC_NEW(hlt_timer_mgr, ctx);
+
+    mgr->timers = 0;
+    mgr->wheel = hlt_calloc(1, sizeof(__hlt_timer_wheel));
+    mgr->wheel->granularity = granularity;
+
+    return mgr;
+}
+
 void hlt_timer_mgr_schedule(hlt_timer_mgr* mgr, hlt_time t, hlt_timer* timer, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     if ( timer->mgr ) {
@@ -290,6 +589,12 @@ void hlt_timer_mgr_schedule(hlt_timer_mgr* mgr, hlt_time t, hlt_timer* timer, hl
         return;
     }
 
+    if ( mgr->wheel ) {
+        _wheel_insert(mgr->wheel, timer);
+        ++mgr->wheel->size;
+        return;
+    }
+
     if ( priority_queue_insert(mgr->timers, timer) != 0 ) {
         hlt_set_exception(excpt, &hlt_exception_out_of_memory, 0, ctx);
         return;
@@ -307,6 +612,9 @@ int32_t hlt_timer_mgr_advance(hlt_timer_mgr* mgr, hlt_time t, hlt_exception** ex
 
     mgr->time = t;
 
+    if ( mgr->wheel )
+        return _wheel_advance(mgr, t, excpt, ctx);
+
     while ( 1 ) {
         hlt_timer* timer = (hlt_timer*) priority_queue_peek(mgr->timers);
 
@@ -331,6 +639,23 @@ hlt_time hlt_timer_mgr_current(hlt_timer_mgr* mgr, hlt_exception** excpt, hlt_ex
     return mgr->time;
 }
 
+hlt_time hlt_timer_mgr_next(hlt_timer_mgr* mgr, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( ! mgr )
+        mgr = ctx->tmgr;
+
+    if ( mgr->wheel ) {
+        if ( ! mgr->wheel->size )
+            return 0;
+
+        uint64_t next = _wheel_next(mgr->wheel);
+        return next != UINT64_MAX ? next * mgr->wheel->granularity : 0;
+    }
+
+    hlt_timer* timer = (hlt_timer*) priority_queue_peek(mgr->timers);
+    return timer ? timer->time : 0;
+}
+
 void hlt_timer_mgr_expire(hlt_timer_mgr* mgr, int8_t fire, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     if ( ! mgr ) {
@@ -339,7 +664,7 @@ void hlt_timer_mgr_expire(hlt_timer_mgr* mgr, int8_t fire, hlt_exception** excpt
     }
 
     while ( 1 ) {
-        hlt_timer* timer = (hlt_timer*) priority_queue_pop(mgr->timers);
+        hlt_timer* timer = mgr->wheel ? _wheel_pop(mgr->wheel) : (hlt_timer*) priority_queue_pop(mgr->timers);
         if ( ! timer )
             break;
 
@@ -358,7 +683,7 @@ hlt_string hlt_timer_mgr_to_string(const hlt_type_info* type, const void* obj, i
     if ( ! mgr )
         return hlt_string_from_asciiz("(Null)", excpt, ctx);
 
-    int64_t size = priority_queue_size(mgr->timers);
+    int64_t size = mgr->wheel ? mgr->wheel->size : priority_queue_size(mgr->timers);
 
     hlt_string size_str = hlt_int_to_string(&hlt_type_info_hlt_int_64, &size, options, seen, excpt, ctx);
     hlt_string time_str = hlt_time_to_string(&hlt_type_info_hlt_time, &mgr->time, options, seen, excpt, ctx);
@@ -17,8 +17,11 @@
 /// the individual actions into the C code for efficiency, rather than using
 /// indirection via some kind of generic mechanism.
 ///
-/// Internally, timer managers use Fibonacci heaps to keep a priority list of
-/// all their timers. That allows for efficient lookups and updating.
+/// Internally, timer managers by default use a binary heap to keep a
+/// priority list of all their timers. Alternatively, a manager can use a
+/// hierarchical timing wheel, which schedules, updates, and cancels timers
+/// in constant time at the expense of grouping them into buckets of a fixed
+/// granularity; see hlt_timer_mgr_new_wheel().
 /// @}
 
 #ifndef LIBHILTI_TIMER_H
@@ -42,7 +45,14 @@ struct __hlt_timer {
     __hlt_gchdr __gchdr; // Header for memory management.
     hlt_timer_mgr* mgr;  // The timer manager the timer belongs to. No memory-managed to avoid cycles.
     hlt_time time;       // Expiration time.
-    size_t queue_pos;    // Used by priority queue.
+    union {
+        size_t queue_pos;                // Used by priority queue.
+        struct {
+            struct __hlt_timer* next;    // Next timer in the same slot.
+            struct __hlt_timer* prev;    // Previous timer in the same slot.
+            struct __hlt_timer** slot;   // The slot's list head.
+        } wheel;                         // Used by timing wheel.
+    };
     int16_t type;        // One of HLT_TIMER_* indicating the timer's type.
     union {              // The timer's payload cookie corresponding to its type.
         hlt_callable* function;
@@ -107,6 +117,21 @@ extern int64_t hlt_timer_to_int64(const hlt_type_info* type, const void* obj, in
 /// Returns: The new timer manager object.
 extern hlt_timer_mgr* hlt_timer_mgr_new(hlt_exception** excpt, hlt_execution_context* ctx);
 
+/// Instantiates a new timer manager object that keeps its timers in a
+/// hierarchical timing wheel rather than a priority queue. Scheduling,
+/// updating, and canceling timers then take constant time. Timers still
+/// never fire before their expiration time, but ones falling into the same
+/// bucket of the wheel fire in undefined order.
+///
+/// granularity: The size of the wheel's buckets. Must be larger than zero.
+///
+/// excpt: &
+///
+/// Returns: The new timer manager object.
+///
+/// Raises: ValueError - If *granularity* is zero.
+extern hlt_timer_mgr* hlt_timer_mgr_new_wheel(hlt_interval granularity, hlt_exception** excpt, hlt_execution_context* ctx);
+
 /// Schedules a timer with the timer manager. A timer can only be scheduled
 /// with one timer manager at a time. It needs to be canceled before it can
 /// be rescheduled.
@@ -157,6 +182,17 @@ extern int32_t hlt_timer_mgr_advance(hlt_timer_mgr* mgr, hlt_time t, hlt_excepti
 /// Returns: The current time.
 extern hlt_time hlt_timer_mgr_current(hlt_timer_mgr* mgr, hlt_exception** excpt, hlt_execution_context* ctx);
 
+/// Returns when the timer manager will next have a timer to fire. With a
+/// timer wheel, the result is the start of the earliest non-empty slot,
+/// which may be a bit earlier than the timer itself.
+///
+/// mgr: The timer manager. If null, uses the context's manager.
+///
+/// excpt: &
+///
+/// Returns: The time, or zero if there aren't any timers scheduled.
+extern hlt_time hlt_timer_mgr_next(hlt_timer_mgr* mgr, hlt_exception** excpt, hlt_execution_context* ctx);
+
 /// Cancels all scheduled timer, optionally firing them all.
 ///
 /// mgr: The timer manager. If null, uses the context's manager.
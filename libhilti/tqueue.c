@@ -4,6 +4,7 @@
 #include <pthread.h>
 #include <assert.h>
 #include <string.h>
+#include <time.h>
 
 #include "memory_.h"
 #include "tqueue.h"
@@ -13,9 +14,45 @@
 typedef struct __batch {
     struct __batch* next; // Link to next batch in chain.
     int write_pos;        // Position for next write.
+    uint64_t time;        // Time when the batch was started, for latency stats.
     void* elems[];        // Here *follows* an array of size batch_size.
 } batch;
 
+// We sample one in this many elements for the latency and occupancy stats.
+#define SAMPLE_RATE 64
+
+// Size of overflow batches used by rings.
+#define OVERFLOW_BATCH_SIZE 64
+
+typedef struct {
+    void* elem;     // The element.
+    uint64_t time;  // Time of writing if sampled for latency stats, zero otherwise.
+} ring_slot;
+
+// A single-writer-single-reader ring. Head and tail count elements read and
+// written, respectively; they are only ever incremented, and the slot
+// index is their value modulo the ring's size.
+typedef struct {
+    // Written by the writer only.
+    uint64_t tail __attribute__((aligned(64)));
+    uint64_t writer_head;       // Writer's cached copy of head.
+
+    // Written by the reader only.
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t reader_tail;       // Reader's cached copy of tail.
+    batch* reader_overflow;     // Overflow elements the reader has taken over.
+    int reader_overflow_pos;    // Position for next read in reader_overflow.
+
+    // These must use the lock for access. overflow may also be read
+    // atomically without it.
+    PTHREAD_SPINLOCK_T lock __attribute__((aligned(64)));
+    int overflow;               // Set while the writer is appending to the overflow list.
+    batch* overflow_head;       // Elements written while the ring was full.
+    batch* overflow_tail;       // Last batch of overflow_head.
+
+    ring_slot slots[];          // Here *follows* an array of size ring_size.
+} ring;
+
 struct __hlt_thread_queue {
     PTHREAD_SPINLOCK_T lock; // Protects accesses to shared data.
 
@@ -47,6 +84,16 @@ struct __hlt_thread_queue {
     // The reader writes this and the writers reads, so there may be a slight
     // race condition, which however doesn't hurt.
     int need_flush;
+
+    // These are used only by queues created with hlt_thread_queue_new_rings().
+    ring**  rings;                        // Array of rings, one for each writer.
+    uint64_t ring_size;                   // Capacity of each ring, a power of two.
+    int     reader_next;                  // Ring the reader looks at first on its next read.
+
+    // These are used with atomic operations.
+    int32_t wakeups;                      // Incremented by writers to wake up a parked reader.
+    int32_t parked;                       // Set while the reader is parked.
+    int32_t interrupt;                    // Set by hlt_thread_queue_wakeup().
 };
 
 
@@ -82,6 +129,43 @@ inline static void _release_lock(hlt_thread_queue* queue, int i, int reader, int
     hlt_pthread_setcancelstate(i, NULL);
 }
 
+inline static void _acquire_ring_lock(ring* r, int* i)
+{
+    hlt_pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, i);
+
+    if ( PTHREAD_SPIN_LOCK(&r->lock) != 0 )
+        _fatal_error("cannot acquire lock");
+}
+
+inline static void _release_ring_lock(ring* r, int i)
+{
+    if ( PTHREAD_SPIN_UNLOCK(&r->lock) != 0 )
+        _fatal_error("cannot release lock");
+
+    hlt_pthread_setcancelstate(i, NULL);
+}
+
+inline static uint64_t _now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+inline static void _record(uint64_t* hist, uint64_t v)
+{
+    int i = v ? 64 - __builtin_clzll(v) : 0;
+    ++hist[i < HLT_THREAD_QUEUE_HIST_BUCKETS ? i : HLT_THREAD_QUEUE_HIST_BUCKETS - 1];
+}
+
+inline static void _record_read(hlt_thread_queue* queue)
+{
+    ++queue->reader_stats->elems;
+
+    if ( (++queue->reader_num_read % SAMPLE_RATE) == 0 )
+        _record(queue->reader_stats->occupancy, hlt_thread_queue_size(queue));
+}
+
 #if 0
 
 static void _debug_print_batch(batch* b)
@@ -151,12 +235,60 @@ hlt_thread_queue* hlt_thread_queue_new(int writers, int batch_size, int max_batc
 
     queue->need_flush = 0;
 
+    queue->rings = 0;
+    queue->ring_size = 0;
+    queue->reader_next = 0;
+    queue->wakeups = 0;
+    queue->parked = 0;
+    queue->interrupt = 0;
+
     if ( PTHREAD_SPIN_INIT(&queue->lock) != 0 )
         _fatal_error("cannot init lock");
 
     return queue;
 }
 
+hlt_thread_queue* hlt_thread_queue_new_rings(int writers, int ring_size)
+{
+    hlt_thread_queue* queue = hlt_thread_queue_new(writers, OVERFLOW_BATCH_SIZE, 0);
+
+    queue->ring_size = 1;
+
+    while ( queue->ring_size < ring_size )
+        queue->ring_size <<= 1;
+
+    queue->rings = (ring**) hlt_malloc(sizeof(ring*) * writers);
+
+    for ( int i = 0; i < writers; ++i ) {
+        ring* r = (ring*) hlt_malloc(sizeof(ring) + queue->ring_size * sizeof(ring_slot));
+        if ( ! r )
+            _fatal_error("out of memory");
+
+        r->tail = r->writer_head = 0;
+        r->head = r->reader_tail = 0;
+        r->reader_overflow = 0;
+        r->reader_overflow_pos = 0;
+        r->overflow = 0;
+        r->overflow_head = r->overflow_tail = 0;
+
+        if ( PTHREAD_SPIN_INIT(&r->lock) != 0 )
+            _fatal_error("cannot init lock");
+
+        queue->rings[i] = r;
+    }
+
+    return queue;
+}
+
+static void _free_batches(batch* b)
+{
+    while ( b ) {
+        batch* next = b->next;
+        hlt_free(b);
+        b = next;
+    }
+}
+
 void hlt_thread_queue_delete(hlt_thread_queue* queue)
 {
     if ( PTHREAD_SPIN_DESTROY(&queue->lock) != 0 )
@@ -185,6 +317,18 @@ void hlt_thread_queue_delete(hlt_thread_queue* queue)
         b = next;
     }
 
+    for ( int w = 0; queue->rings && w < queue->writers; w++ ) {
+        ring* r = queue->rings[w];
+
+        if ( PTHREAD_SPIN_DESTROY(&r->lock) != 0 )
+            _fatal_error("cannot destroy lock");
+
+        _free_batches(r->reader_overflow);
+        _free_batches(r->overflow_head);
+        hlt_free(r);
+    }
+
+    hlt_free(queue->rings);
     hlt_free(queue->reader_stats);
     hlt_free(queue->writer_batches);
     hlt_free(queue->writer_num_written);
@@ -193,6 +337,228 @@ void hlt_thread_queue_delete(hlt_thread_queue* queue)
     hlt_free(queue);
 }
 
+// Wakes up the reader if it's parked.
+inline static void _wakeup_reader(hlt_thread_queue* queue)
+{
+    if ( ! __atomic_load_n(&queue->parked, __ATOMIC_SEQ_CST) )
+        return;
+
+    // Only one writer needs to do the wakeup.
+    if ( ! __atomic_exchange_n(&queue->parked, 0, __ATOMIC_SEQ_CST) )
+        return;
+
+    __atomic_add_fetch(&queue->wakeups, 1, __ATOMIC_SEQ_CST);
+    hlt_thread_unpark(&queue->wakeups);
+}
+
+static void _ring_write(hlt_thread_queue* queue, int writer, void *elem)
+{
+    ring* r = queue->rings[writer];
+    uint64_t time = (queue->writer_num_written[writer] % SAMPLE_RATE) == 0 ? _now() : 0;
+
+    ++queue->writer_num_written[writer];
+    ++queue->writer_stats[writer].elems;
+
+    if ( ! __atomic_load_n(&r->overflow, __ATOMIC_ACQUIRE) ) {
+        if ( r->tail - r->writer_head >= queue->ring_size )
+            r->writer_head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+        if ( r->tail - r->writer_head < queue->ring_size ) {
+            ring_slot* slot = &r->slots[r->tail & (queue->ring_size - 1)];
+            slot->elem = elem;
+            slot->time = time;
+            __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_SEQ_CST);
+            _wakeup_reader(queue);
+            return;
+        }
+    }
+
+    // The ring is full, or we have started to overflow already and the
+    // reader hasn't caught up yet. Append to the overflow list, which the
+    // reader will take over once it has emptied the ring.
+    int i;
+    _acquire_ring_lock(r, &i);
+    ++queue->writer_stats[writer].locked;
+    ++queue->writer_stats[writer].blocked;
+
+    batch* b = r->overflow_tail;
+
+    if ( ! b || b->write_pos >= OVERFLOW_BATCH_SIZE ) {
+        batch* nb = (batch*) hlt_malloc(sizeof(batch) + OVERFLOW_BATCH_SIZE * sizeof(void*));
+        if ( ! nb )
+            _fatal_error("out of memory");
+
+        nb->next = 0;
+        nb->write_pos = 0;
+        nb->time = 0;
+
+        if ( b )
+            b->next = nb;
+        else
+            r->overflow_head = nb;
+
+        r->overflow_tail = b = nb;
+        ++queue->writer_stats[writer].batches;
+    }
+
+    b->elems[b->write_pos++] = elem;
+    __atomic_store_n(&r->overflow, 1, __ATOMIC_SEQ_CST);
+
+    _release_ring_lock(r, i);
+
+    _wakeup_reader(queue);
+}
+
+// Parks the reader until a writer wakes it up, or the timeout (in
+// nanoseconds) expires. Once we have announced that we're parking, we need
+// to look for elements once more as a writer may have missed it; *check*
+// does that. Returns true if the check found something, without parking.
+static int _park_reader(hlt_thread_queue* queue, int8_t (*check)(hlt_thread_queue* queue), uint64_t timeout)
+{
+    int32_t wakeups = __atomic_load_n(&queue->wakeups, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&queue->parked, 1, __ATOMIC_SEQ_CST);
+
+    int found = check(queue) || __atomic_load_n(&queue->interrupt, __ATOMIC_SEQ_CST);
+
+    if ( ! found ) {
+        hlt_thread_park(&queue->wakeups, wakeups, timeout);
+        ++queue->reader_stats->wakeups;
+    }
+
+    __atomic_store_n(&queue->parked, 0, __ATOMIC_SEQ_CST);
+
+    return found;
+}
+
+// Checks whether there's a batch pending for the reader to pick up.
+static int8_t _batch_pending(hlt_thread_queue* queue)
+{
+    int s;
+    _acquire_lock(queue, &s, 1, 0);
+    int8_t pending = (queue->lock_pending_head != 0);
+    _release_lock(queue, s, 1, 0);
+    return pending;
+}
+
+// Returns the next element from a ring, or null if there's none.
+static void* _ring_read_one(hlt_thread_queue* queue, ring* r)
+{
+    while ( 1 ) {
+        // Elements taken over from the overflow list come first.
+        batch* b = r->reader_overflow;
+
+        if ( b ) {
+            void* elem = b->elems[r->reader_overflow_pos++];
+
+            if ( r->reader_overflow_pos >= b->write_pos ) {
+                r->reader_overflow = b->next;
+                r->reader_overflow_pos = 0;
+                hlt_free(b);
+                ++queue->reader_stats->batches;
+            }
+
+            return elem;
+        }
+
+        if ( r->head == r->reader_tail )
+            r->reader_tail = __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST);
+
+        if ( r->head != r->reader_tail ) {
+            ring_slot* slot = &r->slots[r->head & (queue->ring_size - 1)];
+            void* elem = slot->elem;
+            uint64_t time = slot->time;
+
+            __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+
+            if ( time )
+                _record(queue->reader_stats->latency, _now() - time);
+
+            return elem;
+        }
+
+        if ( ! __atomic_load_n(&r->overflow, __ATOMIC_SEQ_CST) )
+            return 0;
+
+        // The writer may have filled the ring up right before switching to
+        // overflow; those elements need to go first.
+        r->reader_tail = __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST);
+
+        if ( r->head != r->reader_tail )
+            continue;
+
+        int i;
+        _acquire_ring_lock(r, &i);
+        ++queue->reader_stats->locked;
+        r->reader_overflow = r->overflow_head;
+        r->reader_overflow_pos = 0;
+        r->overflow_head = r->overflow_tail = 0;
+        __atomic_store_n(&r->overflow, 0, __ATOMIC_SEQ_CST);
+        _release_ring_lock(r, i);
+    }
+}
+
+// Returns the next element from any of the rings, or null if there's none.
+static void* _ring_try_read(hlt_thread_queue* queue)
+{
+    for ( int i = 0; i < queue->writers; i++ ) {
+        int w = queue->reader_next;
+
+        if ( ++queue->reader_next == queue->writers )
+            queue->reader_next = 0;
+
+        void* elem = _ring_read_one(queue, queue->rings[w]);
+
+        if ( elem ) {
+            _record_read(queue);
+            return elem;
+        }
+    }
+
+    return 0;
+}
+
+static void* _ring_read(hlt_thread_queue* queue, int timeout)
+{
+    int block = (timeout == 0);
+    uint64_t deadline = (timeout > 0) ? _now() + timeout * 1000ULL : 0;
+    int woken = 0;
+
+    while ( 1 ) {
+        void* elem = _ring_try_read(queue);
+
+        if ( elem )
+            return elem;
+
+        if ( woken && ! __atomic_load_n(&queue->interrupt, __ATOMIC_SEQ_CST) )
+            ++queue->reader_stats->wasted_wakeups;
+
+        ++queue->reader_stats->blocked;
+
+        queue->reader_num_terminated = 0;
+
+        for ( int i = 0; i < queue->writers; ++i ) {
+            if ( __atomic_load_n(&queue->lock_writers_terminated[i], __ATOMIC_SEQ_CST) )
+                ++queue->reader_num_terminated;
+        }
+
+        if ( timeout < 0 || hlt_thread_queue_terminated(queue) )
+            return 0;
+
+        if ( __atomic_exchange_n(&queue->interrupt, 0, __ATOMIC_SEQ_CST) )
+            return 0;
+
+        uint64_t now = _now();
+
+        if ( ! block && now >= deadline )
+            return 0;
+
+        // Even when blocking, we wake up regularly to notice termination.
+        woken = ! _park_reader(queue, hlt_thread_queue_can_read, block ? 10000000 : deadline - now);
+
+        pthread_testcancel();
+    }
+}
+
 void hlt_thread_queue_write(hlt_thread_queue* queue, int writer, void *elem)
 {
     if ( queue->lock_writers_terminated[writer] )
@@ -200,6 +566,11 @@ void hlt_thread_queue_write(hlt_thread_queue* queue, int writer, void *elem)
         // locking as we're the only thread ever going to write to it.
         return;
 
+    if ( queue->rings ) {
+        _ring_write(queue, writer, elem);
+        return;
+    }
+
     do {
         batch* b = queue->writer_batches[writer];
 
@@ -211,6 +582,7 @@ void hlt_thread_queue_write(hlt_thread_queue* queue, int writer, void *elem)
 
             b->write_pos = 0;
             b->next = 0;
+            b->time = _now();
 
             queue->writer_batches[writer] = b;
         }
@@ -235,6 +607,10 @@ void hlt_thread_queue_flush(hlt_thread_queue* queue, int writer)
 {
     int block;
 
+    if ( queue->rings )
+        // Everything is visible to the reader already.
+        return;
+
     batch* b = queue->writer_batches[writer];
 
     if ( ! ( b && b->write_pos ) )
@@ -278,6 +654,9 @@ void hlt_thread_queue_flush(hlt_thread_queue* queue, int writer)
 
         _release_lock(queue, i, 0, writer);
 
+        if ( ! block )
+            _wakeup_reader(queue);
+
         if ( block ) {
             ++queue->writer_stats[writer].blocked;
             // Sleep a tiny bit.
@@ -294,9 +673,12 @@ void hlt_thread_queue_flush(hlt_thread_queue* queue, int writer)
 
 void* hlt_thread_queue_read(hlt_thread_queue* queue, int timeout)
 {
-    int block = (timeout == 0);
+    if ( queue->rings )
+        return _ring_read(queue, timeout);
 
-    timeout *= 1000; // Turn it into nanoseconds.
+    int block = (timeout == 0);
+    uint64_t deadline = (timeout > 0) ? _now() + timeout * 1000ULL : 0;
+    int woken = 0;
 
     while ( 1 ) {
 
@@ -310,8 +692,10 @@ void* hlt_thread_queue_read(hlt_thread_queue* queue, int timeout)
 
             if ( queue->reader_pos < b->write_pos ) {
                 // Still something in our current batch.
-                ++queue->reader_stats->elems;
-                ++queue->reader_num_read;
+                if ( queue->reader_pos == 0 )
+                    _record(queue->reader_stats->latency, _now() - b->time);
+
+                _record_read(queue);
                 return b->elems[queue->reader_pos++];
             }
 
@@ -349,19 +733,29 @@ void* hlt_thread_queue_read(hlt_thread_queue* queue, int timeout)
 
         if ( ! queue->reader_head ) {
             // Nothing was pending actually ...
+            if ( woken && ! __atomic_load_n(&queue->interrupt, __ATOMIC_SEQ_CST) )
+                ++queue->reader_stats->wasted_wakeups;
+
             ++queue->reader_stats->blocked;
             queue->need_flush = 1;
 
-            if ( timeout <= 0 && ! block )
+            if ( timeout < 0 )
                 return 0;
 
             if ( hlt_thread_queue_terminated(queue) )
                 return 0;
 
-            // Sleep a tiny bit.
-            // pthread_yield();
-            hlt_util_nanosleep(1000);
-            timeout -= 1000;
+            if ( __atomic_exchange_n(&queue->interrupt, 0, __ATOMIC_SEQ_CST) )
+                return 0;
+
+            uint64_t now = _now();
+
+            if ( ! block && now >= deadline )
+                return 0;
+
+            // Wait for a writer to flush. Even when blocking, we wake up
+            // regularly to notice termination.
+            woken = ! _park_reader(queue, _batch_pending, block ? 10000000 : deadline - now);
         }
     }
 
@@ -371,7 +765,17 @@ void* hlt_thread_queue_read(hlt_thread_queue* queue, int timeout)
 
 int8_t hlt_thread_queue_can_read(hlt_thread_queue* queue)
 {
-    return (queue->reader_head != 0);
+    if ( ! queue->rings )
+        return (queue->reader_head != 0);
+
+    for ( int i = 0; i < queue->writers; i++ ) {
+        ring* r = queue->rings[i];
+
+        if ( r->reader_overflow || r->head != __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) || __atomic_load_n(&r->overflow, __ATOMIC_SEQ_CST) )
+            return 1;
+    }
+
+    return 0;
 }
 
 uint64_t hlt_thread_queue_size(hlt_thread_queue* queue)
@@ -385,8 +789,17 @@ uint64_t hlt_thread_queue_size(hlt_thread_queue* queue)
     return size - queue->reader_num_read;
 }
 
+void hlt_thread_queue_wakeup(hlt_thread_queue* queue)
+{
+    __atomic_store_n(&queue->interrupt, 1, __ATOMIC_SEQ_CST);
+    _wakeup_reader(queue);
+}
+
 uint64_t hlt_thread_queue_pending(hlt_thread_queue* queue)
 {
+    if ( queue->rings )
+        return hlt_thread_queue_size(queue);
+
     return queue->lock_num_pending;
 }
 
@@ -394,10 +807,12 @@ void hlt_thread_queue_terminate_writer(hlt_thread_queue* queue, int writer)
 {
     int s;
     _acquire_lock(queue, &s, 0, writer);
-    queue->lock_writers_terminated[writer] = 1;
+    // The ring reader checks this without the lock.
+    __atomic_store_n(&queue->lock_writers_terminated[writer], 1, __ATOMIC_SEQ_CST);
     _release_lock(queue, s, 0, writer);
 
     hlt_thread_queue_flush(queue, writer);
+    _wakeup_reader(queue);
 }
 
 int8_t hlt_thread_queue_terminated(hlt_thread_queue* queue)
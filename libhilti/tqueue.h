@@ -26,6 +26,22 @@
 /// Returns: The new queue.
 hlt_thread_queue* hlt_thread_queue_new(int writers, int batch_size, int max_batches);
 
+/// Creates a new thread-safe multiple-writer-single-reader queue that keeps
+/// a bounded lock-free ring for each writer, rather than passing batches
+/// under a lock. Elements become visible to the reader as soon as they are
+/// written, so flushing is not necessary. If a writer's ring is full,
+/// further elements go into an unbounded overflow list until the reader has
+/// caught up; writes never block. An idle reader parks until a writer wakes
+/// it up, instead of polling.
+///
+/// writers: Number of concurrent writer to support.
+///
+/// ring_size: Number of elements each writer's ring can hold. Will be
+/// rounded up to a power of two.
+///
+/// Returns: The new queue.
+hlt_thread_queue* hlt_thread_queue_new_rings(int writers, int ring_size);
+
 /// Releases all acquired resources.
 ///
 /// queue: The queue to delete.
@@ -96,6 +112,13 @@ uint64_t hlt_thread_queue_size(hlt_thread_queue* queue);
 /// Returns: True if an element is ready.
 int8_t hlt_thread_queue_can_read(hlt_thread_queue* queue);
 
+/// Makes a read currently waiting for an element return null right away.
+/// If no read is waiting, the next one that would wait returns null
+/// instead. This may be called from any thread.
+///
+/// queue: The queue whose reader to wake up.
+void hlt_thread_queue_wakeup(hlt_thread_queue* queue);
+
 /// Terminates a writer. Must only be called from the corresponding thread.
 /// Subsequent writes from that writer will be ignored.
 ///
@@ -128,11 +151,20 @@ void hlt_thread_queue_writer_update(hlt_thread_queue* queue, int writer);
 
 extern uint64_t hlt_thread_queue_pending(hlt_thread_queue* queue);
 
+/// Number of buckets of the histograms in ~~hlt_thread_queue_stats. Bucket
+/// *i* counts values *v* with 2^(i-1) <= v < 2^i; the last one everything
+/// larger.
+#define HLT_THREAD_QUEUE_HIST_BUCKETS 32
+
 typedef struct {
     uint64_t elems;
     uint64_t batches;
     uint64_t blocked;
     uint64_t locked;
+    uint64_t latency[HLT_THREAD_QUEUE_HIST_BUCKETS];   // Reader only: sampled nanoseconds between writing and reading an element.
+    uint64_t occupancy[HLT_THREAD_QUEUE_HIST_BUCKETS]; // Reader only: sampled queue sizes at the time of reading.
+    uint64_t wakeups;        // Reader only: number of times the reader woke up after waiting for an element.
+    uint64_t wasted_wakeups; // Reader only: wakeups that didn't find an element, nor were requested by hlt_thread_queue_wakeup().
 } hlt_thread_queue_stats;
 
 const hlt_thread_queue_stats* hlt_thread_queue_stats_reader(hlt_thread_queue* queue);
@@ -6,6 +6,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 #include <sys/resource.h>
 
 #include "hutil.h"
@@ -16,6 +17,10 @@
 #include "globals.h"
 #include "memory_.h"
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
 void hlt_util_nanosleep(uint64_t nsecs)
 {
     struct timespec sleep_time;
@@ -230,6 +235,37 @@ int8_t __hlt_safe_write(int fd, const char* data, int len)
 	return 1;
 }
 
+int __hlt_safe_writev(int fd, struct iovec* iov, int cnt)
+{
+    int calls = 0;
+
+    while ( cnt > 0 ) {
+        ssize_t n = writev(fd, iov, cnt < IOV_MAX ? cnt : IOV_MAX);
+        ++calls;
+
+        if ( n < 0 ) {
+            if ( errno == EINTR )
+                continue;
+
+            return -1;
+        }
+
+        // Skip what's been written.
+        while ( cnt > 0 && (size_t)n >= iov->iov_len ) {
+            n -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+
+        if ( cnt > 0 ) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return calls;
+}
+
 void __hlt_pointer_stack_init(__hlt_pointer_stack* set)
 {
     static const size_t initial_size = 5;
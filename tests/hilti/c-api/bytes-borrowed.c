@@ -0,0 +1,91 @@
+/*
+
+@TEST-EXEC:  hilti-build -v %INPUT -o a.out
+@TEST-EXEC:  ./a.out >output 2>&1
+@TEST-EXEC:  btest-diff output
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <libhilti.h>
+
+void printb(const hlt_bytes* b)
+{
+    hlt_execution_context* ctx = hlt_global_execution_context();
+
+    hlt_exception* e = 0;
+    hlt_string s = hlt_object_to_string(&hlt_type_info_hlt_bytes, &b, 0, &e, ctx);
+    int i;
+    for ( i = 0; i < s->len; i++ )
+        printf("%c", s->bytes[i]);
+    printf("\n");
+}
+
+int main()
+{
+    hlt_init();
+
+    hlt_execution_context* ctx = hlt_global_execution_context();
+    hlt_exception* e = 0;
+
+    int8_t buf1[6];
+    int8_t buf2[3];
+
+    // Data still referenced after unborrowing gets copied.
+    memcpy(buf1, "abcdef", 6);
+    memcpy(buf2, "ghi", 3);
+
+    hlt_bytes* b = hlt_bytes_new_from_data_borrowed(buf1, 6, &e, ctx);
+    GC_CCTOR(b, hlt_bytes, ctx);
+
+    hlt_bytes* h1 = b;
+    GC_CCTOR(h1, hlt_bytes, ctx);
+
+    hlt_bytes* h2 = hlt_bytes_append_raw_borrowed(b, buf2, 3, &e, ctx);
+    GC_CCTOR(h2, hlt_bytes, ctx);
+
+    hlt_iterator_bytes i = hlt_bytes_offset(b, 4, &e, ctx);
+    hlt_iterator_bytes j = hlt_bytes_offset(b, 7, &e, ctx);
+
+    printf("copied %ld (6)\n", hlt_bytes_unborrow(h1, &e, ctx));
+    printf("copied %ld (3)\n", hlt_bytes_unborrow(h2, &e, ctx));
+    printf("copied %ld (0)\n", hlt_bytes_unborrow(h2, &e, ctx));
+
+    memset(buf1, 'X', 6);
+    memset(buf2, 'X', 3);
+
+    printb(b);
+    printf("%c %c\n", hlt_iterator_bytes_deref(i, &e, ctx), hlt_iterator_bytes_deref(j, &e, ctx));
+
+    GC_CLEAR(h1, hlt_bytes, ctx);
+    GC_CLEAR(h2, hlt_bytes, ctx);
+    GC_CLEAR(b, hlt_bytes, ctx);
+
+    // Data trimmed away doesn't need copying.
+    memcpy(buf1, "abcdef", 6);
+
+    b = hlt_bytes_new_from_data_borrowed(buf1, 6, &e, ctx);
+    GC_CCTOR(b, hlt_bytes, ctx);
+
+    h1 = b;
+    GC_CCTOR(h1, hlt_bytes, ctx);
+
+    hlt_bytes_trim(b, hlt_bytes_end(b, &e, ctx), &e, ctx);
+    printf("copied %ld (0)\n", hlt_bytes_unborrow(h1, &e, ctx));
+
+    GC_CLEAR(h1, hlt_bytes, ctx);
+    GC_CLEAR(b, hlt_bytes, ctx);
+
+    // Neither does data nobody else refers to anymore.
+    h1 = hlt_bytes_new_from_data_borrowed(buf1, 6, &e, ctx);
+    GC_CCTOR(h1, hlt_bytes, ctx);
+    printf("copied %ld (0)\n", hlt_bytes_unborrow(h1, &e, ctx));
+    GC_CLEAR(h1, hlt_bytes, ctx);
+
+    hlt_memory_stats stats = hlt_memory_statistics();
+    printf("borrowed %lu (21), copied %lu (9)\n", stats.size_borrowed, stats.size_borrowed_copied);
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+
+  We don't integrate this into the test-suite, it's for manual benchmarking.
+
+  Searches needles of different lengths in a multi-chunk bytes object, and
+  compares hlt_bytes_find_bytes() against a byte-by-byte scan using
+  hlt_bytes_match_at().
+
+  @TEST-IGNORE
+  @TEST-EXEC:  hilti-build -v %INPUT -o a.out
+*/
+
+#include <assert.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <libhilti.h>
+
+double current_time()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return (double)(tv.tv_sec) + (double)(tv.tv_usec) / 1e6;
+}
+
+// The old algorithm: find the first byte, then match one position at a time.
+hlt_iterator_bytes find_bytewise(hlt_bytes* b, hlt_bytes* needle, int8_t first, hlt_execution_context* ctx)
+{
+    hlt_exception* excpt = 0;
+    hlt_iterator_bytes i = hlt_bytes_begin(b, &excpt, ctx);
+    hlt_iterator_bytes end = hlt_bytes_end(b, &excpt, ctx);
+
+    while ( ! hlt_iterator_bytes_eq(i, end, &excpt, ctx) ) {
+        if ( hlt_iterator_bytes_deref(i, &excpt, ctx) == first && hlt_bytes_match_at(i, needle, &excpt, ctx) )
+            return i;
+
+        i = hlt_iterator_bytes_incr(i, &excpt, ctx);
+    }
+
+    return end;
+}
+
+// Builds text-like input with plenty of partial matches for the needles
+// below, and puts the needle at the very end, crossing the last chunk
+// boundary.
+hlt_bytes* make_input(const char* needle, int chunk_size, int chunks, hlt_execution_context* ctx)
+{
+    hlt_exception* excpt = 0;
+    hlt_bytes* b = hlt_bytes_new(&excpt, ctx);
+
+    for ( int i = 0; i < chunks; i++ ) {
+        int8_t* data = hlt_malloc(chunk_size);
+
+        for ( int j = 0; j < chunk_size; j++ )
+            data[j] = "--boundary\r\nabcdefgh "[(i * chunk_size + j) % 21];
+
+        hlt_bytes_append_raw(b, data, chunk_size, &excpt, ctx);
+    }
+
+    int len = strlen(needle);
+    hlt_bytes_append_raw_copy(b, (int8_t*)needle, len / 2, &excpt, ctx);
+    hlt_bytes_append_raw_copy(b, (int8_t*)needle + len / 2, len - len / 2, &excpt, ctx);
+
+    return b;
+}
+
+int main(int argc, char** argv)
+{
+    hlt_init();
+
+    hlt_execution_context* ctx = hlt_global_execution_context();
+    hlt_exception* excpt = 0;
+
+    const int chunk_size = 1500;
+    const int chunks = 10000;
+    const int rounds = 10;
+
+    const char* needles[] = {
+        "--X",
+        "\r\n--boundary-X",
+        "--boundary-0123456789abcdef0123456789abcdef-X",
+        "--boundary-0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef-X",
+        0
+    };
+
+    double total = (double)chunk_size * chunks * rounds / 1024 / 1024;
+
+    for ( const char** n = needles; *n; n++ ) {
+        int len = strlen(*n);
+        hlt_bytes* needle = hlt_bytes_new_from_data_copy((int8_t*)*n, len, &excpt, ctx);
+
+        hlt_bytes* hay = make_input(*n, chunk_size, chunks, ctx);
+
+        double start = current_time();
+
+        for ( int i = 0; i < rounds; i++ ) {
+            hlt_iterator_bytes r = hlt_bytes_find_bytes(hay, needle, &excpt, ctx);
+            assert(! hlt_iterator_bytes_eq(r, hlt_bytes_end(hay, &excpt, ctx), &excpt, ctx));
+        }
+
+        double delta_new = current_time() - start;
+
+        start = current_time();
+
+        for ( int i = 0; i < rounds; i++ ) {
+            hlt_iterator_bytes r = find_bytewise(hay, needle, (*n)[0], ctx);
+            assert(! hlt_iterator_bytes_eq(r, hlt_bytes_end(hay, &excpt, ctx), &excpt, ctx));
+        }
+
+        double delta_old = current_time() - start;
+
+        fprintf(stderr, "needle length %3d: find_bytes %8.2f MB/s, bytewise %8.2f MB/s\n", len, total / delta_new, total / delta_old);
+
+        GC_DTOR(needle, hlt_bytes, ctx);
+        GC_DTOR(hay, hlt_bytes, ctx);
+    }
+
+    return 0;
+}
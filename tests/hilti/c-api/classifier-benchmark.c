@@ -0,0 +1,183 @@
+/*
+
+  We don't integrate this into the test-suite, it's for manual benchmarking.
+
+  Builds ACL-style classifiers matching on (src net, dst net) with 1k, 10k,
+  and 100k rules, and compares lookups with hlt_classifier_compile()
+  against a linear scan over all rules. Most lookups don't match any rule,
+  as with a default-deny firewall.
+
+  @TEST-IGNORE
+  @TEST-EXEC:  hilti-build -v %INPUT -o a.out
+*/
+
+#include <assert.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <libhilti.h>
+
+double current_time()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return (double)(tv.tv_sec) + (double)(tv.tv_usec) / 1e6;
+}
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+uint32_t rnd()
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return (uint32_t)rnd_state;
+}
+
+// A few address ranges that the rules and lookups cluster around.
+static uint32_t hosts[64];
+
+uint32_t random_addr()
+{
+    return (rnd() % 4) ? rnd() : hosts[rnd() % 64] ^ (rnd() & 0xff);
+}
+
+// Builds a field in the same layout as HILTI's codegen does for an IPv4
+// net: an IPv6-mapped address with the prefix length offset by 96. A
+// negative length returns a wildcard.
+hlt_classifier_field* net_field(uint32_t a, int len)
+{
+    if ( len < 0 ) {
+        hlt_classifier_field* f = hlt_malloc(sizeof(hlt_classifier_field));
+        f->len = 0;
+        f->bits = 0;
+        return f;
+    }
+
+    hlt_classifier_field* f = hlt_malloc(sizeof(hlt_classifier_field) + 16);
+    memset(f->data, 0, 16);
+    f->len = 16;
+    f->bits = 96 + len;
+    f->data[12] = a >> 24;
+    f->data[13] = a >> 16;
+    f->data[14] = a >> 8;
+    f->data[15] = a;
+    return f;
+}
+
+hlt_classifier_field** make_fields(uint32_t src, int src_len, uint32_t dst, int dst_len)
+{
+    hlt_classifier_field** fields = hlt_malloc(2 * sizeof(hlt_classifier_field*));
+    fields[0] = net_field(src, src_len);
+    fields[1] = net_field(dst, dst_len);
+    return fields;
+}
+
+void free_fields(hlt_classifier_field** fields)
+{
+    hlt_free(fields[0]);
+    hlt_free(fields[1]);
+    hlt_free(fields);
+}
+
+void add_rules(hlt_classifier* c1, hlt_classifier* c2, int num_rules, hlt_execution_context* ctx)
+{
+    static const int lens[] = { -1, 16, 16, 24, 24, 24, 32, 32, 32, 32 };
+
+    hlt_exception* excpt = 0;
+
+    for ( int64_t i = 0; i < num_rules; i++ ) {
+        uint32_t src = random_addr();
+        uint32_t dst = random_addr();
+        int src_len = lens[rnd() % 10];
+        int dst_len = lens[rnd() % 10];
+
+        if ( src_len < 0 && dst_len < 0 )
+            // No catch-all rules.
+            src_len = 32;
+
+        hlt_classifier_add_no_prio(c1, make_fields(src, src_len, dst, dst_len), &hlt_type_info_hlt_int_64, &i, &excpt, ctx);
+        hlt_classifier_add_no_prio(c2, make_fields(src, src_len, dst, dst_len), &hlt_type_info_hlt_int_64, &i, &excpt, ctx);
+    }
+}
+
+// Returns the number of matches.
+int lookup(hlt_classifier* c, hlt_classifier_field*** keys, int num_keys, int64_t* results, hlt_execution_context* ctx)
+{
+    int matches = 0;
+
+    for ( int i = 0; i < num_keys; i++ ) {
+        hlt_exception* excpt = 0;
+        void* v = hlt_classifier_get(c, keys[i], &excpt, ctx);
+
+        if ( excpt ) {
+            GC_DTOR(excpt, hlt_exception, ctx);
+            results[i] = -1;
+            continue;
+        }
+
+        results[i] = *(int64_t*)v;
+        ++matches;
+    }
+
+    return matches;
+}
+
+int main(int argc, char** argv)
+{
+    hlt_init();
+
+    hlt_execution_context* ctx = hlt_global_execution_context();
+    hlt_exception* excpt = 0;
+
+    const int num_keys = 20000;
+
+    for ( int i = 0; i < 64; i++ )
+        hosts[i] = rnd();
+
+    hlt_classifier_field*** keys = hlt_malloc(num_keys * sizeof(hlt_classifier_field**));
+
+    for ( int i = 0; i < num_keys; i++ )
+        keys[i] = make_fields(random_addr(), 32, random_addr(), 32);
+
+    int64_t* results1 = hlt_malloc(num_keys * sizeof(int64_t));
+    int64_t* results2 = hlt_malloc(num_keys * sizeof(int64_t));
+
+    for ( int num_rules = 1000; num_rules <= 100000; num_rules *= 10 ) {
+        hlt_classifier* c1 = hlt_classifier_new(2, 0, &hlt_type_info_hlt_int_64, &excpt, ctx);
+        hlt_classifier* c2 = hlt_classifier_new(2, 0, &hlt_type_info_hlt_int_64, &excpt, ctx);
+
+        add_rules(c1, c2, num_rules, ctx);
+
+        double start = current_time();
+        hlt_classifier_compile(c1, &excpt, ctx);
+        double delta_compile = current_time() - start;
+
+        __hlt_classifier_compile_linear(c2, &excpt, ctx);
+
+        start = current_time();
+        int matches = lookup(c1, keys, num_keys, results1, ctx);
+        double delta_new = current_time() - start;
+
+        start = current_time();
+        lookup(c2, keys, num_keys, results2, ctx);
+        double delta_old = current_time() - start;
+
+        assert(memcmp(results1, results2, num_keys * sizeof(int64_t)) == 0);
+
+        fprintf(stderr, "%6d rules (%5d matches, compiled in %.2fs): compiled %10.0f lookups/s, linear %10.0f lookups/s\n",
+                num_rules, matches, delta_compile, num_keys / delta_new, num_keys / delta_old);
+
+        GC_DTOR(c1, hlt_classifier, ctx);
+        GC_DTOR(c2, hlt_classifier, ctx);
+    }
+
+    for ( int i = 0; i < num_keys; i++ )
+        free_fields(keys[i]);
+
+    hlt_free(keys);
+    hlt_free(results1);
+    hlt_free(results2);
+
+    return 0;
+}
@@ -2,12 +2,17 @@
 
   We don't integrate this into the test-suite, it's for manual benchmarking.
 
+  Ping-pongs between the main thread and a fiber that yields back right
+  away, and then repeatedly creates and runs short-lived fibers. Pass
+  "ucontext" as argument to use the ucontext-based context switch rather
+  than the default one.
+
   @TEST-IGNORE
   @TEST-EXEC:  hilti-build -v %INPUT -o a.out
 */
 
-#include <libhilti.h>
 #include <assert.h>
+#include <string.h>
 #include <sys/time.h>
 
 #include <libhilti.h>
@@ -36,26 +41,33 @@ void fiber_func_yield(hlt_fiber* fiber, void* p)
 
 int main(int argc, char** argv)
 {
+    int ucontext = (argc > 1 && strcmp(argv[1], "ucontext") == 0);
+
+    hlt_config cfg = *hlt_config_get();
+    cfg.fiber_switch = (ucontext ? HLT_FIBER_SWITCH_UCONTEXT : HLT_FIBER_SWITCH_ASM);
+    hlt_config_set(&cfg);
+
     hlt_init();
 
-    hlt_fiber* fiber = 0;
+    hlt_execution_context* ctx = hlt_global_execution_context();
+
+    fprintf(stderr, "using %s context switch\n", ucontext ? "ucontext" : "asm");
 
     int rounds = 100000000;
     int cnt = rounds;
     double start = current_time();
 
-    fiber = hlt_fiber_create(fiber_func_yield, hlt_global_execution_context(), (void*)&cnt);
+    hlt_fiber* fiber = hlt_fiber_create(fiber_func_yield, ctx, (void*)&cnt, ctx);
 
     while ( 1 ) {
-        int r = hlt_fiber_start(fiber);
+        int r = hlt_fiber_start(fiber, ctx);
         if ( r == 1 )
             break;
     }
 
     double delta = current_time() - start;
-    double rate = rounds / delta;
 
-    fprintf(stderr, "start/yield: %.2fs => %.2fs rounds/sec\n", delta, rate);
+    fprintf(stderr, "start/yield: %.2fs => %.2f rounds/sec, %.1f ns/round\n", delta, rounds / delta, delta * 1e9 / rounds);
 
     //////////////////////
 
@@ -63,16 +75,14 @@ int main(int argc, char** argv)
     start = current_time();
 
     for ( int i = 0; i < rounds; i++ ) {
-        fiber = hlt_fiber_create(fiber_func_return, hlt_global_execution_context(), (void*)0x1234567890);
-        int r = hlt_fiber_start(fiber);
+        fiber = hlt_fiber_create(fiber_func_return, ctx, (void*)0x1234567890, ctx);
+        int r = hlt_fiber_start(fiber, ctx);
         assert(r == 1);
     }
 
     delta = current_time() - start;
-    rate = rounds / delta;
 
     fprintf(stderr, "create/start/return/delete: %.2fs => %.2f rounds/sec\n", delta, rounds / delta);
 
     return 0;
 }
-
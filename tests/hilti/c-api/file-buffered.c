@@ -0,0 +1,63 @@
+/*
+
+@TEST-EXEC:  hilti-build -v %INPUT -o a.out
+@TEST-EXEC:  ./a.out >output 2>&1
+@TEST-EXEC:  wc -l <test.log | tr -d ' ' >>output
+@TEST-EXEC:  btest-diff output
+
+*/
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include <libhilti.h>
+
+void print_stats(hlt_file* f, hlt_execution_context* ctx)
+{
+    hlt_exception* e = 0;
+    hlt_file_stats stats;
+
+    hlt_file_get_stats(f, &stats, &e, ctx);
+
+    printf("records=%" PRIu64 " bytes=%" PRIu64 " buffers=%" PRIu64 " syscalls=%" PRIu64 "\n",
+           stats.records, stats.bytes, stats.buffers, stats.syscalls);
+}
+
+int main()
+{
+    // Run single-threaded so that writes happen synchronously.
+    hlt_config cfg = *hlt_config_get();
+    cfg.num_workers = 0;
+    cfg.file_buffer_size = 100;
+    cfg.time_file_flush = 3600;
+    hlt_config_set(&cfg);
+
+    hlt_init();
+
+    hlt_execution_context* ctx = hlt_global_execution_context();
+    hlt_exception* e = 0;
+
+    hlt_file* f = hlt_file_new(&e, ctx);
+    hlt_string path = hlt_string_from_asciiz("test.log", &e, ctx);
+    hlt_file_open(f, path, Hilti_FileType_Text, Hilti_FileMode_Create, Hilti_Charset_UTF8, &e, ctx);
+
+    print_stats(f, ctx);
+
+    // Each record comes out as 15 bytes, with the \x01 escaped as five.
+    for ( int i = 0; i < 50; i++ ) {
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "record %02d\x01", i);
+        hlt_bytes* b = hlt_bytes_new_from_data_copy((int8_t*)buffer, 10, &e, ctx);
+        hlt_file_write_bytes(f, b, &e, ctx);
+    }
+
+    // The last record is still buffered.
+    print_stats(f, ctx);
+
+    hlt_file_close(f, &e, ctx);
+
+    hlt_file_get_stats(f, 0, &e, ctx);
+    printf("stats after close raises %d\n", e != 0);
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+
+  We don't integrate this into the test-suite, it's for manual benchmarking.
+
+  Fills a map<addr, int<64>> with 1M random addresses, as a connection
+  table would, then times lookups of present and absent keys as well as
+  removal of all entries.
+
+  @TEST-IGNORE
+  @TEST-EXEC:  hilti-build -v %INPUT -o a.out
+*/
+
+#include <assert.h>
+#include <sys/time.h>
+
+#include <libhilti.h>
+
+double current_time()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return (double)(tv.tv_sec) + (double)(tv.tv_usec) / 1e6;
+}
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+uint64_t rnd()
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}
+
+int main(int argc, char** argv)
+{
+    hlt_init();
+
+    hlt_execution_context* ctx = hlt_global_execution_context();
+    hlt_exception* excpt = 0;
+
+    const int64_t num_keys = 1000000;
+
+    hlt_addr* keys = hlt_malloc(2 * num_keys * sizeof(hlt_addr));
+
+    for ( int64_t i = 0; i < 2 * num_keys; i++ ) {
+        keys[i].a1 = 0;
+        keys[i].a2 = rnd();
+    }
+
+    hlt_map* m = hlt_map_new(&hlt_type_info_hlt_addr, &hlt_type_info_hlt_int_64, 0, &excpt, ctx);
+
+    double start = current_time();
+
+    for ( int64_t i = 0; i < num_keys; i++ )
+        hlt_map_insert(m, &hlt_type_info_hlt_addr, &keys[i], &hlt_type_info_hlt_int_64, &i, &excpt, ctx);
+
+    double delta_insert = current_time() - start;
+
+    assert(hlt_map_size(m, &excpt, ctx) == num_keys);
+
+    int64_t sum = 0;
+
+    start = current_time();
+
+    for ( int64_t i = 0; i < num_keys; i++ )
+        sum += *(int64_t*)hlt_map_get(m, &hlt_type_info_hlt_addr, &keys[i], &excpt, ctx);
+
+    double delta_hit = current_time() - start;
+
+    assert(sum == num_keys * (num_keys - 1) / 2);
+
+    start = current_time();
+
+    for ( int64_t i = num_keys; i < 2 * num_keys; i++ )
+        sum += hlt_map_exists(m, &hlt_type_info_hlt_addr, &keys[i], &excpt, ctx);
+
+    double delta_miss = current_time() - start;
+
+    start = current_time();
+
+    for ( int64_t i = 0; i < num_keys; i++ )
+        hlt_map_remove(m, &hlt_type_info_hlt_addr, &keys[i], &excpt, ctx);
+
+    double delta_remove = current_time() - start;
+
+    assert(hlt_map_size(m, &excpt, ctx) == 0);
+
+    fprintf(stderr, "insert %.0f ns/op, lookup (hit) %.0f ns/op, lookup (miss) %.0f ns/op, remove %.0f ns/op\n",
+            delta_insert * 1e9 / num_keys, delta_hit * 1e9 / num_keys,
+            delta_miss * 1e9 / num_keys, delta_remove * 1e9 / num_keys);
+
+    GC_DTOR(m, hlt_map, ctx);
+    hlt_free(keys);
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+/*
+
+  We don't integrate this into the test-suite, it's for manual benchmarking.
+
+  Times reference count updates on an object owned by the current thread,
+  which uses plain increments, and then on the same object once marked as
+  shared across threads, which uses atomic ones.
+
+  @TEST-IGNORE
+  @TEST-EXEC:  hilti-build -v %INPUT -o a.out
+*/
+
+#include <assert.h>
+#include <sys/time.h>
+
+#include <libhilti.h>
+
+double current_time()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return (double)(tv.tv_sec) + (double)(tv.tv_usec) / 1e6;
+}
+
+double run(hlt_bytes* b, int rounds, hlt_execution_context* ctx)
+{
+    double start = current_time();
+
+    for ( int i = 0; i < rounds; i++ ) {
+        GC_CCTOR(b, hlt_bytes, ctx);
+        GC_DTOR(b, hlt_bytes, ctx);
+    }
+
+    return current_time() - start;
+}
+
+int main(int argc, char** argv)
+{
+    hlt_init();
+
+    hlt_execution_context* ctx = hlt_global_execution_context();
+    hlt_exception* excpt = 0;
+
+    hlt_bytes* b = hlt_bytes_new_from_data_copy((int8_t*)"abc", 3, &excpt, ctx);
+    GC_CCTOR(b, hlt_bytes, ctx);
+
+    int rounds = 100000000;
+
+    double delta_local = run(b, rounds, ctx);
+
+    GC_SHARE_GENERIC(&b, &hlt_type_info_hlt_bytes, ctx);
+
+    double delta_shared = run(b, rounds, ctx);
+
+    fprintf(stderr, "ref/unref thread-local %.2f ns/round, shared %.2f ns/round\n",
+            delta_local * 1e9 / rounds, delta_shared * 1e9 / rounds);
+
+    GC_DTOR(b, hlt_bytes, ctx);
+
+    return 0;
+}
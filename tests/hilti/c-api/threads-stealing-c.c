@@ -0,0 +1,47 @@
+/*
+ * @TEST-IGNORE
+ */
+
+#include <libhilti.h>
+#include <assert.h>
+#include <inttypes.h>
+
+#include "threads-stealing.hlt.h"
+
+int main()
+{
+    hlt_config cfg = *hlt_config_get();
+    cfg.num_workers = 4;
+    cfg.scheduler = HLT_SCHEDULER_STEALING;
+    hlt_config_set(&cfg);
+
+    hlt_init();
+
+    hlt_execution_context* ctx = hlt_global_execution_context();
+    hlt_exception* excpt = 0;
+
+    foo_run(&excpt, ctx);
+    assert(! excpt);
+
+    uint64_t jobs = 0;
+    uint64_t steals = 0;
+    uint64_t stolen = 0;
+
+    for ( int i = 0; i < cfg.num_workers; i++ ) {
+        hlt_threading_worker_load load;
+        hlt_threading_load_worker(i, &load, &excpt);
+        assert(! excpt);
+
+        jobs += load.jobs;
+        steals += load.steals;
+        stolen += load.stolen;
+    }
+
+    fprintf(stderr, "jobs %" PRIu64 "\n", jobs);
+    fprintf(stderr, "steals match %d\n", steals == stolen);
+
+    hlt_threading_load_worker(cfg.num_workers, 0, &excpt);
+    fprintf(stderr, "out of range raises %d\n", excpt != 0);
+
+    return 0;
+}
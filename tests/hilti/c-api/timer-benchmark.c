@@ -0,0 +1,153 @@
+/*
+
+  We don't integrate this into the test-suite, it's for manual benchmarking.
+
+  Schedules, updates, and cancels 10M timers, and then expires 10M map
+  entries with access-based timeouts, once with the default priority-queue
+  timer manager and once with a timing wheel.
+
+  @TEST-IGNORE
+  @TEST-EXEC:  hilti-build -v %INPUT -o a.out
+*/
+
+#include <assert.h>
+#include <sys/time.h>
+
+#include <libhilti.h>
+
+double current_time()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return (double)(tv.tv_sec) + (double)(tv.tv_usec) / 1e6;
+}
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+uint64_t rnd()
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}
+
+static const int64_t num_timers = 10000000;
+
+// Timers are spread over an hour.
+static const hlt_interval spread = 3600 * 1000000000ULL;
+
+void run_timers(const char* name, hlt_timer_mgr* mgr, hlt_execution_context* ctx)
+{
+    hlt_exception* excpt = 0;
+
+    hlt_timer** timers = hlt_malloc(num_timers * sizeof(hlt_timer*));
+
+    for ( int64_t i = 0; i < num_timers; i++ ) {
+        timers[i] = __hlt_timer_new_function(0, &excpt, ctx);
+        GC_CCTOR(timers[i], hlt_timer, ctx);
+    }
+
+    double start = current_time();
+
+    for ( int64_t i = 0; i < num_timers; i++ )
+        hlt_timer_mgr_schedule(mgr, 1 + rnd() % spread, timers[i], &excpt, ctx);
+
+    double delta_schedule = current_time() - start;
+
+    start = current_time();
+
+    for ( int64_t i = 0; i < num_timers; i++ )
+        hlt_timer_update(timers[i], hlt_timer_time(timers[i], &excpt, ctx) + rnd() % spread, &excpt, ctx);
+
+    double delta_update = current_time() - start;
+
+    start = current_time();
+
+    for ( int64_t i = 0; i < num_timers; i++ )
+        hlt_timer_cancel(timers[i], &excpt, ctx);
+
+    double delta_cancel = current_time() - start;
+
+    assert(! excpt);
+
+    fprintf(stderr, "%s: schedule %.0f ns/op, update %.0f ns/op, cancel %.0f ns/op\n", name,
+            delta_schedule * 1e9 / num_timers, delta_update * 1e9 / num_timers, delta_cancel * 1e9 / num_timers);
+
+    for ( int64_t i = 0; i < num_timers; i++ )
+        GC_DTOR(timers[i], hlt_timer, ctx);
+
+    hlt_free(timers);
+}
+
+void run_map(const char* name, hlt_timer_mgr* mgr, hlt_execution_context* ctx)
+{
+    hlt_exception* excpt = 0;
+
+    hlt_map* m = hlt_map_new(&hlt_type_info_hlt_int_64, &hlt_type_info_hlt_int_64, mgr, &excpt, ctx);
+    hlt_map_timeout(m, Hilti_ExpireStrategy_Access, 60 * 1000000000ULL, &excpt, ctx);
+
+    hlt_time t = 0;
+
+    double start = current_time();
+
+    for ( int64_t i = 0; i < num_timers; i++ ) {
+        if ( i % 1000 == 0 )
+            hlt_timer_mgr_advance(mgr, ++t * 1000000, &excpt, ctx);
+
+        hlt_map_insert(m, &hlt_type_info_hlt_int_64, &i, &hlt_type_info_hlt_int_64, &i, &excpt, ctx);
+    }
+
+    double delta_insert = current_time() - start;
+
+    start = current_time();
+
+    for ( int64_t i = 0; i < num_timers; i++ ) {
+        if ( i % 1000 == 0 )
+            hlt_timer_mgr_advance(mgr, ++t * 1000000, &excpt, ctx);
+
+        hlt_map_get(m, &hlt_type_info_hlt_int_64, &i, &excpt, ctx);
+    }
+
+    double delta_access = current_time() - start;
+
+    start = current_time();
+
+    int32_t n = hlt_timer_mgr_advance(mgr, t * 1000000 + 3600 * 1000000000ULL, &excpt, ctx);
+
+    double delta_expire = current_time() - start;
+
+    assert(n == num_timers);
+    assert(hlt_map_size(m, &excpt, ctx) == 0);
+    assert(! excpt);
+
+    fprintf(stderr, "%s: map insert %.0f ns/op, access %.0f ns/op, expire %.0f ns/op\n", name,
+            delta_insert * 1e9 / num_timers, delta_access * 1e9 / num_timers, delta_expire * 1e9 / num_timers);
+
+    GC_DTOR(m, hlt_map, ctx);
+}
+
+int main(int argc, char** argv)
+{
+    hlt_init();
+
+    hlt_execution_context* ctx = hlt_global_execution_context();
+    hlt_exception* excpt = 0;
+
+    hlt_timer_mgr* heap = hlt_timer_mgr_new(&excpt, ctx);
+    GC_CCTOR(heap, hlt_timer_mgr, ctx);
+
+    hlt_timer_mgr* wheel = hlt_timer_mgr_new_wheel(1000000000, &excpt, ctx);
+    GC_CCTOR(wheel, hlt_timer_mgr, ctx);
+
+    run_timers("heap ", heap, ctx);
+    run_timers("wheel", wheel, ctx);
+
+    run_map("heap ", heap, ctx);
+    run_map("wheel", wheel, ctx);
+
+    GC_DTOR(heap, hlt_timer_mgr, ctx);
+    GC_DTOR(wheel, hlt_timer_mgr, ctx);
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+/*
+
+@TEST-EXEC:  hilti-build -v %INPUT -o a.out
+@TEST-EXEC:  ./a.out >output 2>&1
+@TEST-EXEC:  btest-diff output
+
+*/
+
+// Drives a ring-based thread queue with a tiny ring from several writer
+// threads, checking per-writer ordering, the overflow path, and that an
+// idle reader gets woken up.
+
+#include <unistd.h>
+
+#include <libhilti.h>
+
+#define WRITERS 4
+#define ELEMS 5000
+#define RING_SIZE 8
+
+static hlt_thread_queue* queue = 0;
+
+static void* elem(int writer, int i)
+{
+    return (void*)(intptr_t)((writer << 24) | (i + 1));
+}
+
+static void* writer(void* arg)
+{
+    int w = (int)(intptr_t)arg;
+
+    for ( int i = 0; i < ELEMS; i++ )
+        hlt_thread_queue_write(queue, w, elem(w, i));
+
+    hlt_thread_queue_terminate_writer(queue, w);
+    return 0;
+}
+
+static void start_writers(pthread_t* threads)
+{
+    for ( int w = 0; w < WRITERS; w++ )
+        pthread_create(&threads[w], 0, writer, (void*)(intptr_t)w);
+}
+
+static void join_writers(pthread_t* threads)
+{
+    for ( int w = 0; w < WRITERS; w++ )
+        pthread_join(threads[w], 0);
+}
+
+// Reads until all writers have terminated and everything has been read,
+// checking that each writer's elements come out in order.
+static void read_all(int timeout)
+{
+    int next[WRITERS] = { 0 };
+    int total = 0;
+    int errors = 0;
+
+    while ( ! hlt_thread_queue_terminated(queue) ) {
+        intptr_t e = (intptr_t)hlt_thread_queue_read(queue, timeout);
+
+        if ( ! e )
+            continue;
+
+        int w = (int)(e >> 24);
+        int i = (int)(e & 0xffffff) - 1;
+
+        if ( w < 0 || w >= WRITERS || i != next[w] ) {
+            if ( errors++ < 5 )
+                printf("  out of order: writer %d, element %d\n", w, i);
+        }
+
+        else
+            ++next[w];
+
+        ++total;
+    }
+
+    printf("  read %d elements, %d out of order\n", total, errors);
+}
+
+static void test_overflow()
+{
+    printf("overflow\n");
+
+    pthread_t threads[WRITERS];
+
+    queue = hlt_thread_queue_new_rings(WRITERS, RING_SIZE);
+
+    // Let the writers finish before reading anything, so that all but the
+    // first RING_SIZE elements of each go through the overflow list.
+    start_writers(threads);
+    join_writers(threads);
+
+    int overflowed = 0;
+
+    for ( int w = 0; w < WRITERS; w++ ) {
+        if ( hlt_thread_queue_stats_writer(queue, w)->blocked == ELEMS - RING_SIZE )
+            ++overflowed;
+    }
+
+    printf("  %d of %d writers overflowed\n", overflowed, WRITERS);
+
+    read_all(-1);
+    hlt_thread_queue_delete(queue);
+}
+
+static void test_concurrent()
+{
+    printf("concurrent\n");
+
+    pthread_t threads[WRITERS];
+
+    queue = hlt_thread_queue_new_rings(WRITERS, RING_SIZE);
+
+    start_writers(threads);
+    read_all(0);
+    join_writers(threads);
+
+    hlt_thread_queue_delete(queue);
+}
+
+static void* late_writer(void* arg)
+{
+    usleep(100000);
+    hlt_thread_queue_write(queue, 0, elem(0, 0));
+    hlt_thread_queue_terminate_writer(queue, 0);
+    return 0;
+}
+
+static void* interrupter(void* arg)
+{
+    usleep(100000);
+    hlt_thread_queue_wakeup(queue);
+    return 0;
+}
+
+static void test_park()
+{
+    printf("park\n");
+
+    pthread_t thread;
+
+    // A blocking read parks until the writer has something.
+    queue = hlt_thread_queue_new_rings(1, RING_SIZE);
+    pthread_create(&thread, 0, late_writer, 0);
+
+    void* e = hlt_thread_queue_read(queue, 0);
+    printf("  read %s, woken up %s\n", e == elem(0, 0) ? "the element" : "nothing",
+           hlt_thread_queue_stats_reader(queue)->wakeups > 0 ? "yes" : "no");
+
+    pthread_join(thread, 0);
+    hlt_thread_queue_delete(queue);
+
+    // A blocking read on an empty queue returns when interrupted.
+    queue = hlt_thread_queue_new_rings(1, RING_SIZE);
+    pthread_create(&thread, 0, interrupter, 0);
+
+    e = hlt_thread_queue_read(queue, 0);
+    printf("  interrupted read returned %s\n", e ? "an element" : "null");
+
+    pthread_join(thread, 0);
+    hlt_thread_queue_delete(queue);
+}
+
+int main(int argc, char** argv)
+{
+    hlt_init();
+
+    test_overflow();
+    test_concurrent();
+    test_park();
+
+    return 0;
+}
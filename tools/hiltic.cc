@@ -39,6 +39,9 @@ static struct option long_options[] = {
     { "version", no_argument, 0, 'v' },
     { "profile", no_argument, 0, 'F' },
     { "jit", no_argument, 0, 'j' },
+    { "jit-tiered", no_argument, 0, 'T' },
+    { "jit-tier-threshold", required_argument, 0, 'u' },
+    { "jit-tier-interval", required_argument, 0, 'U' },
     { "opt", required_argument, 0, 'O' },
     { "add-stdlibs", no_argument, 0, 's' },
     { "disable-linker", no_argument, 0, 'C' },
@@ -65,6 +68,9 @@ void usage()
             "  -l | --llvm           Output the final LLVM assembly.\n"
 #ifndef HILTIC_NO_JIT
             "  -j | --jit            JIT the final LLVM bitcode to native code and execute main().\n"
+            "  -T | --jit-tiered     With -j, JIT without optimization first and optimize hot functions in the background.\n"
+            "  -u | --jit-tier-threshold <n>  With -T, number of calls after which a function is hot. [Default: 1000]\n"
+            "  -U | --jit-tier-interval <ms>  With -T, how often to look for hot functions.            [Default: 100]\n"
 #endif
             "  -s | --add-stdlibs    Add standard HILTI runtime libraries (implied with -j).\n"
             "  -L | --llvm-always    Like -l, but don't verify correctness first.\n"
@@ -222,7 +228,7 @@ int main(int argc, char** argv)
     shared_ptr<hilti::Options> options = std::make_shared<hilti::Options>();
 
     while ( true ) {
-        int c = getopt_long(argc, argv, "AdD:hjpcFPWbClLsVo:OvI:", long_options, 0);
+        int c = getopt_long(argc, argv, "AdD:hjTu:U:pcFPWbClLsVo:OvI:", long_options, 0);
 
         if ( c < 0 )
             break;
@@ -304,6 +310,18 @@ int main(int argc, char** argv)
             ++num_output_types;
             break;
 
+         case 'T':
+            options->jit_tiered = true;
+            break;
+
+         case 'u':
+            options->jit_tier_threshold = atoi(optarg);
+            break;
+
+         case 'U':
+            options->jit_tier_interval = atoi(optarg);
+            break;
+
          case 's':
             add_stdlibs = true;
             break;
@@ -333,6 +333,8 @@ static void dump_memstats()
     uint64_t current_allocs = stats.num_allocs - stats.num_deallocs;
     uint64_t num_nullbuffer = stats.num_nullbuffer;
     uint64_t max_nullbuffer = stats.max_nullbuffer;
+    uint64_t num_nullbuffer_flushes = stats.num_nullbuffer_flushes;
+    double time_nullbuffer_flush = stats.time_nullbuffer_flush / 1e9;
 
     fprintf(stderr, "--- pac-driver stats: "
                     "%" PRIu64 "M heap, "
@@ -340,9 +342,11 @@ static void dump_memstats()
                     "%" PRIu64 " allocations, "
                     "%" PRIu64 " totals refs "
                     "%" PRIu64 " in nullbuffer "
-                    "%" PRIu64 " max nullbuffer"
+                    "%" PRIu64 " max nullbuffer "
+                    "%" PRIu64 " nullbuffer flushes in %.3fs"
                     "\n",
-            heap, alloced, current_allocs, total_refs, num_nullbuffer, max_nullbuffer);
+            heap, alloced, current_allocs, total_refs, num_nullbuffer, max_nullbuffer,
+            num_nullbuffer_flushes, time_nullbuffer_flush);
 }
 
 void composeOutput(hlt_bytes* data, void** obj, hlt_type_info* type, void* user, hlt_exception** excpt, hlt_execution_context* ctx)